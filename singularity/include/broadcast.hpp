@@ -0,0 +1,160 @@
+#pragma once
+#ifndef BROADCAST_HPP
+#define BROADCAST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "placement.hpp"
+#include "sockimpl.hpp"
+
+namespace singularity::network {
+
+/**
+ * @brief Determines what happens to a message published to a subscriber whose
+ * send queue is full.
+ */
+enum class SlowConsumerPolicy {
+    // discard the new message for that subscriber
+    drop,
+    // abort the subscriber's connection, so it can reconnect and resync
+    disconnect,
+    // replace the oldest queued message on the same topic with the new one,
+    // or discard the oldest queued message if there is none
+    conflate
+};
+
+/**
+ * @brief Configuration options for a Broadcaster.
+ */
+struct BroadcastConfig {
+    // messages queued per subscriber before the slow consumer policy applies
+    size_t queue_capacity = 1024;
+    SlowConsumerPolicy policy = SlowConsumerPolicy::drop;
+    // threads sending to subscribers, each serving a share of them
+    size_t threads = 1;
+    // where the sender threads run
+    concurrency::ThreadPlacement placement;
+};
+
+/**
+ * @brief Counters describing how published messages were delivered.
+ */
+struct BroadcastStats {
+    // calls to `publish`
+    uint64_t published = 0;
+    // messages fully written to a subscriber's socket
+    uint64_t delivered = 0;
+    // messages discarded for a subscriber because its queue was full
+    uint64_t dropped = 0;
+    // queued messages replaced by a newer one on the same topic
+    uint64_t conflated = 0;
+    // subscribers removed because they were too slow or their connection
+    // failed
+    uint64_t disconnected = 0;
+};
+
+/**
+ * @brief Fans messages out to the subscribers of a topic.
+ *
+ * Subscribers are connections, typically accepted by a TCPServer, that are
+ * handed over to the broadcaster. A published message is shared by every
+ * subscriber queue it is placed in rather than copied, and is sent to each
+ * subscriber as a frame that `TCPConnection::receive_frame` reads.
+ *
+ * Sending never blocks: each sender thread writes to its subscribers only as
+ * much as their sockets accept, and waits for the rest to drain while it
+ * serves the others. A slow subscriber therefore only fills its own queue, at
+ * which point the slow consumer policy decides what to give up, and never
+ * holds up the other subscribers or the publisher.
+ *
+ * Subscriptions are managed by the server; anything subscribers send is
+ * ignored.
+ */
+class Broadcaster {
+   private:
+    class BroadcasterImpl;
+    std::unique_ptr<BroadcasterImpl> impl;
+
+   public:
+    using SubscriberId = uint64_t;
+
+    /**
+     * @brief Constructs a broadcaster and starts its sender threads.
+     *
+     * @throw std::invalid_argument Thrown if the queue capacity or the number
+     * of threads is zero, or the placement refers to CPUs unavailable to the
+     * process.
+     * @throw std::system_error Operating system was unable to allocate the
+     * wake up pipes.
+     */
+    explicit Broadcaster(BroadcastConfig config = {});
+
+    /**
+     * @brief Stops the sender threads and closes every subscriber connection.
+     * Messages that have not been sent yet are discarded.
+     */
+    ~Broadcaster();
+
+    Broadcaster(const Broadcaster& other) = delete;
+    Broadcaster& operator=(const Broadcaster& other) = delete;
+
+    /**
+     * @brief Takes over a connection as a new subscriber, with no topics.
+     *
+     * @return The ID used to manage the subscriber's topics.
+     *
+     * @throw InactiveConnectionError Connection was inactive.
+     */
+    SubscriberId add_subscriber(TCPConnection connection);
+
+    /**
+     * @brief Removes a subscriber from all of its topics and resets its
+     * connection, discarding any messages still queued. Performs no operation
+     * if the subscriber was already removed.
+     */
+    void remove_subscriber(SubscriberId subscriber);
+
+    /**
+     * @brief Subscribes a subscriber to a topic.
+     *
+     * @return `false` if the subscriber was removed, for instance after its
+     * connection failed.
+     */
+    bool subscribe(SubscriberId subscriber, const std::string& topic);
+
+    /**
+     * @brief Unsubscribes a subscriber from a topic. Messages that are
+     * already queued are still sent.
+     */
+    void unsubscribe(SubscriberId subscriber, const std::string& topic);
+
+    /**
+     * @brief Queues a message for every subscriber of a topic.
+     *
+     * @param topic The topic to publish to.
+     * @param message The message, which is kept alive until it has been sent
+     * to every subscriber.
+     * @return The number of subscribers the message was queued for.
+     *
+     * @throw std::invalid_argument Thrown if the message is longer than 4 GiB.
+     */
+    size_t publish(const std::string& topic,
+                   std::shared_ptr<const MessageBuffer> message);
+
+    /**
+     * @brief Returns the number of subscribers.
+     */
+    [[nodiscard]] size_t subscribers() const;
+
+    /**
+     * @brief Returns a snapshot of the delivery counters.
+     */
+    [[nodiscard]] BroadcastStats stats() const;
+};
+
+}  // namespace singularity::network
+
+#endif  // BROADCAST_HPP
@@ -0,0 +1,44 @@
+#pragma once
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace singularity::checksum {
+
+/**
+ * @brief Computes the CRC32C (Castagnoli) checksum of a buffer.
+ *
+ * On x86-64 processors with SSE4.2 the hardware `crc32` instruction is used,
+ * running three independent streams in parallel to hide its latency and
+ * merging them with precomputed shift tables. Elsewhere, a portable
+ * slicing-by-8 implementation is used. The implementation is chosen once at
+ * runtime.
+ *
+ * Checksums can be computed incrementally by passing the checksum of the
+ * data so far as `crc`.
+ *
+ * @param data The data to checksum.
+ * @param length The length of the data.
+ * @param crc The checksum of any preceding data, 0 to start a new checksum.
+ * @return The checksum of the preceding data followed by this buffer.
+ */
+uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
+
+/**
+ * @brief Computes CRC32C with the portable slicing-by-8 implementation,
+ * regardless of hardware support.
+ *
+ * @see crc32c
+ */
+uint32_t crc32c_portable(const void* data, size_t length, uint32_t crc = 0);
+
+/**
+ * @brief Checks whether `crc32c` runs on hardware instructions.
+ */
+[[nodiscard]] bool crc32c_accelerated();
+
+}  // namespace singularity::checksum
+
+#endif  // CHECKSUM_HPP
@@ -0,0 +1,75 @@
+#pragma once
+#ifndef CLI_HPP
+#define CLI_HPP
+
+#include <concepts>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace singularity::cli {
+
+/**
+ * @brief Parses the value of a flag as a non-negative integer.
+ *
+ * @throw std::invalid_argument Thrown if the value is not a whole number.
+ */
+inline size_t parse_number(std::string_view flag, const std::string& value) {
+    size_t consumed = 0;
+    unsigned long long number = 0;
+    try {
+        number = std::stoull(value, &consumed);
+    } catch (const std::exception&) {
+        consumed = 0;
+    }
+    if (consumed != value.size() || value.empty() || value[0] == '-') {
+        throw std::invalid_argument(
+            utils::build_string("Invalid value '", value, "' for ", flag));
+    }
+    return static_cast<size_t>(number);
+}
+
+/**
+ * @brief Splits a comma separated list. Empty items are kept.
+ */
+inline std::vector<std::string> split(const std::string& value) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (true) {
+        size_t comma = value.find(',', start);
+        parts.push_back(value.substr(start, comma - start));
+        if (comma == std::string::npos) return parts;
+        start = comma + 1;
+    }
+}
+
+/**
+ * @brief Hands every `--flag value` pair of the command line to `handle`.
+ *
+ * @return `false` if the usage was requested with `--help` or `-h`, in which
+ * case the flags after it are not read.
+ * @throw std::invalid_argument Thrown if the last flag has no value, or by
+ * `handle`.
+ */
+template <typename Handler>
+    requires std::invocable<Handler&, std::string_view, const std::string&>
+bool parse_flags(int argc, char** argv, Handler&& handle) {
+    for (int index = 1; index < argc; ++index) {
+        std::string_view flag = argv[index];
+        if (flag == "--help" || flag == "-h") return false;
+        if (index + 1 >= argc) {
+            throw std::invalid_argument(
+                utils::build_string("Missing value for ", flag));
+        }
+        std::string value = argv[++index];
+        handle(flag, value);
+    }
+    return true;
+}
+
+}  // namespace singularity::cli
+
+#endif  // CLI_HPP
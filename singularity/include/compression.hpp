@@ -0,0 +1,119 @@
+#pragma once
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace singularity::compression {
+
+/**
+ * @brief Returns the largest compressed size `compress` can produce for an
+ * input of the given length.
+ */
+[[nodiscard]] constexpr size_t compress_bound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+/**
+ * @brief Compresses a block with a fast LZ77-class codec.
+ *
+ * The format is a sequence of literal runs and back references into the
+ * previous 64 KiB, in the spirit of LZ4. Matches are found through a hash of
+ * the next four bytes and extended a machine word at a time, and the search
+ * steps over input faster the longer it goes without a match, so data that
+ * does not compress is skipped at close to memory speed.
+ *
+ * @param input The data to compress.
+ * @param length The length of the data.
+ * @param output Where to write the compressed block.
+ * @param capacity The size of the output. At least `compress_bound(length)`
+ * guarantees success.
+ * @return The compressed size, or 0 if the block did not fit in the output.
+ */
+size_t compress(const std::byte* input, size_t length, std::byte* output,
+                size_t capacity);
+
+/**
+ * @brief Decompresses a block produced by `compress`.
+ *
+ * Every reference is bounds checked, so malformed input never reads or
+ * writes outside of the given buffers.
+ *
+ * @param input The compressed block.
+ * @param length The length of the compressed block.
+ * @param output Where to write the decompressed data.
+ * @param capacity The size of the output.
+ * @return The decompressed size.
+ *
+ * @throw DecompressionError Thrown if the block is malformed or decompresses
+ * to more than `capacity` bytes.
+ */
+size_t decompress(const std::byte* input, size_t length, std::byte* output,
+                  size_t capacity);
+
+/**
+ * @brief Compresses a stream of messages, skipping the ones that are not
+ * worth it.
+ *
+ * Messages below a minimum size are never compressed. When a message does
+ * not shrink by at least an eighth, the compressor assumes the stream is
+ * incompressible for a while and skips an exponentially growing number of
+ * messages (up to `MAX_BACKOFF`) before trying again, so a stream of already
+ * compressed or encrypted payloads costs almost nothing. A single message
+ * that compresses well resets the backoff.
+ *
+ * Scratch space is kept between calls, so steady state compression does not
+ * allocate. This class is not thread-safe.
+ */
+class Compressor {
+   private:
+    std::vector<uint32_t> _table;
+    std::vector<std::byte> _output;
+    size_t _min_size;
+    size_t _skip;
+    size_t _backoff;
+
+   public:
+    static constexpr size_t DEFAULT_MIN_SIZE = 256;
+    static constexpr size_t MAX_BACKOFF = 64;
+
+    /**
+     * @param min_size Messages smaller than this are never compressed.
+     */
+    explicit Compressor(size_t min_size = DEFAULT_MIN_SIZE);
+
+    /**
+     * @brief Compresses a message if it is worth it.
+     *
+     * @return The compressed size, or an empty optional if the message was
+     * skipped or did not compress. The compressed data is available through
+     * `data()` until the next call.
+     */
+    std::optional<size_t> compress(const std::byte* input, size_t length);
+
+    /**
+     * @brief Returns the output of the last successful `compress`.
+     */
+    [[nodiscard]] const std::byte* data() const;
+};
+
+class DecompressionError : public std::exception {
+   private:
+    std::string _message;
+
+   public:
+    explicit DecompressionError(const std::string& message);
+    explicit DecompressionError(const char* message);
+    DecompressionError(const DecompressionError& other) = default;
+
+    [[nodiscard]] const char* what() const noexcept override;
+};
+
+}  // namespace singularity::compression
+
+#endif  // COMPRESSION_HPP
@@ -0,0 +1,407 @@
+#pragma once
+#ifndef COMPUTE_HPP
+#define COMPUTE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+#include "sockimpl.hpp"
+#include "tcp_server.hpp"
+
+namespace singularity::compute {
+
+/**
+ * @brief The element types a matrix can hold.
+ */
+enum class DType : uint8_t { float32 = 1, float64 = 2 };
+
+/**
+ * @brief Returns the size of an element of the given type in bytes.
+ */
+size_t element_size(DType dtype);
+
+template <typename T>
+struct dtype_of;
+
+template <>
+struct dtype_of<float> {
+    static constexpr DType value = DType::float32;
+};
+
+template <>
+struct dtype_of<double> {
+    static constexpr DType value = DType::float64;
+};
+
+/**
+ * @brief Heap storage aligned to a cache line, which is also the width of
+ * the widest vector registers (AVX-512).
+ *
+ * The allocation is padded to a whole number of alignment units and the
+ * padding is zeroed, so vectorized kernels can process the last elements with
+ * full width loads. The rest of the storage is left uninitialized.
+ */
+class AlignedBuffer {
+   private:
+    struct Free {
+        void operator()(std::byte* data) const;
+    };
+
+    std::unique_ptr<std::byte[], Free> _data;
+    size_t _size;
+    size_t _capacity;
+
+   public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    /**
+     * @brief Rounds a length up to a whole number of alignment units.
+     */
+    static constexpr size_t padded(size_t length) {
+        return (length + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    /**
+     * @brief Allocates storage for `size` bytes. Even an empty buffer holds
+     * one alignment unit.
+     */
+    explicit AlignedBuffer(size_t size);
+
+    [[nodiscard]] std::byte* data() { return _data.get(); }
+    [[nodiscard]] const std::byte* data() const { return _data.get(); }
+    [[nodiscard]] size_t size() const { return _size; }
+
+    /**
+     * @brief Returns the length of the allocation, including the padding.
+     */
+    [[nodiscard]] size_t capacity() const { return _capacity; }
+};
+
+/**
+ * @brief Describes the elements of a matrix: their type, the shape, and how
+ * far apart the rows are.
+ */
+struct MatrixHeader {
+    DType dtype;
+    size_t rows;
+    size_t cols;
+    // elements from the start of a row to the start of the next, at least
+    // `cols`. Larger strides pad each row, for instance to a vector width.
+    size_t stride;
+
+    /**
+     * @brief Returns the number of bytes spanned by the rows.
+     */
+    [[nodiscard]] size_t size_bytes() const {
+        return rows * stride * element_size(dtype);
+    }
+};
+
+/**
+ * @brief A matrix of single or double precision values, stored in row major
+ * order in aligned storage.
+ *
+ * A matrix either owns its storage or is a view of part of a larger buffer,
+ * such as a received frame, which is kept alive as long as any of its views.
+ * Either way the elements start on an `AlignedBuffer::ALIGNMENT` boundary and
+ * are handed to kernels in place. Matrices can be moved but not copied.
+ */
+class Matrix {
+   private:
+    MatrixHeader _header;
+    std::shared_ptr<AlignedBuffer> _storage;
+    std::byte* _data;
+
+    template <typename T>
+    void _check_type() const {
+        if (dtype_of<T>::value != _header.dtype) {
+            throw std::invalid_argument(
+                "Matrix is accessed as the wrong element type");
+        }
+    }
+
+   public:
+    /**
+     * @brief Constructs a matrix of zeros with storage of its own.
+     *
+     * @param stride Elements from one row to the next, zero for `cols`.
+     *
+     * @throw std::invalid_argument Thrown if either dimension is zero or
+     * greater than 2^31 - 1, the most BLAS can index, or the stride is
+     * smaller than the number of columns.
+     */
+    Matrix(DType dtype, size_t rows, size_t cols, size_t stride = 0);
+
+    /**
+     * @brief Constructs a view of elements already in a buffer.
+     *
+     * @param header The layout of the elements.
+     * @param storage The buffer holding the elements.
+     * @param offset Where the elements start in the buffer, a multiple of
+     * `AlignedBuffer::ALIGNMENT`.
+     *
+     * @throw std::invalid_argument Thrown if the header is invalid, as for
+     * the other constructor, or the elements are misaligned or do not fit in
+     * the buffer.
+     */
+    Matrix(const MatrixHeader& header, std::shared_ptr<AlignedBuffer> storage,
+           size_t offset);
+
+    Matrix(const Matrix& other) = delete;
+    Matrix& operator=(const Matrix& other) = delete;
+    Matrix(Matrix&& other) noexcept = default;
+    Matrix& operator=(Matrix&& other) noexcept = default;
+
+    [[nodiscard]] const MatrixHeader& header() const { return _header; }
+    [[nodiscard]] DType dtype() const { return _header.dtype; }
+    [[nodiscard]] size_t rows() const { return _header.rows; }
+    [[nodiscard]] size_t cols() const { return _header.cols; }
+    [[nodiscard]] size_t stride() const { return _header.stride; }
+
+    /**
+     * @brief Returns the number of bytes spanned by the rows.
+     */
+    [[nodiscard]] size_t size_bytes() const { return _header.size_bytes(); }
+
+    [[nodiscard]] std::byte* data() { return _data; }
+    [[nodiscard]] const std::byte* data() const { return _data; }
+
+    /**
+     * @brief Returns the elements, row after row, including any padding at
+     * the end of the rows.
+     *
+     * @throw std::invalid_argument Thrown if `T` is not the element type.
+     */
+    template <typename T>
+    std::span<T> values() {
+        _check_type<T>();
+        return {reinterpret_cast<T*>(_data), rows() * stride()};
+    }
+
+    template <typename T>
+    std::span<const T> values() const {
+        _check_type<T>();
+        return {reinterpret_cast<const T*>(_data), rows() * stride()};
+    }
+
+    /**
+     * @brief Returns the elements of a row, without its padding.
+     *
+     * @throw std::invalid_argument Thrown if `T` is not the element type.
+     */
+    template <typename T>
+    std::span<const T> row(size_t index) const {
+        return values<T>().subspan(index * stride(), cols());
+    }
+};
+
+/**
+ * @brief Multiplies two matrices with BLAS (`cblas_sgemm` or `cblas_dgemm`).
+ *
+ * @throw std::invalid_argument Thrown if the element types differ or the
+ * columns of `a` do not match the rows of `b`.
+ */
+Matrix multiply(const Matrix& a, const Matrix& b);
+
+/**
+ * @brief Multiplies two matrices into an existing one, such as a view of the
+ * buffer a response is sent from.
+ *
+ * @throw std::invalid_argument Thrown if the element types differ, or the
+ * shapes of the matrices do not fit a multiplication.
+ */
+void multiply(const Matrix& a, const Matrix& b, Matrix& product);
+
+/**
+ * @brief Sets the number of threads BLAS runs each multiplication on.
+ *
+ * The setting is shared by the whole process. Calls made at the same time
+ * from several threads each use up to this many threads.
+ *
+ * @throw std::invalid_argument Thrown if `threads` is zero.
+ */
+void set_blas_threads(size_t threads);
+
+/**
+ * @brief Returns the number of threads BLAS runs each multiplication on.
+ */
+size_t blas_threads();
+
+/**
+ * @brief Configuration options for a ComputeServer.
+ */
+struct ComputeConfig {
+    // threads BLAS runs each multiplication on, applied to the whole process
+    // when the server starts. The cores in use approach this times the
+    // number of workers once every connection is busy.
+    size_t blas_threads = 1;
+    // largest request accepted, as a frame holding both operands
+    size_t max_request_size = 256 * 1024 * 1024;
+    // largest result sent, as a frame holding the product. Requests whose
+    // product would not fit are answered with an error instead. Frames are
+    // never larger than 4 GiB regardless.
+    size_t max_response_size = 256 * 1024 * 1024;
+    // workers each serve one connection at a time, answering its requests
+    // in order
+    network::WorkerConfig workers;
+    network::ServerConfig server;
+};
+
+/**
+ * @brief Multiplies matrices sent by ComputeClients.
+ *
+ * Every request is a frame holding the two operands, and is answered by a
+ * frame holding their product, or the reason it could not be computed. A
+ * client can send any number of requests without waiting, the results
+ * stream back in the order the requests were sent. Frames are received
+ * straight into aligned buffers, the operands are multiplied where they
+ * landed, and the product is computed into the buffer it is sent from.
+ *
+ * Frames start with a 64 byte header. Its first byte is the operation
+ * (requests, 1 for a multiplication) or the status (responses, 0 for success,
+ * 1 for an error followed by its message instead of the rest of the header).
+ * From byte 8 on, it holds a 16 byte header for each matrix the frame carries:
+ * the element type and the rank (2), each as a byte, two reserved bytes, and
+ * the number of rows, columns and the stride (each 32 bit, network byte
+ * order). The elements of each matrix follow in order, row major, in the
+ * byte order of the host, which must be little endian, and padded to a
+ * multiple of 64 bytes so that each matrix starts aligned.
+ */
+class ComputeServer {
+   private:
+    ComputeConfig _config;
+    network::TCPServer _server;
+
+    void _serve(network::TCPConnection& connection) const;
+
+   public:
+    /**
+     * @brief Constructs a compute server.
+     *
+     * @param port The port number on which the server listens.
+     * @param config The server configuration.
+     *
+     * @throw std::invalid_argument Thrown if the port number is not in the
+     * valid range or `blas_threads` is zero.
+     */
+    explicit ComputeServer(uint32_t port, ComputeConfig config = {});
+
+    /**
+     * @brief Applies the BLAS thread count and starts serving requests.
+     *
+     * @throw std::invalid_argument Thrown if the worker configuration is
+     * invalid.
+     * @throw std::logic_error Thrown if the server was already started.
+     * @throw std::system_error Thrown when system is unable to start server.
+     */
+    void start();
+
+    /**
+     * @brief Stops accepting connections, and waits for the connections in
+     * flight to be closed by their clients before shutting them down.
+     *
+     * @param grace_period The maximum time to wait for connections to close.
+     * @return A report of how many connections were drained and dropped.
+     */
+    network::ShutdownReport shutdown(
+        std::chrono::nanoseconds grace_period = std::chrono::nanoseconds{0});
+};
+
+/**
+ * @brief Sends multiplications to a ComputeServer over a single connection.
+ *
+ * Requests may be pipelined by calling `submit` several times before
+ * `receive`. One thread may submit while another receives, but a client that
+ * submits much more than it receives stalls once the socket buffers fill up
+ * with results. Submitting packs both operands into one frame; results are
+ * received into aligned storage and returned as views of it.
+ */
+class ComputeClient {
+   private:
+    network::TCPConnection _connection;
+
+   public:
+    /**
+     * @brief Connects to a compute server.
+     *
+     * @param address The address of the server.
+     * @param max_response_size The largest result accepted, as a frame.
+     *
+     * @throw std::system_error Operating system was unable to open the
+     * connection.
+     */
+    explicit ComputeClient(network::IPSocketAddress address,
+                           size_t max_response_size = 256 * 1024 * 1024);
+
+    /**
+     * @brief Sends a multiplication without waiting for its result.
+     *
+     * @throw std::invalid_argument Thrown if the element types differ or the
+     * columns of `a` do not match the rows of `b`.
+     * @throw std::system_error Operating system was unable to send the request
+     * successfully.
+     * @throw TimeoutError The deadline expired.
+     */
+    void submit(const Matrix& a, const Matrix& b,
+                std::chrono::steady_clock::time_point deadline =
+                    std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Receives the result of the oldest multiplication submitted.
+     *
+     * @throw ComputeError The server could not compute the result.
+     * @throw ProtocolError The response was malformed, or the connection
+     * closed before it arrived.
+     * @throw std::system_error Operating system was unable to receive the
+     * response successfully.
+     * @throw TimeoutError The deadline expired.
+     */
+    Matrix receive(std::chrono::steady_clock::time_point deadline =
+                       std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Multiplies two matrices on the server and waits for the result.
+     */
+    Matrix multiply(const Matrix& a, const Matrix& b,
+                    std::chrono::steady_clock::time_point deadline =
+                        std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Stops receiving results. A `receive` blocked on another thread
+     * wakes up and throws `network::ProtocolError`, as do later ones.
+     *
+     * @throw std::system_error Operating system was unable to shut down the
+     * receiving side of the connection.
+     */
+    void disable_receive();
+
+    /**
+     * @brief Tells the server no more requests follow and closes the
+     * connection.
+     */
+    void close();
+};
+
+/**
+ * @brief Reports a multiplication the server refused or failed to compute.
+ */
+class ComputeError : public std::exception {
+   private:
+    std::string _message;
+
+   public:
+    explicit ComputeError(const std::string& message);
+    explicit ComputeError(const char* message);
+    ComputeError(const ComputeError& other) = default;
+
+    [[nodiscard]] const char* what() const noexcept override;
+};
+
+}  // namespace singularity::compute
+
+#endif  // COMPUTE_HPP
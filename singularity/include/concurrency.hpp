@@ -3,12 +3,19 @@
 #define CONCURRENCY_HPP
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <queue>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 
+#include "metrics.hpp"
+#include "tracing.hpp"
 #include "utils.hpp"
 
 namespace singularity::concurrency {
@@ -16,7 +23,21 @@ namespace singularity::concurrency {
 template <typename T>
 class Buffer {
    public:
+    virtual ~Buffer() = default;
+
     virtual void push(T&& object) = 0;
+
+    /**
+     * @brief Pushes an element, waiting at most `timeout` for space.
+     *
+     * The element is only moved from if the push succeeds, so callers keep
+     * ownership of it on failure.
+     *
+     * @return `true` if the element was pushed, `false` if the timeout
+     * expired first.
+     */
+    virtual bool push(T&& object, std::chrono::nanoseconds timeout) = 0;
+
     virtual T pop() = 0;
     [[nodiscard]] virtual size_t size() const = 0;
     [[nodiscard]] virtual bool empty() const = 0;
@@ -50,12 +71,17 @@ class DynamicBuffer : public Buffer<T> {
         T* copy = _allocator.allocate(_capacity * 2);
 
         for (size_t index = 0; index < _capacity; ++index) {
-            copy[index] = std::move(_storage[(_start + index) % _capacity]);
+            T& element = _storage[(_start + index) % _capacity];
+            std::construct_at(copy + index, std::move(element));
+            std::destroy_at(&element);
         }
 
         std::swap(copy, _storage);
         _allocator.deallocate(copy, _capacity);
 
+        // elements now sit contiguously at the front of the new storage
+        _start = 0;
+        _end = _capacity;
         _capacity *= 2;
     }
 
@@ -80,7 +106,12 @@ class DynamicBuffer : public Buffer<T> {
     DynamicBuffer(DynamicBuffer&& other) = default;
     DynamicBuffer& operator=(DynamicBuffer&& other) = default;
 
-    ~DynamicBuffer() { _allocator.deallocate(_storage, _capacity); }
+    ~DynamicBuffer() {
+        for (size_t index = 0; index < _size; ++index) {
+            std::destroy_at(_storage + (_start + index) % _capacity);
+        }
+        _allocator.deallocate(_storage, _capacity);
+    }
 
     /**
      * @brief Pushes an element into the buffer.
@@ -92,16 +123,31 @@ class DynamicBuffer : public Buffer<T> {
      * @param object The element to be pushed into the buffer.
      */
     void push(T&& object) override {
+        tracing::Span span("DynamicBuffer::push");
         std::unique_lock<std::mutex> lock(_access);
 
         if (_size == _capacity) _grow();
         size_t index = _end++ % _capacity;
-        _storage[index] = std::forward<T>(object);
+        std::construct_at(_storage + index, std::forward<T>(object));
         ++_size;
 
         _pop.notify_one();
     }
 
+    /**
+     * @brief Pushes an element into the buffer.
+     *
+     * The buffer grows to fit new elements, so this never waits and always
+     * succeeds.
+     *
+     * @param object The element to be pushed into the buffer.
+     * @return Always `true`.
+     */
+    bool push(T&& object, std::chrono::nanoseconds) override {
+        push(std::forward<T>(object));
+        return true;
+    }
+
     /**
      * @brief Pops an element from the buffer.
      *
@@ -112,9 +158,11 @@ class DynamicBuffer : public Buffer<T> {
      * @return The first element in the buffer.
      */
     T pop() override {
+        tracing::Span span("DynamicBuffer::pop");
         std::unique_lock<std::mutex> lock(_access);
-        if (_size == 0) _pop.wait(lock);
+        _pop.wait(lock, [this]() { return _size > 0; });
         T item = std::move(_storage[_start]);
+        std::destroy_at(_storage + _start);
         _start = (_start + 1) % _capacity;
         --_size;
         return item;
@@ -170,7 +218,7 @@ class FixedBuffer : public Buffer<T> {
     mutable std::condition_variable _wait_pop;
 
     void _push(T&& object) {
-        _storage[_end] = std::move(object);
+        std::construct_at(_storage + _end, std::move(object));
         ++_size;
         _end = (_end + 1) % buffer_size;
         _wait_push.notify_one();
@@ -178,6 +226,7 @@ class FixedBuffer : public Buffer<T> {
 
     T _pop() {
         T object = std::move(_storage[_start]);
+        std::destroy_at(_storage + _start);
         --_size;
         _start = (_start + 1) % buffer_size;
         _wait_pop.notify_one();
@@ -203,7 +252,12 @@ class FixedBuffer : public Buffer<T> {
     FixedBuffer(FixedBuffer&& other) = default;
     FixedBuffer& operator=(FixedBuffer&& other) = default;
 
-    ~FixedBuffer() { _allocator.deallocate(_storage, buffer_size); }
+    ~FixedBuffer() {
+        for (size_t index = 0; index < _size; ++index) {
+            std::destroy_at(_storage + (_start + index) % buffer_size);
+        }
+        _allocator.deallocate(_storage, buffer_size);
+    }
 
     /**
      * @brief Pushes an element into the buffer.
@@ -214,7 +268,9 @@ class FixedBuffer : public Buffer<T> {
      * @param object The element to be pushed into the buffer.
      */
     void push(T&& object) override {
+        tracing::Span span("FixedBuffer::push");
         std::unique_lock<std::mutex> lock(_data_mutex);
+        _wait_pop.wait(lock, [this]() { return _size < buffer_size; });
         _push(std::forward<T>(object));
     }
 
@@ -230,7 +286,8 @@ class FixedBuffer : public Buffer<T> {
      * @return `true` if the element was successfully pushed into the buffer,
      * `false` if the timeout expired before space became available.
      */
-    bool push(T&& object, std::chrono::nanoseconds timeout) {
+    bool push(T&& object, std::chrono::nanoseconds timeout) override {
+        tracing::Span span("FixedBuffer::push");
         std::unique_lock<std::mutex> lock(_data_mutex);
 
         auto status = _wait_pop.wait_for(
@@ -250,6 +307,7 @@ class FixedBuffer : public Buffer<T> {
      * @return The element popped from the buffer.
      */
     T pop() override {
+        tracing::Span span("FixedBuffer::pop");
         std::unique_lock<std::mutex> lock(_data_mutex);
         _wait_push.wait(lock, [this]() { return _size > 0; });
         return std::forward<T>(_pop());
@@ -268,6 +326,7 @@ class FixedBuffer : public Buffer<T> {
      * the buffer is empty and the timeout expires.
      */
     std::optional<T> pop(std::chrono::nanoseconds timeout) {
+        tracing::Span span("FixedBuffer::pop");
         std::unique_lock<std::mutex> lock(_data_mutex);
         auto status =
             _wait_push.wait_for(lock, timeout, [this]() { return _size > 0; });
@@ -300,6 +359,148 @@ class FixedBuffer : public Buffer<T> {
     }
 };
 
+/**
+ * @brief Wraps a buffer to report its depth and how long callers wait on it.
+ *
+ * Every operation is forwarded to the wrapped buffer, so any implementation
+ * can be instrumented without paying for it when it is not. Registers three
+ * metrics under `name`: the `_depth` gauge, and the `_push_wait_seconds` and
+ * `_pop_wait_seconds` histograms, the time producers spend blocked on a full
+ * buffer and consumers on an empty one. The wrapped buffer must outlive the
+ * wrapper and should only be used through it, or the depth drifts.
+ *
+ * @tparam T The type of elements stored in the buffer.
+ */
+template <typename T>
+class InstrumentedBuffer : public Buffer<T> {
+   private:
+    Buffer<T>& _buffer;
+    metrics::Gauge& _depth;
+    metrics::Histogram& _push_wait;
+    metrics::Histogram& _pop_wait;
+
+   public:
+    /**
+     * @param buffer The buffer to instrument.
+     * @param registry The registry the metrics are added to.
+     * @param name The prefix of the metric names.
+     * @param labels The labels of the metrics, to tell buffers sharing a
+     * name apart.
+     * @throw std::invalid_argument Thrown if the name or labels are invalid.
+     */
+    InstrumentedBuffer(Buffer<T>& buffer, metrics::Registry& registry,
+                       const std::string& name,
+                       const metrics::Labels& labels = {})
+        : _buffer{buffer},
+          _depth{registry.gauge(name + "_depth",
+                                "Elements waiting in the buffer", labels)},
+          _push_wait{registry.histogram(name + "_push_wait_seconds",
+                                        "Time spent pushing to the buffer",
+                                        labels)},
+          _pop_wait{registry.histogram(name + "_pop_wait_seconds",
+                                       "Time spent popping from the buffer",
+                                       labels)} {}
+
+    void push(T&& object) override {
+        auto start = std::chrono::steady_clock::now();
+        // counted first, so a concurrent pop never takes the depth below 0
+        _depth.add();
+        _buffer.push(std::forward<T>(object));
+        _push_wait.record(std::chrono::steady_clock::now() - start);
+    }
+
+    bool push(T&& object, std::chrono::nanoseconds timeout) override {
+        auto start = std::chrono::steady_clock::now();
+        _depth.add();
+        bool pushed = _buffer.push(std::forward<T>(object), timeout);
+        if (!pushed) _depth.subtract();
+        _push_wait.record(std::chrono::steady_clock::now() - start);
+        return pushed;
+    }
+
+    T pop() override {
+        auto start = std::chrono::steady_clock::now();
+        T object = _buffer.pop();
+        _depth.subtract();
+        _pop_wait.record(std::chrono::steady_clock::now() - start);
+        return object;
+    }
+
+    [[nodiscard]] size_t size() const override { return _buffer.size(); }
+
+    [[nodiscard]] bool empty() const override { return _buffer.empty(); }
+};
+
+/**
+ * @brief A fixed set of worker threads that run submitted tasks in the order
+ * they were submitted.
+ *
+ * Tasks are queued in a DynamicBuffer, so submitting never blocks. Tasks must
+ * handle their own exceptions: like an exception escaping a `std::thread`, one
+ * escaping a task terminates the program.
+ */
+class ThreadPool {
+   private:
+    // an empty task tells the worker that pops it to exit
+    DynamicBuffer<std::function<void()>> _tasks;
+    std::vector<std::thread> _workers;
+
+   public:
+    /**
+     * @brief Starts the worker threads.
+     * @param threads The number of worker threads.
+     * @param on_start Run by each worker with its index before it takes any
+     * task, for instance to apply a thread placement.
+     * @throw std::invalid_argument Thrown if `threads` is zero.
+     */
+    explicit ThreadPool(size_t threads,
+                        std::function<void(size_t)> on_start = {}) {
+        if (threads == 0) {
+            throw std::invalid_argument(
+                "Thread pool needs at least one thread");
+        }
+        _workers.reserve(threads);
+        for (size_t index = 0; index < threads; ++index) {
+            _workers.emplace_back([this, index, on_start]() {
+                if (on_start) on_start(index);
+                while (auto task = _tasks.pop()) task();
+            });
+        }
+    }
+
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    /**
+     * @brief Runs every task submitted so far, then stops the workers.
+     */
+    ~ThreadPool() {
+        for (size_t index = 0; index < _workers.size(); ++index) {
+            _tasks.push(std::function<void()>());
+        }
+        for (auto& worker : _workers) worker.join();
+    }
+
+    /**
+     * @brief Queues a task to run on one of the workers.
+     * @throw std::invalid_argument Thrown if `task` is empty.
+     */
+    void submit(std::function<void()> task) {
+        if (!task) throw std::invalid_argument("Task must be callable");
+        _tasks.push(std::move(task));
+    }
+
+    /**
+     * @brief Returns the number of worker threads.
+     */
+    [[nodiscard]] size_t size() const { return _workers.size(); }
+
+    /**
+     * @brief Returns the number of tasks waiting for a worker.
+     */
+    [[nodiscard]] size_t pending() const { return _tasks.size(); }
+};
+
 }  // namespace singularity::concurrency
 
 #endif  // CONCURRENCY_HPP
\ No newline at end of file
@@ -0,0 +1,244 @@
+#pragma once
+#ifndef LOGGING_HPP
+#define LOGGING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// records below this level are compiled out, from 0 (trace) to 4 (error)
+#ifndef SINGULARITY_LOG_LEVEL
+#define SINGULARITY_LOG_LEVEL 2
+#endif
+
+namespace singularity::logging {
+
+enum class Level : uint8_t { trace, debug, info, warn, error };
+
+constexpr Level COMPILED_LEVEL = static_cast<Level>(SINGULARITY_LOG_LEVEL);
+
+/**
+ * @brief Configuration options for the logger.
+ */
+struct LoggerConfig {
+    // records below this level are discarded at the call site
+    Level level = Level::info;
+    // bytes in the ring buffer of each thread that logs, rounded up to a
+    // power of two. Applies to threads that log for the first time after the
+    // logger is configured.
+    size_t ring_capacity = 64 * 1024;
+    // longest a record waits in its ring before it is written
+    std::chrono::milliseconds flush_interval{10};
+    // receives every formatted line, newline included. Called from the
+    // logger's thread only. Writes to standard error when empty.
+    std::function<void(std::string_view)> sink;
+};
+
+/**
+ * @brief Replaces the logger configuration.
+ */
+void configure(LoggerConfig config);
+
+/**
+ * @brief Waits until every record logged before the call has been written
+ * to the sink.
+ */
+void flush();
+
+/**
+ * @brief Returns the number of records discarded because the ring buffer of
+ * the thread logging them was full.
+ */
+[[nodiscard]] uint64_t dropped();
+
+/**
+ * @brief A format string usable as a template argument, so that each call
+ * site is registered with the logger once rather than on every call.
+ */
+template <size_t N>
+struct Format {
+    char text[N];
+
+    constexpr Format(const char (&format)[N]) {
+        std::copy_n(format, N, text);
+    }
+};
+
+// Everything below is used by the logging functions and is not meant to be
+// called directly.
+
+// longest string argument kept in a record, longer ones are truncated
+constexpr size_t MAX_STRING_ARGUMENT = 512;
+
+template <typename T>
+concept StringArgument = std::convertible_to<const T&, std::string_view>;
+
+template <typename T>
+concept ValueArgument =
+    std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>;
+
+// Formats the payload of a record into `out`.
+using Formatter = void (*)(std::string& out, std::string_view format,
+                           const std::byte* payload);
+
+struct Record {
+    std::byte* payload;
+    void* ring;
+    // ring position just past the record
+    uint64_t end;
+};
+
+inline std::atomic<Level> _threshold{Level::info};
+
+uint32_t _register_format(Level level, const char* format,
+                          Formatter formatter);
+// Reserves space for a record in the calling thread's ring. The payload is
+// null if the ring is full, in which case the record is counted as dropped.
+Record _reserve(uint32_t format_id, size_t payload_size);
+void _commit(const Record& record);
+
+void _append_string(std::string& out, std::string_view value);
+void _append_value(std::string& out, int64_t value);
+void _append_value(std::string& out, uint64_t value);
+void _append_value(std::string& out, double value);
+void _append_value(std::string& out, const void* value);
+// Appends the format up to its next `{}` placeholder and moves past it.
+void _append_until_placeholder(std::string& out, std::string_view& format);
+
+template <typename T>
+constexpr size_t _encoded_size(const T& value) {
+    if constexpr (StringArgument<T>) {
+        return sizeof(uint32_t) +
+               std::min(std::string_view(value).size(), MAX_STRING_ARGUMENT);
+    } else {
+        static_assert(ValueArgument<T>,
+                      "Log arguments must be strings, numbers or pointers");
+        return sizeof(T);
+    }
+}
+
+template <typename T>
+void _encode(std::byte*& out, const T& value) {
+    if constexpr (StringArgument<T>) {
+        std::string_view text(value);
+        auto length = static_cast<uint32_t>(
+            std::min(text.size(), MAX_STRING_ARGUMENT));
+        std::memcpy(out, &length, sizeof(length));
+        std::memcpy(out + sizeof(length), text.data(), length);
+        out += sizeof(length) + length;
+    } else {
+        std::memcpy(out, &value, sizeof(T));
+        out += sizeof(T);
+    }
+}
+
+template <typename T>
+void _decode(std::string& out, std::string_view& format,
+             const std::byte*& in) {
+    _append_until_placeholder(out, format);
+    if constexpr (StringArgument<T>) {
+        uint32_t length;
+        std::memcpy(&length, in, sizeof(length));
+        _append_string(out, {reinterpret_cast<const char*>(in) +
+                                 sizeof(length),
+                             length});
+        in += sizeof(length) + length;
+    } else {
+        T value;
+        std::memcpy(&value, in, sizeof(T));
+        in += sizeof(T);
+        if constexpr (std::is_pointer_v<T>) {
+            _append_value(out, static_cast<const void*>(value));
+        } else if constexpr (std::is_same_v<T, bool>) {
+            _append_string(out, value ? "true" : "false");
+        } else if constexpr (std::is_same_v<T, char>) {
+            _append_string(out, {&value, 1});
+        } else if constexpr (std::is_floating_point_v<T>) {
+            _append_value(out, static_cast<double>(value));
+        } else if constexpr (std::is_enum_v<T>) {
+            _append_value(
+                out, static_cast<int64_t>(
+                         static_cast<std::underlying_type_t<T>>(value)));
+        } else if constexpr (std::is_signed_v<T>) {
+            _append_value(out, static_cast<int64_t>(value));
+        } else {
+            _append_value(out, static_cast<uint64_t>(value));
+        }
+    }
+}
+
+template <typename... Args>
+void _format(std::string& out, std::string_view format,
+             const std::byte* payload) {
+    (_decode<Args>(out, format, payload), ...);
+    out.append(format);
+}
+
+/**
+ * @brief Logs a record.
+ *
+ * The call site only copies the arguments into the calling thread's ring
+ * buffer: formatting and writing happen on the logger's thread. Each `{}` in
+ * the format is replaced by the next argument. Arguments may be numbers,
+ * enums, pointers or strings; strings are copied, truncated to
+ * `MAX_STRING_ARGUMENT` bytes. Records below `SINGULARITY_LOG_LEVEL` are
+ * compiled out, and records below the configured level cost a single load.
+ * If the ring is full the record is dropped and counted.
+ *
+ * @tparam level The level of the record.
+ * @tparam format The format of the record.
+ */
+template <Level level, Format format, typename... Args>
+void log(const Args&... args) {
+    if constexpr (level >= COMPILED_LEVEL) {
+        if (level < _threshold.load(std::memory_order_relaxed)) return;
+
+        static const uint32_t format_id = _register_format(
+            level, format.text, &_format<std::decay_t<Args>...>);
+        size_t size = (size_t{0} + ... + _encoded_size(args));
+        Record record = _reserve(format_id, size);
+        if (record.payload == nullptr) return;
+
+        std::byte* out = record.payload;
+        (_encode(out, args), ...);
+        _commit(record);
+    }
+}
+
+template <Format format, typename... Args>
+void trace(const Args&... args) {
+    log<Level::trace, format>(args...);
+}
+
+template <Format format, typename... Args>
+void debug(const Args&... args) {
+    log<Level::debug, format>(args...);
+}
+
+template <Format format, typename... Args>
+void info(const Args&... args) {
+    log<Level::info, format>(args...);
+}
+
+template <Format format, typename... Args>
+void warn(const Args&... args) {
+    log<Level::warn, format>(args...);
+}
+
+template <Format format, typename... Args>
+void error(const Args&... args) {
+    log<Level::error, format>(args...);
+}
+
+}  // namespace singularity::logging
+
+#endif  // LOGGING_HPP
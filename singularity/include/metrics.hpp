@@ -0,0 +1,270 @@
+#pragma once
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace singularity::metrics {
+
+// shards of each counter, threads are spread over them round robin
+constexpr size_t COUNTER_SHARDS = 16;
+
+/**
+ * @brief Label names and values distinguishing metrics of the same name.
+ */
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+// Returns the counter shard of the calling thread.
+inline size_t _shard_index() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t index =
+        next.fetch_add(1, std::memory_order_relaxed) % COUNTER_SHARDS;
+    return index;
+}
+
+/**
+ * @brief The base of every metric held by a Registry.
+ */
+class Metric {
+   private:
+    friend class Registry;
+
+    // Appends the samples of the metric in the Prometheus text format.
+    virtual void _render(std::string& out, const std::string& name,
+                         const std::string& labels) const = 0;
+
+   public:
+    virtual ~Metric() = default;
+};
+
+/**
+ * @brief A monotonically increasing count.
+ *
+ * Each thread increments its own cache line, so concurrent increments never
+ * contend. Reading the value sums the shards, which is only as consistent as
+ * a relaxed read of each of them.
+ */
+class Counter : public Metric {
+   private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+
+    std::array<Shard, COUNTER_SHARDS> _shards;
+
+    void _render(std::string& out, const std::string& name,
+                 const std::string& labels) const override;
+
+   public:
+    void increment(uint64_t amount = 1) {
+        _shards[_shard_index()].value.fetch_add(amount,
+                                                std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64_t value() const {
+        uint64_t total = 0;
+        for (const auto& shard : _shards) {
+            total += shard.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+/**
+ * @brief A value that goes up and down, such as a queue depth.
+ *
+ * Unlike a Counter a gauge is a single atomic, since it can be set outright.
+ */
+class Gauge : public Metric {
+   private:
+    std::atomic<int64_t> _value{0};
+
+    void _render(std::string& out, const std::string& name,
+                 const std::string& labels) const override;
+
+   public:
+    void set(int64_t value) { _value.store(value, std::memory_order_relaxed); }
+
+    void add(int64_t amount = 1) {
+        _value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    void subtract(int64_t amount = 1) {
+        _value.fetch_sub(amount, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] int64_t value() const {
+        return _value.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @brief A distribution of non-negative values, typically latencies.
+ *
+ * Values are counted in log-linear buckets as in an HDR histogram: every
+ * power of two is split into `2^(SUB_BUCKET_BITS - 1)` equal buckets, so any
+ * value is known to within 1/64th (1.6%) without bounding its range or
+ * allocating on the recording path. Recording is two relaxed atomic
+ * additions. Exported as a Prometheus summary with the 50th, 90th, 99th and
+ * 99.9th percentiles.
+ */
+class Histogram : public Metric {
+   public:
+    static constexpr int SUB_BUCKET_BITS = 7;
+
+   private:
+    static constexpr size_t SUB_BUCKETS = size_t{1} << SUB_BUCKET_BITS;
+    static constexpr size_t HALF = SUB_BUCKETS / 2;
+    static constexpr size_t BUCKETS =
+        (64 - SUB_BUCKET_BITS) * HALF + SUB_BUCKETS;
+
+    double _scale;
+    std::array<std::atomic<uint64_t>, BUCKETS> _buckets{};
+    std::atomic<uint64_t> _sum{0};
+
+    static constexpr size_t _bucket(uint64_t value) {
+        if (value < SUB_BUCKETS) return static_cast<size_t>(value);
+        auto shift =
+            static_cast<size_t>(std::bit_width(value)) - SUB_BUCKET_BITS;
+        return shift * HALF + static_cast<size_t>(value >> shift);
+    }
+
+    // the largest value counted in a bucket
+    static constexpr uint64_t _highest(size_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        size_t shift = bucket / HALF - 1;
+        uint64_t lowest = static_cast<uint64_t>(bucket - shift * HALF)
+                          << shift;
+        return lowest + ((uint64_t{1} << shift) - 1);
+    }
+
+    void _render(std::string& out, const std::string& name,
+                 const std::string& labels) const override;
+
+   public:
+    /**
+     * @param scale The number of recorded units per exported unit. The
+     * default exports durations recorded in nanoseconds in seconds.
+     */
+    explicit Histogram(double scale = 1e9) : _scale{scale} {}
+
+    void record(uint64_t value) {
+        _buckets[_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void record(std::chrono::nanoseconds duration) {
+        record(static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0)));
+    }
+
+    /**
+     * @brief Adds the values recorded by another histogram, so that threads
+     * can record into histograms of their own and combine them afterwards.
+     */
+    void merge(const Histogram& other);
+
+    /**
+     * @brief Returns the number of values recorded.
+     */
+    [[nodiscard]] uint64_t count() const;
+
+    /**
+     * @brief Returns the sum of the values recorded.
+     */
+    [[nodiscard]] uint64_t sum() const {
+        return _sum.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the value below which `percentile` percent of the
+     * recorded values fall, rounded up to the top of its bucket, or zero if
+     * nothing was recorded.
+     */
+    [[nodiscard]] uint64_t percentile(double percentile) const;
+};
+
+/**
+ * @brief A named set of metrics, rendered in the Prometheus text format.
+ *
+ * Registering a metric takes a lock and returns a reference that stays valid
+ * for the lifetime of the registry; updating it never locks. Registering the
+ * same name and labels again returns the existing metric, so metrics can be
+ * shared by several owners. This class is thread-safe.
+ */
+class Registry {
+   private:
+    struct Family {
+        std::string help;
+        const char* type;
+        // keyed by the rendered labels
+        std::map<std::string, std::unique_ptr<Metric>> metrics;
+    };
+
+    mutable std::mutex _mutex;
+    std::map<std::string, Family> _families;
+
+    Metric& _register(const std::string& name, const std::string& help,
+                      const Labels& labels, const char* type,
+                      std::unique_ptr<Metric> (*make)(double), double scale);
+
+   public:
+    Registry() = default;
+    Registry(const Registry& other) = delete;
+    Registry& operator=(const Registry& other) = delete;
+
+    /**
+     * @brief Returns the counter with the given name and labels, registering
+     * it if needed.
+     *
+     * @throw std::invalid_argument Thrown if the name or a label name is not
+     * a valid Prometheus name, or the name belongs to another type of metric.
+     */
+    Counter& counter(const std::string& name, const std::string& help,
+                     const Labels& labels = {});
+
+    /**
+     * @brief Returns the gauge with the given name and labels, registering
+     * it if needed.
+     *
+     * @throw std::invalid_argument As for `counter`.
+     */
+    Gauge& gauge(const std::string& name, const std::string& help,
+                 const Labels& labels = {});
+
+    /**
+     * @brief Returns the histogram with the given name and labels,
+     * registering it with the given scale if needed.
+     *
+     * @throw std::invalid_argument As for `counter`.
+     */
+    Histogram& histogram(const std::string& name, const std::string& help,
+                         const Labels& labels = {}, double scale = 1e9);
+
+    /**
+     * @brief Renders every metric in the Prometheus text exposition format,
+     * version 0.0.4, sorted by name.
+     */
+    [[nodiscard]] std::string render() const;
+
+    /**
+     * @brief Returns the process-wide registry, used by default by the
+     * servers and connections of the library.
+     */
+    static std::shared_ptr<Registry> global();
+};
+
+}  // namespace singularity::metrics
+
+#endif  // METRICS_HPP
@@ -0,0 +1,206 @@
+#pragma once
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace singularity::benchmark {
+
+/**
+ * @brief The events counted around a benchmarked region.
+ */
+enum class Event {
+    cycles,
+    instructions,
+    cache_misses,
+    branch_misses,
+    context_switches
+};
+
+constexpr size_t EVENT_COUNT = 5;
+
+constexpr std::array<Event, EVENT_COUNT> EVENTS = {
+    Event::cycles, Event::instructions, Event::cache_misses,
+    Event::branch_misses, Event::context_switches};
+
+/**
+ * @brief Returns the name of an event as used in reports and baselines.
+ */
+const char* event_name(Event event);
+
+/**
+ * @brief What a region took: its wall time and the events counted in it.
+ */
+struct Counts {
+    double seconds = 0;
+    // empty for events the kernel or the hardware could not count, such as
+    // hardware events inside most virtual machines
+    std::array<std::optional<double>, EVENT_COUNT> events;
+
+    [[nodiscard]] const std::optional<double>& operator[](Event event) const {
+        return events[static_cast<size_t>(event)];
+    }
+};
+
+/**
+ * @brief Counts hardware and scheduler events over a region with
+ * `perf_event_open`.
+ *
+ * The calling thread is counted, as are the threads it starts while counting
+ * once they have exited, so a region should join the threads it starts.
+ * Hardware events are counted in user space only, which unprivileged
+ * processes are allowed to do; context switches include the kernel. Counts
+ * are scaled up when the kernel had to multiplex the counters. Events that
+ * cannot be opened are left out rather than failing, and on systems other
+ * than Linux every event is.
+ */
+class PerfCounters {
+   private:
+    std::array<int, EVENT_COUNT> _descriptors;
+    std::chrono::steady_clock::time_point _start;
+
+   public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters& other) = delete;
+    PerfCounters& operator=(const PerfCounters& other) = delete;
+
+    /**
+     * @brief Returns whether the event could be opened.
+     */
+    [[nodiscard]] bool available(Event event) const;
+
+    /**
+     * @brief Resets the counters and starts counting.
+     */
+    void start();
+
+    /**
+     * @brief Stops counting and returns what was counted since `start`.
+     */
+    Counts stop();
+};
+
+/**
+ * @brief A measured region, and the number of operations it performed.
+ */
+struct Result {
+    std::string name;
+    uint64_t operations = 0;
+    Counts counts;
+
+    /**
+     * @brief Returns the wall time per operation in nanoseconds.
+     */
+    [[nodiscard]] double nanoseconds_per_operation() const;
+
+    /**
+     * @brief Returns the event count per operation, or nothing if the event
+     * was not counted.
+     */
+    [[nodiscard]] std::optional<double> per_operation(Event event) const;
+};
+
+/**
+ * @brief Runs `region` between starting and stopping a set of counters.
+ */
+template <typename Function>
+Result measure(std::string name, uint64_t operations, Function&& region) {
+    PerfCounters counters;
+    counters.start();
+    region();
+    return {std::move(name), operations, counters.stop()};
+}
+
+/**
+ * @brief A per-operation figure that got worse than its baseline.
+ */
+struct Regression {
+    std::string name;
+    // "nanoseconds" or an event name
+    std::string metric;
+    double baseline;
+    double current;
+};
+
+/**
+ * @brief Writes results as a JSON baseline: an array holding each result's
+ * name, operations, wall time, and figures per operation.
+ */
+void write_baseline(std::ostream& out, const std::vector<Result>& results);
+
+/**
+ * @brief Reads a baseline written by `write_baseline`, recovering the counts
+ * from the per-operation figures.
+ *
+ * @throw std::invalid_argument Thrown if the text is not such a baseline.
+ */
+std::vector<Result> read_baseline(const std::string& text);
+
+/**
+ * @brief Returns every per-operation figure that is more than `threshold`
+ * (a fraction, 0.05 being 5%) above its baseline.
+ *
+ * Results are matched by name. Figures that either side does not have, and
+ * results without a baseline, are skipped. Every figure is one where lower
+ * is better.
+ */
+std::vector<Regression> compare(const std::vector<Result>& baseline,
+                                const std::vector<Result>& current,
+                                double threshold);
+
+/**
+ * @brief The baseline flags shared by the benchmarks.
+ */
+struct BaselineOptions {
+    // `--write-baseline FILE`, where the results are saved
+    std::string write_path;
+    // `--compare FILE`, the baseline the results are checked against
+    std::string compare_path;
+    // `--threshold PERCENT`, the noise allowed before a figure regresses
+    double threshold = 0.05;
+
+    /**
+     * @brief Takes `value` if `flag` is one of the baseline flags.
+     *
+     * @return Whether the flag was a baseline flag.
+     * @throw std::invalid_argument Thrown if the threshold is not a
+     * non-negative number.
+     */
+    bool parse(std::string_view flag, const std::string& value);
+};
+
+/**
+ * @brief Saves the results and compares them against a baseline, as the
+ * options ask, printing any regressions to `report`.
+ *
+ * @return `false` if a figure regressed.
+ * @throw std::system_error Thrown if a file cannot be read or written.
+ * @throw std::invalid_argument Thrown if the baseline is malformed.
+ */
+bool check_baseline(const BaselineOptions& options,
+                    const std::vector<Result>& results, std::ostream& report);
+
+/**
+ * @brief Prints results with their figures per operation, one per line.
+ */
+void print_results(std::ostream& out, const std::vector<Result>& results);
+
+/**
+ * @brief Prints regressions, or that there were none.
+ */
+void print_regressions(std::ostream& out,
+                       const std::vector<Regression>& regressions,
+                       double threshold);
+
+}  // namespace singularity::benchmark
+
+#endif  // PERF_COUNTERS_HPP
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <cstddef>
+#include <vector>
+
+namespace singularity::concurrency {
+
+/**
+ * @brief A NUMA node and the CPUs that belong to it.
+ */
+struct NumaNode {
+    int id = 0;
+    std::vector<int> cpus;
+};
+
+/**
+ * @brief Describes where a group of threads runs and allocates memory.
+ *
+ * Threads are identified by their index within the group (the worker number
+ * in a pool, for instance), which decides the CPU they are pinned to.
+ */
+struct ThreadPlacement {
+    // CPUs the threads run on, an empty set leaves them unpinned
+    std::vector<int> cpus;
+    // pin each thread to a single CPU, chosen round robin by thread index,
+    // rather than letting every thread run on any CPU in the set
+    bool pin_individually = true;
+    // allocate the threads' memory from the NUMA node they run on, so
+    // buffers and connection state they create stay node-local
+    bool local_memory = false;
+
+    /**
+     * @brief Returns a placement covering every CPU of a NUMA node, with
+     * node-local memory.
+     *
+     * @throw std::invalid_argument Thrown if the node does not exist or has
+     * no CPUs available to the process.
+     */
+    static ThreadPlacement on_node(int node);
+
+    /**
+     * @brief Returns the CPU the thread with the given index is pinned to, or
+     * -1 if threads are not pinned individually.
+     */
+    [[nodiscard]] int cpu_for(size_t thread_index) const;
+};
+
+/**
+ * @brief Returns the NUMA nodes of the machine. Machines, or kernels, without
+ * NUMA support are reported as a single node holding every CPU available to
+ * the process.
+ */
+[[nodiscard]] std::vector<NumaNode> numa_nodes();
+
+/**
+ * @brief Returns the NUMA node a CPU belongs to, or -1 if it is unknown.
+ */
+[[nodiscard]] int numa_node_of(int cpu);
+
+/**
+ * @brief Returns the CPUs the process is allowed to run on.
+ */
+[[nodiscard]] std::vector<int> available_cpus();
+
+/**
+ * @brief Checks that a placement only refers to CPUs available to the
+ * process, so it can be applied once the threads are running.
+ *
+ * @throw std::invalid_argument Thrown if a CPU is unavailable.
+ */
+void validate_placement(const ThreadPlacement& placement);
+
+/**
+ * @brief Applies a placement to the calling thread.
+ *
+ * Performs no operation for an empty placement. Failures are not fatal: the
+ * thread keeps running wherever the kernel allows, which is why placements
+ * should be validated before the threads are started.
+ *
+ * @param placement The placement of the thread's group.
+ * @param thread_index The index of the calling thread within its group.
+ * @return `false` if the kernel refused the affinity or the memory policy.
+ */
+bool apply_placement(const ThreadPlacement& placement, size_t thread_index);
+
+}  // namespace singularity::concurrency
+
+#endif  // PLACEMENT_HPP
@@ -0,0 +1,222 @@
+#pragma once
+#ifndef RATE_LIMIT_HPP
+#define RATE_LIMIT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "sockimpl.hpp"
+
+namespace singularity::network {
+
+/**
+ * @brief A sustained rate and the burst allowed on top of it.
+ */
+struct RateLimit {
+    // units (connections, bytes or messages) per second, zero disables the
+    // limit
+    double rate = 0;
+    // units that may be used at once after a quiet period
+    double burst = 1;
+
+    [[nodiscard]] bool enabled() const { return rate > 0; }
+};
+
+/**
+ * @brief A token bucket implemented with the generic cell rate algorithm.
+ *
+ * The whole state is a single timestamp, the time at which the bucket would
+ * be full again, updated with compare and swap. Concurrent users therefore
+ * never lock, and checking the bucket costs a clock read and a few atomic
+ * operations. A bucket whose timestamp has passed is full, so idle buckets
+ * can be discarded without losing anything.
+ */
+class TokenBucket {
+   private:
+    using clock_type = std::chrono::steady_clock;
+
+    // nanoseconds each unit pushes the full time back by
+    double _unit_ns;
+    // how far the full time may run ahead of now
+    int64_t _tolerance_ns;
+    double _burst;
+    std::atomic<int64_t> _full_ns;
+
+    static int64_t _ns(clock_type::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   time.time_since_epoch())
+            .count();
+    }
+
+    [[nodiscard]] int64_t _charge(double units) const {
+        // bounded so that absurd rates cannot overflow the timestamp
+        return static_cast<int64_t>(
+            std::min(units * _unit_ns, static_cast<double>(INT64_MAX / 4)));
+    }
+
+   public:
+    /**
+     * @brief Constructs a full bucket.
+     *
+     * @throw std::invalid_argument Thrown if the limit is disabled or its
+     * burst is smaller than one unit.
+     */
+    explicit TokenBucket(RateLimit limit) : _full_ns{0} {
+        if (!limit.enabled() || limit.burst < 1) {
+            throw std::invalid_argument(
+                "Rate limit needs a positive rate and a burst of at least 1");
+        }
+        _unit_ns = 1e9 / limit.rate;
+        _burst = limit.burst;
+        _tolerance_ns = _charge(limit.burst);
+    }
+
+    TokenBucket(const TokenBucket& other) = delete;
+    TokenBucket& operator=(const TokenBucket& other) = delete;
+
+    /**
+     * @brief Takes units from the bucket if it holds enough of them.
+     *
+     * @return `true` if the units were taken, `false` if the bucket was left
+     * untouched.
+     */
+    bool try_acquire(double units = 1,
+                     clock_type::time_point now = clock_type::now()) {
+        int64_t now_ns = _ns(now);
+        int64_t full = _full_ns.load(std::memory_order_relaxed);
+        while (true) {
+            int64_t next = std::max(full, now_ns) + _charge(units);
+            if (next - now_ns > _tolerance_ns) return false;
+            if (_full_ns.compare_exchange_weak(full, next,
+                                               std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @brief Takes units from the bucket unconditionally, possibly leaving
+     * it in debt, for usage that is only known after the fact.
+     */
+    void consume(double units,
+                 clock_type::time_point now = clock_type::now()) {
+        int64_t now_ns = _ns(now);
+        int64_t full = _full_ns.load(std::memory_order_relaxed);
+        while (!_full_ns.compare_exchange_weak(
+            full, std::max(full, now_ns) + _charge(units),
+            std::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * @brief Returns how long to wait until the bucket is out of debt, zero
+     * if it is not in debt.
+     */
+    [[nodiscard]] std::chrono::nanoseconds delay(
+        clock_type::time_point now = clock_type::now()) const {
+        int64_t debt = _full_ns.load(std::memory_order_relaxed) - _ns(now) -
+                       _tolerance_ns;
+        return std::chrono::nanoseconds(std::max<int64_t>(debt, 0));
+    }
+
+    /**
+     * @brief Checks if the bucket has been full for at least `period`.
+     */
+    [[nodiscard]] bool idle(
+        std::chrono::nanoseconds period,
+        clock_type::time_point now = clock_type::now()) const {
+        return _full_ns.load(std::memory_order_relaxed) + period.count() <=
+               _ns(now);
+    }
+
+    /**
+     * @brief Returns the number of units the bucket holds when full.
+     */
+    [[nodiscard]] double burst() const { return _burst; }
+};
+
+/**
+ * @brief Limits the rate at which each client address may use a resource.
+ *
+ * Every client address gets its own TokenBucket, kept in a hash table split
+ * into shards with their own locks, so that clients in different shards never
+ * contend. Lookups only take a shared lock; the bucket itself is updated
+ * without locking. Buckets of clients that stayed idle for the expiry period
+ * are discarded as new clients are added. This class is thread-safe.
+ */
+class RateLimiter {
+   private:
+    using clock_type = std::chrono::steady_clock;
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<uint32_t, std::shared_ptr<TokenBucket>> buckets;
+        clock_type::time_point next_sweep;
+    };
+
+    RateLimit _limit;
+    std::chrono::nanoseconds _expiry;
+    std::unique_ptr<Shard[]> _shards;
+    size_t _shard_mask;
+
+    Shard& _shard(uint32_t address) const;
+    // Removes the shard's idle buckets no connection holds on to. Requires
+    // the shard's exclusive lock.
+    size_t _sweep(Shard& shard, clock_type::time_point now);
+
+   public:
+    /**
+     * @brief Constructs a rate limiter with no clients.
+     *
+     * @param limit The limit applied to each client address.
+     * @param expiry How long a client must stay idle before its bucket is
+     * discarded.
+     * @param shards The number of shards, rounded up to a power of two.
+     *
+     * @throw std::invalid_argument Thrown if the limit is invalid, as for
+     * TokenBucket, or the number of shards is zero.
+     */
+    explicit RateLimiter(
+        RateLimit limit,
+        std::chrono::nanoseconds expiry = std::chrono::minutes(1),
+        size_t shards = 64);
+
+    /**
+     * @brief Takes units from a client's bucket if it holds enough of them.
+     *
+     * @return `true` if the client is within its limit.
+     */
+    bool try_acquire(const IPSocketAddress& client, double units = 1);
+
+    /**
+     * @brief Returns a client's bucket, creating a full one if needed.
+     *
+     * Holding on to the bucket, as a connection does for its lifetime, avoids
+     * further lookups and keeps it from expiring, so every connection of a
+     * client shares the same limit.
+     */
+    std::shared_ptr<TokenBucket> bucket(const IPSocketAddress& client);
+
+    /**
+     * @brief Discards the buckets of every idle client right away.
+     *
+     * @return The number of buckets discarded.
+     */
+    size_t expire();
+
+    /**
+     * @brief Returns the number of clients with a bucket.
+     */
+    [[nodiscard]] size_t size() const;
+};
+
+}  // namespace singularity::network
+
+#endif  // RATE_LIMIT_HPP
@@ -0,0 +1,199 @@
+#pragma once
+#ifndef RPC_HPP
+#define RPC_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "sockimpl.hpp"
+#include "tcp_server.hpp"
+
+namespace singularity::network {
+
+/**
+ * @brief Handles a single remote procedure call.
+ *
+ * The request refers to storage owned by the server and is only valid for the
+ * duration of the call. Exceptions thrown by the handler are reported to the
+ * caller as an RPCError carrying the exception message.
+ */
+using RPCHandler = std::function<MessageBuffer(std::span<const std::byte>)>;
+
+/**
+ * @brief Issues remote procedure calls to an RPCServer over a single
+ * connection.
+ *
+ * Calls are tagged with an ID and sent as frames, so any number of them can be
+ * in flight at once and the server may answer them in any order. A background
+ * thread reads the responses and completes the matching futures, so a caller
+ * only waits on the round trip of its own call. Calls may be issued from any
+ * number of threads.
+ */
+class RPCClient {
+   private:
+    TCPConnection _connection;
+    std::mutex _send_mutex;
+
+    mutable std::mutex _pending_mutex;
+    std::unordered_map<uint64_t, std::promise<MessageBuffer>> _pending;
+    uint64_t _next_id;
+    // set once no more responses will arrive, guarded by the pending mutex
+    bool _closed;
+
+    std::thread _reader;
+
+    void _read_responses();
+
+    // Shuts the connection down in both directions, waking the reader.
+    void _shutdown_connection();
+
+    // Fails every call in flight and refuses new ones.
+    void _fail_pending(const std::string& reason);
+
+   public:
+    /**
+     * @brief Connects to an RPC server.
+     *
+     * @param address The address of the server.
+     *
+     * @throw std::system_error Operating system was unable to open the
+     * connection.
+     */
+    explicit RPCClient(IPSocketAddress address);
+
+    RPCClient(const RPCClient& other) = delete;
+    RPCClient& operator=(const RPCClient& other) = delete;
+
+    /**
+     * @brief Fails any calls still in flight and closes the connection.
+     */
+    ~RPCClient();
+
+    /**
+     * @brief Calls a remote method without waiting for its response.
+     *
+     * @param method The name of the method, as registered with the server.
+     * @param request The request passed to the method.
+     * @param deadline The time by which the request must be sent.
+     * @return A future that holds the response, or an RPCError if the method
+     * failed, is unknown to the server, or the connection closed before it
+     * responded.
+     *
+     * @throw std::invalid_argument Thrown if the method name is longer than
+     * 65535 bytes.
+     * @throw RPCError The client was closed.
+     * @throw std::system_error Operating system was unable to send the request
+     * successfully.
+     * @throw TimeoutError The deadline expired.
+     *
+     * A request that fails to send may be left partly written, so the client
+     * closes: every call in flight fails and later calls throw RPCError.
+     */
+    std::future<MessageBuffer> call(
+        std::string_view method, const MessageBuffer& request,
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Returns the number of calls waiting for a response.
+     */
+    [[nodiscard]] size_t in_flight() const;
+
+    /**
+     * @brief Closes the connection, failing any calls still in flight.
+     * Performs no operation if the client is already closed.
+     */
+    void close();
+};
+
+/**
+ * @brief Serves remote procedure calls issued by RPCClients.
+ *
+ * Connections are accepted by a TCPServer. Each connection has a thread that
+ * reads its requests and hands them to a shared worker pool, so the calls
+ * pipelined on one connection run concurrently and are answered as soon as
+ * each finishes, not in the order they arrived. A connection with too many
+ * calls in flight is not read from until some of them finish, so clients
+ * that pipeline faster than the handlers run are slowed down by TCP flow
+ * control instead of queueing without bound.
+ */
+class RPCServer {
+   private:
+    class RPCServerImpl;
+    std::unique_ptr<RPCServerImpl> impl;
+
+   public:
+    /**
+     * @brief Constructs an RPC server.
+     *
+     * @param port The port number on which the server listens.
+     * @param workers The number of threads that run handlers.
+     * @param config Configuration of the underlying TCPServer.
+     *
+     * @throw std::invalid_argument Thrown if the port number is not in the
+     * valid range or `workers` is zero.
+     */
+    RPCServer(uint32_t port, size_t workers, ServerConfig config = {});
+
+    /**
+     * @brief Registers the handler for a method, replacing any previous one.
+     *
+     * @throw std::invalid_argument Thrown if the method name is longer than
+     * 65535 bytes.
+     * @throw std::logic_error Thrown if the server was already started.
+     */
+    void register_handler(const std::string& method, RPCHandler handler);
+
+    /**
+     * @brief Starts accepting connections and serving calls.
+     *
+     * @throw std::system_error Thrown when system is unable to start server.
+     * Nothing is left running, so the server can be started again.
+     */
+    void start();
+
+    /**
+     * @brief Stops accepting connections, and waits for the connections in
+     * flight to be closed by their clients.
+     *
+     * Once the grace period runs out, the remaining connections are shut
+     * down. Calls that are already running finish, but their responses may
+     * not reach the client. Performs no operation if the server is already
+     * shut down.
+     *
+     * @param grace_period The maximum time to wait for connections to close.
+     * @return A report of how many connections were drained and dropped.
+     */
+    ShutdownReport shutdown(
+        std::chrono::nanoseconds grace_period = std::chrono::nanoseconds{0});
+
+    ~RPCServer();  // make the type complete
+};
+
+/**
+ * @brief Reports a failed remote procedure call.
+ */
+class RPCError : public std::exception {
+   private:
+    std::string _message;
+
+   public:
+    explicit RPCError(const std::string& message);
+    explicit RPCError(const char* message);
+    RPCError(const RPCError& other) = default;
+
+    [[nodiscard]] const char* what() const noexcept override;
+};
+
+}  // namespace singularity::network
+
+#endif  // RPC_HPP
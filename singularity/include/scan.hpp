@@ -0,0 +1,43 @@
+#pragma once
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <cstddef>
+
+namespace singularity::scan {
+
+/**
+ * @brief Finds the first occurrence of a byte in a buffer.
+ *
+ * On x86-64 processors the buffer is compared 32 bytes at a time with AVX2,
+ * or 16 bytes at a time with SSE2 where AVX2 is unavailable. Elsewhere, a
+ * portable implementation compares a machine word at a time. The
+ * implementation is chosen once at runtime.
+ *
+ * @param data The buffer to search.
+ * @param length The length of the buffer.
+ * @param value The byte to find.
+ * @return A pointer to the first occurrence, or `nullptr` if the buffer does
+ * not contain the byte.
+ */
+const std::byte* find_byte(const std::byte* data, size_t length,
+                           std::byte value);
+
+/**
+ * @brief Finds the first occurrence of a byte with the portable word at a
+ * time implementation, regardless of hardware support.
+ *
+ * @see find_byte
+ */
+const std::byte* find_byte_portable(const std::byte* data, size_t length,
+                                    std::byte value);
+
+/**
+ * @brief Returns the name of the implementation `find_byte` runs on:
+ * "avx2", "sse2" or "portable".
+ */
+[[nodiscard]] const char* find_byte_implementation();
+
+}  // namespace singularity::scan
+
+#endif  // SCAN_HPP
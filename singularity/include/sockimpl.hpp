@@ -4,12 +4,30 @@
 
 #include <netinet/in.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
+#include <array>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics.hpp"
+#include "timer_wheel.hpp"
+
+namespace singularity::compression {
+class Compressor;
+}  // namespace singularity::compression
 
 namespace singularity::network {
 
@@ -56,10 +74,10 @@ class IPSocketAddress : public SocketAddress {
     IPSocketAddress(const sockaddr* address, socklen_t address_length);
 
     IPSocketAddress(const IPSocketAddress& other);
-    IPSocketAddress(IPSocketAddress&& other) = default;
+    IPSocketAddress(IPSocketAddress&& other) noexcept;
 
     IPSocketAddress& operator=(const IPSocketAddress& other);
-    IPSocketAddress& operator=(IPSocketAddress&& other) = default;
+    IPSocketAddress& operator=(IPSocketAddress&& other) noexcept;
 
     [[nodiscard]] uint32_t address() const;
     [[nodiscard]] std::string string_address() const;
@@ -74,15 +92,62 @@ class IPSocketAddress : public SocketAddress {
 
 /**
  * @brief Represents a message buffer that holds raw data.
+ *
+ * The data either lives on the heap or in a memory mapping, such as a mapped
+ * file or a receive that spilled out of memory. Mapped buffers are paged in
+ * and out by the kernel, so huge payloads do not have to fit in RAM.
  */
 class MessageBuffer {
    private:
-    std::unique_ptr<std::byte> _data;
+    // frees heap data, or unmaps the mapping the data points into. A value
+    // initialized (zero) mapping length means the data is on the heap.
+    struct Release {
+        size_t mapped_length;
+        size_t offset;
+
+        void operator()(std::byte* data) const;
+    };
+
+    std::unique_ptr<std::byte[], Release> _data;
     size_t _length;
 
    public:
     MessageBuffer(const void* data, size_t datasize);
 
+    /**
+     * @brief Takes ownership of an existing allocation without copying it.
+     * @param data The allocation holding the message, at least `datasize`
+     * bytes long.
+     * @param datasize The length of the message.
+     */
+    MessageBuffer(std::unique_ptr<std::byte[]> data, size_t datasize);
+
+    /**
+     * @brief Takes ownership of a memory mapping. The mapping is unmapped
+     * when the buffer is destroyed.
+     *
+     * @param base The start of the mapping, as returned by `mmap`.
+     * @param mapped_length The length of the mapping.
+     * @param datasize The length of the message at the start of the mapping.
+     */
+    static MessageBuffer from_mapping(void* base, size_t mapped_length,
+                                      size_t datasize);
+
+    /**
+     * @brief Maps part of a file read-only, without copying it.
+     *
+     * The file may be closed once the buffer is created. Changes made to the
+     * file afterwards may be visible through the buffer.
+     *
+     * @param file_fd The file to map.
+     * @param length The number of bytes to map.
+     * @param offset The position in the file the message starts at. It does
+     * not need to be page aligned.
+     *
+     * @throw std::system_error Operating system was unable to map the file.
+     */
+    static MessageBuffer map_file(int file_fd, size_t length, off_t offset = 0);
+
     /**
      * @brief Creates a MessageBuffer object from a string.
      * @param message The string to create the buffer from.
@@ -107,10 +172,185 @@ class MessageBuffer {
     [[nodiscard]] const std::byte* raw() const;
     [[nodiscard]] size_t length() const;
 
+    /**
+     * @brief Checks whether the data lives in a memory mapping rather than on
+     * the heap.
+     */
+    [[nodiscard]] bool mapped() const;
+
     friend bool operator==(const MessageBuffer& lhs, const MessageBuffer& rhs);
     friend bool operator!=(const MessageBuffer& lhs, const MessageBuffer& rhs);
 };
 
+/**
+ * @brief A snapshot of the statistics of a single TCP connection.
+ *
+ * The byte, message and time counters are kept by the library and cover every
+ * `send_message`/`receive_message` call, including failed ones. Time spent in
+ * those calls that is not explained by the round trip time points at a slow
+ * peer or a slow server rather than a slow network. The remaining fields come
+ * from the kernel (`TCP_INFO`) and are zero on platforms that do not expose
+ * them or once the connection has been terminated.
+ */
+struct ConnectionStats {
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    uint64_t messages_sent = 0;
+    uint64_t messages_received = 0;
+    std::chrono::nanoseconds send_time{0};
+    std::chrono::nanoseconds receive_time{0};
+
+    // smoothed round trip time and its mean deviation
+    std::chrono::microseconds rtt{0};
+    std::chrono::microseconds rtt_variance{0};
+    uint32_t retransmits = 0;
+    uint32_t total_retransmits = 0;
+    uint32_t lost = 0;
+    uint32_t unacked = 0;
+    // congestion window and slow start threshold, in segments
+    uint32_t congestion_window = 0;
+    uint32_t slow_start_threshold = 0;
+    uint32_t mss = 0;
+};
+
+/**
+ * @brief Statistics aggregated over a sample of live connections.
+ *
+ * Counters are summed over the sampled connections, round trip times are
+ * percentiles across them.
+ */
+struct ConnectionStatsSummary {
+    size_t connections = 0;
+    size_t sampled = 0;
+
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    uint64_t messages_sent = 0;
+    uint64_t messages_received = 0;
+    std::chrono::nanoseconds send_time{0};
+    std::chrono::nanoseconds receive_time{0};
+
+    std::chrono::microseconds rtt_p50{0};
+    std::chrono::microseconds rtt_p99{0};
+    std::chrono::microseconds rtt_max{0};
+    uint64_t total_retransmits = 0;
+    uint64_t lost = 0;
+};
+
+/**
+ * @brief The metrics TCPConnection objects report to, usually shared by every
+ * connection of a server.
+ */
+struct ConnectionMetrics {
+    metrics::Counter& bytes_sent;
+    metrics::Counter& bytes_received;
+    // time spent in each send and receive system call, failed ones included
+    metrics::Histogram& send_latency;
+    metrics::Histogram& receive_latency;
+    // connections reporting to these metrics that are open
+    metrics::Gauge& open_connections;
+
+    /**
+     * @brief Registers the connection metrics with a registry.
+     *
+     * @param labels The labels of the metrics, for instance naming the server
+     * the connections belong to.
+     * @throw std::invalid_argument Thrown if the labels are invalid.
+     */
+    explicit ConnectionMetrics(metrics::Registry& registry,
+                               const metrics::Labels& labels = {});
+};
+
+struct ConnectionCounters;
+class TCPConnection;
+class ChunkReader;
+class DelimitedReader;
+class Broadcaster;
+class TokenBucket;
+
+/**
+ * @brief Callback invoked with each chunk of a streamed receive.
+ *
+ * The data pointer refers to a buffer owned by the receiver and is only valid
+ * for the duration of the call.
+ */
+using ChunkHandler = std::function<void(const std::byte*, size_t)>;
+
+/**
+ * @brief Callback producing the chunks of a streamed send.
+ *
+ * Each call writes up to `capacity` bytes into the given buffer and returns
+ * how many it wrote. Returning 0 ends the stream.
+ */
+using ChunkProducer = std::function<size_t(std::byte*, size_t)>;
+
+/**
+ * @brief Callback providing the storage a received frame is decoded into.
+ *
+ * Called once the frame's length is known, it returns a buffer of at least
+ * that many bytes owned by the caller. Throwing from it abandons the frame
+ * half read, leaving the connection unusable.
+ */
+using FrameAllocator = std::function<std::byte*(size_t)>;
+
+/**
+ * @brief Tracks a set of live connections.
+ *
+ * Servers register every connection they hand out, so that on shutdown they
+ * can wait for in-flight connections to finish and forcibly close whatever is
+ * left. Connections remove themselves when they are terminated. This class is
+ * thread-safe.
+ */
+class ConnectionRegistry {
+   private:
+    friend class TCPConnection;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _released;
+    std::unordered_map<socket_t, std::shared_ptr<const ConnectionCounters>>
+        _sockets;
+
+    void _add(socket_t socket,
+              std::shared_ptr<const ConnectionCounters> counters);
+    void _remove(socket_t socket);
+
+   public:
+    /**
+     * @brief Returns the number of live connections.
+     */
+    [[nodiscard]] size_t size() const;
+
+    /**
+     * @brief Waits until every registered connection has been terminated.
+     *
+     * @param timeout The maximum duration to wait.
+     * @return `true` if no connections remain, `false` if the timeout expired
+     * first.
+     */
+    bool wait_empty(std::chrono::nanoseconds timeout);
+
+    /**
+     * @brief Shuts down every live connection in both directions.
+     *
+     * Threads blocked on those connections are woken up and see the end of
+     * the stream. The connections stay registered until their owners
+     * terminate them.
+     *
+     * @return The number of connections that were shut down.
+     */
+    size_t shutdown_all();
+
+    /**
+     * @brief Aggregates the statistics of up to `max_samples` live
+     * connections.
+     *
+     * When more connections are live, an evenly spaced subset starting at a
+     * random position is sampled, so the cost of a call stays bounded no
+     * matter how many connections the server holds.
+     */
+    [[nodiscard]] ConnectionStatsSummary sample(size_t max_samples) const;
+};
+
 /**
  * @brief Represents a TCP connection.
  *
@@ -119,10 +359,75 @@ class MessageBuffer {
  */
 class TCPConnection {
    protected:
+    friend class ChunkReader;
+    friend class DelimitedReader;
+    friend class Broadcaster;
+    class IdleTimer;
+
     std::optional<socket_t> _socket;
     IPSocketAddress _address;
+    std::shared_ptr<IdleTimer> _idle_timer;
+    std::shared_ptr<ConnectionRegistry> _registry;
+    std::shared_ptr<ConnectionCounters> _counters;
+    size_t _spill_threshold;
+    std::string _spill_directory;
+    std::unique_ptr<compression::Compressor> _compressor;
+    size_t _max_frame_size;
+    bool _checksums;
+    std::shared_ptr<TokenBucket> _byte_limit;
+    std::shared_ptr<TokenBucket> _message_limit;
+    std::shared_ptr<const ConnectionMetrics> _metrics;
+
+    void _check_idle(const char* message) const;
+
+    // Identifies the connection's spans in traces, stable across moves.
+    uint64_t _trace_id() const;
+
+    // Waits while the peer is over its receive limits. Returns the most bytes
+    // the next read may take.
+    size_t _throttle(size_t capacity,
+                     std::chrono::steady_clock::time_point deadline);
+
+    // Counts a message whose last byte was received.
+    void _count_received();
+
+    // Receives at most `capacity` bytes with a single system call, returning
+    // 0 once the peer has finished sending.
+    size_t _receive_chunk(std::byte* chunk, size_t capacity,
+                          std::chrono::steady_clock::time_point deadline);
+
+    // Sends every byte of the given range.
+    void _send_bytes(const std::byte* data, size_t length,
+                     std::chrono::steady_clock::time_point deadline);
+
+    // Sends every byte of the given ranges with as few system calls as
+    // possible. The vectors are consumed.
+    void _send_vectored(iovec* vectors, size_t count,
+                        std::chrono::steady_clock::time_point deadline);
+
+    // Sends as much of the given ranges as the socket accepts without
+    // blocking, returning the number of bytes sent.
+    size_t _send_available(const iovec* vectors, size_t count);
+
+    // Counts messages whose last byte was sent by `_send_available`.
+    void _count_sent(uint64_t messages);
+
+    // frame header: payload length, decoded length (both 32 bit, network
+    // byte order), flags and three reserved bytes
+    using FrameHeader = std::array<std::byte, 12>;
+
+    static FrameHeader _frame_header(size_t wire_length,
+                                     size_t decoded_length, uint8_t flags);
+
+    // Fills the range completely. Returns false if the stream ended before
+    // the first byte and `allow_end` is set.
+    bool _receive_exact(std::byte* data, size_t length, bool allow_end,
+                        std::chrono::steady_clock::time_point deadline);
 
    public:
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t DEFAULT_MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
     /**
      * @brief Constructs a TCPConnection object with the address of the socket
      * to connect to.
@@ -162,6 +467,74 @@ class TCPConnection {
      */
     void send_message(const MessageBuffer& buffer);
 
+    /**
+     * @brief Sends a message over the TCP connection, giving up if it cannot
+     * be fully sent before the deadline.
+     *
+     * @param buffer The message buffer containing the data to be sent.
+     * @param deadline The time by which the message must be sent.
+     *
+     * @throw std::system_error Operating system was unable to send data
+     * successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     */
+    void send_message(const MessageBuffer& buffer,
+                      std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * @brief Sends a stream of chunks pulled from a producer, without ever
+     * materializing the whole payload.
+     *
+     * The producer runs on a helper thread and fills one of two chunk
+     * buffers while the other is being sent, so producing the next chunk
+     * overlaps with sending the previous one. Memory use is bounded by twice
+     * the chunk size. If sending fails, the producer is not called again
+     * and the error is rethrown once its current call returns. Exceptions
+     * thrown by the producer are rethrown to the caller.
+     *
+     * @param producer Called repeatedly to fill the next chunk.
+     * @param chunk_size The size of each chunk buffer.
+     * @param deadline The time by which the whole stream must be sent.
+     * @return The total number of bytes sent.
+     *
+     * @throw std::invalid_argument Thrown if `chunk_size` is zero.
+     * @throw std::system_error Operating system was unable to send data
+     * successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     */
+    size_t send_stream(const ChunkProducer& producer,
+                       size_t chunk_size = DEFAULT_CHUNK_SIZE,
+                       std::chrono::steady_clock::time_point deadline =
+                           std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Sends the contents of a file descriptor.
+     *
+     * On Linux, regular files are sent with `sendfile`, so the data never
+     * passes through user space. Other descriptors, such as pipes, and other
+     * platforms fall back to a pipelined `send_stream`.
+     *
+     * @param file_fd The descriptor to read from. Its file offset is not
+     * changed when it supports positioned reads.
+     * @param offset The position to start reading from. Must be 0 for
+     * descriptors that cannot seek.
+     * @param length The maximum number of bytes to send. Sending stops early
+     * at the end of the file.
+     * @param deadline The time by which the data must be sent.
+     * @return The total number of bytes sent.
+     *
+     * @throw std::system_error Operating system was unable to read or send
+     * data successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     */
+    size_t send_file(int file_fd, off_t offset = 0,
+                     size_t length = std::numeric_limits<size_t>::max(),
+                     std::chrono::steady_clock::time_point deadline =
+                         std::chrono::steady_clock::time_point::max());
+
     /**
      * @brief Receives a message from the TCP connection.
      *
@@ -173,6 +546,253 @@ class TCPConnection {
      */
     MessageBuffer receive_message();
 
+    /**
+     * @brief Receives a message from the TCP connection, giving up if the
+     * peer has not finished sending before the deadline.
+     *
+     * @param deadline The time by which the message must be received.
+     * @return The received message buffer.
+     *
+     * @throw std::system_error Operating system was unable to receive data
+     * successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     */
+    MessageBuffer receive_message(
+        std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * @brief Receives the stream until the peer finishes sending, handing
+     * the data to a callback chunk by chunk.
+     *
+     * Unlike `receive_message()`, the stream is never accumulated: a single
+     * chunk buffer is reused throughout, so memory use is bounded by the
+     * chunk size no matter how much data the peer sends. Each chunk holds
+     * whatever a single read returned, between 1 and `chunk_size` bytes.
+     *
+     * @param handler Invoked once for every chunk received.
+     * @param chunk_size The size of the chunk buffer.
+     * @param deadline The time by which the whole stream must be received.
+     * @return The total number of bytes received.
+     *
+     * @throw std::invalid_argument Thrown if `chunk_size` is zero.
+     * @throw std::system_error Operating system was unable to receive data
+     * successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     * @see ChunkReader
+     */
+    size_t receive_stream(const ChunkHandler& handler,
+                          size_t chunk_size = DEFAULT_CHUNK_SIZE,
+                          std::chrono::steady_clock::time_point deadline =
+                              std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Sends a message as a length-prefixed frame.
+     *
+     * Unlike `send_message`, frames delimit themselves, so any number of them
+     * can be exchanged over one connection. Each frame carries a small header
+     * that records its length and how it was encoded, so the receiver always
+     * knows how to decode it regardless of its own settings. The header and
+     * payload leave in a single system call where possible.
+     *
+     * @param buffer The message to send.
+     * @param deadline The time by which the frame must be sent.
+     *
+     * @throw std::invalid_argument Thrown if the message is longer than 4 GiB.
+     * @throw std::system_error Operating system was unable to send data
+     * successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     */
+    void send_frame(const MessageBuffer& buffer,
+                    std::chrono::steady_clock::time_point deadline =
+                        std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Sends a range of memory owned by the caller as a frame, as
+     * `send_frame` does for a MessageBuffer.
+     *
+     * @throw std::invalid_argument Thrown if the range is longer than 4 GiB.
+     * @throw std::system_error Operating system was unable to send data
+     * successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     */
+    void send_frame(const std::byte* data, size_t length,
+                    std::chrono::steady_clock::time_point deadline =
+                        std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Receives a single frame sent with `send_frame`.
+     *
+     * @param deadline The time by which the frame must be received.
+     * @return The decoded message, or an empty optional if the peer finished
+     * sending at a frame boundary.
+     *
+     * @throw std::system_error Operating system was unable to receive data
+     * successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     * @throw ProtocolError The frame was truncated, malformed, larger than
+     * the maximum frame size, or failed its checksum.
+     */
+    std::optional<MessageBuffer> receive_frame(
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Receives a single frame into storage chosen by the caller, such
+     * as an aligned buffer the frame's contents are used from in place.
+     *
+     * The payload is read, or decompressed, straight into the storage, which
+     * is requested only after the header was checked against the maximum
+     * frame size.
+     *
+     * @param allocate Provides the storage once the frame's length is known.
+     * @param deadline The time by which the frame must be received.
+     * @return The length of the frame, or an empty optional if the peer
+     * finished sending at a frame boundary.
+     *
+     * @throw std::system_error Operating system was unable to receive data
+     * successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     * @throw ProtocolError The frame was truncated, malformed, larger than
+     * the maximum frame size, or failed its checksum.
+     */
+    std::optional<size_t> receive_frame_into(
+        const FrameAllocator& allocate,
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Enables or disables compression of outgoing frames.
+     *
+     * The decision is made per frame: small frames, frames that do not shrink
+     * enough, and frames sent while the stream looks incompressible go out
+     * as they are. Received frames are decoded whatever this setting is.
+     *
+     * @param enabled Whether to compress outgoing frames.
+     * @param min_size Frames smaller than this are never compressed.
+     * @see compression::Compressor
+     */
+    void set_compression(bool enabled, size_t min_size = 256);
+
+    /**
+     * @brief Enables or disables checksums on outgoing frames.
+     *
+     * Checksummed frames carry a CRC32C of the decoded message in a trailer,
+     * which `receive_frame` verifies, so corruption anywhere between the
+     * sender's and the receiver's memory is detected, including in the
+     * compression layer. Like compression, this is flagged per frame, and
+     * received frames are verified whatever this setting is.
+     *
+     * @see checksum::crc32c
+     */
+    void set_checksums(bool enabled);
+
+    /**
+     * @brief Sets the largest frame `receive_frame` accepts, protecting
+     * against peers that announce absurd lengths.
+     */
+    void set_max_frame_size(size_t max_frame_size);
+
+    /**
+     * @brief Makes `receive_message` move messages that grow past a size
+     * threshold out of the heap and into a memory mapped temporary file.
+     *
+     * Once spilled, the message keeps growing in the file without being
+     * copied again, and is returned as a mapped MessageBuffer. The file is
+     * unlinked from the start, so it disappears along with the buffer.
+     *
+     * @param threshold The message size at which to spill, 0 disables
+     * spilling.
+     * @param directory The directory to create the file in. When empty, an
+     * in-memory file (`memfd`) is used where available, which is backed by
+     * swap rather than by a filesystem.
+     */
+    void set_spill_threshold(size_t threshold, std::string directory = "");
+
+    /**
+     * @brief Shuts the connection down once no data has been sent or received
+     * for the given duration.
+     *
+     * Any operation blocked on the connection when the timeout expires is
+     * woken and throws TimeoutError, as does any later operation. Activity is
+     * recorded with a single atomic store, and the timer is only re-armed when
+     * it fires, so busy connections do not touch the timer service.
+     *
+     * @param timers The timer service that tracks the timeout. It is kept
+     * alive for as long as the connection needs it.
+     * @param timeout The maximum idle duration.
+     *
+     * @throw InactiveConnectionError Connection was inactive.
+     */
+    void set_idle_timeout(std::shared_ptr<concurrency::TimerService> timers,
+                          std::chrono::nanoseconds timeout);
+
+    /**
+     * @brief Enables TCP keepalive probing, so dead peers are detected even
+     * when the connection has nothing to send.
+     *
+     * @param idle Idle time before the first probe is sent.
+     * @param interval Time between unanswered probes.
+     * @param probes Number of unanswered probes before the connection is
+     * dropped.
+     *
+     * @throw std::system_error Operating system rejected the options.
+     * @throw InactiveConnectionError Connection was inactive.
+     */
+    void set_keepalive(std::chrono::seconds idle, std::chrono::seconds interval,
+                       int probes);
+
+    /**
+     * @brief Limits the rate at which the connection receives data.
+     *
+     * Once the peer is over a limit, reads stall until it is back within it,
+     * so the kernel buffers fill up and TCP flow control slows the peer down.
+     * Reads never take more than the byte limit's burst at once, so the burst
+     * should be at least the chunk size for efficient reads. Buckets can be
+     * shared, to apply a single limit to several connections.
+     *
+     * @param bytes The bucket charged for every byte received, or `nullptr`
+     * to lift the limit.
+     * @param messages The bucket charged for every message, frame or record
+     * received, or `nullptr` to lift the limit.
+     */
+    void set_receive_limits(std::shared_ptr<TokenBucket> bytes,
+                            std::shared_ptr<TokenBucket> messages);
+
+    /**
+     * @brief Reports the bytes moved and time spent by every send and receive
+     * to a set of metrics, on top of the connection's own statistics.
+     *
+     * @param metrics The metrics to report to, or `nullptr` to stop
+     * reporting.
+     */
+    void set_metrics(std::shared_ptr<const ConnectionMetrics> metrics);
+
+    /**
+     * @brief Returns the CPU that processed the most recent packets received
+     * on the connection, so it can be served by a thread running there.
+     *
+     * @return The CPU number, or -1 if the kernel does not report it.
+     *
+     * @throw InactiveConnectionError Connection was inactive.
+     */
+    [[nodiscard]] int incoming_cpu() const;
+
+    /**
+     * @brief Registers the connection with a registry until it is terminated.
+     *
+     * A connection can belong to at most one registry, tracking it again
+     * moves it to the new registry.
+     *
+     * @throw InactiveConnectionError Connection was inactive.
+     */
+    void track(std::shared_ptr<ConnectionRegistry> registry);
+
     /**
      * @brief Opens the TCP connection.
      *
@@ -200,6 +820,18 @@ class TCPConnection {
      */
     void terminate();
 
+    /**
+     * @brief Abortively closes the TCP connection.
+     *
+     * Unlike `terminate()`, the peer is sent a reset instead of a graceful
+     * shutdown, so it fails fast rather than waiting on a connection that will
+     * never be served. Performs no operation if the connection is closed.
+     *
+     * @throw std::system_error Operating system was unable to close the
+     * connection.
+     */
+    void abort();
+
     /**
      * @brief Disables sending data over the TCP connection.
      *
@@ -220,6 +852,17 @@ class TCPConnection {
      */
     void disable_receive();
 
+    /**
+     * @brief Returns the statistics of the connection.
+     *
+     * Library counters remain available after the connection is terminated,
+     * kernel statistics are only reported while it is active.
+     *
+     * @throw std::system_error Operating system was unable to report the
+     * kernel statistics.
+     */
+    [[nodiscard]] ConnectionStats stats() const;
+
     /**
      * @brief Checks if the TCP connection is active.
      * @return `true` if the connection is active, `false` otherwise.
@@ -227,6 +870,394 @@ class TCPConnection {
     [[nodiscard]] bool active() const;
 };
 
+/**
+ * @brief Reads a TCP stream as a sequence of chunks through one reused buffer.
+ *
+ * The reader is an input range, so a stream can be consumed with a plain
+ * loop while memory use stays bounded by the chunk size:
+ *
+ *     ChunkReader reader(connection);
+ *     for (std::span<const std::byte> chunk : reader) { ... }
+ *
+ * A chunk is only valid until the reader is advanced. The range ends once the
+ * peer has finished sending, and errors are thrown from the read that hits
+ * them, exactly as with `TCPConnection::receive_message()`.
+ */
+class ChunkReader {
+   private:
+    TCPConnection& _connection;
+    std::unique_ptr<std::byte[]> _buffer;
+    size_t _capacity;
+    size_t _length;
+    bool _started;
+    bool _done;
+    std::chrono::steady_clock::time_point _deadline;
+
+   public:
+    class Iterator {
+       private:
+        ChunkReader* _reader;
+
+       public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::span<const std::byte>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = value_type;
+
+        Iterator();
+        explicit Iterator(ChunkReader* reader);
+
+        value_type operator*() const;
+        Iterator& operator++();
+        void operator++(int);
+
+        friend bool operator==(const Iterator& lhs, const Iterator& rhs);
+    };
+
+    /**
+     * @brief Constructs a reader over a connection. Nothing is read until
+     * the first chunk is requested.
+     *
+     * @param connection The connection to read from. It must outlive the
+     * reader.
+     * @param chunk_size The size of the chunk buffer.
+     * @param deadline The time by which the whole stream must be received.
+     *
+     * @throw std::invalid_argument Thrown if `chunk_size` is zero.
+     */
+    explicit ChunkReader(
+        TCPConnection& connection,
+        size_t chunk_size = TCPConnection::DEFAULT_CHUNK_SIZE,
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::time_point::max());
+
+    ChunkReader(const ChunkReader& other) = delete;
+    ChunkReader& operator=(const ChunkReader& other) = delete;
+
+    /**
+     * @brief Reads the next chunk.
+     *
+     * @return The chunk, or an empty optional once the stream has ended.
+     *
+     * @throw std::system_error Operating system was unable to receive data
+     * successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     */
+    std::optional<std::span<const std::byte>> next();
+
+    /**
+     * @brief Returns an iterator to the current chunk, reading the first one
+     * if nothing has been read yet.
+     */
+    Iterator begin();
+    Iterator end();
+};
+
+/**
+ * @brief Reads a TCP stream as a sequence of records separated by a delimiter
+ * byte, such as newline or NUL delimited protocols.
+ *
+ * Data is received into a buffer that is searched with a vectorized scan (see
+ * `scan::find_byte`). Records are returned as views into the buffer, so a
+ * record that arrives entirely within one read is never copied. Only the
+ * incomplete tail of a read is moved to the front of the buffer to make room
+ * for the rest of its record, and the buffer grows if a single record does
+ * not fit.
+ *
+ *     DelimitedReader reader(connection, std::byte{'\n'});
+ *     for (std::span<const std::byte> line : reader) { ... }
+ *
+ * A record is only valid until the reader is advanced, and does not include
+ * its delimiter. If the peer finishes sending in the middle of a record, that
+ * record is returned as the last one.
+ */
+class DelimitedReader {
+   private:
+    TCPConnection& _connection;
+    std::unique_ptr<std::byte[]> _buffer;
+    size_t _capacity;
+    size_t _max_record_size;
+    std::byte _delimiter;
+    // the unread data is [_start, _end), of which [_start, _scanned) is
+    // known not to contain a delimiter
+    size_t _start;
+    size_t _scanned;
+    size_t _end;
+    std::span<const std::byte> _record;
+    bool _started;
+    bool _done;
+    std::chrono::steady_clock::time_point _deadline;
+
+    // Makes room for more data after `_end`, moving or growing the buffer.
+    void _make_room();
+
+   public:
+    class Iterator {
+       private:
+        DelimitedReader* _reader;
+
+       public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::span<const std::byte>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = value_type;
+
+        Iterator();
+        explicit Iterator(DelimitedReader* reader);
+
+        value_type operator*() const;
+        Iterator& operator++();
+        void operator++(int);
+
+        friend bool operator==(const Iterator& lhs, const Iterator& rhs);
+    };
+
+    /**
+     * @brief Constructs a reader over a connection. Nothing is read until
+     * the first record is requested.
+     *
+     * @param connection The connection to read from. It must outlive the
+     * reader.
+     * @param delimiter The byte that ends each record.
+     * @param buffer_size The initial size of the receive buffer.
+     * @param max_record_size The longest record accepted, protecting against
+     * peers that never send a delimiter.
+     * @param deadline The time by which the whole stream must be received.
+     *
+     * @throw std::invalid_argument Thrown if `buffer_size` is zero.
+     */
+    explicit DelimitedReader(
+        TCPConnection& connection, std::byte delimiter = std::byte{'\n'},
+        size_t buffer_size = TCPConnection::DEFAULT_CHUNK_SIZE,
+        size_t max_record_size = TCPConnection::DEFAULT_MAX_FRAME_SIZE,
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::time_point::max());
+
+    DelimitedReader(const DelimitedReader& other) = delete;
+    DelimitedReader& operator=(const DelimitedReader& other) = delete;
+
+    /**
+     * @brief Reads the next record.
+     *
+     * @return The record without its delimiter, or an empty optional once the
+     * stream has ended.
+     *
+     * @throw std::system_error Operating system was unable to receive data
+     * successfully.
+     * @throw InactiveConnectionError Connection was inactive.
+     * @throw TimeoutError The deadline or the idle timeout expired.
+     * @throw ProtocolError A record exceeded the maximum record size.
+     */
+    std::optional<std::span<const std::byte>> next();
+
+    /**
+     * @brief Returns an iterator to the current record, reading the first one
+     * if nothing has been read yet.
+     */
+    Iterator begin();
+    Iterator end();
+};
+
+/**
+ * @brief A single datagram and the peer it was sent to or received from.
+ */
+struct Datagram {
+    IPSocketAddress address;
+    MessageBuffer message;
+};
+
+/**
+ * @brief Callback invoked once per received datagram.
+ *
+ * The data pointer refers to storage owned by the receiving socket and is only
+ * valid for the duration of the call.
+ */
+using DatagramHandler =
+    std::function<void(const IPSocketAddress&, const std::byte*, size_t)>;
+
+/**
+ * @brief Represents a UDP socket.
+ *
+ * The UDPSocket class sends and receives datagrams in batches, amortizing the
+ * cost of a system call across many small packets. On Linux, batches are
+ * moved with `sendmmsg`/`recvmmsg`, and UDP segmentation offload (GSO) and
+ * generic receive offload (GRO) are used when the kernel supports them. Other
+ * platforms fall back to one system call per datagram.
+ */
+class UDPSocket {
+   private:
+    class BatchState;
+
+    std::optional<socket_t> _socket;
+    std::unique_ptr<BatchState> _state;
+
+   public:
+    static constexpr size_t DEFAULT_BATCH_SIZE = 64;
+    static constexpr size_t DEFAULT_MAX_DATAGRAM_SIZE = 2048;
+
+    /**
+     * @brief Constructs an unbound UDP socket.
+     *
+     * @param batch_size The maximum number of datagrams moved per system call.
+     * @param max_datagram_size The largest datagram that can be received
+     * without truncation.
+     *
+     * @throw std::invalid_argument Thrown if either size is zero.
+     * @throw std::system_error Operating system was unable to allocate the
+     * socket.
+     */
+    explicit UDPSocket(size_t batch_size = DEFAULT_BATCH_SIZE,
+                       size_t max_datagram_size = DEFAULT_MAX_DATAGRAM_SIZE);
+    ~UDPSocket();
+
+    UDPSocket(const UDPSocket& other) = delete;
+    UDPSocket& operator=(const UDPSocket& other) = delete;
+
+    UDPSocket(UDPSocket&& other) noexcept;
+    UDPSocket& operator=(UDPSocket&& other) noexcept;
+
+    /**
+     * @brief Binds the socket to a local address.
+     *
+     * Binding to port 0 lets the operating system choose a port, which can be
+     * retrieved afterwards with `local_address()`.
+     *
+     * @throw std::system_error Operating system was unable to bind the socket.
+     * @throw InactiveConnectionError Socket was terminated.
+     */
+    void bind(const IPSocketAddress& address);
+
+    /**
+     * @brief Returns the local address the socket is bound to.
+     *
+     * @throw std::system_error Operating system was unable to query the
+     * address.
+     * @throw InactiveConnectionError Socket was terminated.
+     */
+    [[nodiscard]] IPSocketAddress local_address() const;
+
+    /**
+     * @brief Sends every datagram in the given batch.
+     *
+     * @throw std::system_error Operating system was unable to send data.
+     * @throw InactiveConnectionError Socket was terminated.
+     */
+    void send_batch(const std::vector<Datagram>& datagrams);
+
+    /**
+     * @brief Sends a buffer to a single destination as a train of datagrams of
+     * `segment_size` bytes each (the last one may be shorter).
+     *
+     * With segmentation offload the kernel splits the buffer, so a whole train
+     * costs a single pass through the network stack. Without it, the buffer is
+     * split in user space and sent as a batch.
+     *
+     * @throw std::invalid_argument Thrown if `segment_size` is zero or larger
+     * than the maximum UDP payload (65507 bytes).
+     * @throw std::system_error Operating system was unable to send data.
+     * @throw InactiveConnectionError Socket was terminated.
+     */
+    void send_segmented(const IPSocketAddress& destination,
+                        const MessageBuffer& buffer, uint16_t segment_size);
+
+    /**
+     * @brief Receives a batch of datagrams without copying them.
+     *
+     * Blocks until at least one datagram is available, then drains up to a
+     * full batch without blocking further. Coalesced receive offload packets
+     * are split back into their original datagrams before being handed out.
+     * Datagrams larger than the maximum datagram size are dropped rather than
+     * delivered truncated, and counted by `truncated_datagrams()`.
+     *
+     * @param handler Invoked once for every datagram received.
+     * @return The number of datagrams delivered, or 0 if the receive timeout
+     * expired or every datagram received was dropped.
+     *
+     * @throw std::system_error Operating system was unable to receive data.
+     * @throw InactiveConnectionError Socket was terminated.
+     */
+    size_t receive_batch(const DatagramHandler& handler);
+
+    /**
+     * @brief Receives a batch of datagrams, copying each into its own buffer.
+     *
+     * @see receive_batch(const DatagramHandler&)
+     */
+    std::vector<Datagram> receive_batch();
+
+    /**
+     * @brief Sets the maximum time `receive_batch` blocks waiting for data.
+     *
+     * A zero timeout blocks indefinitely.
+     *
+     * @throw std::system_error Operating system rejected the timeout.
+     * @throw InactiveConnectionError Socket was terminated.
+     */
+    void set_receive_timeout(std::chrono::microseconds timeout);
+
+    /**
+     * @brief Requests coalescing of incoming datagrams by the kernel (GRO).
+     *
+     * @return `true` if receive offload is now enabled, `false` if the platform
+     * does not support it.
+     *
+     * @throw InactiveConnectionError Socket was terminated.
+     */
+    bool enable_receive_offload();
+
+    /**
+     * @brief Checks whether `send_segmented` is handled by the kernel.
+     */
+    [[nodiscard]] bool segmentation_offload() const;
+
+    /**
+     * @brief Returns the number of received datagrams dropped because they
+     * were larger than the maximum datagram size.
+     */
+    [[nodiscard]] size_t truncated_datagrams() const;
+
+    /**
+     * @brief Closes the socket. Performs no operation if already closed.
+     *
+     * @throw std::system_error Operating system was unable to close the
+     * socket.
+     */
+    void terminate();
+
+    /**
+     * @brief Checks if the UDP socket is open.
+     * @return `true` if the socket is open, `false` otherwise.
+     */
+    [[nodiscard]] bool active() const;
+};
+
+class TimeoutError : public std::exception {
+   private:
+    std::string _message;
+
+   public:
+    explicit TimeoutError(const std::string& message);
+    explicit TimeoutError(const char* message);
+    TimeoutError(const TimeoutError& other) = default;
+
+    [[nodiscard]] const char* what() const noexcept override;
+};
+
+class ProtocolError : public std::exception {
+   private:
+    std::string _message;
+
+   public:
+    explicit ProtocolError(const std::string& message);
+    explicit ProtocolError(const char* message);
+    ProtocolError(const ProtocolError& other) = default;
+
+    [[nodiscard]] const char* what() const noexcept override;
+};
+
 class InactiveConnectionError : public std::exception {
    private:
     std::string _message;
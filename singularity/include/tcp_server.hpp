@@ -2,17 +2,149 @@
 #ifndef TCP_SERVER_H
 #define TCP_SERVER_H
 
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <type_traits>
 
 #include "concurrency.hpp"
+#include "metrics.hpp"
+#include "placement.hpp"
+#include "rate_limit.hpp"
 #include "sockimpl.hpp"
 #include "utils.hpp"
 
 namespace singularity::network {
 
+/**
+ * @brief Determines what the server does with a new connection when the
+ * connection buffer is full.
+ */
+enum class OverloadPolicy {
+    // wait for space in the buffer, stalling the accept loop
+    block,
+    // reset the connection immediately so the client fails fast
+    reject,
+    // wait up to the admission deadline for space, then reset
+    deadline
+};
+
+/**
+ * @brief Configuration options for a TCPServer.
+ */
+struct ServerConfig {
+    // maximum number of pending connections held by the kernel
+    int backlog = 30;
+
+    OverloadPolicy overload_policy = OverloadPolicy::block;
+    // only used with `OverloadPolicy::deadline`
+    std::chrono::nanoseconds admission_deadline = std::chrono::milliseconds(10);
+
+    // connections that see no traffic for this long are shut down, zero
+    // disables the timeout
+    std::chrono::nanoseconds idle_timeout{0};
+
+    // TCP keepalive probing for accepted connections, zero idle time disables
+    std::chrono::seconds keepalive_idle{0};
+    std::chrono::seconds keepalive_interval{10};
+    int keepalive_probes = 3;
+
+    // where the acceptor thread runs, and so where new connections are
+    // allocated
+    concurrency::ThreadPlacement acceptor_placement;
+
+    // new connections accepted per second from each client address, further
+    // ones are reset before they reach the connection buffer
+    RateLimit connection_rate;
+    // bytes and messages per second each client address may send, across all
+    // of its connections. Reading from a client over its limit stalls, which
+    // pushes back on it through TCP flow control.
+    RateLimit receive_byte_rate;
+    RateLimit receive_message_rate;
+    // clients idle for this long are forgotten by the rate limiters
+    std::chrono::nanoseconds rate_limit_expiry = std::chrono::minutes(1);
+
+    // where the server and its connections report their metrics, labelled
+    // with the server's port. The process-wide registry when empty.
+    std::shared_ptr<metrics::Registry> metrics;
+    // loopback port on which the server answers HTTP requests with its
+    // metrics registry in the Prometheus text format, zero disables it
+    uint32_t metrics_port = 0;
+};
+
+/**
+ * @brief Counters describing how the server admitted connections.
+ */
+struct AdmissionStats {
+    // connections handed to the connection buffer
+    uint64_t accepted = 0;
+    // connections reset because the buffer stayed full
+    uint64_t shed = 0;
+    // connections reset because their client exceeded the connection rate
+    uint64_t rate_limited = 0;
+    // accepted connections that had to wait for space in the buffer
+    uint64_t queued = 0;
+    // total time accepted connections spent waiting for space
+    std::chrono::nanoseconds queued_time{0};
+};
+
+/**
+ * @brief Describes the outcome of a graceful shutdown.
+ */
+struct ShutdownReport {
+    // connections that finished on their own within the grace period
+    size_t drained = 0;
+    // connections still open when the grace period ran out, which were
+    // forcibly shut down
+    size_t dropped = 0;
+    // time taken to shut down
+    std::chrono::nanoseconds elapsed{0};
+};
+
+/**
+ * @brief Serves a single connection on one of the server's workers. The
+ * connection is closed once the handler returns.
+ */
+using ConnectionHandler = std::function<void(TCPConnection&)>;
+
+/**
+ * @brief Configuration options for the workers of a serving TCPServer.
+ */
+struct WorkerConfig {
+    // threads running the handler, each serving one connection at a time
+    size_t workers = 4;
+    // accepted connections waiting for a worker, beyond which the server's
+    // overload policy applies
+    size_t queue_capacity = 64;
+
+    // where the workers run, worker `i` being thread `i` of the placement
+    concurrency::ThreadPlacement placement;
+    // hand each connection to a worker pinned to the CPU that received its
+    // packets (`SO_INCOMING_CPU`), or failing that to one on the same NUMA
+    // node. Each worker then has its own share of the queue capacity, and
+    // idle workers take connections queued for busy ones. Requires workers
+    // pinned individually.
+    bool steer_by_incoming_cpu = false;
+};
+
+/**
+ * @brief Counters describing the work done by the server's workers.
+ */
+struct WorkerStats {
+    // accepted connections waiting for a worker
+    size_t queued = 0;
+    // connections a handler is currently running on
+    size_t in_flight = 0;
+    // handler runs that returned normally
+    uint64_t handled = 0;
+    // handler runs that threw, after which the connection was reset
+    uint64_t failed = 0;
+    // connections handed to a worker on their incoming CPU or NUMA node
+    uint64_t steered = 0;
+};
+
 /**
  * @brief The TCPServer class represents a TCP server that listens for incoming
  * connections on a specified port.
@@ -32,19 +164,107 @@ class TCPServer {
      */
     explicit TCPServer(uint32_t port);
 
+    /**
+     * @brief Constructs a TCPServer object with the specified port number and
+     * configuration.
+     * @param port The port number on which the server listens. Port must be in
+     * range [0, 65536]
+     * @param config Server configuration options.
+     * @throw std::invalid_argument Thrown if port number or metrics port not
+     * in valid range, the acceptor placement refers to CPUs unavailable to
+     * the process, or a rate limit is invalid.
+     */
+    TCPServer(uint32_t port, ServerConfig config);
+
     /**
      * Starts the TCP server and listens to connections.
      *
      * Anytime a new connection is intercepted, the connection is added to the
-     * connection buffer given.
+     * connection buffer given. If the buffer is full, the connection is
+     * admitted according to the configured overload policy. The metrics
+     * endpoint, if configured, starts serving on its own thread.
      *
+     * @throw std::logic_error Thrown if the server was already started.
      * @throw std::system_error Thrown when system is unable to start server.
-     * See error message (`what()`) for more information.
+     * See error message (`what()`) for more information. Nothing is left
+     * running, so the server can be started again.
      */
     void start(concurrency::Buffer<TCPConnection>& connection_buffer);
 
+    /**
+     * Starts the TCP server and serves every connection with a handler.
+     *
+     * The server owns a pool of workers that take accepted connections from a
+     * bounded queue, so the overload policy applies once the queue is full.
+     * Exceptions escaping the handler are counted and the connection is
+     * reset; they never reach the worker. Shutting down the server with a
+     * grace period drains the connections being served before the workers
+     * are stopped, and destroying the server shuts down whatever the workers
+     * are still blocked on.
+     *
+     * @param handler The function run once per connection.
+     * @param config The worker pool configuration.
+     * @throw std::invalid_argument Thrown if the handler is empty, the number
+     * of workers or the queue capacity is zero, a placement refers to CPUs
+     * unavailable to the process, or steering is enabled without pinning the
+     * workers individually.
+     * @throw std::logic_error Thrown if the server was already started.
+     * @throw std::system_error Thrown when system is unable to start server.
+     * See error message (`what()`) for more information. Nothing is left
+     * running, so the server can be started again.
+     */
+    void serve(ConnectionHandler handler, WorkerConfig config = {});
+
+    /**
+     * @brief Stops accepting connections.
+     *
+     * The acceptor is woken up immediately and the listening socket is closed,
+     * so new clients are refused rather than left waiting in the backlog.
+     * Connections that were already handed out are left untouched. Performs
+     * no operation if the server is already shut down.
+     */
     void shutdown();
 
+    /**
+     * @brief Stops accepting connections and drains the ones in flight.
+     *
+     * In-flight connections are the ones handed to the connection buffer that
+     * have not been terminated yet, whether or not a handler has picked them
+     * up. Once the grace period runs out, any that remain are shut down, which
+     * wakes up the handlers blocked on them.
+     *
+     * @param grace_period The maximum time to wait for in-flight connections.
+     * @return A report of how many connections were drained and dropped.
+     */
+    ShutdownReport shutdown(std::chrono::nanoseconds grace_period);
+
+    /**
+     * @brief Returns the number of connections handed out by the server that
+     * have not yet been terminated.
+     */
+    [[nodiscard]] size_t active_connections() const;
+
+    /**
+     * @brief Returns a snapshot of the admission counters.
+     */
+    [[nodiscard]] AdmissionStats admission_stats() const;
+
+    /**
+     * @brief Returns a snapshot of the worker counters. All of them are zero
+     * unless the server was started with `serve`.
+     */
+    [[nodiscard]] WorkerStats worker_stats() const;
+
+    /**
+     * @brief Aggregates the statistics of a sample of the live connections
+     * handed out by the server.
+     *
+     * @param max_samples The maximum number of connections to inspect.
+     * @see ConnectionRegistry::sample
+     */
+    [[nodiscard]] ConnectionStatsSummary sample_stats(
+        size_t max_samples = 64) const;
+
     ~TCPServer();  // make the type complete
 };
 
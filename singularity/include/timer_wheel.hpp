@@ -0,0 +1,211 @@
+#pragma once
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace singularity::concurrency {
+
+/**
+ * @brief Identifies a timer scheduled on a TimerWheel.
+ *
+ * Handles stay safe to use after their timer fires or is cancelled - the slot
+ * generation is checked, so a stale handle never cancels an unrelated timer.
+ */
+struct TimerHandle {
+    static constexpr uint32_t INVALID = std::numeric_limits<uint32_t>::max();
+
+    uint32_t index = INVALID;
+    uint32_t generation = 0;
+
+    [[nodiscard]] bool valid() const { return index != INVALID; }
+};
+
+/**
+ * @brief A hierarchical timing wheel.
+ *
+ * Timers are kept in four levels of 256 slots each, covering 2^32 ticks. Each
+ * level is 256 times coarser than the one below it, and timers cascade down a
+ * level as their expiry approaches. Scheduling and cancelling are O(1), and
+ * advancing the wheel by one tick touches a single slot. Timers further out
+ * than 2^32 ticks are parked in the top level and re-filed as time passes.
+ *
+ * The wheel itself is not thread-safe and has no notion of wall time - see
+ * TimerService for a threaded driver.
+ */
+class TimerWheel {
+   public:
+    using tick_t = uint64_t;
+    using Callback = std::function<void()>;
+
+    static constexpr size_t LEVELS = 4;
+    static constexpr size_t SLOT_BITS = 8;
+    static constexpr size_t SLOTS = 1 << SLOT_BITS;
+
+   private:
+    static constexpr uint32_t NIL = TimerHandle::INVALID;
+
+    struct Node {
+        Callback callback;
+        tick_t expiry = 0;
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+        uint32_t generation = 0;
+        uint32_t slot = NIL;
+    };
+
+    std::vector<Node> _nodes;
+    std::vector<uint32_t> _free;
+    std::array<uint32_t, LEVELS * SLOTS> _slots;
+
+    tick_t _current;
+    size_t _size;
+
+    void _link(uint32_t index);
+    void _unlink(uint32_t index);
+    void _release(uint32_t index);
+    uint32_t _detach(size_t slot);
+    void _cascade(size_t level);
+
+   public:
+    /**
+     * @brief Constructs an empty wheel whose next tick to process is `start`.
+     */
+    explicit TimerWheel(tick_t start = 0);
+
+    /**
+     * @brief Schedules a callback to run once the wheel reaches `expiry`.
+     *
+     * Expiries at or before the current tick fire on the next advance.
+     *
+     * @return A handle that can be used to cancel the timer.
+     */
+    TimerHandle schedule(tick_t expiry, Callback callback);
+
+    /**
+     * @brief Cancels a pending timer.
+     *
+     * @return `true` if the timer was pending, `false` if it already fired,
+     * was cancelled, or the handle is invalid.
+     */
+    bool cancel(TimerHandle handle);
+
+    /**
+     * @brief Advances the wheel through tick `now` (inclusive), collecting the
+     * callbacks of every timer that expired.
+     *
+     * Callbacks are handed back instead of being invoked so callers can run
+     * them outside of any lock guarding the wheel.
+     *
+     * @param now The last tick to process.
+     * @param expired Output vector the expired callbacks are appended to.
+     * @return The number of timers that expired.
+     */
+    size_t advance(tick_t now, std::vector<Callback>& expired);
+
+    /**
+     * @brief Advances the wheel through tick `now` (inclusive), running the
+     * callback of every timer that expired.
+     *
+     * @return The number of timers that expired.
+     */
+    size_t advance(tick_t now);
+
+    /**
+     * @brief Returns the next tick the wheel will process.
+     */
+    [[nodiscard]] tick_t current() const;
+
+    /**
+     * @brief Returns the number of pending timers.
+     */
+    [[nodiscard]] size_t size() const;
+};
+
+/**
+ * @brief Runs a TimerWheel against the steady clock on a background thread.
+ *
+ * Callbacks run on the service thread and should be short - typically they
+ * flag or shut down a resource that another thread is blocked on. This class
+ * is thread-safe.
+ */
+class TimerService {
+   public:
+    using Callback = TimerWheel::Callback;
+    using clock = std::chrono::steady_clock;
+
+   private:
+    clock::time_point _epoch;
+    std::chrono::nanoseconds _resolution;
+
+    TimerWheel _wheel;
+    mutable std::mutex _wheel_mutex;
+    // held while expired callbacks run, so cancel() can wait them out
+    std::mutex _running_mutex;
+    std::condition_variable _wakeup;
+    bool _stop;
+
+    std::thread _thread;
+
+    TimerWheel::tick_t _to_tick(clock::time_point time) const;
+    void _run();
+
+   public:
+    /**
+     * @brief Starts the service thread.
+     *
+     * @param resolution The duration of a single tick. Timers fire no earlier
+     * than requested and at most one tick late.
+     * @throw std::invalid_argument Thrown if the resolution is not positive.
+     */
+    explicit TimerService(
+        std::chrono::nanoseconds resolution = std::chrono::milliseconds(1));
+
+    /**
+     * @brief Stops the service thread. Pending timers never fire.
+     */
+    ~TimerService();
+
+    TimerService(const TimerService& other) = delete;
+    TimerService& operator=(const TimerService& other) = delete;
+
+    /**
+     * @brief Schedules a callback to run at the given time.
+     */
+    TimerHandle schedule_at(clock::time_point time, Callback callback);
+
+    /**
+     * @brief Schedules a callback to run after the given delay.
+     */
+    TimerHandle schedule_after(std::chrono::nanoseconds delay,
+                               Callback callback);
+
+    /**
+     * @brief Cancels a pending timer.
+     *
+     * When called from outside a callback, this waits for any callbacks that
+     * are currently running to finish, so once it returns the cancelled timer
+     * is guaranteed to not be running.
+     *
+     * @return `true` if the timer was cancelled before it fired.
+     */
+    bool cancel(TimerHandle handle);
+
+    /**
+     * @brief Returns the number of pending timers.
+     */
+    [[nodiscard]] size_t pending() const;
+};
+
+}  // namespace singularity::concurrency
+
+#endif  // TIMER_WHEEL_HPP
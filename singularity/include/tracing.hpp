@@ -0,0 +1,98 @@
+#pragma once
+#ifndef TRACING_HPP
+#define TRACING_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// spans are only recorded when this is set, otherwise they compile to nothing
+#ifndef SINGULARITY_TRACING
+#define SINGULARITY_TRACING 0
+#endif
+
+namespace singularity::tracing {
+
+constexpr bool ENABLED = SINGULARITY_TRACING != 0;
+
+// spans kept per thread, older ones are overwritten
+constexpr size_t RING_CAPACITY = 16 * 1024;
+
+// Returns the current timestamp in ticks, of the TSC where there is one.
+inline uint64_t _now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+#endif
+}
+
+// Stores a finished span in the calling thread's ring.
+void _record(const char* name, uint64_t id, uint64_t start, uint64_t end);
+
+/**
+ * @brief Records the time between its construction and destruction as a span
+ * in the calling thread's trace ring.
+ *
+ * Recording reads the timestamp counter twice and stores a few words in a
+ * buffer owned by the thread, so spans can stay in hot paths. Unless the
+ * library is built with `SINGULARITY_TRACING`, spans do nothing at all.
+ */
+class Span {
+   private:
+    // only read when tracing is compiled in
+    [[maybe_unused]] const char* _name;
+    [[maybe_unused]] uint64_t _id;
+    [[maybe_unused]] uint64_t _start;
+
+   public:
+    /**
+     * @param name The name of the span, which must outlive the trace; in
+     * practice a string literal.
+     * @param id The connection or request the span belongs to, zero for
+     * none. Spans with an id are exported on a timeline of their own.
+     */
+    explicit Span(const char* name, uint64_t id = 0)
+        : _name{name}, _id{id}, _start{0} {
+#if SINGULARITY_TRACING
+        _start = _now();
+#endif
+    }
+
+    Span(const Span& other) = delete;
+    Span& operator=(const Span& other) = delete;
+
+    ~Span() {
+#if SINGULARITY_TRACING
+        _record(_name, _id, _start, _now());
+#endif
+    }
+};
+
+/**
+ * @brief Writes the spans held by every thread's ring in the Chrome trace
+ * event format, which chrome://tracing and Perfetto open.
+ *
+ * Spans without an id appear on the timeline of the thread that recorded
+ * them, spans with an id on the timeline of that id. Spans recorded while
+ * the trace is written may be left out. Writes an empty trace when tracing
+ * is compiled out.
+ */
+void write_chrome_trace(std::ostream& out);
+
+/**
+ * @brief Discards every span recorded so far.
+ */
+void clear();
+
+}  // namespace singularity::tracing
+
+#endif  // TRACING_HPP
@@ -52,9 +52,29 @@ namespace utils {
  */
 template <typename... Args>
 std::string build_string(Args&&... args) {
-    std::ostringstream os;
-    _build_string(os, std::forward<Args>(args)...);
-    return os.str();
+    // constructing a stream costs far more than resetting one, so each thread
+    // reuses its own. A nested call, from an argument's stream insertion
+    // operator, gets a fresh one.
+    thread_local std::ostringstream shared;
+    thread_local bool in_use = false;
+    if (in_use) {
+        std::ostringstream os;
+        _build_string(os, std::forward<Args>(args)...);
+        return os.str();
+    }
+
+    struct Release {
+        bool& flag;
+        ~Release() { flag = false; }
+    } release{in_use};
+    in_use = true;
+    shared.str(std::string());
+    shared.clear();
+    shared.flags(std::ios_base::dec | std::ios_base::skipws);
+    shared.precision(6);
+    shared.fill(' ');
+    _build_string(shared, std::forward<Args>(args)...);
+    return shared.str();
 }
 
 }  // namespace utils
@@ -0,0 +1,481 @@
+#include "broadcast.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace singularity::network;
+
+// messages written to a subscriber with a single system call
+constexpr size_t MAX_BATCH = 32;
+
+class Broadcaster::BroadcasterImpl {
+   private:
+    // a published message, shared by every queue it was placed in. The frame
+    // header is encoded once for all subscribers.
+    struct Message {
+        std::string topic;
+        std::shared_ptr<const MessageBuffer> payload;
+        TCPConnection::FrameHeader header;
+
+        [[nodiscard]] size_t length() const {
+            return header.size() + payload->length();
+        }
+    };
+
+    struct Shard;
+
+    struct Subscriber {
+        SubscriberId id;
+        Shard& shard;
+        // only touched by the shard's thread once added
+        TCPConnection connection;
+        bool waiting;
+
+        std::mutex mutex;
+        std::deque<std::shared_ptr<const Message>> queue;
+        // bytes of the front message that were already sent
+        size_t offset;
+        // queued with the shard, or waiting for the socket to drain
+        bool scheduled;
+        bool closed;
+
+        // guarded by the broadcaster's topic mutex
+        std::unordered_set<std::string> topics;
+
+        Subscriber(SubscriberId id, Shard& shard, TCPConnection connection)
+            : id{id},
+              shard{shard},
+              connection{std::move(connection)},
+              waiting{false},
+              offset{0},
+              scheduled{false},
+              closed{false} {}
+    };
+
+    // a sender thread and the subscribers it serves
+    struct Shard {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Subscriber>> ready;
+        std::array<int, 2> wake_pipe{-1, -1};
+        std::atomic<bool> woken{false};
+        std::thread thread;
+    };
+
+    enum class Outcome { drained, blocked, closed };
+
+    BroadcastConfig _config;
+    std::vector<std::unique_ptr<Shard>> _shards;
+    std::atomic<bool> _stopping;
+
+    mutable std::shared_mutex _topic_mutex;
+    std::unordered_map<std::string, std::vector<std::shared_ptr<Subscriber>>>
+        _topics;
+    std::unordered_map<SubscriberId, std::shared_ptr<Subscriber>>
+        _subscribers;
+    SubscriberId _next_id;
+
+    std::atomic<uint64_t> _published;
+    std::atomic<uint64_t> _delivered;
+    std::atomic<uint64_t> _dropped;
+    std::atomic<uint64_t> _conflated;
+    std::atomic<uint64_t> _disconnected;
+
+    void _schedule(const std::shared_ptr<Subscriber>& subscriber) {
+        Shard& shard = subscriber->shard;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.ready.push_back(subscriber);
+        }
+        if (!shard.woken.exchange(true)) {
+            char signal = 1;
+            // if the pipe is full the shard is already due to wake up
+            [[maybe_unused]] auto status =
+                write(shard.wake_pipe[1], &signal, 1);
+        }
+    }
+
+    // Places a message in a subscriber's queue, applying the slow consumer
+    // policy if it is full. Returns whether the message was queued.
+    bool _enqueue(const std::shared_ptr<Subscriber>& subscriber,
+                  const std::shared_ptr<const Message>& message) {
+        std::unique_lock<std::mutex> lock(subscriber->mutex);
+        if (subscriber->closed) return false;
+
+        auto& queue = subscriber->queue;
+        if (queue.size() >= _config.queue_capacity) {
+            // a partially sent message has to be finished as it is
+            auto first = queue.begin() + (subscriber->offset > 0 ? 1 : 0);
+            switch (_config.policy) {
+                case SlowConsumerPolicy::drop:
+                    ++_dropped;
+                    return false;
+                case SlowConsumerPolicy::disconnect:
+                    subscriber->closed = true;
+                    ++_disconnected;
+                    lock.unlock();
+                    _schedule(subscriber);
+                    return false;
+                case SlowConsumerPolicy::conflate: {
+                    auto stale = std::find_if(
+                        first, queue.end(), [&message](const auto& queued) {
+                            return queued->topic == message->topic;
+                        });
+                    if (stale != queue.end()) {
+                        *stale = message;
+                        ++_conflated;
+                        return true;
+                    }
+                    if (first == queue.end()) {
+                        ++_dropped;
+                        return false;
+                    }
+                    queue.erase(first);
+                    ++_dropped;
+                    break;
+                }
+            }
+        }
+
+        queue.push_back(message);
+        if (!subscriber->scheduled) {
+            subscriber->scheduled = true;
+            lock.unlock();
+            _schedule(subscriber);
+        }
+        return true;
+    }
+
+    // Writes as much of a subscriber's queue as its socket accepts.
+    Outcome _flush(Subscriber& subscriber) {
+        std::lock_guard<std::mutex> lock(subscriber.mutex);
+        if (subscriber.closed) return Outcome::closed;
+
+        auto& queue = subscriber.queue;
+        std::array<iovec, 2 * MAX_BATCH> vectors;
+        while (!queue.empty()) {
+            size_t count = 0;
+            size_t skip = subscriber.offset;
+            for (size_t index = 0; index < queue.size() && index < MAX_BATCH;
+                 ++index) {
+                const Message& message = *queue[index];
+                std::array<iovec, 2> parts = {
+                    iovec{const_cast<std::byte*>(message.header.data()),
+                          message.header.size()},
+                    iovec{const_cast<std::byte*>(message.payload->raw()),
+                          message.payload->length()}};
+                for (iovec part : parts) {
+                    if (skip >= part.iov_len) {
+                        skip -= part.iov_len;
+                        continue;
+                    }
+                    part.iov_base =
+                        static_cast<std::byte*>(part.iov_base) + skip;
+                    part.iov_len -= skip;
+                    skip = 0;
+                    vectors[count++] = part;
+                }
+            }
+
+            size_t sent;
+            try {
+                sent = subscriber.connection._send_available(vectors.data(),
+                                                             count);
+            } catch (const std::exception&) {
+                subscriber.closed = true;
+                ++_disconnected;
+                return Outcome::closed;
+            }
+            if (sent == 0) return Outcome::blocked;
+
+            // retire every message that is now complete
+            sent += subscriber.offset;
+            uint64_t completed = 0;
+            while (!queue.empty() && sent >= queue.front()->length()) {
+                sent -= queue.front()->length();
+                queue.pop_front();
+                ++completed;
+            }
+            subscriber.offset = sent;
+            subscriber.connection._count_sent(completed);
+            _delivered += completed;
+        }
+
+        subscriber.scheduled = false;
+        return Outcome::drained;
+    }
+
+    // Removes a subscriber from the topics and the subscriber list.
+    void _forget(Subscriber& subscriber) {
+        std::unique_lock<std::shared_mutex> lock(_topic_mutex);
+        for (const auto& topic : subscriber.topics) {
+            auto entry = _topics.find(topic);
+            if (entry == _topics.end()) continue;
+            std::erase_if(entry->second, [&subscriber](const auto& member) {
+                return member.get() == &subscriber;
+            });
+            if (entry->second.empty()) _topics.erase(entry);
+        }
+        subscriber.topics.clear();
+        _subscribers.erase(subscriber.id);
+    }
+
+    void _serve(Shard& shard) {
+        std::vector<std::shared_ptr<Subscriber>> pending;
+        std::vector<std::shared_ptr<Subscriber>> waiting;
+        std::vector<pollfd> poll_fds;
+
+        while (!_stopping) {
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                pending.insert(pending.end(), shard.ready.begin(),
+                               shard.ready.end());
+                shard.ready.clear();
+                shard.woken = false;
+            }
+
+            for (auto& subscriber : pending) {
+                switch (_flush(*subscriber)) {
+                    case Outcome::drained:
+                        break;
+                    case Outcome::blocked:
+                        if (!subscriber->waiting) {
+                            subscriber->waiting = true;
+                            waiting.push_back(subscriber);
+                        }
+                        break;
+                    case Outcome::closed:
+                        if (subscriber->connection.active()) {
+                            _forget(*subscriber);
+                            subscriber->connection.abort();
+                        }
+                        break;
+                }
+            }
+            pending.clear();
+            std::erase_if(waiting, [](const auto& subscriber) {
+                return !subscriber->connection.active();
+            });
+
+            poll_fds.assign(1, {shard.wake_pipe[0], POLLIN, 0});
+            for (const auto& subscriber : waiting) {
+                poll_fds.push_back(
+                    {*subscriber->connection._socket, POLLOUT, 0});
+            }
+            if (poll(poll_fds.data(), poll_fds.size(), -1) <= 0) continue;
+
+            if ((poll_fds[0].revents & POLLIN) != 0) {
+                std::array<char, 64> signals;
+                while (read(shard.wake_pipe[0], signals.data(),
+                            signals.size()) > 0) {
+                }
+            }
+
+            // writable subscribers are flushed again, including ones whose
+            // connection failed, which then find out why
+            size_t kept = 0;
+            for (size_t index = 0; index < waiting.size(); ++index) {
+                if (poll_fds[index + 1].revents != 0) {
+                    waiting[index]->waiting = false;
+                    pending.push_back(std::move(waiting[index]));
+                } else {
+                    waiting[kept++] = std::move(waiting[index]);
+                }
+            }
+            waiting.resize(kept);
+        }
+    }
+
+   public:
+    explicit BroadcasterImpl(BroadcastConfig config)
+        : _config{config},
+          _stopping{false},
+          _next_id{0},
+          _published{0},
+          _delivered{0},
+          _dropped{0},
+          _conflated{0},
+          _disconnected{0} {
+        if (config.queue_capacity == 0) {
+            throw std::invalid_argument("Queue capacity must be positive");
+        }
+        if (config.threads == 0) {
+            throw std::invalid_argument(
+                "Broadcaster needs at least one thread");
+        }
+        concurrency::validate_placement(config.placement);
+
+        for (size_t index = 0; index < config.threads; ++index) {
+            auto shard = std::make_unique<Shard>();
+            if (pipe(shard->wake_pipe.data()) == -1) {
+                stop();
+                throw std::system_error(errno, std::system_category(),
+                                        "Unable to allocate wake pipe");
+            }
+            for (int fd : shard->wake_pipe) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+            }
+            _shards.push_back(std::move(shard));
+        }
+        for (size_t index = 0; index < _shards.size(); ++index) {
+            _shards[index]->thread = std::thread(
+                [this, index, &shard = *_shards[index]]() {
+                    concurrency::apply_placement(_config.placement, index);
+                    _serve(shard);
+                });
+        }
+    }
+
+    void stop() {
+        _stopping = true;
+        for (auto& shard : _shards) {
+            if (shard->thread.joinable()) {
+                char signal = 1;
+                [[maybe_unused]] auto status =
+                    write(shard->wake_pipe[1], &signal, 1);
+                shard->thread.join();
+            }
+            for (int fd : shard->wake_pipe) {
+                if (fd != -1) close(fd);
+            }
+        }
+        _shards.clear();
+    }
+
+    ~BroadcasterImpl() { stop(); }
+
+    SubscriberId add_subscriber(TCPConnection connection) {
+        if (!connection.active()) {
+            throw InactiveConnectionError("Unable to add subscriber");
+        }
+        std::unique_lock<std::shared_mutex> lock(_topic_mutex);
+        SubscriberId id = _next_id++;
+        Shard& shard = *_shards[id % _shards.size()];
+        _subscribers.emplace(id, std::make_shared<Subscriber>(
+                                     id, shard, std::move(connection)));
+        return id;
+    }
+
+    void remove_subscriber(SubscriberId id) {
+        std::shared_ptr<Subscriber> subscriber;
+        {
+            std::shared_lock<std::shared_mutex> lock(_topic_mutex);
+            auto entry = _subscribers.find(id);
+            if (entry == _subscribers.end()) return;
+            subscriber = entry->second;
+        }
+        _forget(*subscriber);
+        {
+            std::lock_guard<std::mutex> lock(subscriber->mutex);
+            subscriber->closed = true;
+        }
+        // the connection belongs to the shard's thread, which closes it
+        _schedule(subscriber);
+    }
+
+    bool subscribe(SubscriberId id, const std::string& topic) {
+        std::unique_lock<std::shared_mutex> lock(_topic_mutex);
+        auto entry = _subscribers.find(id);
+        if (entry == _subscribers.end()) return false;
+        if (entry->second->topics.insert(topic).second) {
+            _topics[topic].push_back(entry->second);
+        }
+        return true;
+    }
+
+    void unsubscribe(SubscriberId id, const std::string& topic) {
+        std::unique_lock<std::shared_mutex> lock(_topic_mutex);
+        auto entry = _subscribers.find(id);
+        if (entry == _subscribers.end() ||
+            entry->second->topics.erase(topic) == 0) {
+            return;
+        }
+        auto& members = _topics[topic];
+        std::erase(members, entry->second);
+        if (members.empty()) _topics.erase(topic);
+    }
+
+    size_t publish(const std::string& topic,
+                   std::shared_ptr<const MessageBuffer> payload) {
+        if (payload->length() > UINT32_MAX) {
+            throw std::invalid_argument("Frames are limited to 4 GiB");
+        }
+        auto message = std::make_shared<Message>();
+        message->topic = topic;
+        message->header = TCPConnection::_frame_header(
+            payload->length(), payload->length(), 0);
+        message->payload = std::move(payload);
+        ++_published;
+
+        size_t queued = 0;
+        std::shared_lock<std::shared_mutex> lock(_topic_mutex);
+        auto entry = _topics.find(topic);
+        if (entry == _topics.end()) return 0;
+        for (const auto& subscriber : entry->second) {
+            if (_enqueue(subscriber, message)) ++queued;
+        }
+        return queued;
+    }
+
+    size_t subscribers() const {
+        std::shared_lock<std::shared_mutex> lock(_topic_mutex);
+        return _subscribers.size();
+    }
+
+    BroadcastStats stats() const {
+        BroadcastStats stats;
+        stats.published = _published;
+        stats.delivered = _delivered;
+        stats.dropped = _dropped;
+        stats.conflated = _conflated;
+        stats.disconnected = _disconnected;
+        return stats;
+    }
+};
+
+Broadcaster::Broadcaster(BroadcastConfig config) {
+    impl = std::make_unique<BroadcasterImpl>(config);
+}
+
+Broadcaster::~Broadcaster() = default;
+
+Broadcaster::SubscriberId Broadcaster::add_subscriber(
+    TCPConnection connection) {
+    return impl->add_subscriber(std::move(connection));
+}
+
+void Broadcaster::remove_subscriber(SubscriberId subscriber) {
+    impl->remove_subscriber(subscriber);
+}
+
+bool Broadcaster::subscribe(SubscriberId subscriber, const std::string& topic) {
+    return impl->subscribe(subscriber, topic);
+}
+
+void Broadcaster::unsubscribe(SubscriberId subscriber,
+                              const std::string& topic) {
+    impl->unsubscribe(subscriber, topic);
+}
+
+size_t Broadcaster::publish(const std::string& topic,
+                            std::shared_ptr<const MessageBuffer> message) {
+    return impl->publish(topic, std::move(message));
+}
+
+size_t Broadcaster::subscribers() const { return impl->subscribers(); }
+
+BroadcastStats Broadcaster::stats() const { return impl->stats(); }
@@ -0,0 +1,224 @@
+#include "checksum.hpp"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SINGULARITY_CRC32C_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+// CRC32C polynomial, bit reflected
+constexpr uint32_t POLY = 0x82F63B78;
+
+namespace singularity::checksum {
+
+using SliceTable = std::array<std::array<uint32_t, 256>, 8>;
+
+constexpr SliceTable make_slice_table() {
+    SliceTable table{};
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) != 0 ? (crc >> 1) ^ POLY : crc >> 1;
+        }
+        table[0][byte] = crc;
+    }
+    // table[k][n] is the CRC of byte n followed by k zero bytes
+    for (size_t slice = 1; slice < 8; ++slice) {
+        for (size_t byte = 0; byte < 256; ++byte) {
+            uint32_t previous = table[slice - 1][byte];
+            table[slice][byte] = (previous >> 8) ^ table[0][previous & 0xFF];
+        }
+    }
+    return table;
+}
+
+constexpr SliceTable SLICE_TABLE = make_slice_table();
+
+uint32_t crc32c_portable(const void* data, size_t length, uint32_t crc) {
+    const auto* next = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+
+    while (length >= 8) {
+        uint32_t low;
+        uint32_t high;
+        memcpy(&low, next, sizeof(low));
+        memcpy(&high, next + 4, sizeof(high));
+        if constexpr (std::endian::native == std::endian::big) {
+            low = __builtin_bswap32(low);
+            high = __builtin_bswap32(high);
+        }
+        low ^= crc;
+
+        crc = SLICE_TABLE[7][low & 0xFF] ^ SLICE_TABLE[6][(low >> 8) & 0xFF] ^
+              SLICE_TABLE[5][(low >> 16) & 0xFF] ^ SLICE_TABLE[4][low >> 24] ^
+              SLICE_TABLE[3][high & 0xFF] ^
+              SLICE_TABLE[2][(high >> 8) & 0xFF] ^
+              SLICE_TABLE[1][(high >> 16) & 0xFF] ^ SLICE_TABLE[0][high >> 24];
+        next += 8;
+        length -= 8;
+    }
+
+    while (length-- > 0) {
+        crc = (crc >> 8) ^ SLICE_TABLE[0][(crc ^ *next++) & 0xFF];
+    }
+    return ~crc;
+}
+
+#ifdef SINGULARITY_CRC32C_SSE42
+
+// block sizes of the three-way interleaved kernel
+constexpr size_t LONG_BLOCK = 8192;
+constexpr size_t SHORT_BLOCK = 256;
+static_assert(std::has_single_bit(LONG_BLOCK) &&
+                  std::has_single_bit(SHORT_BLOCK),
+              "Shift tables can only be built for powers of two");
+
+using ShiftTable = std::array<std::array<uint32_t, 256>, 4>;
+
+uint32_t gf2_matrix_times(const uint32_t* matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    while (vector != 0) {
+        if ((vector & 1) != 0) sum ^= *matrix;
+        vector >>= 1;
+        ++matrix;
+    }
+    return sum;
+}
+
+void gf2_matrix_square(uint32_t* square, const uint32_t* matrix) {
+    for (size_t row = 0; row < 32; ++row) {
+        square[row] = gf2_matrix_times(matrix, matrix[row]);
+    }
+}
+
+// Builds the table that advances a CRC over `length` zero bytes, so that the
+// CRCs of adjacent blocks computed in parallel can be merged. The operator is
+// only squared, so `length` must be a power of two.
+ShiftTable make_shift_table(size_t length) {
+    std::array<uint32_t, 32> even;
+    std::array<uint32_t, 32> odd;
+
+    // operator for a single zero bit
+    odd[0] = POLY;
+    uint32_t row = 1;
+    for (size_t index = 1; index < 32; ++index) {
+        odd[index] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even.data(), odd.data());  // two zero bits
+    gf2_matrix_square(odd.data(), even.data());  // four zero bits
+
+    // square up to eight zero bits, then keep squaring once per length bit
+    std::array<uint32_t, 32>* result = &even;
+    do {
+        gf2_matrix_square(even.data(), odd.data());
+        length >>= 1;
+        result = &even;
+        if (length == 0) break;
+        gf2_matrix_square(odd.data(), even.data());
+        length >>= 1;
+        result = &odd;
+    } while (length != 0);
+
+    ShiftTable table;
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+        table[0][byte] = gf2_matrix_times(result->data(), byte);
+        table[1][byte] = gf2_matrix_times(result->data(), byte << 8);
+        table[2][byte] = gf2_matrix_times(result->data(), byte << 16);
+        table[3][byte] = gf2_matrix_times(result->data(), byte << 24);
+    }
+    return table;
+}
+
+uint32_t shift(const ShiftTable& table, uint32_t crc) {
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^
+           table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+uint64_t load64(const uint8_t* data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// Runs three interleaved CRC streams over consecutive blocks of
+// `block_size` bytes each, merging them into `crc`.
+__attribute__((target("sse4.2"))) void crc32c_interleaved(
+    uint64_t& crc, const uint8_t*& next, size_t& length, size_t block_size,
+    const ShiftTable& table) {
+    while (length >= block_size * 3) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const uint8_t* end = next + block_size;
+        do {
+            crc = _mm_crc32_u64(crc, load64(next));
+            crc1 = _mm_crc32_u64(crc1, load64(next + block_size));
+            crc2 = _mm_crc32_u64(crc2, load64(next + 2 * block_size));
+            next += 8;
+        } while (next < end);
+
+        crc = shift(table, static_cast<uint32_t>(crc)) ^ crc1;
+        crc = shift(table, static_cast<uint32_t>(crc)) ^ crc2;
+        next += 2 * block_size;
+        length -= 3 * block_size;
+    }
+}
+
+__attribute__((target("sse4.2"))) uint32_t crc32c_sse42(const void* data,
+                                                        size_t length,
+                                                        uint32_t crc) {
+    static const ShiftTable long_shift = make_shift_table(LONG_BLOCK);
+    static const ShiftTable short_shift = make_shift_table(SHORT_BLOCK);
+
+    const auto* next = static_cast<const uint8_t*>(data);
+    uint64_t crc0 = ~crc;
+
+    // align to a word so the main loops never split loads across lines
+    while (length > 0 && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *next++);
+        --length;
+    }
+
+    crc32c_interleaved(crc0, next, length, LONG_BLOCK, long_shift);
+    crc32c_interleaved(crc0, next, length, SHORT_BLOCK, short_shift);
+
+    while (length >= 8) {
+        crc0 = _mm_crc32_u64(crc0, load64(next));
+        next += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *next++);
+        --length;
+    }
+    return ~static_cast<uint32_t>(crc0);
+}
+
+#endif
+
+using Implementation = uint32_t (*)(const void*, size_t, uint32_t);
+
+Implementation select_implementation() {
+#ifdef SINGULARITY_CRC32C_SSE42
+    // may run before the runtime has probed the processor
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) return crc32c_sse42;
+#endif
+    return crc32c_portable;
+}
+
+Implementation implementation() {
+    static const Implementation selected = select_implementation();
+    return selected;
+}
+
+uint32_t crc32c(const void* data, size_t length, uint32_t crc) {
+    return implementation()(data, length, crc);
+}
+
+bool crc32c_accelerated() { return implementation() != crc32c_portable; }
+
+}  // namespace singularity::checksum
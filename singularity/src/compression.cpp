@@ -0,0 +1,303 @@
+#include "compression.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+// shortest match worth encoding
+constexpr size_t MIN_MATCH = 4;
+// the last bytes of a block are always literals
+constexpr size_t LAST_LITERALS = 5;
+// matches may not start within this many bytes of the end of a block
+constexpr size_t MATCH_FIND_LIMIT = 12;
+constexpr size_t MAX_DISTANCE = 65535;
+
+constexpr unsigned MIN_HASH_BITS = 8;
+constexpr unsigned MAX_HASH_BITS = 12;
+// after 2^SKIP_TRIGGER failed probes, the search step grows by one
+constexpr unsigned SKIP_TRIGGER = 6;
+
+constexpr uint8_t RUN_MASK = 15;
+
+namespace singularity::compression {
+
+uint32_t read32(const std::byte* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint64_t read64(const std::byte* data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint32_t hash(uint32_t sequence, unsigned bits) {
+    return (sequence * 2654435761U) >> (32 - bits);
+}
+
+unsigned hash_bits(size_t length) {
+    auto bits = static_cast<unsigned>(std::bit_width(length));
+    return std::clamp(bits, MIN_HASH_BITS, MAX_HASH_BITS);
+}
+
+// Counts the bytes `current` and `match` have in common, comparing a machine
+// word at a time. Only `current` is checked against `limit`, `match` always
+// trails it.
+size_t count_common(const std::byte* current, const std::byte* match,
+                    const std::byte* limit) {
+    const std::byte* start = current;
+    while (current + sizeof(uint64_t) <= limit) {
+        uint64_t difference = read64(current) ^ read64(match);
+        if (difference != 0) {
+            // the first differing byte is the lowest one in memory order
+            int bits = std::endian::native == std::endian::little
+                           ? std::countr_zero(difference)
+                           : std::countl_zero(difference);
+            return static_cast<size_t>(current - start) +
+                   static_cast<size_t>(bits / 8);
+        }
+        current += sizeof(uint64_t);
+        match += sizeof(uint64_t);
+    }
+    while (current < limit && *current == *match) {
+        ++current;
+        ++match;
+    }
+    return static_cast<size_t>(current - start);
+}
+
+void write_length(std::byte*& output, size_t length) {
+    while (length >= 255) {
+        *output++ = std::byte{255};
+        length -= 255;
+    }
+    *output++ = static_cast<std::byte>(length);
+}
+
+// Writes a literal run followed by a match, or only the literal run when
+// `offset` is 0. Returns false if the sequence does not fit.
+bool write_sequence(std::byte*& output, const std::byte* output_end,
+                    const std::byte* literals, size_t literal_length,
+                    size_t offset, size_t match_length) {
+    size_t needed = 1 + literal_length + literal_length / 255 + 1;
+    if (offset != 0) needed += 2 + (match_length - MIN_MATCH) / 255 + 1;
+    if (static_cast<size_t>(output_end - output) < needed) return false;
+
+    size_t literal_run = std::min<size_t>(literal_length, RUN_MASK);
+    size_t match_run =
+        offset == 0 ? 0 : std::min<size_t>(match_length - MIN_MATCH, RUN_MASK);
+    *output++ = static_cast<std::byte>((literal_run << 4) | match_run);
+
+    if (literal_run == RUN_MASK) {
+        write_length(output, literal_length - RUN_MASK);
+    }
+    memcpy(output, literals, literal_length);
+    output += literal_length;
+
+    if (offset != 0) {
+        *output++ = static_cast<std::byte>(offset & 0xFF);
+        *output++ = static_cast<std::byte>(offset >> 8);
+        if (match_run == RUN_MASK) {
+            write_length(output, match_length - MIN_MATCH - RUN_MASK);
+        }
+    }
+    return true;
+}
+
+// Compresses a block using a caller provided hash table of 2^bits entries.
+size_t compress_block(uint32_t* table, unsigned bits, const std::byte* input,
+                      size_t length, std::byte* output, size_t capacity) {
+    std::fill_n(table, size_t{1} << bits, 0);
+
+    const std::byte* const end = input + length;
+    const std::byte* current = input;
+    const std::byte* anchor = input;
+    std::byte* next_output = output;
+    const std::byte* const output_end = output + capacity;
+
+    if (length > MATCH_FIND_LIMIT) {
+        const std::byte* const search_limit = end - MATCH_FIND_LIMIT;
+        const std::byte* const match_limit = end - LAST_LITERALS;
+
+        ++current;
+        while (current < search_limit) {
+            // probe the hash table, stepping further the longer we go
+            // without finding anything
+            const std::byte* match;
+            size_t probes = size_t{1} << SKIP_TRIGGER;
+            while (true) {
+                uint32_t sequence = read32(current);
+                uint32_t& slot = table[hash(sequence, bits)];
+                match = input + slot;
+                slot = static_cast<uint32_t>(current - input);
+
+                if (static_cast<size_t>(current - match) <= MAX_DISTANCE &&
+                    read32(match) == sequence) {
+                    break;
+                }
+                current += probes++ >> SKIP_TRIGGER;
+                if (current >= search_limit) goto last_literals;
+            }
+
+            // extend the match backwards into the pending literals
+            while (current > anchor && match > input &&
+                   current[-1] == match[-1]) {
+                --current;
+                --match;
+            }
+
+            size_t match_length =
+                MIN_MATCH + count_common(current + MIN_MATCH,
+                                         match + MIN_MATCH, match_limit);
+            if (!write_sequence(next_output, output_end, anchor,
+                                static_cast<size_t>(current - anchor),
+                                static_cast<size_t>(current - match),
+                                match_length)) {
+                return 0;
+            }
+
+            current += match_length;
+            anchor = current;
+            if (current < search_limit) {
+                // remember a position inside the match for the next search
+                table[hash(read32(current - 2), bits)] =
+                    static_cast<uint32_t>(current - 2 - input);
+            }
+        }
+    }
+
+last_literals:
+    if (!write_sequence(next_output, output_end, anchor,
+                        static_cast<size_t>(end - anchor), 0, 0)) {
+        return 0;
+    }
+    return static_cast<size_t>(next_output - output);
+}
+
+size_t compress(const std::byte* input, size_t length, std::byte* output,
+                size_t capacity) {
+    unsigned bits = hash_bits(length);
+    std::vector<uint32_t> table(size_t{1} << bits);
+    return compress_block(table.data(), bits, input, length, output,
+                          capacity);
+}
+
+size_t read_length(const std::byte*& input, const std::byte* end) {
+    size_t length = 0;
+    uint8_t value;
+    do {
+        if (input >= end) {
+            throw DecompressionError("Truncated length in compressed block");
+        }
+        value = static_cast<uint8_t>(*input++);
+        length += value;
+    } while (value == 255);
+    return length;
+}
+
+size_t decompress(const std::byte* input, size_t length, std::byte* output,
+                  size_t capacity) {
+    const std::byte* const end = input + length;
+    std::byte* next_output = output;
+    const std::byte* const output_end = output + capacity;
+
+    while (true) {
+        if (input >= end) {
+            throw DecompressionError("Truncated compressed block");
+        }
+        auto token = static_cast<uint8_t>(*input++);
+
+        size_t literal_length = token >> 4;
+        if (literal_length == RUN_MASK) {
+            literal_length += read_length(input, end);
+        }
+        if (literal_length > static_cast<size_t>(end - input) ||
+            literal_length > static_cast<size_t>(output_end - next_output)) {
+            throw DecompressionError("Literal run out of bounds");
+        }
+        memcpy(next_output, input, literal_length);
+        input += literal_length;
+        next_output += literal_length;
+
+        // the last sequence has no match
+        if (input == end) break;
+
+        if (end - input < 2) {
+            throw DecompressionError("Truncated match offset");
+        }
+        size_t offset = static_cast<size_t>(input[0]) |
+                        (static_cast<size_t>(input[1]) << 8);
+        input += 2;
+        if (offset == 0 || offset > static_cast<size_t>(next_output - output)) {
+            throw DecompressionError("Match offset out of bounds");
+        }
+
+        size_t match_length = (token & RUN_MASK) + MIN_MATCH;
+        if ((token & RUN_MASK) == RUN_MASK) {
+            match_length += read_length(input, end);
+        }
+        if (match_length > static_cast<size_t>(output_end - next_output)) {
+            throw DecompressionError("Match out of bounds");
+        }
+
+        // overlapping matches repeat the last `offset` bytes, so the
+        // pattern can be copied in steps that double every time
+        const std::byte* match = next_output - offset;
+        while (match_length > 0) {
+            size_t step = std::min(
+                static_cast<size_t>(next_output - match), match_length);
+            memcpy(next_output, match, step);
+            next_output += step;
+            match_length -= step;
+        }
+    }
+
+    return static_cast<size_t>(next_output - output);
+}
+
+Compressor::Compressor(size_t min_size)
+    : _table(size_t{1} << MAX_HASH_BITS),
+      _min_size{min_size},
+      _skip{0},
+      _backoff{0} {}
+
+std::optional<size_t> Compressor::compress(const std::byte* input,
+                                           size_t length) {
+    if (length < _min_size) return std::nullopt;
+    if (_skip > 0) {
+        --_skip;
+        return std::nullopt;
+    }
+
+    // anything that does not save an eighth is not worth decompressing, so
+    // don't even give the codec room to produce it
+    size_t limit = length - length / 8;
+    if (_output.size() < limit) _output.resize(limit);
+
+    size_t size = compress_block(_table.data(), hash_bits(length), input,
+                                 length, _output.data(), limit);
+    if (size == 0) {
+        _backoff = std::min(std::max<size_t>(1, _backoff * 2), MAX_BACKOFF);
+        _skip = _backoff;
+        return std::nullopt;
+    }
+
+    _backoff = 0;
+    return size;
+}
+
+const std::byte* Compressor::data() const { return _output.data(); }
+
+DecompressionError::DecompressionError(const std::string& message)
+    : _message{message} {}
+
+DecompressionError::DecompressionError(const char* message)
+    : _message{message} {}
+
+const char* DecompressionError::what() const noexcept {
+    return _message.data();
+}
+
+}  // namespace singularity::compression
@@ -0,0 +1,398 @@
+#include "compute.hpp"
+
+#include <cblas.h>
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "tracing.hpp"
+#include "utils.hpp"
+
+using namespace singularity::compute;
+using singularity::network::ProtocolError;
+
+// elements travel in the host's byte order, so both ends must agree on it
+static_assert(std::endian::native == std::endian::little,
+              "Matrices are exchanged as little endian values");
+
+// operation or status, reserved bytes, then the matrix headers, padded so
+// that the elements that follow start aligned
+constexpr size_t FRAME_HEADER_SIZE = AlignedBuffer::ALIGNMENT;
+constexpr size_t MATRIX_HEADERS_OFFSET = 8;
+// element type, rank, two reserved bytes, rows, columns and stride (32 bit,
+// network byte order)
+constexpr size_t MATRIX_HEADER_SIZE = 16;
+constexpr uint8_t MATRIX_RANK = 2;
+// error messages follow the operation or status and its reserved bytes
+constexpr size_t ERROR_OFFSET = 8;
+
+constexpr uint8_t OPERATION_MULTIPLY = 1;
+constexpr uint8_t STATUS_OK = 0;
+constexpr uint8_t STATUS_ERROR = 1;
+
+void check_header(const MatrixHeader& header) {
+    if (header.rows == 0 || header.cols == 0) {
+        throw std::invalid_argument(
+            "Matrices need at least one row and one column");
+    }
+    if (header.rows > INT_MAX || header.cols > INT_MAX ||
+        header.stride > INT_MAX) {
+        throw std::invalid_argument(singularity::utils::build_string(
+            "Matrices are limited to ", INT_MAX, " rows and columns"));
+    }
+    if (header.stride < header.cols) {
+        throw std::invalid_argument(
+            "Matrix rows are closer than their number of columns");
+    }
+    if (header.rows * header.stride >
+        SIZE_MAX / element_size(header.dtype)) {
+        throw std::invalid_argument("Matrix is too large to address");
+    }
+}
+
+void check_operands(const Matrix& a, const Matrix& b) {
+    if (a.dtype() != b.dtype()) {
+        throw std::invalid_argument("Matrices hold different element types");
+    }
+    if (a.cols() != b.rows()) {
+        throw std::invalid_argument(singularity::utils::build_string(
+            "Cannot multiply a ", a.rows(), "x", a.cols(), " matrix by a ",
+            b.rows(), "x", b.cols(), " matrix"));
+    }
+}
+
+void write_u32(std::byte* next, size_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        *next++ = static_cast<std::byte>((value >> shift) & 0xFF);
+    }
+}
+
+size_t read_u32(const std::byte* next) {
+    size_t value = 0;
+    for (size_t index = 0; index < 4; ++index) {
+        value = (value << 8) | static_cast<uint8_t>(next[index]);
+    }
+    return value;
+}
+
+// Writes the frame header for a frame carrying the given matrices.
+void write_frame_header(AlignedBuffer& frame, uint8_t kind,
+                        std::initializer_list<const MatrixHeader*> headers) {
+    std::byte* next = frame.data();
+    memset(next, 0, FRAME_HEADER_SIZE);
+    next[0] = static_cast<std::byte>(kind);
+    next += MATRIX_HEADERS_OFFSET;
+    for (const MatrixHeader* header : headers) {
+        next[0] = static_cast<std::byte>(header->dtype);
+        next[1] = static_cast<std::byte>(MATRIX_RANK);
+        write_u32(next + 4, header->rows);
+        write_u32(next + 8, header->cols);
+        write_u32(next + 12, header->stride);
+        next += MATRIX_HEADER_SIZE;
+    }
+}
+
+MatrixHeader read_matrix_header(const AlignedBuffer& frame, size_t index) {
+    const std::byte* next =
+        frame.data() + MATRIX_HEADERS_OFFSET + index * MATRIX_HEADER_SIZE;
+    auto dtype = static_cast<uint8_t>(next[0]);
+    if (dtype != static_cast<uint8_t>(DType::float32) &&
+        dtype != static_cast<uint8_t>(DType::float64)) {
+        throw ProtocolError("Matrix has an unknown element type");
+    }
+    if (static_cast<uint8_t>(next[1]) != MATRIX_RANK) {
+        throw ProtocolError("Only matrices of rank 2 are supported");
+    }
+    return {static_cast<DType>(dtype), read_u32(next + 4), read_u32(next + 8),
+            read_u32(next + 12)};
+}
+
+// Views the matrices a frame carries, checking that they fill it exactly.
+std::vector<Matrix> read_matrices(const std::shared_ptr<AlignedBuffer>& frame,
+                                  size_t count) {
+    if (frame->size() < FRAME_HEADER_SIZE) {
+        throw ProtocolError("Frame is shorter than its header");
+    }
+    std::vector<Matrix> matrices;
+    size_t offset = FRAME_HEADER_SIZE;
+    for (size_t index = 0; index < count; ++index) {
+        MatrixHeader header = read_matrix_header(*frame, index);
+        check_header(header);
+        if (header.size_bytes() > frame->size() - offset) {
+            throw ProtocolError("Frame is shorter than its matrices");
+        }
+        matrices.emplace_back(header, frame, offset);
+        offset += AlignedBuffer::padded(header.size_bytes());
+    }
+    if (offset != frame->size()) {
+        throw ProtocolError("Frame length does not match its matrices");
+    }
+    return matrices;
+}
+
+// Receives a frame into a buffer of its own, or nothing at a clean end.
+std::shared_ptr<AlignedBuffer> receive_aligned(
+    singularity::network::TCPConnection& connection,
+    std::chrono::steady_clock::time_point deadline) {
+    std::shared_ptr<AlignedBuffer> frame;
+    auto length = connection.receive_frame_into(
+        [&frame](size_t length) {
+            frame = std::make_shared<AlignedBuffer>(length);
+            return frame->data();
+        },
+        deadline);
+    if (!length.has_value()) return nullptr;
+    return frame;
+}
+
+std::shared_ptr<AlignedBuffer> encode_error(std::string_view reason) {
+    auto frame = std::make_shared<AlignedBuffer>(ERROR_OFFSET + reason.size());
+    memset(frame->data(), 0, ERROR_OFFSET);
+    frame->data()[0] = static_cast<std::byte>(STATUS_ERROR);
+    memcpy(frame->data() + ERROR_OFFSET, reason.data(), reason.size());
+    return frame;
+}
+
+// Computes the response to a request, or the reason it has none. The
+// product is computed into the frame that carries it back.
+std::shared_ptr<AlignedBuffer> respond(
+    const std::shared_ptr<AlignedBuffer>& request, size_t max_response_size) {
+    try {
+        if (request->size() == 0 ||
+            static_cast<uint8_t>(request->data()[0]) != OPERATION_MULTIPLY) {
+            throw ProtocolError("Request has an unknown operation");
+        }
+        std::vector<Matrix> operands = read_matrices(request, 2);
+        const Matrix& a = operands[0];
+        const Matrix& b = operands[1];
+        check_operands(a, b);
+
+        MatrixHeader header{a.dtype(), a.rows(), b.cols(), b.cols()};
+        check_header(header);
+        // small operands can have a huge product, so it is bounded before
+        // anything is allocated for it
+        size_t limit = std::min<size_t>(max_response_size, UINT32_MAX);
+        if (header.size_bytes() > limit ||
+            FRAME_HEADER_SIZE + AlignedBuffer::padded(header.size_bytes()) >
+                limit) {
+            throw std::invalid_argument(singularity::utils::build_string(
+                "Product of a ", a.rows(), "x", a.cols(), " and a ", b.rows(),
+                "x", b.cols(), " matrix exceeds the response limit of ", limit,
+                " bytes"));
+        }
+        size_t length = AlignedBuffer::padded(header.size_bytes());
+        auto response =
+            std::make_shared<AlignedBuffer>(FRAME_HEADER_SIZE + length);
+        write_frame_header(*response, STATUS_OK, {&header});
+        memset(response->data() + FRAME_HEADER_SIZE + header.size_bytes(), 0,
+               length - header.size_bytes());
+        Matrix product(header, response, FRAME_HEADER_SIZE);
+        multiply(a, b, product);
+        return response;
+    } catch (const std::exception& error) {
+        return encode_error(error.what());
+    }
+}
+
+namespace singularity::compute {
+
+size_t element_size(DType dtype) {
+    return dtype == DType::float32 ? sizeof(float) : sizeof(double);
+}
+
+void AlignedBuffer::Free::operator()(std::byte* data) const {
+    ::operator delete[](data, std::align_val_t{ALIGNMENT});
+}
+
+AlignedBuffer::AlignedBuffer(size_t size)
+    : _size{size}, _capacity{padded(std::max<size_t>(size, 1))} {
+    _data.reset(static_cast<std::byte*>(
+        ::operator new[](_capacity, std::align_val_t{ALIGNMENT})));
+    memset(_data.get() + _size, 0, _capacity - _size);
+}
+
+Matrix::Matrix(DType dtype, size_t rows, size_t cols, size_t stride)
+    : _header{dtype, rows, cols, stride == 0 ? cols : stride} {
+    check_header(_header);
+    _storage = std::make_shared<AlignedBuffer>(_header.size_bytes());
+    _data = _storage->data();
+    memset(_data, 0, _header.size_bytes());
+}
+
+Matrix::Matrix(const MatrixHeader& header,
+               std::shared_ptr<AlignedBuffer> storage, size_t offset)
+    : _header{header}, _storage{std::move(storage)} {
+    check_header(_header);
+    if (offset % AlignedBuffer::ALIGNMENT != 0) {
+        throw std::invalid_argument("Matrix elements must start aligned");
+    }
+    if (offset > _storage->size() ||
+        _header.size_bytes() > _storage->size() - offset) {
+        throw std::invalid_argument("Matrix elements overrun their buffer");
+    }
+    _data = _storage->data() + offset;
+}
+
+Matrix multiply(const Matrix& a, const Matrix& b) {
+    check_operands(a, b);
+    Matrix product(a.dtype(), a.rows(), b.cols());
+    multiply(a, b, product);
+    return product;
+}
+
+void multiply(const Matrix& a, const Matrix& b, Matrix& product) {
+    check_operands(a, b);
+    if (product.dtype() != a.dtype() || product.rows() != a.rows() ||
+        product.cols() != b.cols()) {
+        throw std::invalid_argument(utils::build_string(
+            "Product of a ", a.rows(), "x", a.cols(), " and a ", b.rows(), "x",
+            b.cols(), " matrix does not fit a ", product.rows(), "x",
+            product.cols(), " matrix"));
+    }
+    tracing::Span span("multiply");
+
+    // dimensions and strides were checked to fit when the matrices were made
+    auto m = static_cast<blasint>(a.rows());
+    auto n = static_cast<blasint>(b.cols());
+    auto k = static_cast<blasint>(a.cols());
+    auto lda = static_cast<blasint>(a.stride());
+    auto ldb = static_cast<blasint>(b.stride());
+    auto ldc = static_cast<blasint>(product.stride());
+    if (a.dtype() == DType::float32) {
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, 1.0F,
+                    a.values<float>().data(), lda, b.values<float>().data(),
+                    ldb, 0.0F, product.values<float>().data(), ldc);
+    } else {
+        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, 1.0,
+                    a.values<double>().data(), lda, b.values<double>().data(),
+                    ldb, 0.0, product.values<double>().data(), ldc);
+    }
+}
+
+void set_blas_threads(size_t threads) {
+    if (threads == 0 || threads > INT_MAX) {
+        throw std::invalid_argument("BLAS needs at least one thread");
+    }
+    openblas_set_num_threads(static_cast<int>(threads));
+}
+
+size_t blas_threads() {
+    return static_cast<size_t>(openblas_get_num_threads());
+}
+
+ComputeServer::ComputeServer(uint32_t port, ComputeConfig config)
+    : _config{std::move(config)}, _server{port, _config.server} {
+    if (_config.blas_threads == 0) {
+        throw std::invalid_argument("BLAS needs at least one thread");
+    }
+}
+
+void ComputeServer::_serve(network::TCPConnection& connection) const {
+    connection.set_max_frame_size(_config.max_request_size);
+    auto never = std::chrono::steady_clock::time_point::max();
+    while (auto request = receive_aligned(connection, never)) {
+        std::shared_ptr<AlignedBuffer> response =
+            respond(request, _config.max_response_size);
+        connection.send_frame(response->data(), response->size());
+    }
+}
+
+void ComputeServer::start() {
+    set_blas_threads(_config.blas_threads);
+    _server.serve(
+        [this](network::TCPConnection& connection) { _serve(connection); },
+        _config.workers);
+}
+
+network::ShutdownReport ComputeServer::shutdown(
+    std::chrono::nanoseconds grace_period) {
+    return _server.shutdown(grace_period);
+}
+
+ComputeClient::ComputeClient(network::IPSocketAddress address,
+                             size_t max_response_size)
+    : _connection{address} {
+    _connection.open();
+    _connection.set_max_frame_size(max_response_size);
+}
+
+void ComputeClient::submit(const Matrix& a, const Matrix& b,
+                           std::chrono::steady_clock::time_point deadline) {
+    check_operands(a, b);
+    size_t a_length = AlignedBuffer::padded(a.size_bytes());
+    size_t b_length = AlignedBuffer::padded(b.size_bytes());
+    AlignedBuffer request(FRAME_HEADER_SIZE + a_length + b_length);
+    write_frame_header(request, OPERATION_MULTIPLY, {&a.header(), &b.header()});
+
+    // the padding after each operand goes out zeroed
+    std::byte* next = request.data() + FRAME_HEADER_SIZE;
+    memcpy(next, a.data(), a.size_bytes());
+    memset(next + a.size_bytes(), 0, a_length - a.size_bytes());
+    next += a_length;
+    memcpy(next, b.data(), b.size_bytes());
+    memset(next + b.size_bytes(), 0, b_length - b.size_bytes());
+    _connection.send_frame(request.data(), request.size(), deadline);
+}
+
+Matrix ComputeClient::receive(std::chrono::steady_clock::time_point deadline) {
+    std::shared_ptr<AlignedBuffer> response =
+        receive_aligned(_connection, deadline);
+    if (response == nullptr) {
+        throw ProtocolError("Connection closed before the result arrived");
+    }
+    if (response->size() == 0) {
+        throw ProtocolError("Response is missing its status");
+    }
+
+    auto status = static_cast<uint8_t>(response->data()[0]);
+    if (status == STATUS_ERROR) {
+        if (response->size() < ERROR_OFFSET) {
+            throw ProtocolError("Response is shorter than its header");
+        }
+        throw ComputeError(std::string(
+            reinterpret_cast<const char*>(response->data()) + ERROR_OFFSET,
+            response->size() - ERROR_OFFSET));
+    }
+    if (status != STATUS_OK) {
+        throw ProtocolError("Response has an unknown status");
+    }
+    std::vector<Matrix> matrices = read_matrices(response, 1);
+    return std::move(matrices.front());
+}
+
+Matrix ComputeClient::multiply(const Matrix& a, const Matrix& b,
+                               std::chrono::steady_clock::time_point deadline) {
+    submit(a, b, deadline);
+    return receive(deadline);
+}
+
+void ComputeClient::disable_receive() { _connection.disable_receive(); }
+
+void ComputeClient::close() {
+    // the server may already be gone, in which case there is nobody to tell
+    try {
+        _connection.disable_send();
+    } catch (const std::system_error&) {
+    }
+    try {
+        _connection.terminate();
+    } catch (const std::system_error&) {
+    }
+}
+
+ComputeError::ComputeError(const std::string& message) : _message{message} {}
+
+ComputeError::ComputeError(const char* message) : _message{message} {}
+
+const char* ComputeError::what() const noexcept { return _message.data(); }
+
+}  // namespace singularity::compute
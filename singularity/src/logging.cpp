@@ -0,0 +1,374 @@
+#include "logging.hpp"
+
+#include <bit>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// record header: format ID and payload size (both 32 bit) and the time the
+// record was logged (64 bit, nanoseconds since the epoch)
+constexpr size_t HEADER_SIZE = 16;
+// format ID marking the rest of the ring as unused, records never wrap
+constexpr uint32_t PADDING = 0;
+constexpr size_t MIN_RING_CAPACITY = 1024;
+
+constexpr const char* LEVEL_NAMES[] = {"TRACE", "DEBUG", "INFO", "WARN",
+                                       "ERROR"};
+
+constexpr size_t align_record(size_t size) { return (size + 7) & ~size_t{7}; }
+
+namespace singularity::logging {
+
+// A single producer, single consumer ring of variable sized records.
+class Ring {
+   public:
+    std::unique_ptr<std::byte[]> data;
+    size_t capacity;
+    uint32_t thread;
+
+    // written by the producer only
+    alignas(64) std::atomic<uint64_t> head;
+    // the last tail the producer saw, so it only reads the consumer's cache
+    // line when the ring looks full
+    uint64_t cached_tail;
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> orphaned;
+
+    // written by the consumer only
+    alignas(64) std::atomic<uint64_t> tail;
+
+    Ring(size_t ring_capacity, uint32_t thread_number)
+        : data{std::make_unique<std::byte[]>(ring_capacity)},
+          capacity{ring_capacity},
+          thread{thread_number},
+          head{0},
+          cached_tail{0},
+          dropped{0},
+          orphaned{false},
+          tail{0} {}
+};
+
+// Marks the calling thread's ring as orphaned when the thread exits, so the
+// logger can forget it once it is drained.
+struct ThreadRing {
+    std::shared_ptr<Ring> ring;
+
+    ~ThreadRing() {
+        if (ring != nullptr) {
+            ring->orphaned.store(true, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadRing thread_ring;
+
+struct FormatEntry {
+    Level level;
+    const char* text;
+    Formatter formatter;
+};
+
+class Logger {
+   private:
+    std::mutex _mutex;
+    LoggerConfig _config;
+    std::vector<std::shared_ptr<Ring>> _rings;
+    std::vector<FormatEntry> _formats;
+    uint32_t _next_thread;
+    // drops of the rings that were already forgotten
+    uint64_t _forgotten_drops;
+
+    std::condition_variable _wake;
+    std::condition_variable _flushed;
+    uint64_t _requested;
+    uint64_t _completed;
+    bool _stopping;
+    std::thread _thread;
+
+    // only used by the logger's thread
+    std::vector<FormatEntry> _known_formats;
+    uint64_t _reported_drops;
+
+    static void _write_stderr(std::string_view lines) {
+        fwrite(lines.data(), 1, lines.size(), stderr);
+        fflush(stderr);
+    }
+
+    static void _append_prefix(std::string& out, uint64_t time_ns,
+                               Level level, uint32_t thread) {
+        auto seconds = static_cast<time_t>(time_ns / 1000000000);
+        tm utc;
+        gmtime_r(&seconds, &utc);
+        char prefix[64];
+        int length = snprintf(
+            prefix, sizeof(prefix), "%04d-%02d-%02d %02d:%02d:%02d.%06u %-5s ",
+            utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour,
+            utc.tm_min, utc.tm_sec,
+            static_cast<unsigned>(time_ns % 1000000000 / 1000),
+            LEVEL_NAMES[static_cast<size_t>(level)]);
+        out.append(prefix, static_cast<size_t>(std::max(length, 0)));
+        out += '[';
+        _append_value(out, static_cast<uint64_t>(thread));
+        out += "] ";
+    }
+
+    const FormatEntry& _format_entry(uint32_t id) {
+        if (id > _known_formats.size()) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _known_formats = _formats;
+        }
+        return _known_formats[id - 1];
+    }
+
+    // Formats every record committed to the ring so far.
+    void _drain(Ring& ring, std::string& out) {
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        while (tail != head) {
+            const std::byte* record = ring.data.get() + tail % ring.capacity;
+            uint32_t id;
+            std::memcpy(&id, record, sizeof(id));
+            if (id == PADDING) {
+                tail += ring.capacity - tail % ring.capacity;
+                continue;
+            }
+
+            uint32_t payload_size;
+            uint64_t time_ns;
+            std::memcpy(&payload_size, record + 4, sizeof(payload_size));
+            std::memcpy(&time_ns, record + 8, sizeof(time_ns));
+
+            const FormatEntry& entry = _format_entry(id);
+            _append_prefix(out, time_ns, entry.level, ring.thread);
+            entry.formatter(out, entry.text, record + HEADER_SIZE);
+            out += '\n';
+            tail += align_record(HEADER_SIZE + payload_size);
+        }
+        ring.tail.store(tail, std::memory_order_release);
+    }
+
+    void _run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _wake.wait_for(lock, _config.flush_interval, [this]() {
+                return _stopping || _requested > _completed;
+            });
+            uint64_t generation = _requested;
+            bool stopping = _stopping;
+            auto rings = _rings;
+            auto sink = _config.sink;
+            lock.unlock();
+
+            std::string out;
+            uint64_t drops = 0;
+            for (const auto& ring : rings) {
+                _drain(*ring, out);
+                drops += ring->dropped.load(std::memory_order_relaxed);
+            }
+
+            lock.lock();
+            drops += _forgotten_drops;
+            lock.unlock();
+            if (drops > _reported_drops) {
+                _append_prefix(out,
+                               static_cast<uint64_t>(
+                                   std::chrono::duration_cast<
+                                       std::chrono::nanoseconds>(
+                                       std::chrono::system_clock::now()
+                                           .time_since_epoch())
+                                       .count()),
+                               Level::warn, 0);
+                out += "Log rings were full, dropped ";
+                _append_value(out, drops - _reported_drops);
+                out += " records\n";
+                _reported_drops = drops;
+            }
+            if (!out.empty()) {
+                if (sink) {
+                    sink(out);
+                } else {
+                    _write_stderr(out);
+                }
+            }
+
+            lock.lock();
+            // forget the rings of exited threads once they are drained
+            std::erase_if(_rings, [this](const std::shared_ptr<Ring>& ring) {
+                bool done =
+                    ring->orphaned.load(std::memory_order_acquire) &&
+                    ring->tail.load(std::memory_order_relaxed) ==
+                        ring->head.load(std::memory_order_acquire);
+                if (done) _forgotten_drops += ring->dropped;
+                return done;
+            });
+            _completed = generation;
+            _flushed.notify_all();
+            if (stopping) return;
+        }
+    }
+
+   public:
+    Logger()
+        : _next_thread{1},
+          _forgotten_drops{0},
+          _requested{0},
+          _completed{0},
+          _stopping{false},
+          _reported_drops{0} {
+        _thread = std::thread([this]() { _run(); });
+    }
+
+    ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_one();
+        _thread.join();
+    }
+
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    void configure(LoggerConfig config) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _config = std::move(config);
+        _threshold.store(_config.level, std::memory_order_relaxed);
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        uint64_t target = ++_requested;
+        _wake.notify_one();
+        _flushed.wait(lock, [this, target]() { return _completed >= target; });
+    }
+
+    uint64_t dropped() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint64_t total = _forgotten_drops;
+        for (const auto& ring : _rings) total += ring->dropped;
+        return total;
+    }
+
+    uint32_t register_format(Level level, const char* text,
+                             Formatter formatter) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _formats.push_back({level, text, formatter});
+        return static_cast<uint32_t>(_formats.size());
+    }
+
+    Ring* attach(ThreadRing& holder) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t capacity =
+            std::bit_ceil(std::max(_config.ring_capacity, MIN_RING_CAPACITY));
+        holder.ring = std::make_shared<Ring>(capacity, _next_thread++);
+        _rings.push_back(holder.ring);
+        return holder.ring.get();
+    }
+};
+
+void configure(LoggerConfig config) {
+    Logger::instance().configure(std::move(config));
+}
+
+void flush() { Logger::instance().flush(); }
+
+uint64_t dropped() { return Logger::instance().dropped(); }
+
+uint32_t _register_format(Level level, const char* format,
+                          Formatter formatter) {
+    return Logger::instance().register_format(level, format, formatter);
+}
+
+Record _reserve(uint32_t format_id, size_t payload_size) {
+    Ring* ring = thread_ring.ring.get();
+    if (ring == nullptr) ring = Logger::instance().attach(thread_ring);
+
+    size_t size = align_record(HEADER_SIZE + payload_size);
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    size_t offset = head % ring->capacity;
+    size_t contiguous = ring->capacity - offset;
+    // a record that does not fit before the end starts over at the beginning
+    size_t needed = contiguous < size ? contiguous + size : size;
+
+    if (size > ring->capacity / 2 ||
+        head + needed - ring->cached_tail > ring->capacity) {
+        ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+        if (size > ring->capacity / 2 ||
+            head + needed - ring->cached_tail > ring->capacity) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return {nullptr, nullptr, 0};
+        }
+    }
+
+    if (contiguous < size) {
+        std::memcpy(ring->data.get() + offset, &PADDING, sizeof(PADDING));
+        head += contiguous;
+        offset = 0;
+    }
+
+    std::byte* record = ring->data.get() + offset;
+    auto length = static_cast<uint32_t>(payload_size);
+    auto time_ns = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+    std::memcpy(record, &format_id, sizeof(format_id));
+    std::memcpy(record + 4, &length, sizeof(length));
+    std::memcpy(record + 8, &time_ns, sizeof(time_ns));
+    return {record + HEADER_SIZE, ring, head + size};
+}
+
+void _commit(const Record& record) {
+    static_cast<Ring*>(record.ring)
+        ->head.store(record.end, std::memory_order_release);
+}
+
+void _append_string(std::string& out, std::string_view value) {
+    out.append(value);
+}
+
+template <typename T>
+void append_number(std::string& out, T value, int base = 10) {
+    char digits[32];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value, base);
+    out.append(digits, result.ptr);
+}
+
+void _append_value(std::string& out, int64_t value) {
+    append_number(out, value);
+}
+
+void _append_value(std::string& out, uint64_t value) {
+    append_number(out, value);
+}
+
+void _append_value(std::string& out, double value) {
+    char digits[32];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+void _append_value(std::string& out, const void* value) {
+    out += "0x";
+    append_number(out, reinterpret_cast<uintptr_t>(value), 16);
+}
+
+void _append_until_placeholder(std::string& out, std::string_view& format) {
+    size_t placeholder = format.find("{}");
+    if (placeholder == std::string_view::npos) {
+        out.append(format);
+        format = {};
+        return;
+    }
+    out.append(format.substr(0, placeholder));
+    format.remove_prefix(placeholder + 2);
+}
+
+}  // namespace singularity::logging
@@ -1,3 +1,262 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
 
-int main() { std::cout << "Hello from singularity!" << std::endl; }
+#include "cli.hpp"
+#include "sockimpl.hpp"
+#include "tcp_server.hpp"
+#include "tracing.hpp"
+
+using namespace singularity;
+
+// accepted connections waiting for a worker
+constexpr size_t CONNECTION_QUEUE_SIZE = 1024;
+// time given to connections being drained when the sink stops
+constexpr auto GRACE_PERIOD = std::chrono::seconds(1);
+
+/**
+ * @brief How workers read from their connections.
+ */
+enum class IOMode {
+    // a single reused chunk buffer, memory use bounded by the chunk size
+    stream,
+    // `receive_message`, each connection's data accumulated in memory
+    message,
+    // `receive_frame`, one frame at a time until the peer finishes
+    frame
+};
+
+struct Options {
+    uint16_t port = 9000;
+    size_t workers = std::max(1U, std::thread::hardware_concurrency());
+    IOMode mode = IOMode::stream;
+    size_t chunk_size = network::TCPConnection::DEFAULT_CHUNK_SIZE;
+    std::chrono::milliseconds interval{1000};
+    // zero runs until interrupted
+    std::chrono::seconds duration{0};
+    // zero disables the metrics endpoint
+    uint16_t metrics_port = 0;
+    // empty records no trace
+    std::string trace_file;
+};
+
+std::atomic<bool> interrupted = false;
+
+void handle_signal(int) { interrupted = true; }
+
+void print_usage(const char* program) {
+    std::cerr
+        << "Usage: " << program << " [options]\n"
+        << "Accepts connections and discards everything they send, reporting\n"
+        << "ingest throughput and connection rate.\n\n"
+        << "  --port N          port to listen on (default 9000)\n"
+        << "  --workers N       connections drained concurrently (default: "
+           "one per core)\n"
+        << "  --io MODE         stream, message or frame (default stream)\n"
+        << "  --chunk-size N    receive buffer size in stream mode (default "
+           "65536)\n"
+        << "  --interval MS     reporting interval (default 1000)\n"
+        << "  --duration S      stop after this many seconds (default: run "
+           "until interrupted)\n"
+        << "  --metrics-port N  serve Prometheus metrics on this loopback "
+           "port\n"
+        << "  --trace FILE      write a Chrome trace of the run to this file "
+           "on exit\n"
+        << "  --help            show this message\n";
+}
+
+IOMode parse_mode(const std::string& value) {
+    if (value == "stream") return IOMode::stream;
+    if (value == "message") return IOMode::message;
+    if (value == "frame") return IOMode::frame;
+    throw std::invalid_argument(
+        utils::build_string("Unknown I/O mode '", value, "'"));
+}
+
+// Returns the parsed options, or nothing if only the usage was requested.
+std::optional<Options> parse_options(int argc, char** argv) {
+    Options options;
+    auto handle = [&](std::string_view flag, const std::string& value) {
+        if (flag == "--port") {
+            size_t port = cli::parse_number(flag, value);
+            if (port > UINT16_MAX) {
+                throw std::invalid_argument("Port must be at most 65535");
+            }
+            options.port = static_cast<uint16_t>(port);
+        } else if (flag == "--metrics-port") {
+            size_t port = cli::parse_number(flag, value);
+            if (port > UINT16_MAX) {
+                throw std::invalid_argument("Port must be at most 65535");
+            }
+            options.metrics_port = static_cast<uint16_t>(port);
+        } else if (flag == "--trace") {
+            if (!tracing::ENABLED) {
+                throw std::invalid_argument(
+                    "--trace requires building with SINGULARITY_TRACING");
+            }
+            options.trace_file = value;
+        } else if (flag == "--workers") {
+            options.workers = cli::parse_number(flag, value);
+        } else if (flag == "--io") {
+            options.mode = parse_mode(value);
+        } else if (flag == "--chunk-size") {
+            options.chunk_size = cli::parse_number(flag, value);
+        } else if (flag == "--interval") {
+            options.interval =
+                std::chrono::milliseconds(cli::parse_number(flag, value));
+        } else if (flag == "--duration") {
+            options.duration =
+                std::chrono::seconds(cli::parse_number(flag, value));
+        } else {
+            throw std::invalid_argument(
+                utils::build_string("Unknown option ", flag));
+        }
+    };
+    if (!cli::parse_flags(argc, argv, handle)) return std::nullopt;
+
+    if (options.workers == 0 || options.chunk_size == 0 ||
+        options.interval.count() == 0) {
+        throw std::invalid_argument(
+            "Workers, chunk size and interval must be positive");
+    }
+    return options;
+}
+
+// Reads a connection until the peer finishes sending, counting every byte as
+// soon as it arrives where the I/O mode allows.
+void drain(network::TCPConnection& connection, const Options& options,
+           std::atomic<uint64_t>& received) {
+    switch (options.mode) {
+        case IOMode::stream:
+            connection.receive_stream(
+                [&received](const std::byte*, size_t length) {
+                    received.fetch_add(length, std::memory_order_relaxed);
+                },
+                options.chunk_size);
+            break;
+        case IOMode::message:
+            received.fetch_add(connection.receive_message().length(),
+                               std::memory_order_relaxed);
+            break;
+        case IOMode::frame:
+            while (auto frame = connection.receive_frame()) {
+                received.fetch_add(frame->length(), std::memory_order_relaxed);
+            }
+            break;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::optional<Options> parsed;
+    try {
+        parsed = parse_options(argc, argv);
+    } catch (const std::invalid_argument& error) {
+        std::cerr << error.what() << "\n\n";
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!parsed.has_value()) {
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+    }
+    const Options options = *parsed;
+
+    std::signal(SIGINT, handle_signal);
+    std::signal(SIGTERM, handle_signal);
+
+    network::ServerConfig config;
+    config.backlog = 1024;
+    config.metrics_port = options.metrics_port;
+    network::TCPServer server(options.port, config);
+    std::atomic<uint64_t> received = 0;
+
+    network::WorkerConfig workers;
+    workers.workers = options.workers;
+    workers.queue_capacity = CONNECTION_QUEUE_SIZE;
+    try {
+        server.serve(
+            [&options, &received](network::TCPConnection& connection) {
+                drain(connection, options, received);
+            },
+            workers);
+    } catch (const std::system_error& error) {
+        std::cerr << "Unable to start sink: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Sinking on port " << options.port << " with "
+              << options.workers << " workers" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    auto last = start;
+    uint64_t last_bytes = 0;
+    uint64_t last_accepted = 0;
+    uint64_t total_accepted = 0;
+
+    while (!interrupted) {
+        // sleep in short slices so an interrupt is noticed promptly
+        auto next_report = last + options.interval;
+        while (!interrupted && clock::now() < next_report) {
+            std::this_thread::sleep_for(std::min<clock::duration>(
+                next_report - clock::now(), std::chrono::milliseconds(50)));
+        }
+
+        auto now = clock::now();
+        double seconds = std::chrono::duration<double>(now - last).count();
+        uint64_t bytes = received.load();
+        total_accepted = server.admission_stats().accepted;
+        auto worker_stats = server.worker_stats();
+
+        std::cout << std::chrono::duration<double>(now - start).count()
+                  << "s: "
+                  << static_cast<double>(bytes - last_bytes) / 1e6 / seconds
+                  << " MB/s, "
+                  << static_cast<double>(total_accepted - last_accepted) /
+                         seconds
+                  << " conn/s, " << worker_stats.in_flight << " active, "
+                  << worker_stats.queued << " queued" << std::endl;
+
+        last = now;
+        last_bytes = bytes;
+        last_accepted = total_accepted;
+        if (options.duration.count() > 0 && now - start >= options.duration) {
+            break;
+        }
+    }
+
+    auto report = server.shutdown(GRACE_PERIOD);
+    auto worker_stats = server.worker_stats();
+
+    double elapsed =
+        std::chrono::duration<double>(clock::now() - start).count();
+    double megabytes = static_cast<double>(received) / 1e6;
+    std::cout << "Received " << megabytes << " MB from " << total_accepted
+              << " connections (" << megabytes / elapsed << " MB/s), "
+              << worker_stats.failed << " failed, " << report.dropped
+              << " dropped at shutdown" << std::endl;
+
+    if (!options.trace_file.empty()) {
+        std::ofstream trace(options.trace_file);
+        tracing::write_chrome_trace(trace);
+        if (!trace) {
+            std::cerr << "Unable to write trace to " << options.trace_file
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
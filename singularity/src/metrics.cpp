@@ -0,0 +1,236 @@
+#include "metrics.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+#include <string_view>
+
+#include "utils.hpp"
+
+// percentiles exported for each histogram, as Prometheus quantiles
+constexpr std::pair<double, const char*> QUANTILES[] = {
+    {50, "0.5"}, {90, "0.9"}, {99, "0.99"}, {99.9, "0.999"}};
+
+// Checks a metric or label name against `[a-zA-Z_:][a-zA-Z0-9_:]*`, label
+// names not being allowed colons.
+bool valid_name(const std::string& name, bool label) {
+    if (name.empty() || (name[0] >= '0' && name[0] <= '9')) return false;
+    for (char character : name) {
+        bool valid = (character >= 'a' && character <= 'z') ||
+                     (character >= 'A' && character <= 'Z') ||
+                     (character >= '0' && character <= '9') ||
+                     character == '_' || (!label && character == ':');
+        if (!valid) return false;
+    }
+    return true;
+}
+
+// Escapes backslashes and newlines, and quotes in label values.
+void append_escaped(std::string& out, const std::string& text, bool quotes) {
+    for (char character : text) {
+        if (character == '\\') {
+            out += "\\\\";
+        } else if (character == '\n') {
+            out += "\\n";
+        } else if (quotes && character == '"') {
+            out += "\\\"";
+        } else {
+            out += character;
+        }
+    }
+}
+
+template <typename T>
+void append_number(std::string& out, T value) {
+    if constexpr (std::is_floating_point_v<T>) {
+        if (std::isnan(value)) {
+            out += "NaN";
+            return;
+        }
+        if (std::isinf(value)) {
+            out += value > 0 ? "+Inf" : "-Inf";
+            return;
+        }
+    }
+    char digits[32];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+// Appends `name{labels,extra} `, leaving out the braces if both are empty.
+void append_sample_name(std::string& out, const std::string& name,
+                        const std::string& labels,
+                        const std::string& extra = "") {
+    out += name;
+    if (!labels.empty() || !extra.empty()) {
+        out += '{';
+        out += labels;
+        if (!labels.empty() && !extra.empty()) out += ',';
+        out += extra;
+        out += '}';
+    }
+    out += ' ';
+}
+
+namespace singularity::metrics {
+
+void Counter::_render(std::string& out, const std::string& name,
+                      const std::string& labels) const {
+    append_sample_name(out, name, labels);
+    append_number(out, value());
+    out += '\n';
+}
+
+void Gauge::_render(std::string& out, const std::string& name,
+                    const std::string& labels) const {
+    append_sample_name(out, name, labels);
+    append_number(out, value());
+    out += '\n';
+}
+
+void Histogram::merge(const Histogram& other) {
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+        uint64_t count = other._buckets[bucket].load(std::memory_order_relaxed);
+        if (count > 0) {
+            _buckets[bucket].fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+    _sum.fetch_add(other.sum(), std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const {
+    uint64_t total = 0;
+    for (const auto& bucket : _buckets) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t Histogram::percentile(double percentile) const {
+    uint64_t total = count();
+    if (total == 0) return 0;
+
+    double fraction = std::clamp(percentile, 0.0, 100.0) / 100;
+    auto rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(
+               std::ceil(fraction * static_cast<double>(total))));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+        seen += _buckets[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank) return _highest(bucket);
+    }
+    // values recorded while counting, the last bucket holds the maximum
+    return _highest(BUCKETS - 1);
+}
+
+void Histogram::_render(std::string& out, const std::string& name,
+                        const std::string& labels) const {
+    for (const auto& [percent, quantile] : QUANTILES) {
+        append_sample_name(out, name, labels,
+                           utils::build_string("quantile=\"", quantile, "\""));
+        append_number(out, static_cast<double>(this->percentile(percent)) /
+                               _scale);
+        out += '\n';
+    }
+    append_sample_name(out, name + "_sum", labels);
+    append_number(out, static_cast<double>(sum()) / _scale);
+    out += '\n';
+    append_sample_name(out, name + "_count", labels);
+    append_number(out, count());
+    out += '\n';
+}
+
+Metric& Registry::_register(const std::string& name, const std::string& help,
+                            const Labels& labels, const char* type,
+                            std::unique_ptr<Metric> (*make)(double),
+                            double scale) {
+    if (!valid_name(name, false)) {
+        throw std::invalid_argument(
+            utils::build_string("Invalid metric name '", name, "'"));
+    }
+    std::string key;
+    for (const auto& [label, value] : labels) {
+        if (!valid_name(label, true) || label.starts_with("__")) {
+            throw std::invalid_argument(
+                utils::build_string("Invalid label name '", label, "'"));
+        }
+        if (!key.empty()) key += ',';
+        key += label;
+        key += "=\"";
+        append_escaped(key, value, true);
+        key += '"';
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto [family, created] = _families.try_emplace(name);
+    if (created) {
+        family->second.help = help;
+        family->second.type = type;
+    } else if (std::string_view(family->second.type) != type) {
+        throw std::invalid_argument(utils::build_string(
+            "Metric '", name, "' is already registered as a ",
+            family->second.type));
+    }
+
+    auto& metric = family->second.metrics[key];
+    if (metric == nullptr) metric = make(scale);
+    return *metric;
+}
+
+Counter& Registry::counter(const std::string& name, const std::string& help,
+                           const Labels& labels) {
+    return static_cast<Counter&>(_register(
+        name, help, labels, "counter",
+        [](double) -> std::unique_ptr<Metric> {
+            return std::make_unique<Counter>();
+        },
+        0));
+}
+
+Gauge& Registry::gauge(const std::string& name, const std::string& help,
+                       const Labels& labels) {
+    return static_cast<Gauge&>(_register(
+        name, help, labels, "gauge",
+        [](double) -> std::unique_ptr<Metric> {
+            return std::make_unique<Gauge>();
+        },
+        0));
+}
+
+Histogram& Registry::histogram(const std::string& name,
+                               const std::string& help, const Labels& labels,
+                               double scale) {
+    return static_cast<Histogram&>(_register(
+        name, help, labels, "summary",
+        [](double histogram_scale) -> std::unique_ptr<Metric> {
+            return std::make_unique<Histogram>(histogram_scale);
+        },
+        scale));
+}
+
+std::string Registry::render() const {
+    std::string out;
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (const auto& [name, family] : _families) {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        append_escaped(out, family.help, false);
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += family.type;
+        out += '\n';
+        for (const auto& [labels, metric] : family.metrics) {
+            metric->_render(out, name, labels);
+        }
+    }
+    return out;
+}
+
+std::shared_ptr<Registry> Registry::global() {
+    static const auto registry = std::make_shared<Registry>();
+    return registry;
+}
+
+}  // namespace singularity::metrics
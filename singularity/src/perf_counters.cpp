@@ -0,0 +1,435 @@
+#include "perf_counters.hpp"
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include <cerrno>
+#include <charconv>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+
+#include "utils.hpp"
+
+#ifdef __linux__
+struct EventSpec {
+    uint32_t type;
+    uint64_t config;
+    // context switches happen in the kernel, so they are only seen there
+    bool kernel;
+};
+
+// in the order of `Event`
+constexpr EventSpec EVENT_SPECS[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, false},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, false},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, false},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, false},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, true}};
+
+// Opens a disabled counter for the calling thread and the threads it starts,
+// returning -1 if the event cannot be counted.
+int open_event(const EventSpec& spec) {
+    perf_event_attr attributes{};
+    attributes.size = sizeof(attributes);
+    attributes.type = spec.type;
+    attributes.config = spec.config;
+    attributes.disabled = 1;
+    attributes.inherit = 1;
+    attributes.exclude_kernel = spec.kernel ? 0 : 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1,
+                                    -1, PERF_FLAG_FD_CLOEXEC));
+}
+#endif
+
+void append_number(std::string& out, double value) {
+    char digits[32];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+void append_quoted(std::string& out, std::string_view text) {
+    out += '"';
+    for (char character : text) {
+        if (character == '"' || character == '\\') out += '\\';
+        out += character;
+    }
+    out += '"';
+}
+
+namespace singularity::benchmark {
+
+// Reads the subset of JSON that `write_baseline` produces.
+class BaselineParser {
+   private:
+    std::string_view _text;
+    size_t _position;
+
+    [[noreturn]] void _fail(const char* expected) const {
+        throw std::invalid_argument(utils::build_string(
+            "Invalid baseline: expected ", expected, " at offset ",
+            _position));
+    }
+
+    void _skip_space() {
+        while (_position < _text.size() &&
+               (_text[_position] == ' ' || _text[_position] == '\n' ||
+                _text[_position] == '\t' || _text[_position] == '\r')) {
+            ++_position;
+        }
+    }
+
+    // Consumes `character` if it comes next.
+    bool _accept(char character) {
+        _skip_space();
+        if (_position < _text.size() && _text[_position] == character) {
+            ++_position;
+            return true;
+        }
+        return false;
+    }
+
+    void _expect(char character) {
+        if (!_accept(character)) {
+            const char expected[] = {'\'', character, '\'', '\0'};
+            _fail(expected);
+        }
+    }
+
+    std::string _string() {
+        _expect('"');
+        std::string value;
+        while (_position < _text.size() && _text[_position] != '"') {
+            if (_text[_position] == '\\') ++_position;
+            if (_position < _text.size()) value += _text[_position++];
+        }
+        _expect('"');
+        return value;
+    }
+
+    // Returns a number, or nothing for `null`.
+    std::optional<double> _number() {
+        _skip_space();
+        if (_text.substr(_position).starts_with("null")) {
+            _position += 4;
+            return std::nullopt;
+        }
+        double value;
+        const char* begin = _text.data() + _position;
+        auto result =
+            std::from_chars(begin, _text.data() + _text.size(), value);
+        if (result.ec != std::errc()) _fail("a number");
+        _position += static_cast<size_t>(result.ptr - begin);
+        return value;
+    }
+
+    void _per_operation(Result& result) {
+        _expect('{');
+        if (_accept('}')) return;
+        do {
+            std::string key = _string();
+            _expect(':');
+            std::optional<double> value = _number();
+            for (auto event : EVENTS) {
+                if (key == event_name(event) &&
+                    value.has_value()) {
+                    result.counts.events[static_cast<size_t>(event)] =
+                        *value * static_cast<double>(result.operations);
+                }
+            }
+        } while (_accept(','));
+        _expect('}');
+    }
+
+    Result _result() {
+        Result result;
+        _expect('{');
+        do {
+            std::string key = _string();
+            _expect(':');
+            if (key == "name") {
+                result.name = _string();
+            } else if (key == "operations") {
+                result.operations =
+                    static_cast<uint64_t>(_number().value_or(0));
+            } else if (key == "seconds") {
+                result.counts.seconds = _number().value_or(0);
+            } else if (key == "per_operation") {
+                // needs the operations, which are written first
+                _per_operation(result);
+            } else {
+                _fail("a known key");
+            }
+        } while (_accept(','));
+        _expect('}');
+        return result;
+    }
+
+   public:
+    explicit BaselineParser(std::string_view text)
+        : _text{text}, _position{0} {}
+
+    std::vector<Result> parse() {
+        std::vector<Result> results;
+        _expect('[');
+        if (!_accept(']')) {
+            do {
+                results.push_back(_result());
+            } while (_accept(','));
+            _expect(']');
+        }
+        _skip_space();
+        if (_position != _text.size()) _fail("the end");
+        return results;
+    }
+};
+
+const char* event_name(Event event) {
+    switch (event) {
+        case Event::cycles:
+            return "cycles";
+        case Event::instructions:
+            return "instructions";
+        case Event::cache_misses:
+            return "cache_misses";
+        case Event::branch_misses:
+            return "branch_misses";
+        case Event::context_switches:
+            return "context_switches";
+    }
+    return "unknown";
+}
+
+PerfCounters::PerfCounters() {
+    _descriptors.fill(-1);
+#ifdef __linux__
+    for (size_t index = 0; index < EVENT_COUNT; ++index) {
+        _descriptors[index] = open_event(EVENT_SPECS[index]);
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+    for (int descriptor : _descriptors) {
+        if (descriptor != -1) close(descriptor);
+    }
+}
+
+bool PerfCounters::available(Event event) const {
+    return _descriptors[static_cast<size_t>(event)] != -1;
+}
+
+void PerfCounters::start() {
+#ifdef __linux__
+    for (int descriptor : _descriptors) {
+        if (descriptor == -1) continue;
+        ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+        ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    _start = std::chrono::steady_clock::now();
+}
+
+Counts PerfCounters::stop() {
+    auto end = std::chrono::steady_clock::now();
+    Counts counts;
+    counts.seconds = std::chrono::duration<double>(end - _start).count();
+#ifdef __linux__
+    for (size_t index = 0; index < EVENT_COUNT; ++index) {
+        int descriptor = _descriptors[index];
+        if (descriptor == -1) continue;
+        ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+
+        // value, time enabled, time running
+        uint64_t values[3];
+        if (read(descriptor, values, sizeof(values)) != sizeof(values) ||
+            values[2] == 0) {
+            continue;
+        }
+        // scaled up for the time the counter was multiplexed out
+        counts.events[index] = static_cast<double>(values[0]) *
+                               static_cast<double>(values[1]) /
+                               static_cast<double>(values[2]);
+    }
+#endif
+    return counts;
+}
+
+double Result::nanoseconds_per_operation() const {
+    if (operations == 0) return 0;
+    return counts.seconds * 1e9 / static_cast<double>(operations);
+}
+
+std::optional<double> Result::per_operation(Event event) const {
+    const auto& count = counts[event];
+    if (!count.has_value() || operations == 0) return std::nullopt;
+    return *count / static_cast<double>(operations);
+}
+
+void write_baseline(std::ostream& out, const std::vector<Result>& results) {
+    std::string text = "[";
+    for (size_t index = 0; index < results.size(); ++index) {
+        const Result& result = results[index];
+        text += index == 0 ? "\n  {\"name\": " : ",\n  {\"name\": ";
+        append_quoted(text, result.name);
+        text += ", \"operations\": ";
+        append_number(text, static_cast<double>(result.operations));
+        text += ", \"seconds\": ";
+        append_number(text, result.counts.seconds);
+        text += ",\n   \"per_operation\": {\"nanoseconds\": ";
+        append_number(text, result.nanoseconds_per_operation());
+        for (auto event : EVENTS) {
+            text += ", ";
+            append_quoted(text, event_name(event));
+            text += ": ";
+            auto value = result.per_operation(event);
+            if (value.has_value()) {
+                append_number(text, *value);
+            } else {
+                text += "null";
+            }
+        }
+        text += "}}";
+    }
+    text += "\n]\n";
+    out << text;
+}
+
+std::vector<Result> read_baseline(const std::string& text) {
+    return BaselineParser(text).parse();
+}
+
+std::vector<Regression> compare(const std::vector<Result>& baseline,
+                                const std::vector<Result>& current,
+                                double threshold) {
+    std::vector<Regression> regressions;
+    auto check = [&regressions, threshold](const Result& result,
+                                           const char* metric,
+                                           std::optional<double> before,
+                                           std::optional<double> after) {
+        // a zero baseline has no relative change to speak of
+        if (!before.has_value() || !after.has_value() || *before <= 0) return;
+        if (*after > *before * (1 + threshold)) {
+            regressions.push_back({result.name, metric, *before, *after});
+        }
+    };
+
+    for (const Result& result : current) {
+        for (const Result& reference : baseline) {
+            if (reference.name != result.name) continue;
+            check(result, "nanoseconds", reference.nanoseconds_per_operation(),
+                  result.nanoseconds_per_operation());
+            for (auto event : EVENTS) {
+                check(result, event_name(event), reference.per_operation(event),
+                      result.per_operation(event));
+            }
+            break;
+        }
+    }
+    return regressions;
+}
+
+bool BaselineOptions::parse(std::string_view flag, const std::string& value) {
+    if (flag == "--write-baseline") {
+        write_path = value;
+    } else if (flag == "--compare") {
+        compare_path = value;
+    } else if (flag == "--threshold") {
+        size_t consumed = 0;
+        double percent = -1;
+        try {
+            percent = std::stod(value, &consumed);
+        } catch (const std::exception&) {
+            consumed = 0;
+        }
+        if (consumed != value.size() || !(percent >= 0)) {
+            throw std::invalid_argument(utils::build_string(
+                "Invalid value '", value, "' for ", flag));
+        }
+        threshold = percent / 100;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool check_baseline(const BaselineOptions& options,
+                    const std::vector<Result>& results, std::ostream& report) {
+    if (!options.write_path.empty()) {
+        std::ofstream out(options.write_path);
+        write_baseline(out, results);
+        if (!out) {
+            throw std::system_error(
+                errno, std::system_category(),
+                utils::build_string("Unable to write ", options.write_path));
+        }
+    }
+    if (options.compare_path.empty()) return true;
+
+    std::ifstream in(options.compare_path);
+    std::ostringstream text;
+    text << in.rdbuf();
+    if (!in) {
+        throw std::system_error(
+            errno, std::system_category(),
+            utils::build_string("Unable to read ", options.compare_path));
+    }
+    auto regressions =
+        compare(read_baseline(text.str()), results, options.threshold);
+    print_regressions(report, regressions, options.threshold);
+    return regressions.empty();
+}
+
+void print_results(std::ostream& out, const std::vector<Result>& results) {
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+    for (const Result& result : results) {
+        out << result.name << ": " << result.operations << " ops, "
+            << result.nanoseconds_per_operation() << " ns/op";
+        for (auto event : EVENTS) {
+            out << ", " << event_name(event) << "/op ";
+            auto value = result.per_operation(event);
+            if (value.has_value()) {
+                out << *value;
+            } else {
+                out << "n/a";
+            }
+        }
+        out << "\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void print_regressions(std::ostream& out,
+                       const std::vector<Regression>& regressions,
+                       double threshold) {
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+    if (regressions.empty()) {
+        out << "No regressions beyond " << threshold * 100 << "%\n";
+    }
+    for (const Regression& regression : regressions) {
+        out << "REGRESSION " << regression.name << " " << regression.metric
+            << "/op: " << regression.baseline << " -> " << regression.current
+            << " (+" << (regression.current / regression.baseline - 1) * 100
+            << "%)\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}  // namespace singularity::benchmark
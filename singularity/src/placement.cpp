@@ -0,0 +1,154 @@
+#include "placement.hpp"
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "utils.hpp"
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#endif
+
+constexpr static const char* NODE_DIRECTORY = "/sys/devices/system/node";
+
+// Parses a kernel CPU list such as "0-3,8,10-11".
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        if (range.empty() || range == "\n") continue;
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos
+                           ? first
+                           : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        } catch (const std::exception&) {
+            continue;  // malformed entries are skipped
+        }
+    }
+    return cpus;
+}
+
+namespace singularity::concurrency {
+
+ThreadPlacement ThreadPlacement::on_node(int node) {
+    auto allowed = available_cpus();
+    for (const auto& candidate : numa_nodes()) {
+        if (candidate.id != node) continue;
+
+        ThreadPlacement placement;
+        for (int cpu : candidate.cpus) {
+            if (std::binary_search(allowed.begin(), allowed.end(), cpu)) {
+                placement.cpus.push_back(cpu);
+            }
+        }
+        if (placement.cpus.empty()) break;
+        placement.local_memory = true;
+        return placement;
+    }
+    throw std::invalid_argument(utils::build_string(
+        "NUMA node ", node, " has no CPUs available to the process"));
+}
+
+int ThreadPlacement::cpu_for(size_t thread_index) const {
+    if (!pin_individually || cpus.empty()) return -1;
+    return cpus[thread_index % cpus.size()];
+}
+
+std::vector<NumaNode> numa_nodes() {
+    std::vector<NumaNode> nodes;
+    DIR* directory = opendir(NODE_DIRECTORY);
+    if (directory != nullptr) {
+        while (dirent* entry = readdir(directory)) {
+            std::string name = entry->d_name;
+            if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+                !std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+                continue;
+            }
+            std::ifstream list(std::string(NODE_DIRECTORY) + "/" + name +
+                               "/cpulist");
+            std::string cpus;
+            std::getline(list, cpus);
+            nodes.push_back({std::stoi(name.substr(4)), parse_cpu_list(cpus)});
+        }
+        closedir(directory);
+    }
+
+    if (nodes.empty()) return {{0, available_cpus()}};
+    std::sort(nodes.begin(), nodes.end(),
+              [](const NumaNode& left, const NumaNode& right) {
+                  return left.id < right.id;
+              });
+    return nodes;
+}
+
+int numa_node_of(int cpu) {
+    // cached, the topology does not change while the process runs
+    static const std::vector<NumaNode> nodes = numa_nodes();
+    for (const auto& node : nodes) {
+        if (std::find(node.cpus.begin(), node.cpus.end(), cpu) !=
+            node.cpus.end()) {
+            return node.id;
+        }
+    }
+    return -1;
+}
+
+std::vector<int> available_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == -1) return cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+void validate_placement(const ThreadPlacement& placement) {
+    if (placement.cpus.empty()) return;
+    auto allowed = available_cpus();
+    for (int cpu : placement.cpus) {
+        if (!std::binary_search(allowed.begin(), allowed.end(), cpu)) {
+            throw std::invalid_argument(utils::build_string(
+                "CPU ", cpu, " is not available to the process"));
+        }
+    }
+}
+
+bool apply_placement(const ThreadPlacement& placement, size_t thread_index) {
+    if (placement.cpus.empty()) return true;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (placement.pin_individually) {
+        CPU_SET(placement.cpu_for(thread_index), &set);
+    } else {
+        for (int cpu : placement.cpus) CPU_SET(cpu, &set);
+    }
+    bool applied = sched_setaffinity(0, sizeof(set), &set) == 0;
+
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    // the thread is confined to the placement's CPUs, so allocating on the
+    // node it runs on keeps its memory on the placement's nodes
+    if (placement.local_memory &&
+        syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0) == -1) {
+        applied = false;
+    }
+#endif
+    return applied;
+}
+
+}  // namespace singularity::concurrency
@@ -0,0 +1,92 @@
+#include "rate_limit.hpp"
+
+#include <bit>
+#include <mutex>
+
+using namespace singularity::network;
+
+// Spreads addresses over the shards, clients tend to share their high bits.
+constexpr uint64_t mix(uint32_t address) {
+    uint64_t hash = address * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 32);
+}
+
+RateLimiter::RateLimiter(RateLimit limit, std::chrono::nanoseconds expiry,
+                         size_t shards)
+    : _limit{limit}, _expiry{expiry} {
+    if (shards == 0) {
+        throw std::invalid_argument("Rate limiter needs at least one shard");
+    }
+    // validates the limit before anything is allocated
+    TokenBucket validate(limit);
+
+    size_t count = std::bit_ceil(shards);
+    _shards = std::make_unique<Shard[]>(count);
+    _shard_mask = count - 1;
+    auto now = clock_type::now();
+    for (size_t index = 0; index < count; ++index) {
+        _shards[index].next_sweep = now + _expiry;
+    }
+}
+
+RateLimiter::Shard& RateLimiter::_shard(uint32_t address) const {
+    return _shards[mix(address) & _shard_mask];
+}
+
+size_t RateLimiter::_sweep(Shard& shard, clock_type::time_point now) {
+    size_t removed = std::erase_if(shard.buckets, [&](const auto& entry) {
+        return entry.second.use_count() == 1 &&
+               entry.second->idle(_expiry, now);
+    });
+    shard.next_sweep = now + _expiry;
+    return removed;
+}
+
+bool RateLimiter::try_acquire(const IPSocketAddress& client, double units) {
+    Shard& shard = _shard(client.address());
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto found = shard.buckets.find(client.address());
+        if (found != shard.buckets.end()) {
+            return found->second->try_acquire(units);
+        }
+    }
+    return bucket(client)->try_acquire(units);
+}
+
+std::shared_ptr<TokenBucket> RateLimiter::bucket(
+    const IPSocketAddress& client) {
+    Shard& shard = _shard(client.address());
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto found = shard.buckets.find(client.address());
+        if (found != shard.buckets.end()) return found->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto now = clock_type::now();
+    if (now >= shard.next_sweep) _sweep(shard, now);
+    auto& bucket = shard.buckets[client.address()];
+    // another thread may have added the client since the shared lookup
+    if (bucket == nullptr) bucket = std::make_shared<TokenBucket>(_limit);
+    return bucket;
+}
+
+size_t RateLimiter::expire() {
+    size_t removed = 0;
+    auto now = clock_type::now();
+    for (size_t index = 0; index <= _shard_mask; ++index) {
+        std::unique_lock<std::shared_mutex> lock(_shards[index].mutex);
+        removed += _sweep(_shards[index], now);
+    }
+    return removed;
+}
+
+size_t RateLimiter::size() const {
+    size_t total = 0;
+    for (size_t index = 0; index <= _shard_mask; ++index) {
+        std::shared_lock<std::shared_mutex> lock(_shards[index].mutex);
+        total += _shards[index].buckets.size();
+    }
+    return total;
+}
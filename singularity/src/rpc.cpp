@@ -0,0 +1,425 @@
+#include "rpc.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <list>
+#include <optional>
+#include <semaphore>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include "concurrency.hpp"
+#include "utils.hpp"
+
+using namespace singularity::network;
+
+// envelope at the start of every frame: call ID (64 bit, network byte order)
+// and the kind of message. Requests follow it with the length of the method
+// name (16 bit, network byte order) and the name itself.
+constexpr size_t ENVELOPE_SIZE = 9;
+constexpr size_t METHOD_LENGTH_SIZE = 2;
+constexpr size_t MAX_METHOD_LENGTH = UINT16_MAX;
+
+constexpr uint8_t KIND_REQUEST = 0;
+constexpr uint8_t KIND_RESPONSE = 1;
+constexpr uint8_t KIND_ERROR = 2;
+
+// connections accepted but not yet picked up by the dispatcher
+constexpr size_t CONNECTION_QUEUE_SIZE = 64;
+// longest the dispatcher waits for a connection before rechecking shutdown
+constexpr auto DISPATCH_TIMEOUT = std::chrono::milliseconds(50);
+// calls a connection may have queued or running at once. Past this the
+// reader stops reading, and TCP flow control pushes back on the client.
+constexpr ptrdiff_t MAX_CALLS_IN_FLIGHT = 128;
+
+struct Envelope {
+    uint64_t id;
+    uint8_t kind;
+    std::string_view method;
+    std::span<const std::byte> body;
+};
+
+void check_method(std::string_view method) {
+    if (method.size() > MAX_METHOD_LENGTH) {
+        throw std::invalid_argument(singularity::utils::build_string(
+            "Method names are limited to ", MAX_METHOD_LENGTH, " bytes"));
+    }
+}
+
+MessageBuffer encode(uint64_t id, uint8_t kind, std::string_view method,
+                     const std::byte* body, size_t length) {
+    size_t header_length = ENVELOPE_SIZE;
+    if (kind == KIND_REQUEST) {
+        header_length += METHOD_LENGTH_SIZE + method.size();
+    }
+
+    auto message =
+        std::make_unique_for_overwrite<std::byte[]>(header_length + length);
+    std::byte* next = message.get();
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        *next++ = static_cast<std::byte>(id >> shift);
+    }
+    *next++ = static_cast<std::byte>(kind);
+    if (kind == KIND_REQUEST) {
+        *next++ = static_cast<std::byte>(method.size() >> 8);
+        *next++ = static_cast<std::byte>(method.size() & 0xFF);
+        memcpy(next, method.data(), method.size());
+        next += method.size();
+    }
+    if (length > 0) memcpy(next, body, length);
+    return {std::move(message), header_length + length};
+}
+
+MessageBuffer encode_error(uint64_t id, std::string_view message) {
+    return encode(id, KIND_ERROR, {},
+                  reinterpret_cast<const std::byte*>(message.data()),
+                  message.size());
+}
+
+Envelope decode(const MessageBuffer& message) {
+    const std::byte* next = message.raw();
+    size_t remaining = message.length();
+    if (remaining < ENVELOPE_SIZE) {
+        throw ProtocolError("RPC message is shorter than its envelope");
+    }
+
+    Envelope envelope{};
+    for (size_t index = 0; index < 8; ++index) {
+        envelope.id = (envelope.id << 8) | static_cast<uint8_t>(*next++);
+    }
+    envelope.kind = static_cast<uint8_t>(*next++);
+    remaining -= ENVELOPE_SIZE;
+
+    if (envelope.kind == KIND_REQUEST) {
+        if (remaining < METHOD_LENGTH_SIZE) {
+            throw ProtocolError("RPC request is missing its method");
+        }
+        size_t method_length = (static_cast<size_t>(next[0]) << 8) |
+                               static_cast<size_t>(next[1]);
+        next += METHOD_LENGTH_SIZE;
+        remaining -= METHOD_LENGTH_SIZE;
+        if (remaining < method_length) {
+            throw ProtocolError("RPC request is missing its method");
+        }
+        envelope.method = {reinterpret_cast<const char*>(next), method_length};
+        next += method_length;
+        remaining -= method_length;
+    } else if (envelope.kind != KIND_RESPONSE && envelope.kind != KIND_ERROR) {
+        throw ProtocolError("RPC message has an unknown kind");
+    }
+
+    envelope.body = {next, remaining};
+    return envelope;
+}
+
+RPCClient::RPCClient(IPSocketAddress address)
+    : _connection{address}, _next_id{0}, _closed{false} {
+    _connection.open();
+    _reader = std::thread([this]() { _read_responses(); });
+}
+
+RPCClient::~RPCClient() { close(); }
+
+void RPCClient::_read_responses() {
+    std::string reason = "Connection closed before the call completed";
+    try {
+        while (auto frame = _connection.receive_frame()) {
+            Envelope envelope = decode(*frame);
+            if (envelope.kind == KIND_REQUEST) {
+                throw ProtocolError("RPC client received a request");
+            }
+
+            std::promise<MessageBuffer> promise;
+            {
+                std::lock_guard<std::mutex> lock(_pending_mutex);
+                auto entry = _pending.find(envelope.id);
+                if (entry == _pending.end()) {
+                    throw ProtocolError("RPC response matches no call");
+                }
+                promise = std::move(entry->second);
+                _pending.erase(entry);
+            }
+
+            if (envelope.kind == KIND_ERROR) {
+                promise.set_exception(std::make_exception_ptr(
+                    RPCError(std::string(reinterpret_cast<const char*>(
+                                             envelope.body.data()),
+                                         envelope.body.size()))));
+            } else {
+                promise.set_value(MessageBuffer(envelope.body.data(),
+                                                envelope.body.size()));
+            }
+        }
+    } catch (const std::exception& error) {
+        reason = error.what();
+    }
+    _fail_pending(reason);
+}
+
+void RPCClient::_fail_pending(const std::string& reason) {
+    std::unordered_map<uint64_t, std::promise<MessageBuffer>> pending;
+    {
+        std::lock_guard<std::mutex> lock(_pending_mutex);
+        _closed = true;
+        pending.swap(_pending);
+    }
+    for (auto& entry : pending) {
+        entry.second.set_exception(std::make_exception_ptr(RPCError(reason)));
+    }
+}
+
+std::future<MessageBuffer> RPCClient::call(
+    std::string_view method, const MessageBuffer& request,
+    std::chrono::steady_clock::time_point deadline) {
+    check_method(method);
+
+    uint64_t id;
+    std::future<MessageBuffer> result;
+    {
+        // the response may arrive before the send returns, so the call is
+        // registered first
+        std::lock_guard<std::mutex> lock(_pending_mutex);
+        if (_closed) throw RPCError("RPC client is closed");
+        id = _next_id++;
+        result = _pending[id].get_future();
+    }
+
+    MessageBuffer message =
+        encode(id, KIND_REQUEST, method, request.raw(), request.length());
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    try {
+        _connection.send_frame(message, deadline);
+    } catch (const std::exception& error) {
+        // part of the frame may be on the wire already, so the server would
+        // misread anything sent after it
+        _shutdown_connection();
+        _fail_pending(singularity::utils::build_string(
+            "Connection failed sending a call: ", error.what()));
+        throw;
+    }
+    return result;
+}
+
+size_t RPCClient::in_flight() const {
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    return _pending.size();
+}
+
+void RPCClient::_shutdown_connection() {
+    // a peer that already went away makes these fail, the reader has seen
+    // that too
+    try {
+        _connection.disable_send();
+    } catch (const std::system_error&) {
+    }
+    try {
+        // wakes the reader, which fails whatever is still in flight
+        _connection.disable_receive();
+    } catch (const std::system_error&) {
+    }
+}
+
+void RPCClient::close() {
+    if (!_reader.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        _shutdown_connection();
+    }
+    _reader.join();
+    _fail_pending("RPC client is closed");
+
+    try {
+        _connection.terminate();
+    } catch (const std::system_error&) {
+    }
+}
+
+class RPCServer::RPCServerImpl {
+   private:
+    // an accepted connection, shared by its reader and the calls in flight
+    // on it, so it is closed once the last of them is done
+    struct Session {
+        TCPConnection connection;
+        std::mutex send_mutex;
+        std::atomic<bool> finished;
+        // taken by the reader for each call, returned once it is answered
+        std::counting_semaphore<MAX_CALLS_IN_FLIGHT> calls;
+
+        explicit Session(TCPConnection connection)
+            : connection{std::move(connection)},
+              finished{false},
+              calls{MAX_CALLS_IN_FLIGHT} {}
+    };
+
+    struct Reader {
+        std::shared_ptr<Session> session;
+        std::thread thread;
+    };
+
+    std::unordered_map<std::string, RPCHandler> _handlers;
+    size_t _workers;
+    TCPServer _server;
+    concurrency::FixedBuffer<TCPConnection, CONNECTION_QUEUE_SIZE>
+        _connections;
+
+    std::optional<concurrency::ThreadPool> _pool;
+    std::atomic<bool> _started;
+    std::atomic<bool> _stopping;
+    std::optional<std::thread> _dispatcher;
+    std::list<Reader> _readers;
+    std::mutex _stop_mutex;
+
+    void _dispatch() {
+        while (!_stopping) {
+            auto connection = _connections.pop(DISPATCH_TIMEOUT);
+            _reap(false);
+            if (!connection.has_value()) continue;
+
+            auto session = std::make_shared<Session>(std::move(*connection));
+            _readers.push_back(
+                {session, std::thread([this, session]() { _read(session); })});
+        }
+    }
+
+    // Joins the readers that are done, or all of them.
+    void _reap(bool all) {
+        for (auto reader = _readers.begin(); reader != _readers.end();) {
+            if (all || reader->session->finished) {
+                reader->thread.join();
+                reader = _readers.erase(reader);
+            } else {
+                ++reader;
+            }
+        }
+    }
+
+    void _read(const std::shared_ptr<Session>& session) {
+        try {
+            while (auto frame = session->connection.receive_frame()) {
+                auto request = std::make_shared<MessageBuffer>(
+                    std::move(*frame));
+                Envelope envelope = decode(*request);
+                if (envelope.kind != KIND_REQUEST) {
+                    throw ProtocolError("RPC server received a response");
+                }
+                session->calls.acquire();
+                _pool->submit([this, session, request, envelope]() {
+                    _serve(*session, envelope);
+                    session->calls.release();
+                });
+            }
+        } catch (const std::exception&) {
+            // the connection is broken or speaks something else, it is
+            // closed once the calls in flight on it are done
+        }
+        session->finished = true;
+    }
+
+    void _serve(Session& session, const Envelope& envelope) {
+        MessageBuffer response("", 0);
+        try {
+            auto handler = _handlers.find(std::string(envelope.method));
+            if (handler == _handlers.end()) {
+                throw RPCError(singularity::utils::build_string(
+                    "Unknown method '", envelope.method, "'"));
+            }
+            MessageBuffer result = handler->second(envelope.body);
+            response = encode(envelope.id, KIND_RESPONSE, {}, result.raw(),
+                              result.length());
+        } catch (const std::exception& error) {
+            response = encode_error(envelope.id, error.what());
+        } catch (...) {
+            // anything escaping into the pool would terminate the server
+            response = encode_error(envelope.id, "RPC handler failed");
+        }
+
+        try {
+            std::lock_guard<std::mutex> lock(session.send_mutex);
+            session.connection.send_frame(response);
+        } catch (const std::exception&) {
+            // the client went away, nobody is waiting for the response
+        }
+    }
+
+   public:
+    RPCServerImpl(uint32_t port, size_t workers, ServerConfig config)
+        : _workers{workers},
+          _server{port, config},
+          _started{false},
+          _stopping{false} {
+        if (workers == 0) {
+            throw std::invalid_argument("RPC server needs at least one worker");
+        }
+    }
+
+    void register_handler(const std::string& method, RPCHandler handler) {
+        check_method(method);
+        if (_started) {
+            throw std::logic_error(
+                "Handlers must be registered before the server starts");
+        }
+        _handlers.insert_or_assign(method, std::move(handler));
+    }
+
+    void start() {
+        if (_started.exchange(true)) return;
+        try {
+            _server.start(_connections);
+        } catch (...) {
+            // nothing else was started, so starting can be retried
+            _started = false;
+            throw;
+        }
+        _pool.emplace(_workers);
+        _dispatcher = std::thread([this]() { _dispatch(); });
+    }
+
+    ShutdownReport stop(std::chrono::nanoseconds grace_period) {
+        std::lock_guard<std::mutex> lock(_stop_mutex);
+        if (!_dispatcher.has_value()) return {};
+
+        // the dispatcher keeps serving queued connections while they drain,
+        // and the connections left over are shut down by the server
+        ShutdownReport report = _server.shutdown(grace_period);
+        _stopping = true;
+        _dispatcher->join();
+        _dispatcher.reset();
+
+        // connections still queued were never served
+        std::optional<TCPConnection> queued;
+        while ((queued = _connections.pop(std::chrono::nanoseconds{0}))) {
+            queued->abort();
+        }
+        _reap(true);
+        // runs the calls still queued, whose responses go nowhere
+        _pool.reset();
+        return report;
+    }
+
+    ~RPCServerImpl() { stop(std::chrono::nanoseconds{0}); }
+};
+
+RPCServer::RPCServer(uint32_t port, size_t workers, ServerConfig config) {
+    impl = std::make_unique<RPCServerImpl>(port, workers, config);
+}
+
+void RPCServer::register_handler(const std::string& method,
+                                 RPCHandler handler) {
+    impl->register_handler(method, std::move(handler));
+}
+
+void RPCServer::start() { impl->start(); }
+
+ShutdownReport RPCServer::shutdown(std::chrono::nanoseconds grace_period) {
+    return impl->stop(grace_period);
+}
+
+RPCServer::~RPCServer() = default;
+
+RPCError::RPCError(const std::string& message) : _message{message} {}
+
+RPCError::RPCError(const char* message) : _message{message} {}
+
+const char* RPCError::what() const noexcept { return _message.data(); }
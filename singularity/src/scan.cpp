@@ -0,0 +1,133 @@
+#include "scan.hpp"
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SINGULARITY_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// every byte of a word set to 0x01 and 0x80 respectively
+constexpr uint64_t LOW_BITS = 0x0101010101010101;
+constexpr uint64_t HIGH_BITS = 0x8080808080808080;
+
+namespace singularity::scan {
+
+const std::byte* find_byte_portable(const std::byte* data, size_t length,
+                                    std::byte value) {
+    const std::byte* next = data;
+    const std::byte* const end = data + length;
+    const uint64_t pattern = LOW_BITS * static_cast<uint8_t>(value);
+
+    while (end - next >= static_cast<ptrdiff_t>(sizeof(uint64_t))) {
+        uint64_t word;
+        memcpy(&word, next, sizeof(word));
+        if constexpr (std::endian::native == std::endian::big) {
+            word = __builtin_bswap64(word);
+        }
+        // bytes equal to the value become zero, and the high bit of the
+        // lowest zero byte is set. Borrows may also flag higher bytes, so
+        // only the lowest flag is trusted.
+        uint64_t zeros = word ^ pattern;
+        uint64_t found = (zeros - LOW_BITS) & ~zeros & HIGH_BITS;
+        if (found != 0) return next + std::countr_zero(found) / 8;
+        next += sizeof(uint64_t);
+    }
+
+    for (; next < end; ++next) {
+        if (*next == value) return next;
+    }
+    return nullptr;
+}
+
+#ifdef SINGULARITY_SCAN_X86
+
+__attribute__((target("sse2"))) const std::byte* find_byte_sse2(
+    const std::byte* data, size_t length, std::byte value) {
+    const std::byte* next = data;
+    const std::byte* const end = data + length;
+    const __m128i pattern = _mm_set1_epi8(static_cast<char>(value));
+
+    while (end - next >= 16) {
+        __m128i block =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(next));
+        auto mask = static_cast<unsigned>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern)));
+        if (mask != 0) return next + std::countr_zero(mask);
+        next += 16;
+    }
+    return find_byte_portable(next, static_cast<size_t>(end - next), value);
+}
+
+__attribute__((target("avx2"))) const std::byte* find_byte_avx2(
+    const std::byte* data, size_t length, std::byte value) {
+    const std::byte* next = data;
+    const std::byte* const end = data + length;
+    const __m256i pattern = _mm256_set1_epi8(static_cast<char>(value));
+
+    // two vectors per iteration, tested together, so long records without
+    // a delimiter cost one branch per 64 bytes
+    while (end - next >= 64) {
+        __m256i low = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(next)),
+            pattern);
+        __m256i high = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(next + 32)),
+            pattern);
+        if (!_mm256_testz_si256(_mm256_or_si256(low, high),
+                                _mm256_or_si256(low, high))) {
+            auto mask = static_cast<uint64_t>(static_cast<uint32_t>(
+                            _mm256_movemask_epi8(low))) |
+                        (static_cast<uint64_t>(static_cast<uint32_t>(
+                             _mm256_movemask_epi8(high)))
+                         << 32);
+            return next + std::countr_zero(mask);
+        }
+        next += 64;
+    }
+    if (end - next >= 32) {
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(next)),
+                pattern)));
+        if (mask != 0) return next + std::countr_zero(mask);
+        next += 32;
+    }
+    return find_byte_sse2(next, static_cast<size_t>(end - next), value);
+}
+
+#endif
+
+using Implementation = const std::byte* (*)(const std::byte*, size_t,
+                                            std::byte);
+
+struct Selection {
+    Implementation function;
+    const char* name;
+};
+
+Selection select_implementation() {
+#ifdef SINGULARITY_SCAN_X86
+    // may run before the runtime has probed the processor
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {find_byte_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse2")) return {find_byte_sse2, "sse2"};
+#endif
+    return {find_byte_portable, "portable"};
+}
+
+const Selection& selection() {
+    static const Selection selected = select_implementation();
+    return selected;
+}
+
+const std::byte* find_byte(const std::byte* data, size_t length,
+                           std::byte value) {
+    return selection().function(data, length, value);
+}
+
+const char* find_byte_implementation() { return selection().name; }
+
+}  // namespace singularity::scan
@@ -1,19 +1,67 @@
 #include "sockimpl.hpp"
 
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
 #include <system_error>
+#include <thread>
 
+#include "checksum.hpp"
+#include "compression.hpp"
+#include "rate_limit.hpp"
+#include "scan.hpp"
+#include "tracing.hpp"
 #include "utils.hpp"
 
 constexpr size_t MIN_BUFFER_SIZE = 1024;
 constexpr size_t BUFFER_EPSILON = 32;
 
+// largest payload that fits in a single IPv4 UDP datagram
+constexpr size_t MAX_UDP_PAYLOAD = 65507;
+// upper bound on segments the kernel accepts in one GSO send
+constexpr size_t MAX_GSO_SEGMENTS = 64;
+
+#ifdef MSG_NOSIGNAL
+// report a closed peer as EPIPE instead of raising SIGPIPE
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
+
+// see TCPConnection::FrameHeader
+constexpr size_t FRAME_HEADER_SIZE = 12;
+// checksummed frames end with the CRC32C of the decoded message
+constexpr size_t FRAME_TRAILER_SIZE = 4;
+constexpr uint8_t FRAME_COMPRESSED = 1 << 0;
+constexpr uint8_t FRAME_CHECKSUM = 1 << 1;
+constexpr uint8_t FRAME_KNOWN_FLAGS = FRAME_COMPRESSED | FRAME_CHECKSUM;
+
+using clock_type = std::chrono::steady_clock;
+constexpr auto NO_DEADLINE = clock_type::time_point::max();
+
 void disable(int socket_fd, int type) {
     int status = shutdown(socket_fd, type);
     if (status == -1) {
@@ -24,6 +72,33 @@ void disable(int socket_fd, int type) {
 
 namespace singularity::network {
 
+// Waits until the socket is ready for the given events, throwing if the
+// deadline passes first.
+void wait_ready(socket_t socket_fd, short events,
+                clock_type::time_point deadline, const char* message) {
+    if (deadline == NO_DEADLINE) return;
+
+    pollfd info{socket_fd, events, 0};
+    while (true) {
+        auto remaining = deadline - clock_type::now();
+        if (remaining <= clock_type::duration::zero()) {
+            throw TimeoutError(message);
+        }
+
+        auto milliseconds =
+            std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+        int timeout = static_cast<int>(
+            std::min<decltype(milliseconds)>(milliseconds, INT_MAX));
+
+        int status = poll(&info, 1, timeout);
+        if (status > 0) return;
+        if (status == -1 && errno != EINTR) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Unable to wait on connection");
+        }
+    }
+}
+
 SocketAddress::SocketAddress() : _address{} {}
 
 sa_family_t SocketAddress::sa_family() const { return _address.ss_family; }
@@ -58,16 +133,29 @@ IPSocketAddress::IPSocketAddress(const char* address, uint16_t port)
 }
 
 IPSocketAddress::IPSocketAddress(const sockaddr* address,
-                                 socklen_t address_length) {
-    memcpy(&_address, address, address_length);
+                                 socklen_t address_length)
+    : _ip_addr{reinterpret_cast<sockaddr_in*>(&_address)} {
+    memcpy(&_address, address,
+           std::min(static_cast<size_t>(address_length), sizeof(_address)));
 }
 
 IPSocketAddress::IPSocketAddress(const IPSocketAddress& other)
     : SocketAddress(other),
       _ip_addr{reinterpret_cast<sockaddr_in*>(&_address)} {}
 
+IPSocketAddress::IPSocketAddress(IPSocketAddress&& other) noexcept
+    : SocketAddress(other),
+      _ip_addr{reinterpret_cast<sockaddr_in*>(&_address)} {}
+
+// _ip_addr always points into our own storage, so only the storage is copied
 IPSocketAddress& IPSocketAddress::operator=(const IPSocketAddress& other) {
-    return (*this = IPSocketAddress(other));
+    _address = other._address;
+    return *this;
+}
+
+IPSocketAddress& IPSocketAddress::operator=(IPSocketAddress&& other) noexcept {
+    _address = other._address;
+    return *this;
 }
 
 uint32_t IPSocketAddress::address() const {
@@ -108,11 +196,54 @@ socklen_t IPSocketAddress::length() const {
 }
 
 MessageBuffer::MessageBuffer(const void* data, size_t datasize)
-    : _length{datasize} {
-    _data.reset(new std::byte[datasize]);
+    : _data{std::make_unique_for_overwrite<std::byte[]>(datasize).release(),
+            Release{}},
+      _length{datasize} {
     memcpy(_data.get(), data, datasize);
 }
 
+MessageBuffer::MessageBuffer(std::unique_ptr<std::byte[]> data,
+                             size_t datasize)
+    : _data{data.release(), Release{}}, _length{datasize} {}
+
+void MessageBuffer::Release::operator()(std::byte* data) const {
+    if (mapped_length == 0) {
+        delete[] data;
+    } else {
+        munmap(data - offset, mapped_length);
+    }
+}
+
+MessageBuffer MessageBuffer::from_mapping(void* base, size_t mapped_length,
+                                          size_t datasize) {
+    MessageBuffer buffer(std::unique_ptr<std::byte[]>(), datasize);
+    buffer._data = std::unique_ptr<std::byte[], Release>(
+        static_cast<std::byte*>(base), Release{mapped_length, 0});
+    return buffer;
+}
+
+MessageBuffer MessageBuffer::map_file(int file_fd, size_t length,
+                                      off_t offset) {
+    // mappings must start on a page boundary
+    auto page_size = static_cast<off_t>(sysconf(_SC_PAGESIZE));
+    off_t aligned_offset = offset - offset % page_size;
+    auto lead = static_cast<size_t>(offset - aligned_offset);
+
+    // zero length mappings are invalid, map at least one byte
+    size_t mapped_length = std::max<size_t>(lead + length, 1);
+    void* base = mmap(nullptr, mapped_length, PROT_READ, MAP_SHARED, file_fd,
+                      aligned_offset);
+    if (base == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category(),
+                                "Unable to map file");
+    }
+
+    MessageBuffer buffer(std::unique_ptr<std::byte[]>(), length);
+    buffer._data = std::unique_ptr<std::byte[], Release>(
+        static_cast<std::byte*>(base) + lead, Release{mapped_length, lead});
+    return buffer;
+}
+
 MessageBuffer MessageBuffer::from_string(const std::string& message) {
     return {message.data(), message.length() + 1};
 }
@@ -139,21 +270,440 @@ const std::byte* MessageBuffer::raw() const { return _data.get(); }
 
 size_t MessageBuffer::length() const { return _length; }
 
+bool MessageBuffer::mapped() const {
+    return _data.get_deleter().mapped_length > 0;
+}
+
+/**
+ * A growable, shared mapping of an unlinked temporary file.
+ *
+ * Growing extends the file and the mapping, but never copies the data that is
+ * already there.
+ */
+class SpillRegion {
+   private:
+    int _fd;
+    std::byte* _data;
+    size_t _capacity;
+
+    static int _open(const std::string& directory) {
+        int fd = -1;
+#ifdef __linux__
+        if (directory.empty()) {
+            fd = memfd_create("singularity-spill", MFD_CLOEXEC);
+        } else {
+            fd = open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        }
+        if (fd != -1 || (errno != EOPNOTSUPP && errno != ENOSYS)) return fd;
+#endif
+        // no anonymous files here, fall back to creating and unlinking one
+        std::string path =
+            (directory.empty() ? std::string("/tmp") : directory) +
+            "/singularity-spill-XXXXXX";
+        fd = mkstemp(path.data());
+        if (fd != -1) unlink(path.c_str());
+        return fd;
+    }
+
+    void _map(size_t capacity) {
+        if (ftruncate(_fd, static_cast<off_t>(capacity)) == -1) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Unable to grow spill file");
+        }
+
+        void* data;
+#ifdef __linux__
+        data = _data == nullptr
+                   ? mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, _fd, 0)
+                   : mremap(_data, _capacity, capacity, MREMAP_MAYMOVE);
+#else
+        if (_data != nullptr) munmap(_data, _capacity);
+        _data = nullptr;
+        data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd,
+                    0);
+#endif
+        if (data == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Unable to map spill file");
+        }
+        _data = static_cast<std::byte*>(data);
+        _capacity = capacity;
+    }
+
+   public:
+    SpillRegion(const std::string& directory, size_t capacity)
+        : _fd{_open(directory)}, _data{nullptr}, _capacity{0} {
+        if (_fd == -1) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Unable to create spill file");
+        }
+        try {
+            _map(capacity);
+        } catch (...) {
+            close(_fd);
+            throw;
+        }
+    }
+
+    SpillRegion(const SpillRegion& other) = delete;
+    SpillRegion& operator=(const SpillRegion& other) = delete;
+
+    ~SpillRegion() {
+        if (_data != nullptr) munmap(_data, _capacity);
+        if (_fd != -1) close(_fd);
+    }
+
+    void grow(size_t capacity) { _map(capacity); }
+
+    [[nodiscard]] std::byte* data() const { return _data; }
+
+    // Hands the mapping over to a MessageBuffer. The file lives on for as
+    // long as it is mapped.
+    MessageBuffer release(size_t length) {
+        MessageBuffer buffer =
+            MessageBuffer::from_mapping(_data, _capacity, length);
+        _data = nullptr;
+        close(_fd);
+        _fd = -1;
+        return buffer;
+    }
+};
+
+/**
+ * Tracks idle time for a connection on a TimerService.
+ *
+ * Connections only record the time of their last activity. When the timer
+ * fires, it either shuts the socket down or re-arms itself for the remainder
+ * of the timeout, so the timer is touched at most once per timeout period.
+ */
+class TCPConnection::IdleTimer
+    : public std::enable_shared_from_this<TCPConnection::IdleTimer> {
+   private:
+    std::shared_ptr<concurrency::TimerService> _timers;
+    std::chrono::nanoseconds _timeout;
+    socket_t _socket;
+
+    std::atomic<clock_type::rep> _last_activity;
+
+    std::mutex _mutex;
+    concurrency::TimerHandle _handle;
+    bool _disarmed;
+
+    // requires _mutex
+    void _arm(clock_type::time_point expiry) {
+        std::weak_ptr<IdleTimer> self = weak_from_this();
+        _handle = _timers->schedule_at(expiry, [self]() {
+            if (auto timer = self.lock()) timer->_expire();
+        });
+    }
+
+    void _expire() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_disarmed) return;
+
+        clock_type::time_point last{clock_type::duration(
+            _last_activity.load(std::memory_order_relaxed))};
+        if (clock_type::now() - last >= _timeout) {
+            expired = true;
+            // wakes up any thread blocked on the socket
+            shutdown(_socket, SHUT_RDWR);
+        } else {
+            _arm(last + _timeout);
+        }
+    }
+
+   public:
+    std::atomic<bool> expired;
+
+    IdleTimer(std::shared_ptr<concurrency::TimerService> timers,
+              std::chrono::nanoseconds timeout, socket_t socket)
+        : _timers{std::move(timers)},
+          _timeout{timeout},
+          _socket{socket},
+          _disarmed{false},
+          expired{false} {
+        touch();
+    }
+
+    void touch() {
+        _last_activity.store(clock_type::now().time_since_epoch().count(),
+                             std::memory_order_relaxed);
+    }
+
+    void arm() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _arm(clock_type::now() + _timeout);
+    }
+
+    // once this returns the timer is guaranteed to never touch the socket
+    void disarm() {
+        concurrency::TimerHandle handle;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _disarmed = true;
+            handle = _handle;
+        }
+        _timers->cancel(handle);
+    }
+};
+
+/**
+ * Library-side counters of a connection.
+ *
+ * Shared with the registry the connection is tracked by, so statistics can be
+ * sampled from other threads while the owner keeps sending and receiving.
+ * Each counter is only written by the thread operating on the connection.
+ */
+struct ConnectionCounters {
+    std::atomic<uint64_t> bytes_sent{0};
+    std::atomic<uint64_t> bytes_received{0};
+    std::atomic<uint64_t> messages_sent{0};
+    std::atomic<uint64_t> messages_received{0};
+    std::atomic<int64_t> send_time{0};
+    std::atomic<int64_t> receive_time{0};
+
+    void read(ConnectionStats& stats) const {
+        stats.bytes_sent = bytes_sent.load(std::memory_order_relaxed);
+        stats.bytes_received = bytes_received.load(std::memory_order_relaxed);
+        stats.messages_sent = messages_sent.load(std::memory_order_relaxed);
+        stats.messages_received =
+            messages_received.load(std::memory_order_relaxed);
+        stats.send_time = std::chrono::nanoseconds(
+            send_time.load(std::memory_order_relaxed));
+        stats.receive_time = std::chrono::nanoseconds(
+            receive_time.load(std::memory_order_relaxed));
+    }
+};
+
+// Records the bytes moved and time spent by one send or receive call when it
+// goes out of scope, so failed calls are accounted for too.
+class OperationRecorder {
+   private:
+    std::atomic<uint64_t>& _bytes;
+    std::atomic<int64_t>& _time;
+    metrics::Counter* _bytes_metric;
+    metrics::Histogram* _latency_metric;
+    clock_type::time_point _start;
+
+   public:
+    size_t bytes = 0;
+
+    OperationRecorder(ConnectionCounters& counters,
+                      const ConnectionMetrics* metrics, bool sending)
+        : _bytes{sending ? counters.bytes_sent : counters.bytes_received},
+          _time{sending ? counters.send_time : counters.receive_time},
+          _bytes_metric{nullptr},
+          _latency_metric{nullptr},
+          _start{clock_type::now()} {
+        if (metrics != nullptr) {
+            _bytes_metric =
+                sending ? &metrics->bytes_sent : &metrics->bytes_received;
+            _latency_metric =
+                sending ? &metrics->send_latency : &metrics->receive_latency;
+        }
+    }
+
+    OperationRecorder(const OperationRecorder& other) = delete;
+    OperationRecorder& operator=(const OperationRecorder& other) = delete;
+
+    ~OperationRecorder() {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock_type::now() - _start);
+        _bytes.fetch_add(bytes, std::memory_order_relaxed);
+        _time.fetch_add(elapsed.count(), std::memory_order_relaxed);
+        if (_bytes_metric != nullptr) {
+            _bytes_metric->increment(bytes);
+            _latency_metric->record(elapsed);
+        }
+    }
+};
+
+// Fills in the kernel statistics of a TCP socket, returning false if the
+// operating system could not report them.
+bool read_tcp_info(socket_t socket_fd, ConnectionStats& stats) {
+#if defined(__linux__) && defined(TCP_INFO)
+    tcp_info info{};
+    socklen_t length = sizeof(info);
+    if (getsockopt(socket_fd, IPPROTO_TCP, TCP_INFO, &info, &length) == -1) {
+        return false;
+    }
+
+    stats.rtt = std::chrono::microseconds(info.tcpi_rtt);
+    stats.rtt_variance = std::chrono::microseconds(info.tcpi_rttvar);
+    stats.retransmits = info.tcpi_retransmits;
+    stats.total_retransmits = info.tcpi_total_retrans;
+    stats.lost = info.tcpi_lost;
+    stats.unacked = info.tcpi_unacked;
+    stats.congestion_window = info.tcpi_snd_cwnd;
+    stats.slow_start_threshold = info.tcpi_snd_ssthresh;
+    stats.mss = info.tcpi_snd_mss;
+#else
+    (void)socket_fd;
+    (void)stats;
+#endif
+    return true;
+}
+
+ConnectionMetrics::ConnectionMetrics(metrics::Registry& registry,
+                                     const metrics::Labels& labels)
+    : bytes_sent{registry.counter("singularity_connection_sent_bytes_total",
+                                  "Bytes sent over TCP connections", labels)},
+      bytes_received{registry.counter(
+          "singularity_connection_received_bytes_total",
+          "Bytes received over TCP connections", labels)},
+      send_latency{registry.histogram(
+          "singularity_connection_send_seconds",
+          "Time spent in each send call of TCP connections", labels)},
+      receive_latency{registry.histogram(
+          "singularity_connection_receive_seconds",
+          "Time spent in each receive call of TCP connections", labels)},
+      open_connections{registry.gauge("singularity_connections_open",
+                                      "TCP connections currently open",
+                                      labels)} {}
+
 TCPConnection::TCPConnection(socket_t sock_fd, IPSocketAddress client_address)
-    : _socket{sock_fd}, _address{std::move(client_address)} {}
+    : _socket{sock_fd},
+      _address{std::move(client_address)},
+      _counters{std::make_shared<ConnectionCounters>()},
+      _spill_threshold{0},
+      _max_frame_size{DEFAULT_MAX_FRAME_SIZE},
+      _checksums{false} {}
 
 TCPConnection::TCPConnection(IPSocketAddress address)
-    : _socket{std::nullopt}, _address{std::move(address)} {}
+    : _socket{std::nullopt},
+      _address{std::move(address)},
+      _counters{std::make_shared<ConnectionCounters>()},
+      _spill_threshold{0},
+      _max_frame_size{DEFAULT_MAX_FRAME_SIZE},
+      _checksums{false} {}
+
+void ConnectionRegistry::_add(
+    socket_t socket, std::shared_ptr<const ConnectionCounters> counters) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sockets.insert_or_assign(socket, std::move(counters));
+}
+
+void ConnectionRegistry::_remove(socket_t socket) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sockets.erase(socket);
+    if (_sockets.empty()) _released.notify_all();
+}
+
+size_t ConnectionRegistry::size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _sockets.size();
+}
+
+bool ConnectionRegistry::wait_empty(std::chrono::nanoseconds timeout) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _released.wait_for(lock, timeout,
+                              [this]() { return _sockets.empty(); });
+}
+
+size_t ConnectionRegistry::shutdown_all() {
+    // holding the lock keeps owners from closing (and the OS from reusing)
+    // any of these descriptors until we are done with them
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (const auto& entry : _sockets) {
+        shutdown(entry.first, SHUT_RDWR);
+    }
+    return _sockets.size();
+}
+
+ConnectionStatsSummary ConnectionRegistry::sample(size_t max_samples) const {
+    ConnectionStatsSummary summary;
+    std::vector<std::chrono::microseconds> rtts;
+
+    {
+        // the lock keeps sampled descriptors from being closed under us
+        std::lock_guard<std::mutex> lock(_mutex);
+        summary.connections = _sockets.size();
+        if (max_samples == 0 || _sockets.empty()) return summary;
+
+        size_t stride = std::max<size_t>(1, _sockets.size() / max_samples);
+        size_t offset = 0;
+        if (stride > 1) {
+            thread_local std::minstd_rand generator{std::random_device{}()};
+            offset = std::uniform_int_distribution<size_t>(0, stride - 1)(
+                generator);
+        }
+
+        rtts.reserve(std::min(max_samples, _sockets.size()));
+        size_t position = 0;
+        for (const auto& [socket, counters] : _sockets) {
+            if (summary.sampled == max_samples) break;
+            if (position++ % stride != offset) continue;
+
+            ConnectionStats stats;
+            counters->read(stats);
+            if (!read_tcp_info(socket, stats)) continue;
+
+            ++summary.sampled;
+            summary.bytes_sent += stats.bytes_sent;
+            summary.bytes_received += stats.bytes_received;
+            summary.messages_sent += stats.messages_sent;
+            summary.messages_received += stats.messages_received;
+            summary.send_time += stats.send_time;
+            summary.receive_time += stats.receive_time;
+            summary.total_retransmits += stats.total_retransmits;
+            summary.lost += stats.lost;
+            rtts.push_back(stats.rtt);
+        }
+    }
+
+    if (!rtts.empty()) {
+        std::sort(rtts.begin(), rtts.end());
+        auto percentile = [&rtts](size_t percent) {
+            return rtts[(rtts.size() - 1) * percent / 100];
+        };
+        summary.rtt_p50 = percentile(50);
+        summary.rtt_p99 = percentile(99);
+        summary.rtt_max = rtts.back();
+    }
+    return summary;
+}
 
 TCPConnection::TCPConnection(TCPConnection&& other) noexcept
-    : _socket{other._socket}, _address{other._address} {
+    : _socket{other._socket},
+      _address{other._address},
+      _idle_timer{std::move(other._idle_timer)},
+      _registry{std::move(other._registry)},
+      _counters{std::move(other._counters)},
+      _spill_threshold{other._spill_threshold},
+      _spill_directory{std::move(other._spill_directory)},
+      _compressor{std::move(other._compressor)},
+      _max_frame_size{other._max_frame_size},
+      _checksums{other._checksums},
+      _byte_limit{std::move(other._byte_limit)},
+      _message_limit{std::move(other._message_limit)},
+      _metrics{std::move(other._metrics)} {
     other._socket.reset();  // avoid double free on file descriptor
 }
 
 TCPConnection& TCPConnection::operator=(TCPConnection&& other) noexcept {
-    _socket = other._socket;
-    _address = other._address;
-    other._socket.reset();
+    if (this != &other) {
+        // release the connection we were managing before taking over
+        try {
+            terminate();
+        } catch (const std::system_error&) {
+        }
+
+        _socket = other._socket;
+        _address = other._address;
+        _idle_timer = std::move(other._idle_timer);
+        _registry = std::move(other._registry);
+        _counters = std::move(other._counters);
+        _spill_threshold = other._spill_threshold;
+        _spill_directory = std::move(other._spill_directory);
+        _compressor = std::move(other._compressor);
+        _max_frame_size = other._max_frame_size;
+        _checksums = other._checksums;
+        _byte_limit = std::move(other._byte_limit);
+        _message_limit = std::move(other._message_limit);
+        _metrics = std::move(other._metrics);
+        other._socket.reset();
+    }
     return *this;
 }
 
@@ -161,17 +711,34 @@ TCPConnection::~TCPConnection() { terminate(); }
 
 void TCPConnection::open() {
     if (!_socket.has_value()) {
+        // a moved-from connection gave its counters away
+        if (_counters == nullptr) {
+            _counters = std::make_shared<ConnectionCounters>();
+        }
         _socket = socket(AF_INET, SOCK_STREAM, 0);
         int status = connect(*_socket, _address.data(), _address.length());
         if (status == -1) {
             throw std::system_error(errno, std::system_category(),
                                     "Unable to open TCP connection");
         }
+        if (_metrics != nullptr) _metrics->open_connections.add();
     }
 }
 
 void TCPConnection::terminate() {
+    if (_idle_timer != nullptr) {
+        // the timer must be stopped before the descriptor can be reused
+        _idle_timer->disarm();
+        _idle_timer.reset();
+    }
+
     if (_socket.has_value()) {
+        if (_registry != nullptr) {
+            _registry->_remove(*_socket);
+            _registry.reset();
+        }
+        if (_metrics != nullptr) _metrics->open_connections.subtract();
+
         int status = close(*_socket);
 
         if (status == -1) {
@@ -183,6 +750,15 @@ void TCPConnection::terminate() {
     }
 }
 
+void TCPConnection::abort() {
+    if (_socket.has_value()) {
+        // a zero linger timeout makes close() discard unsent data and reset
+        linger option{1, 0};
+        setsockopt(*_socket, SOL_SOCKET, SO_LINGER, &option, sizeof(option));
+        terminate();
+    }
+}
+
 void TCPConnection::disable_send() {
     if (_socket.has_value()) {
         disable(*_socket, SHUT_WR);
@@ -197,53 +773,371 @@ void TCPConnection::disable_receive() {
 
 bool TCPConnection::active() const { return _socket.has_value(); }
 
+ConnectionStats TCPConnection::stats() const {
+    ConnectionStats stats;
+    if (_counters != nullptr) _counters->read(stats);
+
+    if (_socket.has_value() && !read_tcp_info(*_socket, stats)) {
+        throw std::system_error(errno, std::system_category(),
+                                "Unable to read connection statistics");
+    }
+    return stats;
+}
+
+void TCPConnection::_check_idle(const char* message) const {
+    if (_idle_timer != nullptr && _idle_timer->expired) {
+        throw TimeoutError(message);
+    }
+}
+
+uint64_t TCPConnection::_trace_id() const {
+    return reinterpret_cast<uintptr_t>(_counters.get());
+}
+
 void TCPConnection::send_message(const MessageBuffer& buffer) {
+    send_message(buffer, NO_DEADLINE);
+}
+
+void TCPConnection::_send_bytes(const std::byte* data, size_t length,
+                                clock_type::time_point deadline) {
     if (!_socket.has_value()) {
         throw InactiveConnectionError("Unable to send message");
     }
+    _check_idle("Unable to send message: connection idle timeout expired");
 
-    const std::byte* next_byte = buffer.raw();
-    size_t remaining_bytes = buffer.length();
+    const std::byte* next_byte = data;
+    size_t remaining_bytes = length;
     ssize_t bytes_sent = 0;
+    OperationRecorder recorder(*_counters, _metrics.get(), true);
 
     do {
-        bytes_sent = send(*_socket, next_byte, remaining_bytes, 0);
+        wait_ready(*_socket, POLLOUT, deadline,
+                   "Unable to send message: deadline exceeded");
+        bytes_sent = send(*_socket, next_byte, remaining_bytes, SEND_FLAGS);
 
         if (bytes_sent == -1) {
+            _check_idle(
+                "Unable to send message: connection idle timeout expired");
             throw std::system_error(errno, std::system_category(),
                                     "Failure to send message");
         }
+        if (_idle_timer != nullptr) _idle_timer->touch();
 
         auto offset = static_cast<size_t>(bytes_sent);
         remaining_bytes -= offset;
         next_byte += offset;
+        recorder.bytes += offset;
     } while (remaining_bytes > 0);
 }
 
+void TCPConnection::send_message(const MessageBuffer& buffer,
+                                 clock_type::time_point deadline) {
+    tracing::Span span("send_message", _trace_id());
+    _send_bytes(buffer.raw(), buffer.length(), deadline);
+    _counters->messages_sent.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Runs a ChunkProducer on a helper thread, double buffering its output.
+ *
+ * The producer fills one slot while the consumer drains the other. Slots are
+ * handed back and forth under a single mutex, which is only held to flip the
+ * `full` flags, never while producing or sending.
+ */
+class ChunkPipeline {
+   private:
+    struct Slot {
+        std::unique_ptr<std::byte[]> data;
+        size_t length = 0;
+        bool full = false;
+        // raised when the consumer reaches this slot, so chunks produced
+        // before a failure are still sent
+        std::exception_ptr error;
+    };
+
+    const ChunkProducer& _producer;
+    size_t _chunk_size;
+    std::array<Slot, 2> _slots;
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    bool _stop;
+    std::thread _thread;
+
+    void _produce() {
+        for (size_t turn = 0;; ++turn) {
+            Slot& slot = _slots[turn % 2];
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _changed.wait(lock, [this, &slot]() {
+                    return _stop || !slot.full;
+                });
+                if (_stop) return;
+            }
+
+            size_t length = 0;
+            std::exception_ptr error;
+            try {
+                length = std::min(_producer(slot.data.get(), _chunk_size),
+                                  _chunk_size);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                slot.length = length;
+                slot.full = true;
+                slot.error = error;
+            }
+            _changed.notify_one();
+            if (length == 0) return;
+        }
+    }
+
+   public:
+    ChunkPipeline(const ChunkProducer& producer, size_t chunk_size)
+        : _producer{producer}, _chunk_size{chunk_size}, _stop{false} {
+        for (Slot& slot : _slots) {
+            slot.data = std::make_unique_for_overwrite<std::byte[]>(chunk_size);
+        }
+        _thread = std::thread([this]() { _produce(); });
+    }
+
+    ChunkPipeline(const ChunkPipeline& other) = delete;
+    ChunkPipeline& operator=(const ChunkPipeline& other) = delete;
+
+    ~ChunkPipeline() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _changed.notify_one();
+        _thread.join();
+    }
+
+    // Sends every produced chunk, returning the total number of bytes.
+    template <typename Sender>
+    size_t drain(Sender&& send_chunk) {
+        size_t total_bytes = 0;
+        for (size_t turn = 0;; ++turn) {
+            Slot& slot = _slots[turn % 2];
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _changed.wait(lock, [&slot]() { return slot.full; });
+                if (slot.error) std::rethrow_exception(slot.error);
+            }
+            if (slot.length == 0) return total_bytes;
+
+            send_chunk(slot.data.get(), slot.length);
+            total_bytes += slot.length;
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                slot.full = false;
+            }
+            _changed.notify_one();
+        }
+    }
+};
+
+size_t TCPConnection::send_stream(const ChunkProducer& producer,
+                                  size_t chunk_size,
+                                  clock_type::time_point deadline) {
+    tracing::Span span("send_stream", _trace_id());
+    if (chunk_size == 0) {
+        throw std::invalid_argument("Chunk size must be positive");
+    }
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to send message");
+    }
+
+    ChunkPipeline pipeline(producer, chunk_size);
+    size_t total_bytes =
+        pipeline.drain([this, deadline](const std::byte* data, size_t length) {
+            _send_bytes(data, length, deadline);
+        });
+
+    _counters->messages_sent.fetch_add(1, std::memory_order_relaxed);
+    return total_bytes;
+}
+
+size_t TCPConnection::send_file(int file_fd, off_t offset, size_t length,
+                                clock_type::time_point deadline) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to send message");
+    }
+    _check_idle("Unable to send message: connection idle timeout expired");
+
+#ifdef __linux__
+    {
+        size_t total_bytes = 0;
+        bool supported = true;
+        OperationRecorder recorder(*_counters, _metrics.get(), true);
+
+        while (total_bytes < length) {
+            wait_ready(*_socket, POLLOUT, deadline,
+                       "Unable to send message: deadline exceeded");
+            // the kernel caps a single transfer just below 2 GiB
+            size_t request = std::min<size_t>(length - total_bytes, 1 << 30);
+            ssize_t bytes_sent = sendfile(*_socket, file_fd, &offset, request);
+
+            if (bytes_sent == -1) {
+                // only fall back before anything was sent, so the stream
+                // never contains a gap
+                if (total_bytes == 0 && (errno == EINVAL || errno == ESPIPE ||
+                                         errno == ENOSYS)) {
+                    supported = false;
+                    break;
+                }
+                _check_idle(
+                    "Unable to send message: connection idle timeout expired");
+                throw std::system_error(errno, std::system_category(),
+                                        "Failure to send file");
+            }
+            if (bytes_sent == 0) break;  // end of file
+            if (_idle_timer != nullptr) _idle_timer->touch();
+
+            total_bytes += static_cast<size_t>(bytes_sent);
+            recorder.bytes += static_cast<size_t>(bytes_sent);
+        }
+
+        if (supported) {
+            _counters->messages_sent.fetch_add(1, std::memory_order_relaxed);
+            return total_bytes;
+        }
+    }
+#endif
+
+    // positioned reads keep the descriptor's own offset untouched, plain
+    // reads cover pipes and sockets
+    bool positioned = true;
+    size_t remaining = length;
+    auto producer = [&](std::byte* chunk, size_t capacity) -> size_t {
+        size_t request = std::min(capacity, remaining);
+        if (request == 0) return 0;
+
+        ssize_t bytes_read;
+        while (true) {
+            bytes_read = positioned ? pread(file_fd, chunk, request, offset)
+                                    : read(file_fd, chunk, request);
+            if (bytes_read != -1) break;
+
+            if (positioned && errno == ESPIPE && offset == 0) {
+                positioned = false;
+            } else if (errno != EINTR) {
+                throw std::system_error(errno, std::system_category(),
+                                        "Unable to read file");
+            }
+        }
+        offset += bytes_read;
+        remaining -= static_cast<size_t>(bytes_read);
+        return static_cast<size_t>(bytes_read);
+    };
+
+    size_t chunk_size = std::clamp<size_t>(remaining, 1, DEFAULT_CHUNK_SIZE);
+    return send_stream(producer, chunk_size, deadline);
+}
+
 MessageBuffer TCPConnection::receive_message() {
+    return receive_message(NO_DEADLINE);
+}
+
+size_t TCPConnection::_receive_chunk(std::byte* chunk, size_t capacity,
+                                     clock_type::time_point deadline) {
     if (!_socket.has_value()) {
         throw InactiveConnectionError("Unable to receive message");
     }
+    _check_idle("Unable to receive message: connection idle timeout expired");
 
-    auto buffer = std::make_unique<std::byte[]>(MIN_BUFFER_SIZE);
-    size_t buffer_capacity = MIN_BUFFER_SIZE;
+    capacity = _throttle(capacity, deadline);
+    OperationRecorder recorder(*_counters, _metrics.get(), false);
+    wait_ready(*_socket, POLLIN, deadline,
+               "Unable to receive message: deadline exceeded");
+    ssize_t bytes_received = recv(*_socket, chunk, capacity, 0);
 
-    std::byte* next_byte = buffer.get();
-    size_t bytes_written = 0;
-    ssize_t bytes_received = 0;
+    if (bytes_received == -1) {
+        _check_idle(
+            "Unable to receive message: connection idle timeout expired");
+        throw std::system_error(errno, std::system_category(),
+                                "Error in receiving message");
+    }
+    if (_idle_timer != nullptr) _idle_timer->touch();
 
-    do {
-        bytes_received =
-            recv(*_socket, next_byte, buffer_capacity - bytes_written, 0);
+    if (bytes_received == 0) {
+        // a timed out connection looks like end of stream, don't mistake the
+        // partial message for a complete one
+        _check_idle(
+            "Unable to receive message: connection idle timeout expired");
+    }
 
-        if (bytes_received == -1) {
-            throw std::system_error(errno, std::system_category(),
-                                    "Error in receiving message");
+    recorder.bytes = static_cast<size_t>(bytes_received);
+    if (_byte_limit != nullptr && recorder.bytes > 0) {
+        _byte_limit->consume(static_cast<double>(recorder.bytes));
+    }
+    return recorder.bytes;
+}
+
+size_t TCPConnection::_throttle(size_t capacity,
+                                clock_type::time_point deadline) {
+    if (_byte_limit == nullptr && _message_limit == nullptr) return capacity;
+
+    auto now = clock_type::now();
+    std::chrono::nanoseconds delay{0};
+    for (const auto* limit : {&_byte_limit, &_message_limit}) {
+        if (*limit != nullptr) delay = std::max(delay, (*limit)->delay(now));
+    }
+    if (delay > std::chrono::nanoseconds::zero()) {
+        if (delay > deadline - now) {
+            std::this_thread::sleep_until(deadline);
+            throw TimeoutError("Unable to receive message: deadline exceeded");
         }
+        std::this_thread::sleep_for(delay);
+    }
 
-        auto offset = static_cast<size_t>(bytes_received);
-        bytes_written += offset;
-        next_byte += offset;
+    if (_byte_limit == nullptr) return capacity;
+    auto burst = static_cast<size_t>(_byte_limit->burst());
+    return std::clamp<size_t>(capacity, 1, std::max<size_t>(burst, 1));
+}
+
+void TCPConnection::_count_received() {
+    _counters->messages_received.fetch_add(1, std::memory_order_relaxed);
+    if (_message_limit != nullptr) _message_limit->consume(1);
+}
+
+void TCPConnection::set_receive_limits(std::shared_ptr<TokenBucket> bytes,
+                                       std::shared_ptr<TokenBucket> messages) {
+    _byte_limit = std::move(bytes);
+    _message_limit = std::move(messages);
+}
+
+void TCPConnection::set_metrics(
+    std::shared_ptr<const ConnectionMetrics> metrics) {
+    // the open connection gauge follows the connection to its new metrics
+    if (_socket.has_value()) {
+        if (_metrics != nullptr) _metrics->open_connections.subtract();
+        if (metrics != nullptr) metrics->open_connections.add();
+    }
+    _metrics = std::move(metrics);
+}
+
+MessageBuffer TCPConnection::receive_message(clock_type::time_point deadline) {
+    tracing::Span span("receive_message", _trace_id());
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to receive message");
+    }
+
+    auto buffer = std::make_unique_for_overwrite<std::byte[]>(MIN_BUFFER_SIZE);
+    std::optional<SpillRegion> spill;
+    std::byte* data = buffer.get();
+    size_t buffer_capacity = MIN_BUFFER_SIZE;
+    size_t bytes_written = 0;
+    size_t bytes_received = 0;
+
+    do {
+        bytes_received = _receive_chunk(
+            data + bytes_written, buffer_capacity - bytes_written, deadline);
+        bytes_written += bytes_received;
 
         if (bytes_written + BUFFER_EPSILON >= buffer_capacity) {
             // grow buffer eagerly in anticipation of more data
@@ -251,20 +1145,976 @@ MessageBuffer TCPConnection::receive_message() {
             // NOTE: we can dynamically tune epsilon in response
             // to stream patterns for performance. Not necessary atm though.
             buffer_capacity *= 2;
-            auto copy = std::make_unique<std::byte[]>(buffer_capacity);
-            memcpy(copy.get(), buffer.get(), bytes_written);
-            buffer.swap(copy);
-            next_byte = buffer.get() + bytes_written;
+            if (spill.has_value()) {
+                spill->grow(buffer_capacity);
+                data = spill->data();
+            } else if (_spill_threshold > 0 &&
+                       buffer_capacity > _spill_threshold) {
+                // the last copy this message sees, from here on it grows in
+                // place inside the file
+                spill.emplace(_spill_directory, buffer_capacity);
+                memcpy(spill->data(), buffer.get(), bytes_written);
+                buffer.reset();
+                data = spill->data();
+            } else {
+                auto copy = std::make_unique_for_overwrite<std::byte[]>(
+                    buffer_capacity);
+                memcpy(copy.get(), buffer.get(), bytes_written);
+                buffer.swap(copy);
+                data = buffer.get();
+            }
         }
     } while (bytes_received != 0);
 
-    return {buffer.get(), bytes_written};
+    _count_received();
+    if (spill.has_value()) return spill->release(bytes_written);
+
+    // hand the allocation over instead of copying the message out of it
+    return {std::move(buffer), bytes_written};
 }
 
-std::string create_error(const char* prefix) {
-    return singularity::utils::build_string(prefix, ": connection is inactive");
+size_t TCPConnection::receive_stream(const ChunkHandler& handler,
+                                     size_t chunk_size,
+                                     clock_type::time_point deadline) {
+    tracing::Span span("receive_stream", _trace_id());
+    ChunkReader reader(*this, chunk_size, deadline);
+
+    size_t total_bytes = 0;
+    while (auto chunk = reader.next()) {
+        handler(chunk->data(), chunk->size());
+        total_bytes += chunk->size();
+    }
+    return total_bytes;
+}
+
+void TCPConnection::_send_vectored(iovec* vectors, size_t count,
+                                   clock_type::time_point deadline) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to send message");
+    }
+    _check_idle("Unable to send message: connection idle timeout expired");
+
+    OperationRecorder recorder(*_counters, _metrics.get(), true);
+    while (count > 0) {
+        wait_ready(*_socket, POLLOUT, deadline,
+                   "Unable to send message: deadline exceeded");
+
+        msghdr message{};
+        message.msg_iov = vectors;
+        message.msg_iovlen = static_cast<decltype(message.msg_iovlen)>(count);
+        ssize_t bytes_sent = sendmsg(*_socket, &message, SEND_FLAGS);
+
+        if (bytes_sent == -1) {
+            _check_idle(
+                "Unable to send message: connection idle timeout expired");
+            throw std::system_error(errno, std::system_category(),
+                                    "Failure to send message");
+        }
+        if (_idle_timer != nullptr) _idle_timer->touch();
+
+        // skip past whatever was sent, fully sent vectors first
+        auto offset = static_cast<size_t>(bytes_sent);
+        recorder.bytes += offset;
+        while (count > 0 && offset >= vectors->iov_len) {
+            offset -= vectors->iov_len;
+            ++vectors;
+            --count;
+        }
+        if (count > 0) {
+            vectors->iov_base = static_cast<char*>(vectors->iov_base) + offset;
+            vectors->iov_len -= offset;
+        }
+    }
 }
 
+bool TCPConnection::_receive_exact(std::byte* data, size_t length,
+                                   bool allow_end,
+                                   clock_type::time_point deadline) {
+    size_t bytes_written = 0;
+    while (bytes_written < length) {
+        size_t bytes_received = _receive_chunk(
+            data + bytes_written, length - bytes_written, deadline);
+        if (bytes_received == 0) {
+            if (allow_end && bytes_written == 0) return false;
+            throw ProtocolError("Connection closed in the middle of a frame");
+        }
+        bytes_written += bytes_received;
+    }
+    return true;
+}
+
+size_t TCPConnection::_send_available(const iovec* vectors, size_t count) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to send message");
+    }
+    _check_idle("Unable to send message: connection idle timeout expired");
+
+    OperationRecorder recorder(*_counters, _metrics.get(), true);
+    msghdr message{};
+    // sendmsg never writes through the vectors
+    message.msg_iov = const_cast<iovec*>(vectors);
+    message.msg_iovlen = static_cast<decltype(message.msg_iovlen)>(count);
+    ssize_t bytes_sent = sendmsg(*_socket, &message, SEND_FLAGS | MSG_DONTWAIT);
+
+    if (bytes_sent == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        _check_idle("Unable to send message: connection idle timeout expired");
+        throw std::system_error(errno, std::system_category(),
+                                "Failure to send message");
+    }
+    if (_idle_timer != nullptr) _idle_timer->touch();
+
+    recorder.bytes = static_cast<size_t>(bytes_sent);
+    return recorder.bytes;
+}
+
+void TCPConnection::_count_sent(uint64_t messages) {
+    _counters->messages_sent.fetch_add(messages, std::memory_order_relaxed);
+}
+
+TCPConnection::FrameHeader TCPConnection::_frame_header(size_t wire_length,
+                                                        size_t decoded_length,
+                                                        uint8_t flags) {
+    static_assert(sizeof(FrameHeader) == FRAME_HEADER_SIZE);
+
+    FrameHeader header{};
+    uint32_t wire = htonl(static_cast<uint32_t>(wire_length));
+    uint32_t decoded = htonl(static_cast<uint32_t>(decoded_length));
+    memcpy(header.data(), &wire, sizeof(wire));
+    memcpy(header.data() + 4, &decoded, sizeof(decoded));
+    header[8] = static_cast<std::byte>(flags);
+    return header;
+}
+
+void TCPConnection::send_frame(const MessageBuffer& buffer,
+                               clock_type::time_point deadline) {
+    send_frame(buffer.raw(), buffer.length(), deadline);
+}
+
+void TCPConnection::send_frame(const std::byte* data, size_t length,
+                               clock_type::time_point deadline) {
+    tracing::Span span("send_frame", _trace_id());
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to send message");
+    }
+    if (length > UINT32_MAX) {
+        throw std::invalid_argument("Frames are limited to 4 GiB");
+    }
+
+    const std::byte* payload = data;
+    size_t payload_length = length;
+    uint8_t flags = 0;
+
+    if (_compressor != nullptr) {
+        auto compressed = _compressor->compress(payload, payload_length);
+        if (compressed.has_value()) {
+            payload = _compressor->data();
+            payload_length = *compressed;
+            flags |= FRAME_COMPRESSED;
+        }
+    }
+
+    uint32_t checksum = 0;
+    if (_checksums) {
+        checksum = htonl(checksum::crc32c(data, length));
+        flags |= FRAME_CHECKSUM;
+    }
+
+    FrameHeader header = _frame_header(payload_length, length, flags);
+    std::array<iovec, 3> vectors = {
+        iovec{header.data(), header.size()},
+        iovec{const_cast<std::byte*>(payload), payload_length},
+        iovec{&checksum, _checksums ? FRAME_TRAILER_SIZE : 0}};
+    _send_vectored(vectors.data(), vectors.size(), deadline);
+
+    _counters->messages_sent.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::optional<MessageBuffer> TCPConnection::receive_frame(
+    clock_type::time_point deadline) {
+    std::unique_ptr<std::byte[]> message;
+    auto length = receive_frame_into(
+        [&message](size_t message_length) {
+            message = std::make_unique_for_overwrite<std::byte[]>(
+                message_length);
+            return message.get();
+        },
+        deadline);
+    if (!length.has_value()) return std::nullopt;
+    return MessageBuffer(std::move(message), *length);
+}
+
+std::optional<size_t> TCPConnection::receive_frame_into(
+    const FrameAllocator& allocate, clock_type::time_point deadline) {
+    tracing::Span span("receive_frame", _trace_id());
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to receive message");
+    }
+
+    FrameHeader header;
+    if (!_receive_exact(header.data(), header.size(), true, deadline)) {
+        return std::nullopt;
+    }
+
+    uint32_t wire_length;
+    uint32_t decoded_length;
+    memcpy(&wire_length, header.data(), sizeof(wire_length));
+    memcpy(&decoded_length, header.data() + 4, sizeof(decoded_length));
+    size_t payload_length = ntohl(wire_length);
+    size_t message_length = ntohl(decoded_length);
+    auto flags = static_cast<uint8_t>(header[8]);
+
+    if ((flags & ~FRAME_KNOWN_FLAGS) != 0) {
+        throw ProtocolError("Frame uses unsupported features");
+    }
+    if (message_length > _max_frame_size) {
+        throw ProtocolError("Frame exceeds the maximum frame size");
+    }
+    bool compressed = (flags & FRAME_COMPRESSED) != 0;
+    if (compressed ? payload_length > compression::compress_bound(
+                                          message_length)
+                   : payload_length != message_length) {
+        throw ProtocolError("Frame lengths are inconsistent");
+    }
+
+    std::byte* message = allocate(message_length);
+    if (!compressed) {
+        _receive_exact(message, message_length, false, deadline);
+    } else {
+        auto payload =
+            std::make_unique_for_overwrite<std::byte[]>(payload_length);
+        _receive_exact(payload.get(), payload_length, false, deadline);
+
+        size_t decoded;
+        try {
+            decoded = compression::decompress(payload.get(), payload_length,
+                                              message, message_length);
+        } catch (const compression::DecompressionError& error) {
+            throw ProtocolError(error.what());
+        }
+        if (decoded != message_length) {
+            throw ProtocolError("Frame decompressed to the wrong length");
+        }
+    }
+
+    if ((flags & FRAME_CHECKSUM) != 0) {
+        uint32_t checksum;
+        _receive_exact(reinterpret_cast<std::byte*>(&checksum),
+                       FRAME_TRAILER_SIZE, false, deadline);
+        if (ntohl(checksum) != checksum::crc32c(message, message_length)) {
+            throw ProtocolError("Frame failed its checksum");
+        }
+    }
+
+    _count_received();
+    return message_length;
+}
+
+void TCPConnection::set_compression(bool enabled, size_t min_size) {
+    if (enabled) {
+        _compressor = std::make_unique<compression::Compressor>(min_size);
+    } else {
+        _compressor.reset();
+    }
+}
+
+void TCPConnection::set_checksums(bool enabled) { _checksums = enabled; }
+
+void TCPConnection::set_max_frame_size(size_t max_frame_size) {
+    _max_frame_size = max_frame_size;
+}
+
+void TCPConnection::set_spill_threshold(size_t threshold,
+                                        std::string directory) {
+    _spill_threshold = threshold;
+    _spill_directory = std::move(directory);
+}
+
+void TCPConnection::set_idle_timeout(
+    std::shared_ptr<concurrency::TimerService> timers,
+    std::chrono::nanoseconds timeout) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to set idle timeout");
+    }
+
+    if (_idle_timer != nullptr) _idle_timer->disarm();
+    _idle_timer =
+        std::make_shared<IdleTimer>(std::move(timers), timeout, *_socket);
+    _idle_timer->arm();
+}
+
+void TCPConnection::track(std::shared_ptr<ConnectionRegistry> registry) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to track connection");
+    }
+
+    if (_registry != nullptr) _registry->_remove(*_socket);
+    _registry = std::move(registry);
+    _registry->_add(*_socket, _counters);
+}
+
+void TCPConnection::set_keepalive(std::chrono::seconds idle,
+                                  std::chrono::seconds interval, int probes) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to enable keepalive");
+    }
+
+    auto set_option = [this](int level, int name, int value) {
+        int status = setsockopt(*_socket, level, name, &value, sizeof(value));
+        if (status == -1) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Unable to enable keepalive");
+        }
+    };
+
+    set_option(SOL_SOCKET, SO_KEEPALIVE, 1);
+#if defined(TCP_KEEPIDLE)
+    set_option(IPPROTO_TCP, TCP_KEEPIDLE, static_cast<int>(idle.count()));
+#elif defined(TCP_KEEPALIVE)
+    set_option(IPPROTO_TCP, TCP_KEEPALIVE, static_cast<int>(idle.count()));
+#endif
+#ifdef TCP_KEEPINTVL
+    set_option(IPPROTO_TCP, TCP_KEEPINTVL, static_cast<int>(interval.count()));
+#endif
+#ifdef TCP_KEEPCNT
+    set_option(IPPROTO_TCP, TCP_KEEPCNT, probes);
+#endif
+}
+
+int TCPConnection::incoming_cpu() const {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to query incoming CPU");
+    }
+#ifdef SO_INCOMING_CPU
+    int cpu = -1;
+    socklen_t length = sizeof(cpu);
+    if (getsockopt(*_socket, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &length) ==
+        -1) {
+        return -1;
+    }
+    return cpu;
+#else
+    return -1;
+#endif
+}
+
+ChunkReader::ChunkReader(TCPConnection& connection, size_t chunk_size,
+                         clock_type::time_point deadline)
+    : _connection{connection},
+      _capacity{chunk_size},
+      _length{0},
+      _started{false},
+      _done{false},
+      _deadline{deadline} {
+    if (chunk_size == 0) {
+        throw std::invalid_argument("Chunk size must be positive");
+    }
+    _buffer = std::make_unique_for_overwrite<std::byte[]>(chunk_size);
+}
+
+std::optional<std::span<const std::byte>> ChunkReader::next() {
+    _started = true;
+    if (_done) return std::nullopt;
+
+    _length = _connection._receive_chunk(_buffer.get(), _capacity, _deadline);
+    if (_length == 0) {
+        _connection._count_received();
+        _done = true;
+        return std::nullopt;
+    }
+    return std::span<const std::byte>(_buffer.get(), _length);
+}
+
+ChunkReader::Iterator ChunkReader::begin() {
+    if (!_started) next();
+    return _done ? Iterator() : Iterator(this);
+}
+
+ChunkReader::Iterator ChunkReader::end() { return {}; }
+
+ChunkReader::Iterator::Iterator() : _reader{nullptr} {}
+
+ChunkReader::Iterator::Iterator(ChunkReader* reader) : _reader{reader} {}
+
+std::span<const std::byte> ChunkReader::Iterator::operator*() const {
+    return {_reader->_buffer.get(), _reader->_length};
+}
+
+ChunkReader::Iterator& ChunkReader::Iterator::operator++() {
+    if (!_reader->next().has_value()) _reader = nullptr;
+    return *this;
+}
+
+void ChunkReader::Iterator::operator++(int) { ++*this; }
+
+bool operator==(const ChunkReader::Iterator& lhs,
+                const ChunkReader::Iterator& rhs) {
+    return lhs._reader == rhs._reader;
+}
+
+DelimitedReader::DelimitedReader(TCPConnection& connection,
+                                 std::byte delimiter, size_t buffer_size,
+                                 size_t max_record_size,
+                                 clock_type::time_point deadline)
+    : _connection{connection},
+      _capacity{buffer_size},
+      _max_record_size{max_record_size},
+      _delimiter{delimiter},
+      _start{0},
+      _scanned{0},
+      _end{0},
+      _started{false},
+      _done{false},
+      _deadline{deadline} {
+    if (buffer_size == 0) {
+        throw std::invalid_argument("Buffer size must be positive");
+    }
+    _buffer = std::make_unique_for_overwrite<std::byte[]>(buffer_size);
+}
+
+void DelimitedReader::_make_room() {
+    if (_start > 0) {
+        // only the incomplete record is moved, complete ones have already
+        // been handed out in place
+        memmove(_buffer.get(), _buffer.get() + _start, _end - _start);
+        _scanned -= _start;
+        _end -= _start;
+        _start = 0;
+        return;
+    }
+
+    // a single record fills the buffer, leave room for it and its delimiter
+    size_t capacity = std::min(_capacity * 2, _max_record_size + 1);
+    auto buffer = std::make_unique_for_overwrite<std::byte[]>(capacity);
+    memcpy(buffer.get(), _buffer.get(), _end);
+    _buffer = std::move(buffer);
+    _capacity = capacity;
+}
+
+std::optional<std::span<const std::byte>> DelimitedReader::next() {
+    _started = true;
+    _record = {};
+    if (_done) return std::nullopt;
+
+    // the buffer can be larger than a record, so complete records are
+    // checked as well as incomplete ones
+    auto check_length = [this](size_t length) {
+        if (length > _max_record_size) {
+            throw ProtocolError(utils::build_string(
+                "Record exceeds the maximum record size of ",
+                _max_record_size, " bytes"));
+        }
+    };
+
+    while (true) {
+        const std::byte* found = scan::find_byte(
+            _buffer.get() + _scanned, _end - _scanned, _delimiter);
+        if (found != nullptr) {
+            auto position = static_cast<size_t>(found - _buffer.get());
+            check_length(position - _start);
+            _record = {_buffer.get() + _start, position - _start};
+            _start = position + 1;
+            _scanned = _start;
+            break;
+        }
+        _scanned = _end;
+
+        check_length(_end - _start);
+        if (_end == _capacity) _make_room();
+
+        size_t received = _connection._receive_chunk(
+            _buffer.get() + _end, _capacity - _end, _deadline);
+        if (received == 0) {
+            _done = true;
+            // a trailing record without a delimiter is still a record
+            if (_start == _end) return std::nullopt;
+            check_length(_end - _start);
+            _record = {_buffer.get() + _start, _end - _start};
+            _start = _end;
+            _scanned = _end;
+            break;
+        }
+        _end += received;
+    }
+
+    _connection._count_received();
+    return _record;
+}
+
+DelimitedReader::Iterator DelimitedReader::begin() {
+    if (!_started) next();
+    // empty records still point into the buffer, only the end has no data
+    return _record.data() == nullptr ? Iterator() : Iterator(this);
+}
+
+DelimitedReader::Iterator DelimitedReader::end() { return {}; }
+
+DelimitedReader::Iterator::Iterator() : _reader{nullptr} {}
+
+DelimitedReader::Iterator::Iterator(DelimitedReader* reader)
+    : _reader{reader} {}
+
+std::span<const std::byte> DelimitedReader::Iterator::operator*() const {
+    return _reader->_record;
+}
+
+DelimitedReader::Iterator& DelimitedReader::Iterator::operator++() {
+    if (!_reader->next().has_value()) _reader = nullptr;
+    return *this;
+}
+
+void DelimitedReader::Iterator::operator++(int) { ++*this; }
+
+bool operator==(const DelimitedReader::Iterator& lhs,
+                const DelimitedReader::Iterator& rhs) {
+    return lhs._reader == rhs._reader;
+}
+
+#ifdef __linux__
+constexpr size_t CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+#endif
+
+class UDPSocket::BatchState {
+   public:
+    size_t batch_size;
+    size_t slot_size;
+    bool gso_supported;
+    bool gro_enabled;
+    // datagrams dropped because they did not fit a slot
+    size_t truncated;
+
+    std::unique_ptr<std::byte[]> slab;
+    std::vector<sockaddr_storage> addresses;
+    std::vector<iovec> vectors;
+#ifdef __linux__
+    std::vector<mmsghdr> headers;
+    std::vector<std::array<char, CONTROL_SIZE>> controls;
+#endif
+
+    BatchState(size_t batch_size, size_t slot_size)
+        : batch_size{batch_size},
+          slot_size{slot_size},
+          gso_supported{false},
+          gro_enabled{false},
+          truncated{0},
+          addresses(batch_size),
+          vectors(batch_size)
+#ifdef __linux__
+          ,
+          headers(batch_size),
+          controls(batch_size)
+#endif
+    {
+        slab.reset(new std::byte[batch_size * slot_size]);
+    }
+
+    void resize_slots(size_t size) {
+        slab.reset(new std::byte[batch_size * size]);
+        slot_size = size;
+    }
+};
+
+UDPSocket::UDPSocket(size_t batch_size, size_t max_datagram_size) {
+    if (batch_size == 0 || max_datagram_size == 0) {
+        throw std::invalid_argument(
+            "UDP batch size and datagram size must be greater than 0");
+    }
+
+    socket_t sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock_fd == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "Unable to allocate UDP socket");
+    }
+    _socket = sock_fd;
+    _state = std::make_unique<BatchState>(
+        batch_size, std::min(max_datagram_size, MAX_UDP_PAYLOAD));
+
+#ifdef UDP_SEGMENT
+    // the option only exists on kernels that implement segmentation offload
+    int segment = 0;
+    socklen_t option_length = sizeof(segment);
+    _state->gso_supported = getsockopt(sock_fd, SOL_UDP, UDP_SEGMENT, &segment,
+                                       &option_length) == 0;
+#endif
+}
+
+UDPSocket::UDPSocket(UDPSocket&& other) noexcept
+    : _socket{other._socket}, _state{std::move(other._state)} {
+    other._socket.reset();
+}
+
+UDPSocket& UDPSocket::operator=(UDPSocket&& other) noexcept {
+    if (this != &other) {
+        // release the socket we were managing before taking over
+        try {
+            terminate();
+        } catch (const std::system_error&) {
+        }
+
+        _socket = other._socket;
+        _state = std::move(other._state);
+        other._socket.reset();
+    }
+    return *this;
+}
+
+UDPSocket::~UDPSocket() { terminate(); }
+
+void UDPSocket::bind(const IPSocketAddress& address) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to bind UDP socket");
+    }
+
+    int status = ::bind(*_socket, address.data(), address.length());
+    if (status == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "Unable to bind UDP socket to given address");
+    }
+}
+
+IPSocketAddress UDPSocket::local_address() const {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to query UDP socket address");
+    }
+
+    sockaddr_storage storage{};
+    socklen_t length = sizeof(storage);
+    int status =
+        getsockname(*_socket, reinterpret_cast<sockaddr*>(&storage), &length);
+    if (status == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "Unable to query UDP socket address");
+    }
+    return {reinterpret_cast<const sockaddr*>(&storage), length};
+}
+
+void UDPSocket::send_batch(const std::vector<Datagram>& datagrams) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to send datagrams");
+    }
+
+    size_t sent = 0;
+    while (sent < datagrams.size()) {
+#ifdef __linux__
+        size_t count = std::min(_state->batch_size, datagrams.size() - sent);
+        for (size_t index = 0; index < count; ++index) {
+            const Datagram& datagram = datagrams[sent + index];
+            iovec& vector = _state->vectors[index];
+            vector.iov_base = const_cast<std::byte*>(datagram.message.raw());
+            vector.iov_len = datagram.message.length();
+
+            msghdr& header = _state->headers[index].msg_hdr;
+            header = msghdr{};
+            header.msg_name = const_cast<sockaddr*>(datagram.address.data());
+            header.msg_namelen = datagram.address.length();
+            header.msg_iov = &vector;
+            header.msg_iovlen = 1;
+        }
+
+        int status = sendmmsg(*_socket, _state->headers.data(),
+                              static_cast<unsigned int>(count), 0);
+        if (status == -1) {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::system_category(),
+                                    "Failure to send datagrams");
+        }
+        sent += static_cast<size_t>(status);
+#else
+        const Datagram& datagram = datagrams[sent];
+        ssize_t status =
+            sendto(*_socket, datagram.message.raw(), datagram.message.length(),
+                   0, datagram.address.data(), datagram.address.length());
+        if (status == -1) {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::system_category(),
+                                    "Failure to send datagrams");
+        }
+        ++sent;
+#endif
+    }
+}
+
+void UDPSocket::send_segmented(const IPSocketAddress& destination,
+                               const MessageBuffer& buffer,
+                               uint16_t segment_size) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to send datagrams");
+    }
+    if (segment_size == 0) {
+        throw std::invalid_argument("Segment size must be greater than 0");
+    }
+    if (segment_size > MAX_UDP_PAYLOAD) {
+        throw std::invalid_argument(
+            "Segment size exceeds the maximum UDP payload");
+    }
+
+    // splits data into datagrams in user space and sends them as a batch
+    auto send_split = [&](const std::byte* data, size_t length) {
+        std::vector<Datagram> segments;
+        segments.reserve((length + segment_size - 1) / segment_size);
+        while (length > 0) {
+            size_t segment = std::min<size_t>(segment_size, length);
+            segments.push_back({destination, MessageBuffer(data, segment)});
+            data += segment;
+            length -= segment;
+        }
+        send_batch(segments);
+    };
+
+    const std::byte* next_byte = buffer.raw();
+    size_t remaining_bytes = buffer.length();
+
+#ifdef UDP_SEGMENT
+    // largest train the kernel will split in one call
+    size_t train_size =
+        std::min(MAX_GSO_SEGMENTS, MAX_UDP_PAYLOAD / segment_size) *
+        segment_size;
+
+    while (_state->gso_supported && remaining_bytes > 0) {
+        size_t length = std::min(train_size, remaining_bytes);
+
+        iovec vector{const_cast<std::byte*>(next_byte), length};
+        std::array<char, CONTROL_SIZE> control{};
+
+        msghdr header{};
+        header.msg_name = const_cast<sockaddr*>(destination.data());
+        header.msg_namelen = destination.length();
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+        header.msg_control = control.data();
+        header.msg_controllen = control.size();
+
+        cmsghdr* message = CMSG_FIRSTHDR(&header);
+        message->cmsg_level = SOL_UDP;
+        message->cmsg_type = UDP_SEGMENT;
+        message->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(message), &segment_size, sizeof(segment_size));
+
+        ssize_t status = sendmsg(*_socket, &header, 0);
+        if (status == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL) {
+                // segment does not fit the path MTU, so this train is split
+                // in user space and the next one is offered to GSO again
+                send_split(next_byte, length);
+                next_byte += length;
+                remaining_bytes -= length;
+                continue;
+            }
+            if (errno == EIO || errno == ENOPROTOOPT) {
+                // device cannot offload, segment in user space from now on
+                _state->gso_supported = false;
+                break;
+            }
+            throw std::system_error(errno, std::system_category(),
+                                    "Failure to send segmented datagrams");
+        }
+
+        next_byte += length;
+        remaining_bytes -= length;
+    }
+#endif
+
+    send_split(next_byte, remaining_bytes);
+}
+
+size_t UDPSocket::receive_batch(const DatagramHandler& handler) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to receive datagrams");
+    }
+
+    BatchState& state = *_state;
+    size_t delivered = 0;
+
+    auto deliver = [&](const sockaddr_storage& storage, socklen_t length,
+                       const std::byte* data, size_t data_length,
+                       size_t segment_size) {
+        IPSocketAddress address(reinterpret_cast<const sockaddr*>(&storage),
+                                length);
+        // empty datagrams are valid and still delivered once
+        size_t offset = 0;
+        do {
+            handler(address, data + offset,
+                    std::min(segment_size, data_length - offset));
+            ++delivered;
+            offset += segment_size;
+        } while (offset < data_length);
+    };
+
+#ifdef __linux__
+    for (size_t index = 0; index < state.batch_size; ++index) {
+        iovec& vector = state.vectors[index];
+        vector.iov_base = state.slab.get() + index * state.slot_size;
+        vector.iov_len = state.slot_size;
+
+        msghdr& header = state.headers[index].msg_hdr;
+        header = msghdr{};
+        header.msg_name = &state.addresses[index];
+        header.msg_namelen = sizeof(sockaddr_storage);
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+        if (state.gro_enabled) {
+            header.msg_control = state.controls[index].data();
+            header.msg_controllen = CONTROL_SIZE;
+        }
+    }
+
+    int count = -1;
+    do {
+        count = recvmmsg(*_socket, state.headers.data(),
+                         static_cast<unsigned int>(state.batch_size),
+                         MSG_WAITFORONE, nullptr);
+    } while (count == -1 && errno == EINTR);
+
+    if (count == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        throw std::system_error(errno, std::system_category(),
+                                "Error in receiving datagrams");
+    }
+
+    for (size_t index = 0; index < static_cast<size_t>(count); ++index) {
+        const mmsghdr& received = state.headers[index];
+        if ((received.msg_hdr.msg_flags & MSG_TRUNC) != 0) {
+            ++state.truncated;
+            continue;
+        }
+        size_t length = received.msg_len;
+        size_t segment_size = length;
+
+#ifdef UDP_GRO
+        // coalesced packets carry the size of the original datagrams
+        for (cmsghdr* message = CMSG_FIRSTHDR(&received.msg_hdr);
+             message != nullptr;
+             message = CMSG_NXTHDR(
+                 const_cast<msghdr*>(&received.msg_hdr), message)) {
+            if (message->cmsg_level == SOL_UDP &&
+                message->cmsg_type == UDP_GRO) {
+                int gro_size = 0;
+                memcpy(&gro_size, CMSG_DATA(message), sizeof(gro_size));
+                if (gro_size > 0) {
+                    segment_size = static_cast<size_t>(gro_size);
+                }
+            }
+        }
+#endif
+
+        deliver(state.addresses[index], received.msg_hdr.msg_namelen,
+                state.slab.get() + index * state.slot_size, length,
+                segment_size);
+    }
+#else
+    for (size_t index = 0; index < state.batch_size; ++index) {
+        iovec vector{state.slab.get(), state.slot_size};
+        msghdr header{};
+        header.msg_name = &state.addresses[0];
+        header.msg_namelen = sizeof(sockaddr_storage);
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+
+        int flags = index == 0 ? 0 : MSG_DONTWAIT;
+        ssize_t status = recvmsg(*_socket, &header, flags);
+        if (status == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            throw std::system_error(errno, std::system_category(),
+                                    "Error in receiving datagrams");
+        }
+        if ((header.msg_flags & MSG_TRUNC) != 0) {
+            ++state.truncated;
+            continue;
+        }
+        auto received = static_cast<size_t>(status);
+        deliver(state.addresses[0], header.msg_namelen, state.slab.get(),
+                received, received);
+    }
+#endif
+
+    return delivered;
+}
+
+std::vector<Datagram> UDPSocket::receive_batch() {
+    std::vector<Datagram> datagrams;
+    receive_batch([&datagrams](const IPSocketAddress& address,
+                               const std::byte* data, size_t length) {
+        datagrams.push_back({address, MessageBuffer(data, length)});
+    });
+    return datagrams;
+}
+
+void UDPSocket::set_receive_timeout(std::chrono::microseconds timeout) {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to set receive timeout");
+    }
+
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    timeval value{};
+    value.tv_sec = static_cast<time_t>(seconds.count());
+    value.tv_usec = static_cast<suseconds_t>((timeout - seconds).count());
+
+    int status =
+        setsockopt(*_socket, SOL_SOCKET, SO_RCVTIMEO, &value, sizeof(value));
+    if (status == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "Unable to set receive timeout");
+    }
+}
+
+bool UDPSocket::enable_receive_offload() {
+    if (!_socket.has_value()) {
+        throw InactiveConnectionError("Unable to enable receive offload");
+    }
+
+#ifdef UDP_GRO
+    int enable = 1;
+    if (setsockopt(*_socket, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) == 0) {
+        // coalesced packets can be as large as a full datagram
+        if (!_state->gro_enabled) _state->resize_slots(MAX_UDP_PAYLOAD);
+        _state->gro_enabled = true;
+    }
+#endif
+    return _state->gro_enabled;
+}
+
+bool UDPSocket::segmentation_offload() const {
+    return _state != nullptr && _state->gso_supported;
+}
+
+size_t UDPSocket::truncated_datagrams() const {
+    return _state == nullptr ? 0 : _state->truncated;
+}
+
+void UDPSocket::terminate() {
+    if (_socket.has_value()) {
+        int status = close(*_socket);
+
+        if (status == -1) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Unable to close UDP socket");
+        }
+
+        _socket.reset();
+    }
+}
+
+bool UDPSocket::active() const { return _socket.has_value(); }
+
+std::string create_error(const char* prefix) {
+    return singularity::utils::build_string(prefix, ": connection is inactive");
+}
+
+TimeoutError::TimeoutError(const std::string& message) : _message{message} {}
+
+TimeoutError::TimeoutError(const char* message) : _message{message} {}
+
+const char* TimeoutError::what() const noexcept { return _message.data(); }
+
+ProtocolError::ProtocolError(const std::string& message)
+    : _message{message} {}
+
+ProtocolError::ProtocolError(const char* message) : _message{message} {}
+
+const char* ProtocolError::what() const noexcept { return _message.data(); }
+
 InactiveConnectionError::InactiveConnectionError(const std::string& prefix)
     : _message{create_error(prefix.data())} {}
 
@@ -1,38 +1,386 @@
 #include "tcp_server.hpp"
 
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <stdexcept>
+#include <string>
 #include <system_error>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "logging.hpp"
 #include "poll.h"
+#include "tracing.hpp"
 #include "utils.hpp"
 
 using namespace singularity::network;
 
 constexpr static uint32_t MAX_PORT_NUM =
     static_cast<uint32_t>(std::numeric_limits<uint16_t>::max());
-constexpr static size_t TIMEOUT = 50;
+// longest the acceptor waits on a full buffer before rechecking for shutdown
+constexpr static auto TIMEOUT = std::chrono::milliseconds(50);
+// how long the acceptor stops accepting after running out of descriptors or
+// memory, which leaves the listener readable until connections are closed
+constexpr static auto ACCEPT_BACKOFF = std::chrono::milliseconds(10);
+// how long a steered worker waits on its own queue before looking for
+// connections queued for busy workers
+constexpr static auto STEAL_INTERVAL = std::chrono::milliseconds(5);
+
+// longest a metrics scrape may take to send its request or read the reply
+constexpr static auto SCRAPE_TIMEOUT = std::chrono::seconds(1);
+// longest request a metrics scrape may send
+constexpr static size_t MAX_SCRAPE_REQUEST = 8 * 1024;
+
+// index of the calling worker within the server's pool
+thread_local size_t current_worker = 0;
 
 void throw_system_error(const std::string& message) {
     throw std::system_error(errno, std::system_category(), message);
 }
 
+// The metrics a server reports, besides those of its connections.
+struct ServerMetrics {
+    singularity::metrics::Counter& accepted;
+    singularity::metrics::Counter& accept_errors;
+    singularity::metrics::Counter& shed;
+    singularity::metrics::Counter& rate_limited;
+    singularity::metrics::Histogram& admission_wait;
+    singularity::metrics::Gauge& queue_depth;
+    singularity::metrics::Histogram& handler_time;
+
+    ServerMetrics(singularity::metrics::Registry& registry,
+                  const singularity::metrics::Labels& labels)
+        : accepted{registry.counter("singularity_server_accepted_total",
+                                    "Connections handed out by the server",
+                                    labels)},
+          accept_errors{registry.counter(
+              "singularity_server_accept_errors_total",
+              "Connections that failed to be accepted or configured",
+              labels)},
+          shed{registry.counter("singularity_server_shed_total",
+                                "Connections reset because the server was "
+                                "overloaded",
+                                labels)},
+          rate_limited{registry.counter(
+              "singularity_server_rate_limited_total",
+              "Connections reset because their client exceeded the "
+              "connection rate",
+              labels)},
+          admission_wait{registry.histogram(
+              "singularity_server_admission_wait_seconds",
+              "Time accepted connections waited for space in the connection "
+              "buffer",
+              labels)},
+          queue_depth{registry.gauge(
+              "singularity_server_queued_connections",
+              "Accepted connections waiting for one of the server's workers",
+              labels)},
+          handler_time{registry.histogram(
+              "singularity_server_handler_seconds",
+              "Time the server's workers spent serving each connection",
+              labels)} {}
+};
+
+// Answers an HTTP request on a freshly accepted socket with the rendered
+// registry. Slow or malformed requests are given up on.
+void answer_scrape(int client, const singularity::metrics::Registry& registry) {
+    timeval timeout{
+        std::chrono::duration_cast<std::chrono::seconds>(SCRAPE_TIMEOUT)
+            .count(),
+        0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char chunk[1024];
+    while (request.find("\r\n\r\n") == std::string::npos) {
+        if (request.size() >= MAX_SCRAPE_REQUEST) return;
+        ssize_t received = recv(client, chunk, sizeof(chunk), 0);
+        if (received <= 0) return;
+        request.append(chunk, static_cast<size_t>(received));
+    }
+
+    std::string body;
+    std::string status = "200 OK";
+    if (request.starts_with("GET ")) {
+        body = registry.render();
+    } else {
+        status = "405 Method Not Allowed";
+    }
+    std::string response = singularity::utils::build_string(
+        "HTTP/1.1 ", status,
+        "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8"
+        "\r\nContent-Length: ",
+        body.size(), "\r\nConnection: close\r\n\r\n", body);
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t written = send(client, response.data() + sent,
+                               response.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0) return;
+        sent += static_cast<size_t>(written);
+    }
+}
+
+// Hands accepted connections to the workers of a serving server. Unlike a
+// FixedBuffer, its capacity is chosen at runtime.
+class HandoffQueue : public singularity::concurrency::Buffer<TCPConnection> {
+   private:
+    std::deque<TCPConnection> _connections;
+    size_t _capacity;
+    singularity::metrics::Gauge& _depth;
+    mutable std::mutex _mutex;
+    std::condition_variable _wait_push;
+    std::condition_variable _wait_pop;
+
+    TCPConnection _pop() {
+        TCPConnection connection = std::move(_connections.front());
+        _connections.pop_front();
+        _depth.subtract();
+        _wait_pop.notify_one();
+        return connection;
+    }
+
+   public:
+    HandoffQueue(size_t capacity, singularity::metrics::Gauge& depth)
+        : _capacity{capacity}, _depth{depth} {}
+
+    void push(TCPConnection&& connection) override {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wait_pop.wait(lock,
+                       [this]() { return _connections.size() < _capacity; });
+        _connections.push_back(std::move(connection));
+        _depth.add();
+        _wait_push.notify_one();
+    }
+
+    bool push(TCPConnection&& connection,
+              std::chrono::nanoseconds timeout) override {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto status = _wait_pop.wait_for(lock, timeout, [this]() {
+            return _connections.size() < _capacity;
+        });
+        if (!status) return false;
+        _connections.push_back(std::move(connection));
+        _depth.add();
+        _wait_push.notify_one();
+        return true;
+    }
+
+    TCPConnection pop() override {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wait_push.wait(lock, [this]() { return !_connections.empty(); });
+        return _pop();
+    }
+
+    std::optional<TCPConnection> pop(std::chrono::nanoseconds timeout) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto status = _wait_push.wait_for(
+            lock, timeout, [this]() { return !_connections.empty(); });
+        if (!status) return std::nullopt;
+        return _pop();
+    }
+
+    [[nodiscard]] size_t size() const override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _connections.size();
+    }
+
+    [[nodiscard]] bool empty() const override { return size() == 0; }
+};
+
+// The queues between the acceptor and the workers of a serving server: a
+// single shared queue, or one per worker when connections are steered.
+class WorkerQueues : public singularity::concurrency::Buffer<TCPConnection> {
+   private:
+    std::vector<std::unique_ptr<HandoffQueue>> _queues;
+    // workers pinned to each CPU, and running on each NUMA node
+    std::unordered_map<int, std::vector<size_t>> _cpu_workers;
+    std::unordered_map<int, std::vector<size_t>> _node_workers;
+    std::atomic<size_t> _next;
+    std::atomic<uint64_t> _steered;
+
+    // Picks the queue for a connection, and whether it was steered there.
+    std::pair<size_t, bool> _route(const TCPConnection& connection) {
+        if (_queues.size() == 1) return {0, false};
+
+        int cpu = connection.incoming_cpu();
+        for (const auto* workers : {&_cpu_workers, &_node_workers}) {
+            int key = workers == &_cpu_workers
+                          ? cpu
+                          : singularity::concurrency::numa_node_of(cpu);
+            auto candidates = workers->find(key);
+            if (cpu != -1 && candidates != workers->end()) {
+                const auto& indices = candidates->second;
+                return {indices[_next++ % indices.size()], true};
+            }
+        }
+        return {_next++ % _queues.size(), false};
+    }
+
+   public:
+    WorkerQueues(const WorkerConfig& config, singularity::metrics::Gauge& depth)
+        : _next{0}, _steered{0} {
+        size_t count = config.steer_by_incoming_cpu ? config.workers : 1;
+        size_t capacity = std::max<size_t>(
+            1, (config.queue_capacity + count - 1) / count);
+        for (size_t index = 0; index < count; ++index) {
+            _queues.push_back(std::make_unique<HandoffQueue>(capacity, depth));
+        }
+
+        if (!config.steer_by_incoming_cpu) return;
+        for (size_t worker = 0; worker < config.workers; ++worker) {
+            int cpu = config.placement.cpu_for(worker);
+            _cpu_workers[cpu].push_back(worker);
+            _node_workers[singularity::concurrency::numa_node_of(cpu)]
+                .push_back(worker);
+        }
+    }
+
+    void push(TCPConnection&& connection) override {
+        auto [index, steered] = _route(connection);
+        // counted first, so the count is up to date once a worker has it
+        if (steered) ++_steered;
+        _queues[index]->push(std::move(connection));
+    }
+
+    bool push(TCPConnection&& connection,
+              std::chrono::nanoseconds timeout) override {
+        auto [index, steered] = _route(connection);
+        if (steered) ++_steered;
+        if (_queues[index]->push(std::move(connection),
+                                 std::chrono::nanoseconds::zero())) {
+            return true;
+        }
+        if (steered) --_steered;
+        // the chosen worker is backed up, any other with room will do
+        for (auto& queue : _queues) {
+            if (queue->push(std::move(connection),
+                            std::chrono::nanoseconds::zero())) {
+                return true;
+            }
+        }
+        if (steered) ++_steered;
+        if (_queues[index]->push(std::move(connection), timeout)) return true;
+        if (steered) --_steered;
+        return false;
+    }
+
+    TCPConnection pop() override {
+        while (true) {
+            if (auto connection = pop(0, TIMEOUT)) {
+                return std::move(*connection);
+            }
+        }
+    }
+
+    // Pops a connection for a worker, from its own queue if it has one, and
+    // otherwise from the queue of a busy worker.
+    std::optional<TCPConnection> pop(size_t worker,
+                                     std::chrono::nanoseconds timeout) {
+        if (_queues.size() == 1) return _queues[0]->pop(timeout);
+
+        auto& own = _queues[worker % _queues.size()];
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        do {
+            if (auto connection = own->pop(STEAL_INTERVAL)) return connection;
+            for (auto& queue : _queues) {
+                if (auto connection =
+                        queue->pop(std::chrono::nanoseconds::zero())) {
+                    return connection;
+                }
+            }
+        } while (std::chrono::steady_clock::now() < deadline);
+        return std::nullopt;
+    }
+
+    [[nodiscard]] size_t size() const override {
+        size_t total = 0;
+        for (const auto& queue : _queues) total += queue->size();
+        return total;
+    }
+
+    [[nodiscard]] bool empty() const override { return size() == 0; }
+
+    [[nodiscard]] uint64_t steered() const { return _steered; }
+};
+
 class TCPServer::TCPServerImpl {
    public:
     std::atomic<bool> shutdown;
     uint16_t _port;
-    pollfd socket_info;
+    ServerConfig _config;
+    // the listening socket, followed by the read end of the wake pipe
+    std::array<pollfd, 2> poll_fds;
+    std::array<int, 2> wake_pipe;
+    std::mutex stop_mutex;
 
     std::optional<std::thread> main_thread;
+    // only open when the metrics endpoint is enabled
+    socket_t metrics_socket;
+    std::optional<std::thread> metrics_thread;
+    // only allocated when idle timeouts are enabled
+    std::shared_ptr<concurrency::TimerService> timers;
+    // shared with the connections, which may outlive the server
+    std::shared_ptr<ConnectionRegistry> registry;
+
+    std::atomic<uint64_t> accepted;
+    std::atomic<uint64_t> shed;
+    std::atomic<uint64_t> queued;
+    std::atomic<int64_t> queued_time_ns;
+    std::atomic<uint64_t> rate_limited;
+    std::atomic<bool> started;
+
+    std::shared_ptr<metrics::Registry> metrics_registry;
+    std::unique_ptr<ServerMetrics> server_metrics;
+    // shared by every connection the server hands out
+    std::shared_ptr<const ConnectionMetrics> connection_metrics;
+
+    // only allocated for the rate limits that are enabled
+    std::unique_ptr<RateLimiter> connection_limiter;
+    std::unique_ptr<RateLimiter> byte_limiter;
+    std::unique_ptr<RateLimiter> message_limiter;
 
-    TCPServerImpl(uint32_t port) : shutdown{false}, main_thread{std::nullopt} {
+    // only allocated when the server is serving with its own workers
+    ConnectionHandler handler;
+    std::unique_ptr<WorkerQueues> handoff;
+    std::unique_ptr<singularity::concurrency::ThreadPool> workers;
+    std::atomic<bool> workers_stopping;
+    std::atomic<size_t> in_flight;
+    std::atomic<uint64_t> handled;
+    std::atomic<uint64_t> failed;
+
+    TCPServerImpl(uint32_t port, ServerConfig config)
+        : shutdown{false},
+          _config{config},
+          wake_pipe{-1, -1},
+          main_thread{std::nullopt},
+          metrics_socket{-1},
+          metrics_thread{std::nullopt},
+          registry{std::make_shared<ConnectionRegistry>()},
+          accepted{0},
+          shed{0},
+          queued{0},
+          queued_time_ns{0},
+          rate_limited{0},
+          started{false},
+          workers_stopping{false},
+          in_flight{0},
+          handled{0},
+          failed{0} {
         if (port > MAX_PORT_NUM) {
             std::string error_message = singularity::utils::build_string(
                 "Invalid port number ", port, ", expected in range [0,",
@@ -40,11 +388,50 @@ class TCPServer::TCPServerImpl {
             throw std::invalid_argument(error_message);
         }
         _port = static_cast<uint16_t>(port);
-        socket_info.events = POLLIN;
+        if (_config.metrics_port > MAX_PORT_NUM) {
+            throw std::invalid_argument(singularity::utils::build_string(
+                "Invalid metrics port number ", _config.metrics_port,
+                ", expected in range [0,", MAX_PORT_NUM, "]"));
+        }
+        concurrency::validate_placement(_config.acceptor_placement);
+        for (auto [limit, limiter] :
+             {std::pair{_config.connection_rate, &connection_limiter},
+              std::pair{_config.receive_byte_rate, &byte_limiter},
+              std::pair{_config.receive_message_rate, &message_limiter}}) {
+            if (limit.enabled()) {
+                *limiter = std::make_unique<RateLimiter>(
+                    limit, _config.rate_limit_expiry);
+            }
+        }
+
+        metrics_registry = _config.metrics != nullptr
+                               ? _config.metrics
+                               : metrics::Registry::global();
+        metrics::Labels labels{{"port", std::to_string(_port)}};
+        server_metrics =
+            std::make_unique<ServerMetrics>(*metrics_registry, labels);
+        connection_metrics =
+            std::make_shared<ConnectionMetrics>(*metrics_registry, labels);
+
+        // writing to the pipe wakes the acceptor out of poll() immediately
+        if (pipe(wake_pipe.data()) == -1) {
+            throw_system_error("Unable to allocate wake pipe");
+        }
+        for (int fd : wake_pipe) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+        poll_fds[0] = {-1, POLLIN, 0};
+        poll_fds[1] = {wake_pipe[0], POLLIN, 0};
+
+        if (_config.idle_timeout > std::chrono::nanoseconds::zero()) {
+            timers = std::make_shared<concurrency::TimerService>();
+        }
     }
 
     void setup() {
-        socket_t& sock_fd = socket_info.fd;
+        socket_t& sock_fd = poll_fds[0].fd;
         sock_fd = socket(AF_INET, SOCK_STREAM, 0);
         if (sock_fd == -1) {
             throw_system_error("Unable to allocate socket");
@@ -63,48 +450,383 @@ class TCPServer::TCPServerImpl {
             throw_system_error("Unable to bind socket to given port");
         }
 
-        int listen_status = listen(sock_fd, 30);
+        int listen_status = listen(sock_fd, _config.backlog);
         if (listen_status == -1) {
             throw_system_error("Unable to set socket to listen");
         }
+
+        if (_config.metrics_port != 0) setup_metrics();
+    }
+
+    void setup_metrics() {
+        metrics_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (metrics_socket == -1) {
+            throw_system_error("Unable to allocate metrics socket");
+        }
+
+        int reuse = 1;
+        if (setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                       sizeof(reuse)) == -1) {
+            throw_system_error("Cannot enable metrics socket reuse");
+        }
+
+        // only reachable from the machine itself
+        IPSocketAddress address(INADDR_LOOPBACK,
+                                static_cast<uint16_t>(_config.metrics_port));
+        if (bind(metrics_socket, address.data(), address.length()) == -1) {
+            throw_system_error("Unable to bind metrics socket to given port");
+        }
+        if (listen(metrics_socket, _config.backlog) == -1) {
+            throw_system_error("Unable to set metrics socket to listen");
+        }
+    }
+
+    // Answers scrapes one at a time until the server shuts down.
+    void serve_metrics() {
+        std::array<pollfd, 2> fds{
+            {{metrics_socket, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}}};
+        while (!shutdown) {
+            auto num_events = poll(fds.data(), fds.size(), -1);
+            if (num_events > 0 && fds[0].revents & POLLIN) {
+                int client = accept(metrics_socket, nullptr, nullptr);
+                if (client == -1) continue;
+                answer_scrape(client, *metrics_registry);
+                close(client);
+            }
+        }
     }
 
     void start(concurrency::Buffer<TCPConnection>& connection_buffer) {
         auto runner = [this, &connection_buffer]() {
-            int timeout = TIMEOUT;  // can dynamically adjust this in future
-
+            concurrency::apply_placement(_config.acceptor_placement, 0);
             IPSocketAddress address;
             socklen_t address_length = address.length();
 
             while (!shutdown) {
-                auto num_events = poll(&socket_info, 1, timeout);
-                if (num_events > 0 && socket_info.revents | POLLIN) {
-                    int client_socket =
-                        accept(socket_info.fd, address.data(), &address_length);
-                    connection_buffer.push(
-                        TCPConnection(client_socket, address));
+                auto num_events = poll(poll_fds.data(), poll_fds.size(), -1);
+                if (num_events > 0 && poll_fds[0].revents & POLLIN) {
+                    tracing::Span span("accept");
+                    address_length = address.length();
+                    int client_socket = accept(poll_fds[0].fd, address.data(),
+                                               &address_length);
+                    if (client_socket == -1) {
+                        if (errno == EINTR) continue;
+                        server_metrics->accept_errors.increment();
+                        if (errno == EMFILE || errno == ENFILE ||
+                            errno == ENOBUFS || errno == ENOMEM) {
+                            // only the wake pipe is watched, so shutdown
+                            // still interrupts the wait
+                            poll(&poll_fds[1], 1,
+                                 static_cast<int>(ACCEPT_BACKOFF.count()));
+                        }
+                        continue;
+                    }
+
+                    TCPConnection connection(client_socket, address);
+                    if (connection_limiter != nullptr &&
+                        !connection_limiter->try_acquire(address)) {
+                        connection.abort();
+                        server_metrics->rate_limited.increment();
+                        ++rate_limited;
+                        continue;
+                    }
+                    try {
+                        configure(connection, address);
+                    } catch (const std::system_error&) {
+                        server_metrics->accept_errors.increment();
+                        continue;  // connection is closed on scope exit
+                    }
+                    admit(connection_buffer, std::move(connection));
                 }
             }
         };
         main_thread = std::thread(runner);
+        if (metrics_socket != -1) {
+            metrics_thread = std::thread([this]() { serve_metrics(); });
+        }
     }
 
-    ~TCPServerImpl() {
-        if (main_thread->joinable()) {
+    void check_workers(const ConnectionHandler& connection_handler,
+                       const WorkerConfig& config) {
+        if (!connection_handler) {
+            throw std::invalid_argument("Connection handler must be callable");
+        }
+        if (config.workers == 0 || config.queue_capacity == 0) {
+            throw std::invalid_argument(
+                "Workers and queue capacity must be positive");
+        }
+        concurrency::validate_placement(config.placement);
+        if (config.steer_by_incoming_cpu &&
+            config.placement.cpu_for(0) == -1) {
+            throw std::invalid_argument(
+                "Steering connections requires individually pinned workers");
+        }
+    }
+
+    // Marks the server started and binds its sockets. If binding fails the
+    // server is left as it was, so starting can be retried.
+    void begin() {
+        if (started.exchange(true)) {
+            throw std::logic_error("Server was already started");
+        }
+        try {
+            setup();
+        } catch (...) {
+            close_listeners();
+            started = false;
+            throw;
+        }
+    }
+
+    void spawn_workers(ConnectionHandler connection_handler,
+                       const WorkerConfig& config) {
+        handler = std::move(connection_handler);
+        handoff = std::make_unique<WorkerQueues>(config,
+                                                 server_metrics->queue_depth);
+        workers = std::make_unique<singularity::concurrency::ThreadPool>(
+            config.workers, [placement = config.placement](size_t index) {
+                current_worker = index;
+                concurrency::apply_placement(placement, index);
+            });
+        for (size_t index = 0; index < config.workers; ++index) {
+            // each worker takes exactly one of these, as they only return
+            // once the workers stop
+            workers->submit([this]() { run_worker(current_worker); });
+        }
+    }
+
+    void run_worker(size_t index) {
+        // connections still queued when the workers stop are served anyway,
+        // they were accepted and are accounted for by the registry
+        while (!workers_stopping || !handoff->empty()) {
+            auto connection = handoff->pop(index, TIMEOUT);
+            if (!connection.has_value()) continue;
+
+            ++in_flight;
+            tracing::Span span("handle");
+            auto start = std::chrono::steady_clock::now();
+            try {
+                handler(*connection);
+                ++handled;
+            } catch (const std::exception& error) {
+                ++failed;
+                logging::warn<"Connection handler failed: {}">(error.what());
+                try {
+                    connection->abort();
+                } catch (const std::system_error&) {
+                    // connection is closed on scope exit regardless
+                }
+            } catch (...) {
+                ++failed;
+                logging::warn<"Connection handler failed: unknown exception">();
+                try {
+                    connection->abort();
+                } catch (const std::system_error&) {
+                }
+            }
+            server_metrics->handler_time.record(
+                std::chrono::steady_clock::now() - start);
+            --in_flight;
+        }
+    }
+
+    // Waits for the workers to exit. Unless `force` is set, the caller must
+    // ensure no handler is blocked on a connection that stays open.
+    void stop_workers(bool force) {
+        if (workers == nullptr) return;
+        workers_stopping = true;
+        if (force) registry->shutdown_all();
+        workers.reset();
+    }
+
+    void configure(TCPConnection& connection,
+                   const IPSocketAddress& address) {
+        connection.track(registry);
+        connection.set_metrics(connection_metrics);
+        if (byte_limiter != nullptr || message_limiter != nullptr) {
+            connection.set_receive_limits(
+                byte_limiter ? byte_limiter->bucket(address) : nullptr,
+                message_limiter ? message_limiter->bucket(address) : nullptr);
+        }
+        if (timers != nullptr) {
+            connection.set_idle_timeout(timers, _config.idle_timeout);
+        }
+        if (_config.keepalive_idle > std::chrono::seconds::zero()) {
+            connection.set_keepalive(_config.keepalive_idle,
+                                     _config.keepalive_interval,
+                                     _config.keepalive_probes);
+        }
+    }
+
+    void admit(concurrency::Buffer<TCPConnection>& connection_buffer,
+               TCPConnection connection) {
+        tracing::Span span("admit");
+        // fast path - the buffer has room, nothing to decide
+        if (connection_buffer.push(std::move(connection),
+                                   std::chrono::nanoseconds::zero())) {
+            // metric first, so it is up to date once the stats are
+            server_metrics->accepted.increment();
+            ++accepted;
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        bool admitted = false;
+        switch (_config.overload_policy) {
+            case OverloadPolicy::block:
+                admitted = push_until(
+                    connection_buffer, connection,
+                    std::chrono::steady_clock::time_point::max());
+                break;
+            case OverloadPolicy::deadline:
+                admitted = push_until(connection_buffer, connection,
+                                      start + _config.admission_deadline);
+                break;
+            case OverloadPolicy::reject:
+                break;
+        }
+
+        if (!admitted) {
+            // connection was not moved from, reset it so the client sees the
+            // failure now rather than after its own timeout
+            connection.abort();
+            server_metrics->shed.increment();
+            ++shed;
+            return;
+        }
+
+        auto waited = std::chrono::steady_clock::now() - start;
+        server_metrics->accepted.increment();
+        server_metrics->admission_wait.record(waited);
+        ++accepted;
+        ++queued;
+        queued_time_ns +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(waited)
+                .count();
+    }
+
+    // Waits until `deadline` for space in the buffer, in slices so that a
+    // shutdown is noticed promptly. The connection is only moved on success.
+    bool push_until(concurrency::Buffer<TCPConnection>& connection_buffer,
+                    TCPConnection& connection,
+                    std::chrono::steady_clock::time_point deadline) {
+        while (!shutdown) {
+            auto remaining = deadline - std::chrono::steady_clock::now();
+            if (remaining <= std::chrono::nanoseconds::zero()) return false;
+
+            auto slice = std::min<std::chrono::nanoseconds>(remaining, TIMEOUT);
+            if (connection_buffer.push(std::move(connection), slice)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+
+        if (!shutdown.exchange(true)) {
+            char signal = 1;
+            // if the pipe is full the acceptor is already due to wake up
+            [[maybe_unused]] auto status = write(wake_pipe[1], &signal, 1);
+        }
+
+        if (main_thread.has_value() && main_thread->joinable()) {
             main_thread->join();
         }
-        close(socket_info.fd);
+        if (metrics_thread.has_value() && metrics_thread->joinable()) {
+            metrics_thread->join();
+        }
+        // refuse new clients instead of leaving them in the backlog
+        close_listeners();
+    }
+
+    void close_listeners() {
+        if (metrics_socket != -1) {
+            close(metrics_socket);
+            metrics_socket = -1;
+        }
+        if (poll_fds[0].fd != -1) {
+            close(poll_fds[0].fd);
+            poll_fds[0].fd = -1;
+        }
+    }
+
+    ~TCPServerImpl() {
+        stop();
+        stop_workers(true);
+        for (int fd : wake_pipe) {
+            if (fd != -1) close(fd);
+        }
     }
 };
 
-TCPServer::TCPServer(uint32_t port) {
-    impl = std::make_unique<TCPServerImpl>(port);
+TCPServer::TCPServer(uint32_t port) : TCPServer(port, ServerConfig{}) {}
+
+TCPServer::TCPServer(uint32_t port, ServerConfig config) {
+    impl = std::make_unique<TCPServerImpl>(port, config);
 }
 
 void TCPServer::start(concurrency::Buffer<TCPConnection>& connection_buffer) {
-    impl->setup();
+    impl->begin();
     impl->start(connection_buffer);
 }
 
-void TCPServer::shutdown() { impl->shutdown = true; }
+void TCPServer::serve(ConnectionHandler handler, WorkerConfig config) {
+    impl->check_workers(handler, config);
+    // workers are only spawned once the socket is bound, so a failed bind
+    // leaves nothing running
+    impl->begin();
+    impl->spawn_workers(std::move(handler), config);
+    impl->start(*impl->handoff);
+}
+
+void TCPServer::shutdown() { impl->stop(); }
+
+ShutdownReport TCPServer::shutdown(std::chrono::nanoseconds grace_period) {
+    auto start = std::chrono::steady_clock::now();
+    impl->stop();
+
+    // nothing new can be registered once the acceptor has stopped
+    ShutdownReport report;
+    size_t in_flight = impl->registry->size();
+    if (!impl->registry->wait_empty(grace_period)) {
+        report.dropped = impl->registry->shutdown_all();
+    }
+    report.drained = in_flight - std::min(in_flight, report.dropped);
+    // every connection has finished or was shut down, so the workers only
+    // have fast failures left to process
+    impl->stop_workers(false);
+    report.elapsed = std::chrono::steady_clock::now() - start;
+    return report;
+}
+
+size_t TCPServer::active_connections() const {
+    return impl->registry->size();
+}
+
+ConnectionStatsSummary TCPServer::sample_stats(size_t max_samples) const {
+    return impl->registry->sample(max_samples);
+}
+
+AdmissionStats TCPServer::admission_stats() const {
+    AdmissionStats stats;
+    stats.accepted = impl->accepted;
+    stats.shed = impl->shed;
+    stats.queued = impl->queued;
+    stats.queued_time = std::chrono::nanoseconds(impl->queued_time_ns);
+    stats.rate_limited = impl->rate_limited;
+    return stats;
+}
+
+WorkerStats TCPServer::worker_stats() const {
+    WorkerStats stats;
+    if (impl->handoff != nullptr) stats.queued = impl->handoff->size();
+    stats.in_flight = impl->in_flight;
+    stats.handled = impl->handled;
+    stats.failed = impl->failed;
+    if (impl->handoff != nullptr) stats.steered = impl->handoff->steered();
+    return stats;
+}
+
 TCPServer::~TCPServer() { shutdown(); };
\ No newline at end of file
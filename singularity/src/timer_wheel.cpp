@@ -0,0 +1,251 @@
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace singularity::concurrency {
+
+TimerWheel::TimerWheel(tick_t start) : _current{start}, _size{0} {
+    _slots.fill(NIL);
+}
+
+void TimerWheel::_link(uint32_t index) {
+    Node& node = _nodes[index];
+    tick_t expiry = std::max(node.expiry, _current);
+    tick_t delta = expiry - _current;
+
+    size_t level = 0;
+    while (level < LEVELS - 1 &&
+           delta >= (tick_t{1} << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+
+    // park timers beyond the wheel's range in the furthest top level slot,
+    // they are re-filed with their real expiry when that slot cascades
+    constexpr tick_t range = tick_t{1} << (SLOT_BITS * LEVELS);
+    if (delta >= range) expiry = _current + range - 1;
+
+    size_t slot =
+        level * SLOTS + ((expiry >> (SLOT_BITS * level)) & (SLOTS - 1));
+
+    node.slot = static_cast<uint32_t>(slot);
+    node.prev = NIL;
+    node.next = _slots[slot];
+    if (node.next != NIL) _nodes[node.next].prev = index;
+    _slots[slot] = index;
+}
+
+void TimerWheel::_unlink(uint32_t index) {
+    Node& node = _nodes[index];
+    if (node.prev == NIL) {
+        _slots[node.slot] = node.next;
+    } else {
+        _nodes[node.prev].next = node.next;
+    }
+    if (node.next != NIL) _nodes[node.next].prev = node.prev;
+}
+
+void TimerWheel::_release(uint32_t index) {
+    Node& node = _nodes[index];
+    node.callback = nullptr;
+    node.slot = NIL;
+    ++node.generation;
+    _free.push_back(index);
+    --_size;
+}
+
+uint32_t TimerWheel::_detach(size_t slot) {
+    uint32_t head = _slots[slot];
+    _slots[slot] = NIL;
+    return head;
+}
+
+void TimerWheel::_cascade(size_t level) {
+    size_t index = (_current >> (SLOT_BITS * level)) & (SLOTS - 1);
+
+    uint32_t head = _detach(level * SLOTS + index);
+    while (head != NIL) {
+        uint32_t next = _nodes[head].next;
+        _link(head);
+        head = next;
+    }
+
+    if (index == 0 && level + 1 < LEVELS) _cascade(level + 1);
+}
+
+TimerHandle TimerWheel::schedule(tick_t expiry, Callback callback) {
+    uint32_t index;
+    if (!_free.empty()) {
+        index = _free.back();
+        _free.pop_back();
+    } else {
+        if (_nodes.size() >= NIL) {
+            throw std::length_error("Timer wheel capacity exceeded");
+        }
+        index = static_cast<uint32_t>(_nodes.size());
+        _nodes.emplace_back();
+    }
+
+    Node& node = _nodes[index];
+    node.callback = std::move(callback);
+    node.expiry = expiry;
+    _link(index);
+    ++_size;
+
+    return {index, node.generation};
+}
+
+bool TimerWheel::cancel(TimerHandle handle) {
+    if (!handle.valid() || handle.index >= _nodes.size()) return false;
+
+    Node& node = _nodes[handle.index];
+    if (node.generation != handle.generation || node.slot == NIL) {
+        return false;
+    }
+
+    _unlink(handle.index);
+    _release(handle.index);
+    return true;
+}
+
+size_t TimerWheel::advance(tick_t now, std::vector<Callback>& expired) {
+    size_t fired = 0;
+
+    while (_current <= now) {
+        // nothing to cascade or fire, skip straight to the target tick
+        if (_size == 0) {
+            _current = now + 1;
+            break;
+        }
+
+        size_t index = _current & (SLOTS - 1);
+        if (index == 0) _cascade(1);
+
+        uint32_t head = _detach(index);
+        ++_current;
+
+        while (head != NIL) {
+            Node& node = _nodes[head];
+            uint32_t next = node.next;
+            expired.push_back(std::move(node.callback));
+            _release(head);
+            ++fired;
+            head = next;
+        }
+    }
+
+    return fired;
+}
+
+size_t TimerWheel::advance(tick_t now) {
+    std::vector<Callback> expired;
+    size_t fired = advance(now, expired);
+    for (auto& callback : expired) callback();
+    return fired;
+}
+
+TimerWheel::tick_t TimerWheel::current() const { return _current; }
+
+size_t TimerWheel::size() const { return _size; }
+
+TimerService::TimerService(std::chrono::nanoseconds resolution)
+    : _epoch{clock::now()},
+      _resolution{resolution},
+      _wheel{0},
+      _stop{false} {
+    if (resolution <= std::chrono::nanoseconds::zero()) {
+        throw std::invalid_argument("Timer resolution must be positive");
+    }
+    _thread = std::thread([this]() { _run(); });
+}
+
+TimerService::~TimerService() {
+    {
+        std::unique_lock<std::mutex> lock(_wheel_mutex);
+        _stop = true;
+    }
+    _wakeup.notify_one();
+    _thread.join();
+}
+
+TimerWheel::tick_t TimerService::_to_tick(clock::time_point time) const {
+    if (time <= _epoch) return 0;
+    // round up so timers never fire early
+    auto elapsed = time - _epoch;
+    return static_cast<TimerWheel::tick_t>(
+        (elapsed + _resolution - std::chrono::nanoseconds(1)) / _resolution);
+}
+
+void TimerService::_run() {
+    std::vector<Callback> expired;
+    std::unique_lock<std::mutex> lock(_wheel_mutex);
+
+    while (!_stop) {
+        auto now = static_cast<TimerWheel::tick_t>((clock::now() - _epoch) /
+                                                   _resolution);
+        _wheel.advance(now, expired);
+
+        if (!expired.empty()) {
+            std::unique_lock<std::mutex> running(_running_mutex);
+            lock.unlock();
+            for (auto& callback : expired) callback();
+            expired.clear();
+            running.unlock();
+            lock.lock();
+            continue;
+        }
+
+        if (_wheel.size() == 0) {
+            _wakeup.wait(lock, [this]() { return _stop || _wheel.size() > 0; });
+        } else {
+            _wakeup.wait_until(
+                lock, _epoch + _resolution * static_cast<int64_t>(now + 1));
+        }
+    }
+}
+
+TimerHandle TimerService::schedule_at(clock::time_point time,
+                                      Callback callback) {
+    std::unique_lock<std::mutex> lock(_wheel_mutex);
+
+    bool idle = _wheel.size() == 0;
+    if (idle) {
+        // catch an idle wheel up to the present instead of ticking through
+        // the gap once the timer is added
+        auto now = static_cast<TimerWheel::tick_t>((clock::now() - _epoch) /
+                                                   _resolution);
+        _wheel.advance(now);
+    }
+
+    TimerHandle handle = _wheel.schedule(_to_tick(time), std::move(callback));
+    lock.unlock();
+
+    if (idle) _wakeup.notify_one();
+    return handle;
+}
+
+TimerHandle TimerService::schedule_after(std::chrono::nanoseconds delay,
+                                         Callback callback) {
+    return schedule_at(clock::now() + delay, std::move(callback));
+}
+
+bool TimerService::cancel(TimerHandle handle) {
+    bool cancelled;
+    {
+        std::unique_lock<std::mutex> lock(_wheel_mutex);
+        cancelled = _wheel.cancel(handle);
+    }
+
+    // the timer may be running right now, wait for it unless we are it
+    if (!cancelled && std::this_thread::get_id() != _thread.get_id()) {
+        std::lock_guard<std::mutex> running(_running_mutex);
+    }
+    return cancelled;
+}
+
+size_t TimerService::pending() const {
+    std::unique_lock<std::mutex> lock(_wheel_mutex);
+    return _wheel.size();
+}
+
+}  // namespace singularity::concurrency
@@ -0,0 +1,182 @@
+#include "tracing.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// shortest interval the tick rate is measured over
+constexpr auto MIN_CALIBRATION = std::chrono::milliseconds(10);
+
+namespace singularity::tracing {
+
+struct Event {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> id{0};
+    std::atomic<uint64_t> start{0};
+    std::atomic<uint64_t> end{0};
+};
+
+// The spans of a single thread. Only that thread writes to it, so recording
+// never contends; the fields are atomics so that a trace can be written while
+// the thread keeps recording.
+struct Ring {
+    std::unique_ptr<Event[]> events;
+    uint32_t thread;
+    // spans recorded so far, and the first one not cleared
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> first;
+
+    explicit Ring(uint32_t thread_number)
+        : events{std::make_unique<Event[]>(RING_CAPACITY)},
+          thread{thread_number},
+          head{0},
+          first{0} {}
+};
+
+struct Origin {
+    uint64_t ticks;
+    std::chrono::steady_clock::time_point time;
+};
+
+class Tracer {
+   private:
+    std::mutex _mutex;
+    // rings outlive their threads, so their spans can still be exported
+    std::vector<std::shared_ptr<Ring>> _rings;
+    uint32_t _next_thread;
+    Origin _origin;
+
+    // Returns the number of ticks per microsecond.
+    double _tick_rate() const {
+        auto end = _origin.time + MIN_CALIBRATION;
+        while (std::chrono::steady_clock::now() < end) {
+            std::this_thread::yield();
+        }
+        uint64_t ticks = _now();
+        auto elapsed = std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - _origin.time);
+        return static_cast<double>(ticks - _origin.ticks) / elapsed.count();
+    }
+
+   public:
+    Tracer()
+        : _next_thread{1}, _origin{_now(), std::chrono::steady_clock::now()} {}
+
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    Ring* attach() {
+        thread_local std::shared_ptr<Ring> ring;
+        if (ring == nullptr) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ring = std::make_shared<Ring>(_next_thread++);
+            _rings.push_back(ring);
+        }
+        return ring.get();
+    }
+
+    void write(std::ostream& out) {
+        std::vector<std::shared_ptr<Ring>> rings;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            rings = _rings;
+        }
+        double rate = rings.empty() ? 1 : _tick_rate();
+        auto pid = static_cast<int64_t>(getpid());
+        auto timestamp = [this, rate](uint64_t ticks) {
+            return static_cast<double>(ticks - _origin.ticks) / rate;
+        };
+
+        auto flags = out.flags();
+        auto precision = out.precision();
+        out << std::fixed << std::setprecision(3)
+            << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        const char* separator = "";
+        std::vector<std::pair<uint64_t, uint64_t>> times;
+        std::vector<std::pair<const char*, uint64_t>> spans;
+        for (const auto& ring : rings) {
+            out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\","
+                << "\"pid\":" << pid << ",\"tid\":" << ring->thread
+                << ",\"args\":{\"name\":\"thread " << ring->thread << "\"}}";
+            separator = ",";
+
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t first = std::max(
+                ring->first.load(std::memory_order_relaxed),
+                head > RING_CAPACITY ? head - RING_CAPACITY : 0);
+            times.clear();
+            spans.clear();
+            for (uint64_t index = first; index < head; ++index) {
+                const Event& event = ring->events[index % RING_CAPACITY];
+                spans.emplace_back(event.name.load(std::memory_order_relaxed),
+                                   event.id.load(std::memory_order_relaxed));
+                times.emplace_back(
+                    event.start.load(std::memory_order_relaxed),
+                    event.end.load(std::memory_order_relaxed));
+            }
+            // spans overwritten while they were copied are left out, including
+            // the one that may be being written
+            uint64_t reused = ring->head.load(std::memory_order_acquire) + 1;
+            uint64_t valid =
+                reused > RING_CAPACITY ? reused - RING_CAPACITY : 0;
+
+            for (size_t offset = 0; offset < spans.size(); ++offset) {
+                if (first + offset < valid) continue;
+                auto [name, id] = spans[offset];
+                auto [start, end] = times[offset];
+                out << ",{\"name\":\"" << name << "\",\"pid\":" << pid
+                    << ",\"tid\":" << ring->thread
+                    << ",\"ts\":" << timestamp(start);
+                if (id == 0) {
+                    out << ",\"ph\":\"X\",\"dur\":"
+                        << static_cast<double>(end - start) / rate << "}";
+                    continue;
+                }
+                // async spans sharing an id are drawn on a timeline of their
+                // own
+                out << ",\"ph\":\"b\",\"cat\":\"connection\",\"id\":" << id
+                    << "},{\"name\":\"" << name << "\",\"pid\":" << pid
+                    << ",\"tid\":" << ring->thread
+                    << ",\"ts\":" << timestamp(end)
+                    << ",\"ph\":\"e\",\"cat\":\"connection\",\"id\":" << id
+                    << "}";
+            }
+        }
+        out << "]}\n";
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const auto& ring : _rings) {
+            ring->first.store(ring->head.load(std::memory_order_acquire),
+                              std::memory_order_relaxed);
+        }
+    }
+};
+
+void _record(const char* name, uint64_t id, uint64_t start, uint64_t end) {
+    thread_local Ring* ring = Tracer::instance().attach();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    Event& event = ring->events[head % RING_CAPACITY];
+    event.name.store(name, std::memory_order_relaxed);
+    event.id.store(id, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.end.store(end, std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void write_chrome_trace(std::ostream& out) { Tracer::instance().write(out); }
+
+void clear() { Tracer::instance().clear(); }
+
+}  // namespace singularity::tracing
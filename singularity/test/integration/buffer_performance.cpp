@@ -1,50 +1,398 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <latch>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <utility>
+#include <vector>
 
+#include "cli.hpp"
 #include "concurrency.hpp"
+#include "metrics.hpp"
+#include "perf_counters.hpp"
+#include "utils.hpp"
 
-constexpr size_t NUM_PRODUCERS = 10;
-constexpr size_t NUM_CONSUMERS = 10;
-constexpr size_t TOTAL_ITEMS = 10000000;
+// element sizes and FixedBuffer capacities are template arguments, so a sweep
+// picks from these
+using ElementSizes = std::index_sequence<16, 128, 1024>;
+using FixedCapacities = std::index_sequence<16, 1024, 65536>;
 
-struct TestStruct {
-    bool yes;
-    int hello;
-    double hi;
-    char space[100] = {0};
+using namespace singularity;
+
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * @brief The element handed from producers to consumers, stamped with the
+ * time it was pushed.
+ */
+template <size_t Size>
+struct Element {
+    int64_t pushed_ns;
+    std::array<std::byte, Size - sizeof(int64_t)> payload;
+};
+
+/**
+ * @brief A buffer implementation under test.
+ */
+template <typename T>
+struct BufferCase {
+    std::string name;
+    // zero for unbounded buffers
+    size_t capacity;
+    std::function<std::unique_ptr<concurrency::Buffer<T>>()> make;
+};
+
+enum class Format { csv, json };
+
+struct Options {
+    std::vector<std::string> buffers{"dynamic", "fixed"};
+    std::vector<size_t> producers{1, 4};
+    std::vector<size_t> consumers{1, 4};
+    std::vector<size_t> sizes{16, 128, 1024};
+    // only applies to bounded buffers
+    std::vector<size_t> capacities{16, 1024};
+    size_t items = 1000000;
+    Format format = Format::csv;
+    benchmark::BaselineOptions baseline;
+};
+
+struct Result {
+    std::string buffer;
+    size_t capacity;
+    size_t producers;
+    size_t consumers;
+    size_t element_size;
+    size_t items;
+    double seconds;
+    // nanoseconds between a push starting and the pop that returns it
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    // over the whole run, thread start up included
+    benchmark::Counts counts;
 };
 
-int main() {
-    singularity::concurrency::FixedBuffer<TestStruct, 1000> buffer;
+template <size_t... Values, typename Function>
+void for_each(std::index_sequence<Values...>, Function&& function) {
+    (function.template operator()<Values>(), ...);
+}
+
+template <size_t... Values>
+bool contains(std::index_sequence<Values...>, size_t value) {
+    return ((value == Values) || ...);
+}
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               clock_type::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief Returns every buffer implementation under test. New implementations
+ * of concurrency::Buffer are benchmarked by adding them here.
+ */
+template <typename T>
+std::vector<BufferCase<T>> buffer_cases() {
+    std::vector<BufferCase<T>> cases;
+    cases.push_back({"dynamic", 0, []() {
+                         return std::make_unique<
+                             concurrency::DynamicBuffer<T>>();
+                     }});
+    for_each(FixedCapacities{}, [&cases]<size_t Capacity>() {
+        cases.push_back({"fixed", Capacity, []() {
+                             return std::make_unique<
+                                 concurrency::FixedBuffer<T, Capacity>>();
+                         }});
+    });
+    return cases;
+}
 
-    std::vector<std::thread> producers(NUM_PRODUCERS);
-    for (size_t index = 0; index < NUM_PRODUCERS; ++index) {
-        producers.emplace_back([&buffer]() {
-            for (size_t i = 0; i < TOTAL_ITEMS / NUM_PRODUCERS; i++) {
-                buffer.push({i % 2 == 0, static_cast<int>(i),
-                             static_cast<double>(i + 40) + 3.14});
+/**
+ * @brief Moves `items` elements through a buffer from `producers` threads to
+ * `consumers` threads, all started together.
+ */
+template <size_t Size>
+Result run(const BufferCase<Element<Size>>& buffer_case, size_t producers,
+           size_t consumers, size_t items) {
+    auto buffer = buffer_case.make();
+    // each consumer claims an element before popping it, so together they
+    // pop exactly `items`
+    std::atomic<int64_t> unclaimed{static_cast<int64_t>(items)};
+    std::vector<std::unique_ptr<metrics::Histogram>> latencies;
+    for (size_t index = 0; index < consumers; ++index) {
+        latencies.push_back(std::make_unique<metrics::Histogram>());
+    }
+
+    // started first, threads are only counted if started after the counters
+    benchmark::PerfCounters counters;
+    counters.start();
+
+    std::latch ready(static_cast<ptrdiff_t>(producers + consumers + 1));
+    std::vector<std::thread> threads;
+    threads.reserve(producers + consumers);
+    for (size_t index = 0; index < producers; ++index) {
+        size_t count = items / producers + (index < items % producers);
+        threads.emplace_back([&buffer, &ready, count]() {
+            ready.arrive_and_wait();
+            for (size_t item = 0; item < count; ++item) {
+                buffer->push(Element<Size>{now_ns(), {}});
             }
         });
     }
-
-    std::vector<std::thread> consumers(NUM_CONSUMERS);
-    for (size_t index = 0; index < NUM_CONSUMERS; ++index) {
-        consumers.emplace_back([&buffer]() {
-            for (size_t i = 0; i < TOTAL_ITEMS / NUM_CONSUMERS; i++) {
-                auto x = buffer.pop();
-                x.hello += 1;
+    for (size_t index = 0; index < consumers; ++index) {
+        threads.emplace_back([&buffer, &ready, &unclaimed,
+                              &latency = *latencies[index]]() {
+            ready.arrive_and_wait();
+            while (unclaimed.fetch_sub(1, std::memory_order_relaxed) > 0) {
+                Element<Size> element = buffer->pop();
+                latency.record(
+                    std::chrono::nanoseconds(now_ns() - element.pushed_ns));
             }
         });
     }
 
-    for (auto& thread : producers) {
-        if (thread.joinable()) {
-            thread.join();
+    ready.arrive_and_wait();
+    auto start = clock_type::now();
+    for (auto& thread : threads) thread.join();
+    double seconds =
+        std::chrono::duration<double>(clock_type::now() - start).count();
+    benchmark::Counts counts = counters.stop();
+
+    metrics::Histogram& latency = *latencies[0];
+    for (size_t index = 1; index < consumers; ++index) {
+        latency.merge(*latencies[index]);
+    }
+    return {buffer_case.name,
+            buffer_case.capacity,
+            producers,
+            consumers,
+            Size,
+            items,
+            seconds,
+            latency.percentile(50),
+            latency.percentile(99),
+            latency.percentile(99.9),
+            counts};
+}
+
+void print_usage(const char* program) {
+    std::cerr
+        << "Usage: " << program << " [options]\n"
+        << "Measures the throughput and handoff latency of every buffer\n"
+        << "implementation, for each combination of the values given.\n\n"
+        << "  --buffers LIST         dynamic, fixed (default: both)\n"
+        << "  --producers LIST       producer threads (default 1,4)\n"
+        << "  --consumers LIST       consumer threads (default 1,4)\n"
+        << "  --sizes LIST           element sizes in bytes, of 16, 128, "
+           "1024 (default: all)\n"
+        << "  --capacities LIST      bounded buffer capacities, of 16, 1024, "
+           "65536 (default\n"
+        << "                         16,1024)\n"
+        << "  --items N              elements moved per run (default "
+           "1000000)\n"
+        << "  --format FORMAT        csv or json (default csv)\n"
+        << "  --write-baseline FILE  save the per item figures as a "
+           "baseline\n"
+        << "  --compare FILE         compare against a baseline, failing on "
+           "regressions\n"
+        << "  --threshold PERCENT    noise allowed before a figure regresses "
+           "(default 5)\n"
+        << "  --help                 show this message\n";
+}
+
+std::vector<size_t> parse_positive_list(std::string_view flag,
+                                        const std::string& value) {
+    std::vector<size_t> numbers;
+    for (const auto& part : cli::split(value)) {
+        numbers.push_back(cli::parse_number(flag, part));
+        if (numbers.back() == 0) {
+            throw std::invalid_argument(
+                utils::build_string("Values of ", flag, " must be positive"));
         }
     }
+    return numbers;
+}
+
+// Returns the parsed options, or nothing if only the usage was requested.
+std::optional<Options> parse_options(int argc, char** argv) {
+    Options options;
+    auto handle = [&](std::string_view flag, const std::string& value) {
+        if (options.baseline.parse(flag, value)) return;
+
+        if (flag == "--buffers") {
+            options.buffers = cli::split(value);
+            for (const auto& name : options.buffers) {
+                if (name != "dynamic" && name != "fixed") {
+                    throw std::invalid_argument(
+                        utils::build_string("Unknown buffer '", name, "'"));
+                }
+            }
+        } else if (flag == "--producers") {
+            options.producers = parse_positive_list(flag, value);
+        } else if (flag == "--consumers") {
+            options.consumers = parse_positive_list(flag, value);
+        } else if (flag == "--sizes") {
+            options.sizes = parse_positive_list(flag, value);
+            for (size_t size : options.sizes) {
+                if (!contains(ElementSizes{}, size)) {
+                    throw std::invalid_argument(utils::build_string(
+                        "Unsupported element size ", size));
+                }
+            }
+        } else if (flag == "--capacities") {
+            options.capacities = parse_positive_list(flag, value);
+            for (size_t capacity : options.capacities) {
+                if (!contains(FixedCapacities{}, capacity)) {
+                    throw std::invalid_argument(utils::build_string(
+                        "Unsupported capacity ", capacity));
+                }
+            }
+        } else if (flag == "--items") {
+            options.items = cli::parse_number(flag, value);
+        } else if (flag == "--format") {
+            if (value == "csv") {
+                options.format = Format::csv;
+            } else if (value == "json") {
+                options.format = Format::json;
+            } else {
+                throw std::invalid_argument(
+                    utils::build_string("Unknown format '", value, "'"));
+            }
+        } else {
+            throw std::invalid_argument(
+                utils::build_string("Unknown option ", flag));
+        }
+    };
+    if (!cli::parse_flags(argc, argv, handle)) return std::nullopt;
+
+    if (options.items == 0) {
+        throw std::invalid_argument("Items must be positive");
+    }
+    return options;
+}
+
+template <typename T>
+bool selected(const std::vector<T>& values, const T& value) {
+    return std::find(values.begin(), values.end(), value) != values.end();
+}
+
+// Names a run in baselines.
+std::string run_name(const Result& result) {
+    return utils::build_string(result.buffer, "/", result.capacity, "/",
+                               result.producers, "p", result.consumers, "c/",
+                               result.element_size, "B");
+}
+
+void print_result(const Result& result, Format format, bool first) {
+    double throughput = static_cast<double>(result.items) / result.seconds;
+    benchmark::Result counted{run_name(result), result.items, result.counts};
+    if (format == Format::csv) {
+        std::cout << result.buffer << ',' << result.capacity << ','
+                  << result.producers << ',' << result.consumers << ','
+                  << result.element_size << ',' << result.items << ','
+                  << result.seconds << ',' << throughput << ','
+                  << result.p50_ns << ',' << result.p99_ns << ','
+                  << result.p999_ns;
+        // events that were not counted are left empty
+        for (auto event : benchmark::EVENTS) {
+            std::cout << ',';
+            if (auto value = counted.per_operation(event)) std::cout << *value;
+        }
+        std::cout << std::endl;
+        return;
+    }
+    std::cout << (first ? "\n" : ",\n") << "  {\"buffer\": \"" << result.buffer
+              << "\", \"capacity\": " << result.capacity
+              << ", \"producers\": " << result.producers
+              << ", \"consumers\": " << result.consumers
+              << ", \"element_size\": " << result.element_size
+              << ", \"items\": " << result.items
+              << ", \"seconds\": " << result.seconds
+              << ", \"items_per_second\": " << throughput
+              << ", \"p50_ns\": " << result.p50_ns
+              << ", \"p99_ns\": " << result.p99_ns
+              << ", \"p999_ns\": " << result.p999_ns;
+    for (auto event : benchmark::EVENTS) {
+        std::cout << ", \"" << benchmark::event_name(event) << "_per_item\": ";
+        if (auto value = counted.per_operation(event)) {
+            std::cout << *value;
+        } else {
+            std::cout << "null";
+        }
+    }
+    std::cout << "}" << std::flush;
+}
+
+int main(int argc, char** argv) {
+    std::optional<Options> parsed;
+    try {
+        parsed = parse_options(argc, argv);
+    } catch (const std::invalid_argument& error) {
+        std::cerr << error.what() << "\n\n";
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!parsed.has_value()) {
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+    }
+    const Options options = *parsed;
+
+    if (options.format == Format::csv) {
+        std::cout << "buffer,capacity,producers,consumers,element_size,items,"
+                     "seconds,items_per_second,p50_ns,p99_ns,p999_ns";
+        for (auto event : benchmark::EVENTS) {
+            std::cout << ',' << benchmark::event_name(event) << "_per_item";
+        }
+        std::cout << std::endl;
+    } else {
+        std::cout << "[";
+    }
+
+    bool first = true;
+    std::vector<benchmark::Result> counted;
+    for_each(ElementSizes{}, [&options, &first, &counted]<size_t Size>() {
+        if (!selected(options.sizes, Size)) return;
+        for (const auto& buffer_case : buffer_cases<Element<Size>>()) {
+            if (!selected(options.buffers, buffer_case.name)) continue;
+            if (buffer_case.capacity != 0 &&
+                !selected(options.capacities, buffer_case.capacity)) {
+                continue;
+            }
+            for (size_t producers : options.producers) {
+                for (size_t consumers : options.consumers) {
+                    Result result = run<Size>(buffer_case, producers,
+                                              consumers, options.items);
+                    print_result(result, options.format, first);
+                    counted.push_back(
+                        {run_name(result), result.items, result.counts});
+                    first = false;
+                }
+            }
+        }
+    });
+
+    if (options.format == Format::json) std::cout << "\n]" << std::endl;
 
-    for (auto& thread : consumers) {
-        if (thread.joinable()) {
-            thread.join();
+    try {
+        if (!benchmark::check_baseline(options.baseline, counted, std::cerr)) {
+            return EXIT_FAILURE;
         }
+    } catch (const std::exception& error) {
+        std::cerr << error.what() << std::endl;
+        return EXIT_FAILURE;
     }
-}
\ No newline at end of file
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,52 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "checksum.hpp"
+
+constexpr size_t TOTAL_BYTES = size_t{1} << 30;
+
+using namespace singularity;
+
+template <typename Function>
+double throughput(Function&& checksum, const std::vector<uint8_t>& data,
+                  size_t length) {
+    size_t iterations = TOTAL_BYTES / length;
+    uint32_t crc = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        crc = checksum(data.data(), length, crc);
+    }
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+    // keep the result alive so the loop is not optimized away
+    if (crc == 0x12345678) std::cout << "";
+    return static_cast<double>(iterations * length) / elapsed / 1e9;
+}
+
+int main() {
+    std::vector<uint8_t> data(size_t{1} << 20);
+    for (size_t index = 0; index < data.size(); ++index) {
+        data[index] = static_cast<uint8_t>(index * 131);
+    }
+
+    std::cout << "Hardware acceleration: "
+              << (checksum::crc32c_accelerated() ? "yes" : "no") << std::endl;
+    for (size_t length : {64, 1024, 4096, 65536, 1 << 20}) {
+        auto dispatched = [](const void* buffer, size_t size, uint32_t crc) {
+            return checksum::crc32c(buffer, size, crc);
+        };
+        auto portable = [](const void* buffer, size_t size, uint32_t crc) {
+            return checksum::crc32c_portable(buffer, size, crc);
+        };
+        std::cout << length << " bytes: crc32c "
+                  << throughput(dispatched, data, length)
+                  << " GB/s, slicing-by-8 "
+                  << throughput(portable, data, length) << " GB/s"
+                  << std::endl;
+    }
+}
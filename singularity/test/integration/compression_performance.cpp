@@ -0,0 +1,112 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "compression.hpp"
+
+constexpr size_t PAYLOAD_SIZE = 1 << 20;
+constexpr size_t ITERATIONS = 200;
+
+using namespace singularity;
+
+struct Payload {
+    std::string name;
+    std::vector<std::byte> data;
+};
+
+std::vector<std::byte> fill(const std::string& pattern_source) {
+    std::vector<std::byte> data(PAYLOAD_SIZE);
+    for (size_t offset = 0; offset < data.size();
+         offset += pattern_source.size()) {
+        size_t length = std::min(pattern_source.size(), data.size() - offset);
+        memcpy(data.data() + offset, pattern_source.data(), length);
+    }
+    return data;
+}
+
+std::vector<Payload> make_payloads() {
+    std::mt19937_64 generator(42);
+    std::vector<Payload> payloads;
+
+    // structured records with varying fields, typical of RPC traffic
+    std::string json;
+    while (json.size() < PAYLOAD_SIZE) {
+        json += "{\"user\": " + std::to_string(generator() % 100000) +
+                ", \"action\": \"" +
+                (generator() % 2 == 0 ? "read" : "write") +
+                "\", \"latency_us\": " + std::to_string(generator() % 5000) +
+                ", \"region\": \"eu-west\"}\n";
+    }
+    payloads.push_back({"json records", fill(json)});
+
+    std::string logs;
+    while (logs.size() < PAYLOAD_SIZE) {
+        logs += "2024-05-01T12:00:" + std::to_string(generator() % 60) +
+                " INFO request served path=/api/v1/items/" +
+                std::to_string(generator() % 1000) + " status=200\n";
+    }
+    payloads.push_back({"log lines", fill(logs)});
+
+    // sensor style numeric data that changes slowly
+    std::vector<std::byte> numeric(PAYLOAD_SIZE);
+    float value = 0.0F;
+    for (size_t offset = 0; offset + sizeof(float) <= numeric.size();
+         offset += sizeof(float)) {
+        value += static_cast<float>(generator() % 3) - 1.0F;
+        memcpy(numeric.data() + offset, &value, sizeof(float));
+    }
+    payloads.push_back({"float series", std::move(numeric)});
+
+    // already compressed or encrypted data
+    std::vector<std::byte> noise(PAYLOAD_SIZE);
+    for (auto& byte : noise) byte = static_cast<std::byte>(generator() & 0xFF);
+    payloads.push_back({"random bytes", std::move(noise)});
+
+    payloads.push_back({"zeros", std::vector<std::byte>(PAYLOAD_SIZE)});
+    return payloads;
+}
+
+int main() {
+    using clock = std::chrono::steady_clock;
+
+    std::vector<std::byte> compressed(
+        compression::compress_bound(PAYLOAD_SIZE));
+    std::vector<std::byte> output(PAYLOAD_SIZE);
+
+    for (const auto& payload : make_payloads()) {
+        size_t compressed_size = 0;
+        auto start = clock::now();
+        for (size_t iteration = 0; iteration < ITERATIONS; ++iteration) {
+            compressed_size = compression::compress(
+                payload.data.data(), payload.data.size(), compressed.data(),
+                compressed.size());
+        }
+        double compress_time =
+            std::chrono::duration<double>(clock::now() - start).count();
+
+        start = clock::now();
+        for (size_t iteration = 0; iteration < ITERATIONS; ++iteration) {
+            compression::decompress(compressed.data(), compressed_size,
+                                    output.data(), output.size());
+        }
+        double decompress_time =
+            std::chrono::duration<double>(clock::now() - start).count();
+
+        if (output != payload.data) {
+            std::cerr << payload.name << ": round trip mismatch" << std::endl;
+            return 1;
+        }
+
+        double megabytes =
+            static_cast<double>(PAYLOAD_SIZE * ITERATIONS) / 1e6;
+        std::cout << payload.name << ": ratio "
+                  << static_cast<double>(PAYLOAD_SIZE) /
+                         static_cast<double>(compressed_size)
+                  << ", compress " << megabytes / compress_time
+                  << " MB/s, decompress " << megabytes / decompress_time
+                  << " MB/s" << std::endl;
+    }
+}
@@ -0,0 +1,288 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <semaphore>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "cli.hpp"
+#include "compute.hpp"
+#include "metrics.hpp"
+#include "sockimpl.hpp"
+#include "utils.hpp"
+
+// port of the compute server started when no target is given
+constexpr uint16_t LOCAL_PORT = 10207;
+// multiplications timed in process, to compare the service against
+constexpr size_t LOCAL_REPETITIONS = 5;
+
+using namespace singularity;
+
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    // zero starts a compute server in this process
+    uint16_t port = 0;
+    size_t connections = 2;
+    // zero serves every connection at once
+    size_t workers = 0;
+    size_t blas_threads = 1;
+    size_t size = 512;
+    compute::DType dtype = compute::DType::float64;
+    size_t requests = 20;
+    size_t depth = 2;
+};
+
+compute::Matrix random_matrix(compute::DType dtype, size_t size,
+                              uint32_t seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> distribution(-1, 1);
+    compute::Matrix matrix(dtype, size, size);
+    if (dtype == compute::DType::float32) {
+        for (float& value : matrix.values<float>()) {
+            value = static_cast<float>(distribution(generator));
+        }
+    } else {
+        for (double& value : matrix.values<double>()) {
+            value = distribution(generator);
+        }
+    }
+    return matrix;
+}
+
+double gigaflops(size_t size, size_t multiplications, double seconds) {
+    auto order = static_cast<double>(size);
+    return 2 * order * order * order *
+           static_cast<double>(multiplications) / seconds / 1e9;
+}
+
+/**
+ * @brief Multiplies the same operands over one connection, keeping up to
+ * `depth` requests in flight, and records how long each result took.
+ */
+void run_connection(const network::IPSocketAddress& address,
+                    const Options& options, uint32_t seed,
+                    metrics::Histogram& latency) {
+    compute::Matrix a = random_matrix(options.dtype, options.size, seed);
+    compute::Matrix b = random_matrix(options.dtype, options.size, seed + 1);
+    compute::ComputeClient client(address);
+
+    // submitted requests hold a slot until their result arrives
+    std::counting_semaphore<> slots(static_cast<ptrdiff_t>(options.depth));
+    // nanoseconds since the clock's epoch, published to the receiving thread
+    std::vector<std::atomic<int64_t>> submitted(options.requests);
+    std::exception_ptr failure;
+    std::thread sender([&]() {
+        try {
+            for (size_t index = 0; index < options.requests; ++index) {
+                slots.acquire();
+                submitted[index].store(
+                    clock_type::now().time_since_epoch().count(),
+                    std::memory_order_release);
+                client.submit(a, b);
+            }
+        } catch (...) {
+            failure = std::current_exception();
+            // no more results are coming, so wake up the receiving loop
+            try {
+                client.disable_receive();
+            } catch (const std::system_error&) {
+            }
+        }
+    });
+
+    try {
+        for (size_t index = 0; index < options.requests; ++index) {
+            compute::Matrix product = client.receive();
+            clock_type::time_point start{clock_type::duration{
+                submitted[index].load(std::memory_order_acquire)}};
+            latency.record(clock_type::now() - start);
+            slots.release();
+        }
+    } catch (const std::exception& error) {
+        std::cerr << "Connection stopped receiving: " << error.what()
+                  << std::endl;
+        // lets a sender waiting for a slot finish
+        slots.release(static_cast<ptrdiff_t>(options.depth));
+    }
+    sender.join();
+    client.close();
+    if (failure) std::rethrow_exception(failure);
+}
+
+void print_usage(const char* program) {
+    std::cerr
+        << "Usage: " << program << " [options]\n"
+        << "Multiplies square matrices on a compute server and reports the\n"
+        << "GFLOP/s achieved end to end, against the same multiplication in\n"
+        << "process. Targets a server started in this process unless --port\n"
+        << "is given.\n\n"
+        << "  --host ADDRESS       server address (default 127.0.0.1)\n"
+        << "  --port N             compute server port\n"
+        << "  --connections N      concurrent clients (default 2)\n"
+        << "  --workers N          workers of the local server (default: one "
+           "per connection)\n"
+        << "  --blas-threads N     BLAS threads per multiplication (default "
+           "1)\n"
+        << "  --size N             rows and columns of the matrices (default "
+           "512)\n"
+        << "  --dtype f32|f64      element type (default f64)\n"
+        << "  --requests N         multiplications per client (default 20)\n"
+        << "  --depth N            requests in flight per client (default 2)\n"
+        << "  --help               show this message\n";
+}
+
+// Returns the parsed options, or nothing if only the usage was requested.
+std::optional<Options> parse_options(int argc, char** argv) {
+    Options options;
+    auto handle = [&](std::string_view flag, const std::string& value) {
+        if (flag == "--host") {
+            options.host = value;
+        } else if (flag == "--port") {
+            size_t port = cli::parse_number(flag, value);
+            if (port == 0 || port > UINT16_MAX) {
+                throw std::invalid_argument("Port must be from 1 to 65535");
+            }
+            options.port = static_cast<uint16_t>(port);
+        } else if (flag == "--connections") {
+            options.connections = cli::parse_number(flag, value);
+        } else if (flag == "--workers") {
+            options.workers = cli::parse_number(flag, value);
+        } else if (flag == "--blas-threads") {
+            options.blas_threads = cli::parse_number(flag, value);
+        } else if (flag == "--size") {
+            options.size = cli::parse_number(flag, value);
+        } else if (flag == "--dtype") {
+            if (value == "f32") {
+                options.dtype = compute::DType::float32;
+            } else if (value == "f64") {
+                options.dtype = compute::DType::float64;
+            } else {
+                throw std::invalid_argument("Element type must be f32 or f64");
+            }
+        } else if (flag == "--requests") {
+            options.requests = cli::parse_number(flag, value);
+        } else if (flag == "--depth") {
+            options.depth = cli::parse_number(flag, value);
+        } else {
+            throw std::invalid_argument(
+                utils::build_string("Unknown option ", flag));
+        }
+    };
+    if (!cli::parse_flags(argc, argv, handle)) return std::nullopt;
+
+    if (options.connections == 0 || options.blas_threads == 0 ||
+        options.size == 0 || options.requests == 0 || options.depth == 0) {
+        throw std::invalid_argument(
+            "Connections, BLAS threads, size, requests and depth must be "
+            "positive");
+    }
+    return options;
+}
+
+int main(int argc, char** argv) {
+    std::optional<Options> parsed;
+    try {
+        parsed = parse_options(argc, argv);
+    } catch (const std::invalid_argument& error) {
+        std::cerr << error.what() << "\n\n";
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!parsed.has_value()) {
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+    }
+    const Options options = *parsed;
+
+    // the same multiplication without the network, as the ceiling
+    compute::set_blas_threads(options.blas_threads);
+    compute::Matrix a = random_matrix(options.dtype, options.size, 1);
+    compute::Matrix b = random_matrix(options.dtype, options.size, 2);
+    compute::multiply(a, b);
+    auto local_start = clock_type::now();
+    for (size_t index = 0; index < LOCAL_REPETITIONS; ++index) {
+        compute::multiply(a, b);
+    }
+    double local_seconds =
+        std::chrono::duration<double>(clock_type::now() - local_start).count();
+
+    std::unique_ptr<compute::ComputeServer> server;
+    uint16_t port = options.port;
+    if (port == 0) {
+        port = LOCAL_PORT;
+        compute::ComputeConfig config;
+        config.blas_threads = options.blas_threads;
+        config.server.backlog = static_cast<int>(options.connections);
+        // a worker is held by its connection until the client is done
+        config.workers.workers =
+            options.workers == 0 ? options.connections : options.workers;
+        config.workers.queue_capacity = options.connections;
+        server = std::make_unique<compute::ComputeServer>(port, config);
+        server->start();
+    }
+
+    network::IPSocketAddress address(options.host.c_str(), port);
+    std::vector<metrics::Histogram> latencies(options.connections);
+    std::vector<std::thread> clients;
+    std::atomic<bool> failed{false};
+    auto start = clock_type::now();
+    for (size_t index = 0; index < options.connections; ++index) {
+        clients.emplace_back([&, index]() {
+            try {
+                run_connection(address, options,
+                               static_cast<uint32_t>(2 * index + 1),
+                               latencies[index]);
+            } catch (const std::exception& error) {
+                std::cerr << "Client " << index << " failed: " << error.what()
+                          << std::endl;
+                failed = true;
+            }
+        });
+    }
+    for (auto& client : clients) client.join();
+    double seconds =
+        std::chrono::duration<double>(clock_type::now() - start).count();
+    if (server != nullptr) server->shutdown();
+
+    metrics::Histogram latency;
+    for (const auto& histogram : latencies) latency.merge(histogram);
+    uint64_t completed = latency.count();
+    // both operands go out and the product comes back
+    double megabytes = 3 * static_cast<double>(a.size_bytes()) *
+                       static_cast<double>(completed) / 1e6;
+    double service = gigaflops(options.size, completed, seconds);
+    double ceiling = gigaflops(options.size, LOCAL_REPETITIONS, local_seconds);
+    auto milliseconds = [&latency](double percentile) {
+        return static_cast<double>(latency.percentile(percentile)) / 1e6;
+    };
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "matrices:       " << options.size << "x" << options.size
+              << (options.dtype == compute::DType::float32 ? " f32" : " f64")
+              << "\nmultiplied:     " << completed << " of "
+              << options.connections * options.requests << " in " << seconds
+              << " s"
+              << "\nservice:        " << service << " GFLOP/s, " << megabytes
+              << " MB moved"
+              << "\nin process:     " << ceiling << " GFLOP/s on "
+              << options.blas_threads << " BLAS thread(s)"
+              << "\nefficiency:     " << 100 * service / ceiling << "%"
+              << std::setprecision(3) << "\nlatency p50:    "
+              << milliseconds(50) << " ms\nlatency p99:    " << milliseconds(99)
+              << " ms\nlatency max:    " << milliseconds(100) << " ms"
+              << std::endl;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
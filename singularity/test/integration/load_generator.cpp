@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "cli.hpp"
+#include "metrics.hpp"
+#include "sockimpl.hpp"
+#include "tcp_server.hpp"
+#include "utils.hpp"
+
+// port of the echo server started when no target is given
+constexpr uint16_t LOCAL_PORT = 10203;
+// time given to the server to answer once the last request was sent
+constexpr auto DRAIN_TIMEOUT = std::chrono::seconds(5);
+
+using namespace singularity;
+
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * @brief A period during which the request rate changes linearly from
+ * `start_rate` to `end_rate`, reported on its own.
+ */
+struct Stage {
+    double start_rate;
+    double end_rate;
+    std::chrono::nanoseconds duration;
+};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    // zero starts an echo server in this process
+    uint16_t port = 0;
+    size_t connections = 8;
+    // zero serves every connection at once
+    size_t workers = 0;
+    size_t size = 64;
+    std::vector<double> rates{1000};
+    bool ramp = false;
+    size_t ramp_stages = 5;
+    std::chrono::seconds stage_duration{5};
+};
+
+/**
+ * @brief The requests of a stage and how long they took.
+ */
+struct StageResult {
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> failed{0};
+    // when the last response of the stage arrived, since the run started
+    std::atomic<int64_t> last_answer_ns{0};
+    // latencies in nanoseconds, from the time each request was meant to be
+    // sent rather than the time it was
+    metrics::Histogram latency;
+};
+
+/**
+ * @brief The load profile, as consecutive stages.
+ */
+class Schedule {
+   private:
+    std::vector<Stage> _stages;
+    std::vector<std::chrono::nanoseconds> _starts;
+    std::chrono::nanoseconds _length;
+
+   public:
+    explicit Schedule(std::vector<Stage> stages)
+        : _stages{std::move(stages)}, _length{0} {
+        for (const auto& stage : _stages) {
+            _starts.push_back(_length);
+            _length += stage.duration;
+        }
+    }
+
+    [[nodiscard]] const std::vector<Stage>& stages() const { return _stages; }
+
+    [[nodiscard]] std::chrono::nanoseconds length() const { return _length; }
+
+    [[nodiscard]] std::chrono::nanoseconds start_of(size_t stage) const {
+        return _starts[stage];
+    }
+
+    // Returns the stage running at `elapsed`, which must be before the end.
+    [[nodiscard]] size_t stage_at(std::chrono::nanoseconds elapsed) const {
+        auto next = std::upper_bound(_starts.begin(), _starts.end(), elapsed);
+        return static_cast<size_t>(next - _starts.begin()) - 1;
+    }
+
+    // Returns the total request rate at `elapsed`, in requests per second.
+    [[nodiscard]] double rate_at(std::chrono::nanoseconds elapsed) const {
+        size_t index = stage_at(elapsed);
+        const Stage& stage = _stages[index];
+        double progress = std::chrono::duration<double>(elapsed -
+                                                        _starts[index]) /
+                          std::chrono::duration<double>(stage.duration);
+        return stage.start_rate +
+               (stage.end_rate - stage.start_rate) * progress;
+    }
+};
+
+/**
+ * @brief Sends requests on one connection at the times the schedule sets,
+ * whether or not earlier ones were answered.
+ *
+ * Each of the `connections` connections carries an equal share of the rate,
+ * offset from the others so that requests are spread evenly. A request is
+ * stamped with the time it was meant to be sent: when the sender falls
+ * behind, because the server stopped reading or this process was
+ * descheduled, the delay counts towards the request's latency instead of
+ * silently lowering the rate.
+ */
+void send_requests(network::TCPConnection& connection, const Schedule& schedule,
+                   std::vector<StageResult>& results, size_t index,
+                   size_t connections, size_t size,
+                   clock_type::time_point start) {
+    std::vector<std::byte> payload(size);
+    auto elapsed = std::chrono::nanoseconds(static_cast<int64_t>(
+        1e9 * static_cast<double>(index) / schedule.rate_at({})));
+
+    try {
+        while (elapsed < schedule.length()) {
+            std::this_thread::sleep_until(start + elapsed);
+            int64_t intended = elapsed.count();
+            std::memcpy(payload.data(), &intended, sizeof(intended));
+            StageResult& result = results[schedule.stage_at(elapsed)];
+            result.sent.fetch_add(1, std::memory_order_relaxed);
+            try {
+                connection.send_frame(
+                    network::MessageBuffer(payload.data(), payload.size()));
+            } catch (const std::exception&) {
+                result.failed.fetch_add(1, std::memory_order_relaxed);
+                throw;
+            }
+            elapsed += std::chrono::nanoseconds(static_cast<int64_t>(
+                1e9 * static_cast<double>(connections) /
+                schedule.rate_at(elapsed)));
+        }
+        connection.disable_send();
+    } catch (const std::exception& error) {
+        std::cerr << "Connection " << index << " stopped sending: "
+                  << error.what() << std::endl;
+    }
+}
+
+/**
+ * @brief Receives the echoed requests of one connection, recording their
+ * latency in the stage they were meant to be sent in.
+ */
+void receive_responses(network::TCPConnection& connection,
+                       const Schedule& schedule,
+                       std::vector<StageResult>& results,
+                       clock_type::time_point start) {
+    auto deadline = start + schedule.length() + DRAIN_TIMEOUT;
+    try {
+        while (auto response = connection.receive_frame(deadline)) {
+            auto now = clock_type::now();
+            int64_t intended;
+            if (response->length() < sizeof(intended)) {
+                throw std::runtime_error("Response shorter than its request");
+            }
+            std::memcpy(&intended, response->raw(), sizeof(intended));
+            auto elapsed = std::chrono::nanoseconds(intended);
+            StageResult& result = results[schedule.stage_at(elapsed)];
+            result.latency.record(now - (start + elapsed));
+
+            int64_t answered = (now - start).count();
+            int64_t last = result.last_answer_ns.load();
+            while (last < answered &&
+                   !result.last_answer_ns.compare_exchange_weak(last,
+                                                                answered)) {
+            }
+        }
+    } catch (const network::TimeoutError&) {
+        // whatever is left unanswered is reported as such
+    } catch (const std::exception& error) {
+        std::cerr << "Connection stopped receiving: " << error.what()
+                  << std::endl;
+    }
+}
+
+void print_usage(const char* program) {
+    std::cerr
+        << "Usage: " << program << " [options]\n"
+        << "Sends framed requests at a fixed rate, whether or not earlier\n"
+        << "ones were answered, and reports their latency from the time they\n"
+        << "were meant to be sent. Targets an echo server started in this\n"
+        << "process unless --port is given.\n\n"
+        << "  --host ADDRESS     server address (default 127.0.0.1)\n"
+        << "  --port N           server port, which must echo frames back\n"
+        << "  --connections N    connections sharing the load (default 8)\n"
+        << "  --workers N        workers of the local server (default: one "
+           "per connection)\n"
+        << "  --size N           request size in bytes, at least 8 (default "
+           "64)\n"
+        << "  --rate R           requests per second (default 1000)\n"
+        << "  --step LIST        rates to step through, one stage each\n"
+        << "  --ramp FROM,TO     rate rising linearly over the stages\n"
+        << "  --stages N         stages of a ramp (default 5)\n"
+        << "  --duration S       seconds per stage (default 5)\n"
+        << "  --help             show this message\n";
+}
+
+std::vector<double> parse_rates(std::string_view flag,
+                                const std::string& value) {
+    std::vector<double> rates;
+    for (const auto& part : cli::split(value)) {
+        size_t rate = cli::parse_number(flag, part);
+        if (rate == 0) {
+            throw std::invalid_argument("Rates must be positive");
+        }
+        rates.push_back(static_cast<double>(rate));
+    }
+    return rates;
+}
+
+// Returns the parsed options, or nothing if only the usage was requested.
+std::optional<Options> parse_options(int argc, char** argv) {
+    Options options;
+    size_t profiles = 0;
+    auto handle = [&](std::string_view flag, const std::string& value) {
+        if (flag == "--host") {
+            options.host = value;
+        } else if (flag == "--port") {
+            size_t port = cli::parse_number(flag, value);
+            if (port == 0 || port > UINT16_MAX) {
+                throw std::invalid_argument("Port must be from 1 to 65535");
+            }
+            options.port = static_cast<uint16_t>(port);
+        } else if (flag == "--connections") {
+            options.connections = cli::parse_number(flag, value);
+        } else if (flag == "--workers") {
+            options.workers = cli::parse_number(flag, value);
+        } else if (flag == "--size") {
+            options.size = cli::parse_number(flag, value);
+        } else if (flag == "--rate" || flag == "--step") {
+            options.rates = parse_rates(flag, value);
+            if (flag == "--rate" && options.rates.size() != 1) {
+                throw std::invalid_argument("--rate takes a single rate");
+            }
+            options.ramp = false;
+            ++profiles;
+        } else if (flag == "--ramp") {
+            options.rates = parse_rates(flag, value);
+            if (options.rates.size() != 2) {
+                throw std::invalid_argument("--ramp takes two rates");
+            }
+            options.ramp = true;
+            ++profiles;
+        } else if (flag == "--stages") {
+            options.ramp_stages = cli::parse_number(flag, value);
+        } else if (flag == "--duration") {
+            options.stage_duration =
+                std::chrono::seconds(cli::parse_number(flag, value));
+        } else {
+            throw std::invalid_argument(
+                utils::build_string("Unknown option ", flag));
+        }
+    };
+    if (!cli::parse_flags(argc, argv, handle)) return std::nullopt;
+
+    if (profiles > 1) {
+        throw std::invalid_argument(
+            "Only one of --rate, --step and --ramp can be given");
+    }
+    if (options.connections == 0 || options.ramp_stages == 0 ||
+        options.stage_duration.count() == 0) {
+        throw std::invalid_argument(
+            "Connections, stages and duration must be positive");
+    }
+    if (options.size < sizeof(int64_t)) {
+        throw std::invalid_argument("Requests must be at least 8 bytes");
+    }
+    return options;
+}
+
+std::vector<Stage> make_stages(const Options& options) {
+    std::vector<Stage> stages;
+    if (!options.ramp) {
+        for (double rate : options.rates) {
+            stages.push_back({rate, rate, options.stage_duration});
+        }
+        return stages;
+    }
+    double from = options.rates[0];
+    double step = (options.rates[1] - from) /
+                  static_cast<double>(options.ramp_stages);
+    for (size_t index = 0; index < options.ramp_stages; ++index) {
+        double start = from + step * static_cast<double>(index);
+        stages.push_back({start, start + step, options.stage_duration});
+    }
+    return stages;
+}
+
+void print_report(const Schedule& schedule,
+                  const std::vector<StageResult>& results) {
+    std::cout << std::left << std::setw(6) << "stage" << std::right
+              << std::setw(18) << "target/s" << std::setw(10) << "sent"
+              << std::setw(10) << "answered" << std::setw(12) << "achieved/s"
+              << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms"
+              << std::setw(10) << "p99 ms" << std::setw(10) << "p99.9 ms"
+              << std::setw(10) << "max ms" << "\n";
+
+    std::cout << std::fixed;
+    for (size_t index = 0; index < results.size(); ++index) {
+        const Stage& stage = schedule.stages()[index];
+        const StageResult& result = results[index];
+        std::string target =
+            stage.start_rate == stage.end_rate
+                ? utils::build_string(static_cast<uint64_t>(stage.start_rate))
+                : utils::build_string(
+                      static_cast<uint64_t>(stage.start_rate), "-",
+                      static_cast<uint64_t>(stage.end_rate));
+        uint64_t answered = result.latency.count();
+        // a server falling behind answers the stage's requests after it ended
+        auto answering = std::max(
+            stage.duration, std::chrono::nanoseconds(result.last_answer_ns) -
+                                schedule.start_of(index));
+        double seconds = std::chrono::duration<double>(answering).count();
+        auto milliseconds = [&result](double percentile) {
+            return static_cast<double>(result.latency.percentile(percentile)) /
+                   1e6;
+        };
+
+        std::cout << std::left << std::setw(6) << index + 1 << std::right
+                  << std::setw(18) << target << std::setw(10) << result.sent
+                  << std::setw(10) << answered << std::setprecision(1)
+                  << std::setw(12) << static_cast<double>(answered) / seconds
+                  << std::setprecision(3) << std::setw(10) << milliseconds(50)
+                  << std::setw(10) << milliseconds(90) << std::setw(10)
+                  << milliseconds(99) << std::setw(10) << milliseconds(99.9)
+                  << std::setw(10) << milliseconds(100) << "\n";
+        if (result.failed > 0 || answered < result.sent) {
+            std::cout << "      " << result.sent - answered
+                      << " unanswered, of which " << result.failed
+                      << " failed to send\n";
+        }
+    }
+    std::cout << std::flush;
+}
+
+int main(int argc, char** argv) {
+    std::optional<Options> parsed;
+    try {
+        parsed = parse_options(argc, argv);
+    } catch (const std::invalid_argument& error) {
+        std::cerr << error.what() << "\n\n";
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!parsed.has_value()) {
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+    }
+    const Options options = *parsed;
+
+    std::unique_ptr<network::TCPServer> server;
+    uint16_t port = options.port;
+    if (port == 0) {
+        port = LOCAL_PORT;
+        network::ServerConfig config;
+        config.backlog = static_cast<int>(options.connections);
+        server = std::make_unique<network::TCPServer>(port, config);
+
+        // a worker is held by its connection until the client is done
+        network::WorkerConfig workers;
+        workers.workers =
+            options.workers == 0 ? options.connections : options.workers;
+        workers.queue_capacity = options.connections;
+        server->serve(
+            [](network::TCPConnection& connection) {
+                while (auto request = connection.receive_frame()) {
+                    connection.send_frame(*request);
+                }
+            },
+            workers);
+    }
+
+    network::IPSocketAddress address(options.host.c_str(), port);
+    std::vector<network::TCPConnection> connections;
+    connections.reserve(options.connections);
+    try {
+        for (size_t index = 0; index < options.connections; ++index) {
+            connections.emplace_back(address).open();
+        }
+    } catch (const std::exception& error) {
+        std::cerr << "Unable to connect: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Schedule schedule(make_stages(options));
+    std::vector<StageResult> results(schedule.stages().size());
+    // leave the threads time to start before the first request is due
+    auto start = clock_type::now() + std::chrono::milliseconds(100);
+
+    // each connection is used by one sender and one receiver, which touch
+    // separate directions of the socket
+    std::vector<std::thread> threads;
+    threads.reserve(2 * options.connections);
+    for (size_t index = 0; index < options.connections; ++index) {
+        threads.emplace_back(send_requests, std::ref(connections[index]),
+                             std::cref(schedule), std::ref(results), index,
+                             options.connections, options.size, start);
+        threads.emplace_back(receive_responses, std::ref(connections[index]),
+                             std::cref(schedule), std::ref(results), start);
+    }
+    for (auto& thread : threads) thread.join();
+
+    connections.clear();
+    if (server != nullptr) server->shutdown(DRAIN_TIMEOUT);
+    print_report(schedule, results);
+    return EXIT_SUCCESS;
+}
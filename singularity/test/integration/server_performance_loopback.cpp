@@ -3,12 +3,18 @@
 
 #include <atomic>
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <mutex>
+#include <stdexcept>
+#include <string_view>
 #include <thread>
+#include <vector>
 
+#include "perf_counters.hpp"
 #include "tcp_server.hpp"
+#include "utils.hpp"
 
 constexpr size_t TOTAL_CONNECTIONS = 10000;
 constexpr size_t NUM_THREADS = 15;
@@ -52,7 +58,45 @@ void launch_client(std::atomic<size_t>& num_connections, size_t ctx_count) {
     }
 }
 
-int main() {
+void print_usage(const char* program) {
+    std::cerr
+        << "Usage: " << program << " [options]\n"
+        << "Echoes a message over " << TOTAL_CONNECTIONS
+        << " loopback connections, reporting the\n"
+        << "time and events per connection.\n\n"
+        << "  --write-baseline FILE  save the figures as a baseline\n"
+        << "  --compare FILE         compare against a baseline, failing on "
+           "regressions\n"
+        << "  --threshold PERCENT    noise allowed before a figure regresses "
+           "(default 5)\n"
+        << "  --help                 show this message\n";
+}
+
+int main(int argc, char** argv) {
+    benchmark::BaselineOptions baseline;
+    try {
+        for (int index = 1; index < argc; ++index) {
+            std::string_view flag = argv[index];
+            if (flag == "--help" || flag == "-h") {
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            }
+            if (index + 1 >= argc || !baseline.parse(flag, argv[index + 1])) {
+                throw std::invalid_argument(
+                    utils::build_string("Unknown option ", flag));
+            }
+            ++index;
+        }
+    } catch (const std::invalid_argument& error) {
+        std::cerr << error.what() << "\n\n";
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // the server's threads are only counted if started after the counters
+    benchmark::PerfCounters counters;
+    counters.start();
+
     std::atomic<size_t> num_connections = 0;
     std::atomic<bool> handler_shutdown = false;
 
@@ -93,4 +137,17 @@ int main() {
     server.shutdown();
     handler_shutdown.exchange(true);
     handle_thread.join();
+
+    std::vector<benchmark::Result> results = {
+        {"echo", TOTAL_CONNECTIONS, counters.stop()}};
+    benchmark::print_results(std::cout, results);
+    try {
+        if (!benchmark::check_baseline(baseline, results, std::cerr)) {
+            return EXIT_FAILURE;
+        }
+    } catch (const std::exception& error) {
+        std::cerr << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "sockimpl.hpp"
+
+constexpr size_t TOTAL_DATAGRAMS = 10000000;
+constexpr size_t DATAGRAM_SIZE = 64;
+constexpr size_t BATCH_SIZE = 64;
+
+using namespace singularity;
+
+int main() {
+    network::UDPSocket receiver(BATCH_SIZE);
+    receiver.bind(network::IPSocketAddress("127.0.0.1", 0));
+    receiver.set_receive_timeout(std::chrono::milliseconds(200));
+    network::IPSocketAddress destination = receiver.local_address();
+
+    std::atomic<size_t> num_received = 0;
+    std::thread consumer([&receiver, &num_received]() {
+        size_t received = 0;
+        auto discard = [&received](const network::IPSocketAddress&,
+                                   const std::byte*, size_t) { ++received; };
+        // stop once the sender has gone quiet
+        while (receiver.receive_batch(discard) > 0) {
+        }
+        num_received = received;
+    });
+
+    char payload[DATAGRAM_SIZE] = {0};
+    std::vector<network::Datagram> batch;
+    for (size_t index = 0; index < BATCH_SIZE; ++index) {
+        batch.push_back({destination, network::MessageBuffer(
+                                          payload, DATAGRAM_SIZE)});
+    }
+
+    network::UDPSocket sender(BATCH_SIZE);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t sent = 0; sent < TOTAL_DATAGRAMS; sent += BATCH_SIZE) {
+        sender.send_batch(batch);
+    }
+    auto elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    consumer.join();
+
+    std::cout << "Sent " << TOTAL_DATAGRAMS << " datagrams of "
+              << DATAGRAM_SIZE << " bytes in " << elapsed << "s ("
+              << static_cast<double>(TOTAL_DATAGRAMS) / elapsed
+              << " datagrams/s)\n";
+    std::cout << "Received " << num_received << " datagrams ("
+              << static_cast<double>(num_received) / elapsed
+              << " datagrams/s)" << std::endl;
+}
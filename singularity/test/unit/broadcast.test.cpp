@@ -0,0 +1,134 @@
+#include "broadcast.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "concurrency.hpp"
+#include "tcp_server.hpp"
+
+using namespace singularity;
+using namespace singularity::network;
+
+constexpr uint16_t PORT = 10404;
+
+class BroadcasterTest : public testing::Test {
+   protected:
+    TCPServer server{PORT};
+    concurrency::FixedBuffer<TCPConnection, 30> accepted;
+
+    void SetUp() override { server.start(accepted); }
+
+    // Connects a client, returning it along with the server side of the
+    // connection.
+    std::pair<TCPConnection, TCPConnection> connect() {
+        TCPConnection client(IPSocketAddress("127.0.0.1", PORT));
+        client.open();
+        return {std::move(client), accepted.pop()};
+    }
+
+    static std::shared_ptr<const MessageBuffer> message(
+        const std::string& text) {
+        return std::make_shared<const MessageBuffer>(
+            MessageBuffer::from_string(text));
+    }
+
+    static std::string receive(TCPConnection& client) {
+        auto frame = client.receive_frame(std::chrono::steady_clock::now() +
+                                          std::chrono::seconds(5));
+        EXPECT_TRUE(frame.has_value());
+        return frame.has_value()
+                   ? reinterpret_cast<const char*>(frame->raw())
+                   : "";
+    }
+};
+
+TEST_F(BroadcasterTest, TopicFanOut) {
+    EXPECT_THROW({ Broadcaster invalid({.queue_capacity = 0}); },
+                 std::invalid_argument);
+
+    Broadcaster broadcaster({.threads = 2});
+    auto [first_client, first] = connect();
+    auto [second_client, second] = connect();
+    auto first_id = broadcaster.add_subscriber(std::move(first));
+    auto second_id = broadcaster.add_subscriber(std::move(second));
+    EXPECT_EQ(broadcaster.subscribers(), 2);
+
+    EXPECT_TRUE(broadcaster.subscribe(first_id, "prices"));
+    EXPECT_TRUE(broadcaster.subscribe(second_id, "prices"));
+    EXPECT_TRUE(broadcaster.subscribe(second_id, "trades"));
+
+    EXPECT_EQ(broadcaster.publish("prices", message("AAPL 189.5")), 2);
+    EXPECT_EQ(broadcaster.publish("trades", message("AAPL 100@189.4")), 1);
+    EXPECT_EQ(broadcaster.publish("news", message("nobody listens")), 0);
+
+    broadcaster.unsubscribe(second_id, "prices");
+    EXPECT_EQ(broadcaster.publish("prices", message("MSFT 411.2")), 1);
+
+    EXPECT_EQ(receive(first_client), "AAPL 189.5");
+    EXPECT_EQ(receive(first_client), "MSFT 411.2");
+    EXPECT_EQ(receive(second_client), "AAPL 189.5");
+    EXPECT_EQ(receive(second_client), "AAPL 100@189.4");
+
+    // removal closes the connection
+    broadcaster.remove_subscriber(first_id);
+    EXPECT_FALSE(broadcaster.subscribe(first_id, "prices"));
+    EXPECT_EQ(broadcaster.subscribers(), 1);
+    EXPECT_ANY_THROW({ first_client.receive_frame(); });
+
+    auto stats = broadcaster.stats();
+    EXPECT_EQ(stats.published, 4);
+    EXPECT_EQ(stats.delivered, 4);
+}
+
+class SlowConsumerTest
+    : public BroadcasterTest,
+      public testing::WithParamInterface<SlowConsumerPolicy> {};
+
+// One subscriber never reads, so its socket and then its queue fill up, while
+// the other reads every message as it is published.
+TEST_P(SlowConsumerTest, SlowSubscriberDoesNotStallOthers) {
+    Broadcaster broadcaster({.queue_capacity = 4, .policy = GetParam()});
+    auto [slow_client, slow] = connect();
+    auto [fast_client, fast] = connect();
+    auto slow_id = broadcaster.add_subscriber(std::move(slow));
+    auto fast_id = broadcaster.add_subscriber(std::move(fast));
+
+    // alternating topics give conflation something to merge
+    for (const char* topic : {"even", "odd"}) {
+        broadcaster.subscribe(slow_id, topic);
+        broadcaster.subscribe(fast_id, topic);
+    }
+
+    constexpr size_t MESSAGES = 200;
+    std::string payload(256 * 1024, 'm');
+    for (size_t index = 0; index < MESSAGES; ++index) {
+        std::string text = std::to_string(index) + payload;
+        broadcaster.publish(index % 2 == 0 ? "even" : "odd", message(text));
+        EXPECT_EQ(receive(fast_client), text);
+    }
+
+    auto stats = broadcaster.stats();
+    switch (GetParam()) {
+        case SlowConsumerPolicy::drop:
+            EXPECT_GT(stats.dropped, 0);
+            break;
+        case SlowConsumerPolicy::disconnect:
+            EXPECT_EQ(stats.disconnected, 1);
+            EXPECT_EQ(broadcaster.subscribers(), 1);
+            break;
+        case SlowConsumerPolicy::conflate:
+            EXPECT_GT(stats.conflated, 0);
+            break;
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Policies, SlowConsumerTest,
+                         testing::Values(SlowConsumerPolicy::drop,
+                                         SlowConsumerPolicy::disconnect,
+                                         SlowConsumerPolicy::conflate));
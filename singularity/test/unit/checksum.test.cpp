@@ -0,0 +1,54 @@
+#include "checksum.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace singularity;
+
+TEST(ChecksumTest, KnownVectors) {
+    const char* digits = "123456789";
+    EXPECT_EQ(checksum::crc32c(digits, strlen(digits)), 0xE3069283);
+    EXPECT_EQ(checksum::crc32c_portable(digits, strlen(digits)), 0xE3069283);
+    EXPECT_EQ(checksum::crc32c(nullptr, 0), 0);
+
+    // RFC 3720 test patterns
+    std::vector<uint8_t> zeros(32, 0);
+    std::vector<uint8_t> ones(32, 0xFF);
+    EXPECT_EQ(checksum::crc32c(zeros.data(), zeros.size()), 0x8A9136AA);
+    EXPECT_EQ(checksum::crc32c(ones.data(), ones.size()), 0x62A8AB43);
+}
+
+TEST(ChecksumTest, MatchesPortable) {
+    std::mt19937_64 generator(11);
+    std::vector<uint8_t> data(3 * 8192 * 2 + 3 * 256 + 77);
+    for (auto& byte : data) byte = static_cast<uint8_t>(generator());
+
+    // cover every kernel and misaligned starts
+    for (size_t length : {size_t{0}, size_t{1}, size_t{7}, size_t{8},
+                          size_t{255}, size_t{3 * 256}, size_t{3 * 256 + 13},
+                          size_t{3 * 8192}, size_t{3 * 8192 + 3 * 256 + 5},
+                          data.size() - 3}) {
+        for (size_t offset = 0; offset < 3; ++offset) {
+            EXPECT_EQ(checksum::crc32c(data.data() + offset, length),
+                      checksum::crc32c_portable(data.data() + offset, length))
+                << "length " << length << ", offset " << offset;
+        }
+    }
+}
+
+TEST(ChecksumTest, Incremental) {
+    std::string text(50000, '\0');
+    for (size_t index = 0; index < text.size(); ++index) {
+        text[index] = static_cast<char>(index * 31 % 251);
+    }
+
+    uint32_t whole = checksum::crc32c(text.data(), text.size());
+    uint32_t partial = checksum::crc32c(text.data(), 12345);
+    partial = checksum::crc32c(text.data() + 12345, text.size() - 12345,
+                               partial);
+    EXPECT_EQ(partial, whole);
+}
@@ -0,0 +1,133 @@
+#include "compression.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace singularity;
+
+std::vector<std::byte> round_trip(const std::vector<std::byte>& input) {
+    std::vector<std::byte> compressed(
+        compression::compress_bound(input.size()));
+    size_t compressed_size = compression::compress(
+        input.data(), input.size(), compressed.data(), compressed.size());
+    EXPECT_GT(compressed_size, 0);
+
+    std::vector<std::byte> output(input.size());
+    size_t output_size = compression::decompress(
+        compressed.data(), compressed_size, output.data(), output.size());
+    output.resize(output_size);
+    return output;
+}
+
+std::vector<std::byte> to_bytes(const std::string& text) {
+    std::vector<std::byte> bytes(text.size());
+    memcpy(bytes.data(), text.data(), text.size());
+    return bytes;
+}
+
+std::vector<std::byte> random_bytes(size_t length, uint64_t seed) {
+    std::mt19937_64 generator(seed);
+    std::vector<std::byte> bytes(length);
+    for (auto& byte : bytes) {
+        byte = static_cast<std::byte>(generator() & 0xFF);
+    }
+    return bytes;
+}
+
+TEST(CompressionTest, RoundTrip) {
+    std::string text;
+    for (size_t index = 0; index < 2000; ++index) {
+        text += "{\"id\": " + std::to_string(index) +
+                ", \"status\": \"ok\", \"tags\": [\"alpha\", \"beta\"]}\n";
+    }
+
+    std::vector<std::vector<std::byte>> inputs = {
+        {},
+        to_bytes("a"),
+        to_bytes("short, but longer than the match find limit"),
+        to_bytes(std::string(100000, 'z')),
+        to_bytes(text),
+        random_bytes(70000, 1),
+    };
+    for (const auto& input : inputs) {
+        EXPECT_EQ(round_trip(input), input);
+    }
+}
+
+TEST(CompressionTest, Ratio) {
+    auto input = to_bytes(std::string(100000, 'z'));
+    std::vector<std::byte> compressed(
+        compression::compress_bound(input.size()));
+    size_t size = compression::compress(input.data(), input.size(),
+                                        compressed.data(), compressed.size());
+    EXPECT_LT(size, input.size() / 100);
+
+    // too small an output is reported instead of overrun
+    auto noise = random_bytes(10000, 2);
+    EXPECT_EQ(compression::compress(noise.data(), noise.size(),
+                                    compressed.data(), noise.size() / 2),
+              0);
+}
+
+TEST(CompressionTest, MalformedInput) {
+    auto input = to_bytes(std::string(5000, 'q') + "tail of the block");
+    std::vector<std::byte> compressed(
+        compression::compress_bound(input.size()));
+    size_t size = compression::compress(input.data(), input.size(),
+                                        compressed.data(), compressed.size());
+    std::vector<std::byte> output(input.size());
+
+    // truncated blocks and undersized outputs are rejected
+    EXPECT_THROW(
+        {
+            compression::decompress(compressed.data(), size - 1,
+                                    output.data(), output.size());
+        },
+        compression::DecompressionError);
+    EXPECT_THROW(
+        {
+            compression::decompress(compressed.data(), size, output.data(),
+                                    output.size() - 1);
+        },
+        compression::DecompressionError);
+
+    // random garbage never escapes the buffers
+    for (uint64_t seed = 0; seed < 200; ++seed) {
+        auto garbage = random_bytes(64, seed);
+        try {
+            compression::decompress(garbage.data(), garbage.size(),
+                                    output.data(), output.size());
+        } catch (const compression::DecompressionError&) {
+        }
+    }
+}
+
+TEST(CompressorTest, AdaptiveSkip) {
+    compression::Compressor compressor(64);
+    auto text = to_bytes(std::string(4096, 'x'));
+    auto noise = random_bytes(4096, 3);
+
+    EXPECT_FALSE(compressor.compress(text.data(), 32).has_value());
+    EXPECT_TRUE(compressor.compress(text.data(), text.size()).has_value());
+
+    // an incompressible message backs off for 1, then 2, then 4 messages
+    EXPECT_FALSE(compressor.compress(noise.data(), noise.size()).has_value());
+    EXPECT_FALSE(compressor.compress(text.data(), text.size()).has_value());
+    EXPECT_FALSE(compressor.compress(noise.data(), noise.size()).has_value());
+    EXPECT_FALSE(compressor.compress(text.data(), text.size()).has_value());
+    EXPECT_FALSE(compressor.compress(text.data(), text.size()).has_value());
+
+    // a compressible message is tried again, and resets the backoff
+    auto size = compressor.compress(text.data(), text.size());
+    ASSERT_TRUE(size.has_value());
+    std::vector<std::byte> output(text.size());
+    EXPECT_EQ(compression::decompress(compressor.data(), *size, output.data(),
+                                      output.size()),
+              text.size());
+    EXPECT_EQ(output, text);
+    EXPECT_TRUE(compressor.compress(text.data(), text.size()).has_value());
+}
@@ -0,0 +1,272 @@
+#include "compute.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace singularity;
+using namespace singularity::compute;
+
+constexpr uint16_t PORT = 10606;
+
+template <typename T>
+Matrix random_matrix(size_t rows, size_t cols, uint32_t seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<T> distribution(-1, 1);
+    Matrix matrix(dtype_of<T>::value, rows, cols);
+    for (T& value : matrix.values<T>()) value = distribution(generator);
+    return matrix;
+}
+
+// Checks a product against the textbook algorithm.
+template <typename T>
+void expect_product(const Matrix& a, const Matrix& b, const Matrix& product,
+                    T tolerance) {
+    ASSERT_EQ(product.dtype(), dtype_of<T>::value);
+    ASSERT_EQ(product.rows(), a.rows());
+    ASSERT_EQ(product.cols(), b.cols());
+    auto left = a.values<T>();
+    auto right = b.values<T>();
+    auto result = product.values<T>();
+    for (size_t row = 0; row < a.rows(); ++row) {
+        for (size_t col = 0; col < b.cols(); ++col) {
+            T expected = 0;
+            for (size_t index = 0; index < a.cols(); ++index) {
+                expected += left[row * a.cols() + index] *
+                            right[index * b.cols() + col];
+            }
+            EXPECT_NEAR(result[row * b.cols() + col], expected, tolerance);
+        }
+    }
+}
+
+TEST(ComputeTest, MultipliesSinglePrecision) {
+    Matrix a = random_matrix<float>(37, 53, 1);
+    Matrix b = random_matrix<float>(53, 29, 2);
+    expect_product<float>(a, b, multiply(a, b), 1e-4F);
+}
+
+TEST(ComputeTest, MultipliesDoublePrecision) {
+    Matrix a = random_matrix<double>(64, 1, 3);
+    Matrix b = random_matrix<double>(1, 100, 4);
+    expect_product<double>(a, b, multiply(a, b), 1e-12);
+}
+
+TEST(ComputeTest, RejectsMismatchedOperands) {
+    Matrix a = random_matrix<float>(4, 5, 1);
+    EXPECT_THROW(multiply(a, random_matrix<float>(4, 5, 2)),
+                 std::invalid_argument);
+    EXPECT_THROW(multiply(a, random_matrix<double>(5, 4, 2)),
+                 std::invalid_argument);
+}
+
+TEST(ComputeTest, ChecksShapeAndElementType) {
+    EXPECT_THROW(Matrix(DType::float32, 0, 4), std::invalid_argument);
+    EXPECT_THROW(Matrix(DType::float64, 4, size_t{1} << 31),
+                 std::invalid_argument);
+
+    Matrix matrix(DType::float64, 3, 2);
+    EXPECT_EQ(matrix.size_bytes(), 6 * sizeof(double));
+    EXPECT_EQ(matrix.values<double>().size(), 6);
+    EXPECT_THROW(matrix.values<float>(), std::invalid_argument);
+}
+
+TEST(ComputeTest, AlignsAndPadsBuffers) {
+    for (size_t size : {0, 1, 64, 100}) {
+        AlignedBuffer buffer(size);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer.data()) %
+                      AlignedBuffer::ALIGNMENT,
+                  0);
+        EXPECT_EQ(buffer.size(), size);
+        EXPECT_EQ(buffer.capacity() % AlignedBuffer::ALIGNMENT, 0);
+        EXPECT_GE(buffer.capacity(), std::max<size_t>(size, 1));
+        for (size_t index = size; index < buffer.capacity(); ++index) {
+            EXPECT_EQ(buffer.data()[index], std::byte{0});
+        }
+    }
+}
+
+TEST(ComputeTest, ViewsElementsInPlace) {
+    auto storage = std::make_shared<AlignedBuffer>(64 + 6 * sizeof(double));
+    auto* elements = reinterpret_cast<double*>(storage->data() + 64);
+    for (size_t index = 0; index < 6; ++index) {
+        elements[index] = static_cast<double>(index);
+    }
+
+    MatrixHeader header{DType::float64, 2, 2, 3};
+    Matrix view(header, storage, 64);
+    EXPECT_EQ(view.data(), storage->data() + 64);
+    EXPECT_EQ(view.row<double>(1)[0], 3);
+    EXPECT_EQ(view.row<double>(1).size(), 2);
+
+    EXPECT_THROW(Matrix(header, storage, 32), std::invalid_argument);
+    EXPECT_THROW(Matrix(header, storage, 128), std::invalid_argument);
+    EXPECT_THROW(Matrix({DType::float64, 2, 4, 3}, storage, 64),
+                 std::invalid_argument);
+}
+
+TEST(ComputeTest, MultipliesStridedMatrices) {
+    Matrix a = random_matrix<double>(3, 4, 10);
+    Matrix b = random_matrix<double>(4, 5, 11);
+    Matrix padded_a(DType::float64, 3, 4, 8);
+    for (size_t row = 0; row < 3; ++row) {
+        for (size_t col = 0; col < 4; ++col) {
+            padded_a.values<double>()[row * 8 + col] = a.row<double>(row)[col];
+        }
+    }
+
+    Matrix product(DType::float64, 3, 5, 8);
+    multiply(padded_a, b, product);
+    Matrix expected = multiply(a, b);
+    for (size_t row = 0; row < 3; ++row) {
+        for (size_t col = 0; col < 5; ++col) {
+            EXPECT_NEAR(product.row<double>(row)[col],
+                        expected.row<double>(row)[col], 1e-12);
+        }
+    }
+    EXPECT_THROW(multiply(a, b, padded_a), std::invalid_argument);
+}
+
+TEST(ComputeTest, SetsBlasThreads) {
+    EXPECT_THROW(set_blas_threads(0), std::invalid_argument);
+    set_blas_threads(1);
+    EXPECT_EQ(blas_threads(), 1);
+}
+
+class ComputeServerTest : public testing::Test {
+   protected:
+    ComputeServer server{PORT};
+    network::IPSocketAddress address{"127.0.0.1", PORT};
+
+    void SetUp() override { server.start(); }
+};
+
+TEST_F(ComputeServerTest, MultipliesRemotely) {
+    ComputeClient client(address);
+    Matrix a = random_matrix<float>(20, 30, 5);
+    Matrix b = random_matrix<float>(30, 10, 6);
+    expect_product<float>(a, b, client.multiply(a, b), 1e-4F);
+
+    Matrix c = random_matrix<double>(8, 8, 7);
+    expect_product<double>(c, c, client.multiply(c, c), 1e-12);
+    client.close();
+}
+
+TEST_F(ComputeServerTest, StreamsPipelinedResultsInOrder) {
+    ComputeClient client(address);
+    std::vector<std::pair<Matrix, Matrix>> operands;
+    for (size_t index = 1; index <= 8; ++index) {
+        auto seed = static_cast<uint32_t>(index);
+        operands.emplace_back(random_matrix<double>(index, 16, seed),
+                              random_matrix<double>(16, 2 * index, seed + 1));
+        client.submit(operands.back().first, operands.back().second);
+    }
+    for (const auto& [a, b] : operands) {
+        expect_product<double>(a, b, client.receive(), 1e-12);
+    }
+    client.close();
+}
+
+TEST_F(ComputeServerTest, ReceivesResultsAligned) {
+    ComputeClient client(address);
+    Matrix a = random_matrix<float>(3, 5, 8);
+    Matrix b = random_matrix<float>(5, 7, 9);
+    Matrix product = client.multiply(a, b);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(product.data()) %
+                  AlignedBuffer::ALIGNMENT,
+              0);
+    expect_product<float>(a, b, product, 1e-5F);
+
+    // strided operands arrive with their layout intact
+    Matrix padded(DType::float32, 5, 7, 16);
+    for (size_t row = 0; row < 5; ++row) {
+        for (size_t col = 0; col < 7; ++col) {
+            padded.values<float>()[row * 16 + col] = b.row<float>(row)[col];
+        }
+    }
+    expect_product<float>(a, b, client.multiply(a, padded), 1e-5F);
+    client.close();
+}
+
+TEST_F(ComputeServerTest, AnswersMalformedRequestsWithErrors) {
+    network::TCPConnection connection(address);
+    connection.open();
+
+    // an unknown operation, then a 1x2 matrix multiplied by a 1x1 one
+    std::vector<std::byte> unknown(64, std::byte{0});
+    unknown[0] = std::byte{7};
+    std::vector<std::byte> mismatched(3 * 64, std::byte{0});
+    mismatched[0] = std::byte{1};
+    for (size_t cols : {2, 1}) {
+        std::byte* header = mismatched.data() + (cols == 2 ? 8 : 24);
+        header[0] = static_cast<std::byte>(DType::float32);
+        header[1] = std::byte{2};
+        header[7] = std::byte{1};
+        header[11] = static_cast<std::byte>(cols);
+        header[15] = static_cast<std::byte>(cols);
+    }
+    // a request cut short of its second operand
+    std::vector<std::byte> truncated(mismatched.begin(),
+                                     mismatched.begin() + 2 * 64);
+
+    std::vector<std::string> reasons;
+    for (const auto& request : {unknown, mismatched, truncated}) {
+        connection.send_frame(request.data(), request.size());
+        auto response = connection.receive_frame();
+        ASSERT_TRUE(response.has_value());
+        ASSERT_GT(response->length(), 8);
+        EXPECT_EQ(static_cast<uint8_t>(response->raw()[0]), 1);
+        const char* reason = reinterpret_cast<const char*>(response->raw());
+        reasons.emplace_back(reason + 8, response->length() - 8);
+    }
+    EXPECT_EQ(reasons[0], "Request has an unknown operation");
+    EXPECT_EQ(reasons[1], "Cannot multiply a 1x2 matrix by a 1x1 matrix");
+    EXPECT_EQ(reasons[2], "Frame is shorter than its matrices");
+
+    // errors leave the connection usable until the client is done
+    connection.disable_send();
+    EXPECT_FALSE(connection.receive_frame().has_value());
+}
+
+TEST_F(ComputeServerTest, RefusesOversizedProducts) {
+    ComputeClient client(address);
+
+    // a column times a row is small to send but 16 GiB to answer
+    Matrix column(DType::float32, 65536, 1);
+    Matrix row(DType::float32, 1, 65536);
+    client.submit(column, row);
+    try {
+        client.receive();
+        FAIL() << "Oversized product was computed";
+    } catch (const ComputeError& error) {
+        EXPECT_NE(std::string(error.what()).find("exceeds the response limit"),
+                  std::string::npos);
+    }
+
+    // the connection keeps serving requests that fit
+    Matrix a = random_matrix<float>(4, 4, 10);
+    expect_product<float>(a, a, client.multiply(a, a), 1e-5F);
+    client.close();
+}
+
+TEST_F(ComputeServerTest, DisablingReceiveWakesReceiver) {
+    ComputeClient client(address);
+    std::thread receiver([&client]() {
+        EXPECT_THROW(client.receive(), network::ProtocolError);
+    });
+    // nothing was submitted, so the receiver blocks until woken up
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    client.disable_receive();
+    receiver.join();
+    EXPECT_THROW(client.receive(), network::ProtocolError);
+    client.close();
+}
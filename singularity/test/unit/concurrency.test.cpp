@@ -2,6 +2,8 @@
 
 #include <gtest/gtest.h>
 
+#include <set>
+#include <stdexcept>
 #include <thread>
 
 using namespace singularity;
@@ -44,6 +46,14 @@ TEST(DynamicBufferTestSingleThread, FIFO) {
     }
 }
 
+TEST(DynamicBufferTestSingleThread, TimeoutPush) {
+    concurrency::DynamicBuffer<int> queue;
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_TRUE(queue.push(int{i}, std::chrono::nanoseconds::zero()));
+    }
+    EXPECT_EQ(queue.size(), 100);
+}
+
 TEST(DynamicBufferTestSingleThread, InterleaveTest) {
     concurrency::DynamicBuffer<int> queue;
 }
@@ -146,6 +156,29 @@ TEST(FixedBufferTest, TimeoutPush) {
     EXPECT_FALSE(buffer.push(4, std::chrono::milliseconds(10)));
 }
 
+TEST(FixedBufferTest, BlockingPush) {
+    concurrency::FixedBuffer<int, 1> buffer;
+    buffer.push(1);
+
+    std::thread producer([&buffer]() { buffer.push(2); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(buffer.size(), 1);
+
+    EXPECT_EQ(buffer.pop(), 1);
+    producer.join();
+    EXPECT_EQ(buffer.pop(), 2);
+}
+
+TEST(FixedBufferTest, TimeoutPushKeepsObject) {
+    concurrency::FixedBuffer<std::unique_ptr<int>, 1> buffer;
+    buffer.push(std::make_unique<int>(1));
+
+    auto object = std::make_unique<int>(2);
+    EXPECT_FALSE(buffer.push(std::move(object), std::chrono::milliseconds(1)));
+    ASSERT_NE(object, nullptr);
+    EXPECT_EQ(*object, 2);
+}
+
 TEST(FixedBufferTest, MultithreadedTest) {
     concurrency::FixedBuffer<int, 1000> queue;
 
@@ -182,4 +215,78 @@ TEST(FixedBufferTest, MultithreadedTest) {
     }
 
     EXPECT_EQ(queue.size(), 0);
-}
\ No newline at end of file
+}
+TEST(ThreadPoolTest, RunsEveryTask) {
+    EXPECT_THROW({ concurrency::ThreadPool pool(0); }, std::invalid_argument);
+
+    std::atomic<size_t> completed = 0;
+    std::mutex thread_mutex;
+    std::set<std::thread::id> threads;
+    {
+        concurrency::ThreadPool pool(4);
+        EXPECT_EQ(pool.size(), 4);
+        EXPECT_THROW({ pool.submit(nullptr); }, std::invalid_argument);
+
+        for (size_t index = 0; index < 200; ++index) {
+            pool.submit([&]() {
+                {
+                    std::lock_guard<std::mutex> lock(thread_mutex);
+                    threads.insert(std::this_thread::get_id());
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                ++completed;
+            });
+        }
+        // destruction waits for the queue to drain
+    }
+    EXPECT_EQ(completed, 200);
+    EXPECT_GT(threads.size(), 1);
+}
+
+TEST(ThreadPoolTest, StartHookRunsOnEveryWorker) {
+    std::mutex index_mutex;
+    std::set<size_t> indices;
+    {
+        concurrency::ThreadPool pool(3, [&](size_t index) {
+            std::lock_guard<std::mutex> lock(index_mutex);
+            indices.insert(index);
+        });
+    }
+    EXPECT_EQ(indices, (std::set<size_t>{0, 1, 2}));
+}
+
+TEST(InstrumentedBufferTest, ReportsDepthAndWaits) {
+    metrics::Registry registry;
+    concurrency::FixedBuffer<int, 2> fixed;
+    concurrency::InstrumentedBuffer<int> buffer(fixed, registry, "jobs",
+                                                {{"stage", "parse"}});
+    auto& depth = registry.gauge("jobs_depth", "", {{"stage", "parse"}});
+    auto& push_wait =
+        registry.histogram("jobs_push_wait_seconds", "", {{"stage", "parse"}});
+    auto& pop_wait =
+        registry.histogram("jobs_pop_wait_seconds", "", {{"stage", "parse"}});
+
+    buffer.push(1);
+    EXPECT_TRUE(buffer.push(2, std::chrono::milliseconds(1)));
+    EXPECT_FALSE(buffer.push(3, std::chrono::milliseconds(1)));
+    EXPECT_EQ(depth.value(), 2);
+    EXPECT_EQ(buffer.size(), 2);
+    EXPECT_EQ(push_wait.count(), 3);
+    // the failed push waited out its timeout
+    EXPECT_GE(push_wait.percentile(100), 1000000);
+
+    std::thread consumer([&buffer]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        EXPECT_EQ(buffer.pop(), 1);
+    });
+    // blocks until the consumer makes room
+    buffer.push(4);
+    consumer.join();
+    EXPECT_GE(push_wait.percentile(100), 5000000);
+
+    EXPECT_EQ(buffer.pop(), 2);
+    EXPECT_EQ(buffer.pop(), 4);
+    EXPECT_EQ(depth.value(), 0);
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_EQ(pop_wait.count(), 3);
+}
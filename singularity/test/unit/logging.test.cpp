@@ -0,0 +1,137 @@
+#include "logging.hpp"
+
+#include <gtest/gtest.h>
+
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils.hpp"
+
+using namespace singularity;
+
+enum class Color { red, green };
+
+class LoggingTest : public testing::Test {
+   protected:
+    std::mutex lines_mutex;
+    std::string lines;
+
+    void SetUp() override {
+        logging::LoggerConfig config;
+        config.level = logging::Level::info;
+        config.sink = [this](std::string_view output) {
+            std::lock_guard<std::mutex> lock(lines_mutex);
+            lines.append(output);
+        };
+        logging::configure(config);
+    }
+
+    void TearDown() override {
+        logging::flush();
+        logging::configure({});
+    }
+
+    std::string output() {
+        logging::flush();
+        std::lock_guard<std::mutex> lock(lines_mutex);
+        return lines;
+    }
+};
+
+TEST_F(LoggingTest, FormatsArguments) {
+    int pointee = 0;
+    std::string text = "owned";
+    logging::info<"{} {} {} {} {}">(-42, 7U, 2.5, true, 'c');
+    logging::warn<"{} and {} and {}">("literal", text,
+                                      std::string_view("view"));
+    logging::error<"{} at {}, missing">(Color::green, &pointee);
+    logging::info<"no placeholders">();
+
+    std::string logged = output();
+    EXPECT_NE(logged.find(" INFO  ["), std::string::npos);
+    EXPECT_NE(logged.find("] -42 7 2.5 true c\n"), std::string::npos);
+    EXPECT_NE(logged.find(" WARN  ["), std::string::npos);
+    EXPECT_NE(logged.find("literal and owned and view\n"), std::string::npos);
+    EXPECT_NE(logged.find(" ERROR ["), std::string::npos);
+    EXPECT_NE(logged.find("1 at 0x"), std::string::npos);
+    EXPECT_NE(logged.find(", missing\n"), std::string::npos);
+    EXPECT_NE(logged.find("no placeholders\n"), std::string::npos);
+}
+
+TEST_F(LoggingTest, FiltersLevels) {
+    // compiled out by default, and below the configured level otherwise
+    logging::debug<"hidden debug">();
+    logging::trace<"hidden trace">();
+
+    logging::LoggerConfig config;
+    config.level = logging::Level::error;
+    config.sink = [this](std::string_view output) {
+        std::lock_guard<std::mutex> lock(lines_mutex);
+        lines.append(output);
+    };
+    logging::configure(config);
+    logging::warn<"hidden warning">();
+    logging::error<"shown error">();
+
+    std::string logged = output();
+    EXPECT_EQ(logged.find("hidden"), std::string::npos);
+    EXPECT_NE(logged.find("shown error"), std::string::npos);
+}
+
+TEST_F(LoggingTest, ManyThreads) {
+    constexpr size_t num_threads = 4;
+    constexpr size_t num_records = 200;
+    std::vector<std::thread> threads;
+    for (size_t thread = 0; thread < num_threads; ++thread) {
+        threads.emplace_back([thread]() {
+            for (size_t index = 0; index < num_records; ++index) {
+                logging::info<"thread {} record {}">(thread, index);
+                // leave the logger time to keep up
+                if (index % 50 == 49) logging::flush();
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    std::string logged = output();
+    size_t records = 0;
+    for (size_t at = logged.find("record"); at != std::string::npos;
+         at = logged.find("record", at + 1)) {
+        ++records;
+    }
+    EXPECT_EQ(records + logging::dropped(), num_threads * num_records);
+    EXPECT_NE(logged.find("thread 3 record 199\n"), std::string::npos);
+}
+
+TEST_F(LoggingTest, DropsWhenFull) {
+    // a thread that logs far more than its ring holds between flushes
+    logging::LoggerConfig config;
+    config.ring_capacity = 1024;
+    config.sink = [this](std::string_view output) {
+        std::lock_guard<std::mutex> lock(lines_mutex);
+        lines.append(output);
+    };
+    logging::configure(config);
+    uint64_t dropped_before = logging::dropped();
+    std::thread flood([]() {
+        std::string payload(400, 'x');
+        for (size_t index = 0; index < 1000; ++index) {
+            logging::info<"{}">(payload);
+        }
+    });
+    flood.join();
+
+    EXPECT_GT(logging::dropped(), dropped_before);
+    EXPECT_NE(output().find("Log rings were full, dropped"),
+              std::string::npos);
+}
+
+TEST(BuildStringTest, ReusesStream) {
+    EXPECT_EQ(utils::build_string("a", 1, 'b', 2.5), "a1b2.5");
+    // formatting state does not leak from one call into the next
+    EXPECT_EQ(utils::build_string(std::setprecision(3), 3.14159), "3.14");
+    EXPECT_EQ(utils::build_string(3.14159), "3.14159");
+}
@@ -0,0 +1,151 @@
+#include "metrics.hpp"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace singularity;
+
+TEST(CounterTest, CountsAcrossThreads) {
+    metrics::Counter counter;
+    std::vector<std::thread> threads;
+    for (size_t thread = 0; thread < 8; ++thread) {
+        threads.emplace_back([&counter]() {
+            for (size_t index = 0; index < 10000; ++index) counter.increment();
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    counter.increment(5);
+    EXPECT_EQ(counter.value(), 80005);
+}
+
+TEST(GaugeTest, GoesUpAndDown) {
+    metrics::Gauge gauge;
+    gauge.add(5);
+    gauge.subtract(7);
+    EXPECT_EQ(gauge.value(), -2);
+    gauge.set(42);
+    EXPECT_EQ(gauge.value(), 42);
+}
+
+TEST(HistogramTest, EmptyHistogram) {
+    metrics::Histogram histogram;
+    EXPECT_EQ(histogram.count(), 0);
+    EXPECT_EQ(histogram.sum(), 0);
+    EXPECT_EQ(histogram.percentile(99), 0);
+}
+
+TEST(HistogramTest, SmallValuesAreExact) {
+    metrics::Histogram histogram;
+    for (uint64_t value = 1; value <= 100; ++value) histogram.record(value);
+    EXPECT_EQ(histogram.count(), 100);
+    EXPECT_EQ(histogram.sum(), 5050);
+    EXPECT_EQ(histogram.percentile(0), 1);
+    EXPECT_EQ(histogram.percentile(50), 50);
+    EXPECT_EQ(histogram.percentile(99), 99);
+    EXPECT_EQ(histogram.percentile(100), 100);
+}
+
+TEST(HistogramTest, LargeValuesWithinBucketPrecision) {
+    metrics::Histogram histogram;
+    std::vector<uint64_t> values = {1000,        123456,      9999999,
+                                    4000000000,  1ULL << 40,  (1ULL << 63) + 7,
+                                    UINT64_MAX};
+    for (uint64_t value : values) {
+        metrics::Histogram single;
+        single.record(value);
+        uint64_t reported = single.percentile(50);
+        EXPECT_GE(reported, value);
+        EXPECT_LE(static_cast<double>(reported - value),
+                  static_cast<double>(value) / 64);
+        histogram.record(value);
+    }
+    EXPECT_EQ(histogram.percentile(100), UINT64_MAX);
+    EXPECT_EQ(histogram.count(), values.size());
+}
+
+TEST(HistogramTest, RecordsDurations) {
+    metrics::Histogram histogram;
+    histogram.record(std::chrono::microseconds(3));
+    // negative durations, from clocks going backwards, count as zero
+    histogram.record(std::chrono::nanoseconds(-5));
+    EXPECT_EQ(histogram.count(), 2);
+    EXPECT_EQ(histogram.sum(), 3000);
+    EXPECT_EQ(histogram.percentile(0), 0);
+}
+
+TEST(HistogramTest, MergesHistograms) {
+    metrics::Histogram first;
+    metrics::Histogram second;
+    for (uint64_t value = 1; value <= 50; ++value) first.record(value);
+    for (uint64_t value = 51; value <= 100; ++value) second.record(value);
+    first.merge(second);
+    EXPECT_EQ(first.count(), 100);
+    EXPECT_EQ(first.sum(), 5050);
+    EXPECT_EQ(first.percentile(50), 50);
+    EXPECT_EQ(first.percentile(100), 100);
+    EXPECT_EQ(second.count(), 50);
+}
+
+TEST(RegistryTest, ReturnsSameMetric) {
+    metrics::Registry registry;
+    auto& first = registry.counter("requests_total", "Requests",
+                                   {{"method", "get"}});
+    auto& second = registry.counter("requests_total", "Requests",
+                                    {{"method", "get"}});
+    auto& other = registry.counter("requests_total", "Requests",
+                                   {{"method", "put"}});
+    EXPECT_EQ(&first, &second);
+    EXPECT_NE(&first, &other);
+}
+
+TEST(RegistryTest, RejectsInvalidMetrics) {
+    metrics::Registry registry;
+    registry.counter("requests_total", "Requests");
+    EXPECT_THROW(registry.gauge("requests_total", "Requests"),
+                 std::invalid_argument);
+    EXPECT_THROW(registry.counter("2requests", "Requests"),
+                 std::invalid_argument);
+    EXPECT_THROW(registry.counter("requests-total", "Requests"),
+                 std::invalid_argument);
+    EXPECT_THROW(registry.counter("requests", "Requests", {{"a:b", "c"}}),
+                 std::invalid_argument);
+    EXPECT_THROW(registry.counter("requests", "Requests", {{"__name", "c"}}),
+                 std::invalid_argument);
+}
+
+TEST(RegistryTest, RendersPrometheusText) {
+    metrics::Registry registry;
+    registry.counter("requests_total", "Requests served", {{"code", "200"}})
+        .increment(3);
+    registry.gauge("queue_depth", "Waiting\nrequests").set(-2);
+    auto& latency = registry.histogram("latency_seconds", "Latency",
+                                       {{"path", "/a\"b\\"}});
+    latency.record(std::chrono::milliseconds(2));
+    latency.record(std::chrono::milliseconds(2));
+
+    std::string expected =
+        "# HELP latency_seconds Latency\n"
+        "# TYPE latency_seconds summary\n"
+        "latency_seconds{path=\"/a\\\"b\\\\\",quantile=\"0.5\"} 0.002";
+    std::string text = registry.render();
+    EXPECT_EQ(text.substr(0, expected.size()), expected);
+    EXPECT_NE(text.find("latency_seconds_sum{path=\"/a\\\"b\\\\\"} 0.004\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("latency_seconds_count{path=\"/a\\\"b\\\\\"} 2\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("# HELP queue_depth Waiting\\nrequests\n"
+                        "# TYPE queue_depth gauge\n"
+                        "queue_depth -2\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("# TYPE requests_total counter\n"
+                        "requests_total{code=\"200\"} 3\n"),
+              std::string::npos);
+}
+
+TEST(RegistryTest, GlobalRegistryIsShared) {
+    EXPECT_EQ(metrics::Registry::global(), metrics::Registry::global());
+}
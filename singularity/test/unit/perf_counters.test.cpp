@@ -0,0 +1,98 @@
+#include "perf_counters.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace singularity;
+
+benchmark::Result make_result(const std::string& name, uint64_t operations,
+                              double seconds, std::optional<double> cycles) {
+    benchmark::Result result{name, operations, {}};
+    result.counts.seconds = seconds;
+    result.counts.events[static_cast<size_t>(benchmark::Event::cycles)] =
+        cycles;
+    return result;
+}
+
+TEST(PerfCountersTest, MeasuresRegions) {
+    auto result = benchmark::measure("sleep", 10, []() {
+        std::thread worker([]() {
+            for (size_t index = 0; index < 10; ++index) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+        worker.join();
+    });
+
+    EXPECT_EQ(result.name, "sleep");
+    EXPECT_GE(result.counts.seconds, 0.01);
+    EXPECT_GE(result.nanoseconds_per_operation(), 1e6);
+
+    // counters are optional, virtual machines rarely expose hardware ones
+    benchmark::PerfCounters counters;
+    auto switches = result.counts[benchmark::Event::context_switches];
+    EXPECT_EQ(switches.has_value(),
+              counters.available(benchmark::Event::context_switches));
+    // the sleeping thread was started inside the region
+    if (switches.has_value()) {
+        EXPECT_GE(*switches, 10);
+    }
+}
+
+TEST(PerfCountersTest, BaselineRoundTrips) {
+    std::vector<benchmark::Result> results = {
+        make_result("fixed \"quoted\"", 1000, 0.5, 2.5e6),
+        make_result("dynamic", 3, 1e-6, std::nullopt)};
+
+    std::ostringstream out;
+    benchmark::write_baseline(out, results);
+    auto parsed = benchmark::read_baseline(out.str());
+
+    ASSERT_EQ(parsed.size(), 2);
+    EXPECT_EQ(parsed[0].name, "fixed \"quoted\"");
+    EXPECT_EQ(parsed[0].operations, 1000);
+    EXPECT_DOUBLE_EQ(parsed[0].counts.seconds, 0.5);
+    EXPECT_DOUBLE_EQ(*parsed[0].per_operation(benchmark::Event::cycles),
+                     2500);
+    EXPECT_FALSE(parsed[1].per_operation(benchmark::Event::cycles));
+    EXPECT_DOUBLE_EQ(parsed[1].nanoseconds_per_operation(),
+                     results[1].nanoseconds_per_operation());
+
+    EXPECT_TRUE(benchmark::read_baseline("[]").empty());
+    EXPECT_THROW(benchmark::read_baseline("[{\"name\": 1}]"),
+                 std::invalid_argument);
+    EXPECT_THROW(benchmark::read_baseline("[{\"other\": 1}]"),
+                 std::invalid_argument);
+    EXPECT_THROW(benchmark::read_baseline("[] trailing"),
+                 std::invalid_argument);
+}
+
+TEST(PerfCountersTest, FlagsRegressionsBeyondThreshold) {
+    std::vector<benchmark::Result> baseline = {
+        make_result("a", 100, 1.0, 1000), make_result("b", 100, 1.0, 1000),
+        make_result("c", 100, 1.0, std::nullopt)};
+    std::vector<benchmark::Result> current = {
+        // within noise
+        make_result("a", 100, 1.04, 1040),
+        // slower, with more cycles per operation
+        make_result("b", 200, 2.4, 2400),
+        // cycles were not counted for the baseline
+        make_result("c", 100, 1.0, 5000),
+        // no baseline
+        make_result("d", 100, 9.0, 9000)};
+
+    auto regressions = benchmark::compare(baseline, current, 0.05);
+    ASSERT_EQ(regressions.size(), 2);
+    EXPECT_EQ(regressions[0].name, "b");
+    EXPECT_EQ(regressions[0].metric, "nanoseconds");
+    EXPECT_DOUBLE_EQ(regressions[0].baseline, 1e7);
+    EXPECT_DOUBLE_EQ(regressions[0].current, 1.2e7);
+    EXPECT_EQ(regressions[1].metric, "cycles");
+
+    EXPECT_TRUE(benchmark::compare(baseline, current, 0.5).empty());
+}
@@ -0,0 +1,75 @@
+#include "placement.hpp"
+
+#include <gtest/gtest.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+using namespace singularity;
+
+TEST(PlacementTest, Topology) {
+    auto cpus = concurrency::available_cpus();
+    ASSERT_FALSE(cpus.empty());
+    EXPECT_TRUE(std::is_sorted(cpus.begin(), cpus.end()));
+
+    // every available CPU belongs to exactly one node
+    auto nodes = concurrency::numa_nodes();
+    ASSERT_FALSE(nodes.empty());
+    for (int cpu : cpus) {
+        int node = concurrency::numa_node_of(cpu);
+        ASSERT_NE(node, -1);
+        auto owners = std::count_if(
+            nodes.begin(), nodes.end(), [cpu](const auto& candidate) {
+                return std::find(candidate.cpus.begin(), candidate.cpus.end(),
+                                 cpu) != candidate.cpus.end();
+            });
+        EXPECT_EQ(owners, 1);
+    }
+    EXPECT_EQ(concurrency::numa_node_of(-1), -1);
+
+    auto local = concurrency::ThreadPlacement::on_node(
+        concurrency::numa_node_of(cpus.front()));
+    EXPECT_TRUE(local.local_memory);
+    EXPECT_NE(std::find(local.cpus.begin(), local.cpus.end(), cpus.front()),
+              local.cpus.end());
+    EXPECT_THROW({ concurrency::ThreadPlacement::on_node(-1); },
+                 std::invalid_argument);
+}
+
+TEST(PlacementTest, CPUForThread) {
+    concurrency::ThreadPlacement placement;
+    EXPECT_EQ(placement.cpu_for(0), -1);
+
+    placement.cpus = {4, 6};
+    EXPECT_EQ(placement.cpu_for(0), 4);
+    EXPECT_EQ(placement.cpu_for(1), 6);
+    EXPECT_EQ(placement.cpu_for(2), 4);
+
+    placement.pin_individually = false;
+    EXPECT_EQ(placement.cpu_for(0), -1);
+}
+
+TEST(PlacementTest, ValidateAndApply) {
+    auto cpus = concurrency::available_cpus();
+    concurrency::ThreadPlacement placement;
+    EXPECT_NO_THROW({ concurrency::validate_placement(placement); });
+    EXPECT_TRUE(concurrency::apply_placement(placement, 0));
+
+    placement.cpus = {CPU_SETSIZE + 1};
+    EXPECT_THROW({ concurrency::validate_placement(placement); },
+                 std::invalid_argument);
+
+    // run on a separate thread so the test process keeps its own affinity
+    placement.cpus = {cpus.back()};
+    placement.local_memory = true;
+    concurrency::validate_placement(placement);
+    int running_on = -1;
+    std::thread pinned([&placement, &running_on]() {
+        concurrency::apply_placement(placement, 0);
+        running_on = sched_getcpu();
+    });
+    pinned.join();
+    EXPECT_EQ(running_on, cpus.back());
+}
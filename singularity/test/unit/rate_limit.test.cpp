@@ -0,0 +1,131 @@
+#include "rate_limit.hpp"
+
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace singularity::network;
+using namespace std::chrono_literals;
+
+constexpr uint16_t PORT = 10505;
+
+TEST(TokenBucketTest, BurstThenRate) {
+    EXPECT_THROW({ TokenBucket disabled(RateLimit{}); }, std::invalid_argument);
+    EXPECT_THROW({ TokenBucket empty(RateLimit{10, 0.5}); },
+                 std::invalid_argument);
+
+    // ten units per second, up to three at once
+    TokenBucket bucket(RateLimit{10, 3});
+    auto now = std::chrono::steady_clock::now();
+    EXPECT_TRUE(bucket.try_acquire(1, now));
+    EXPECT_TRUE(bucket.try_acquire(2, now));
+    EXPECT_FALSE(bucket.try_acquire(1, now));
+
+    // a unit comes back every 100ms
+    EXPECT_FALSE(bucket.try_acquire(1, now + 99ms));
+    EXPECT_TRUE(bucket.try_acquire(1, now + 100ms));
+    EXPECT_FALSE(bucket.try_acquire(1, now + 100ms));
+    EXPECT_TRUE(bucket.try_acquire(3, now + 500ms));
+
+    // consuming goes into debt, which has to be waited out
+    EXPECT_EQ(bucket.delay(now + 500ms), 0ns);
+    bucket.consume(5, now + 500ms);
+    EXPECT_EQ(bucket.delay(now + 500ms), 500ms);
+    EXPECT_EQ(bucket.delay(now + 1s), 0ns);
+
+    EXPECT_FALSE(bucket.idle(1s, now + 1s));
+    EXPECT_TRUE(bucket.idle(1s, now + 2300ms));
+}
+
+TEST(TokenBucketTest, ConcurrentAcquires) {
+    // no refill within the test, exactly the burst is handed out
+    TokenBucket bucket(RateLimit{1e-3, 1000});
+    std::atomic<size_t> acquired = 0;
+    std::vector<std::thread> threads;
+    for (size_t index = 0; index < 4; ++index) {
+        threads.emplace_back([&]() {
+            for (size_t attempt = 0; attempt < 500; ++attempt) {
+                if (bucket.try_acquire()) ++acquired;
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    EXPECT_EQ(acquired, 1000);
+}
+
+TEST(RateLimiterTest, PerClientBuckets) {
+    EXPECT_THROW({ RateLimiter invalid(RateLimit{1, 1}, 1s, 0); },
+                 std::invalid_argument);
+
+    RateLimiter limiter(RateLimit{1e-3, 2}, 1s, 3);
+    IPSocketAddress first("10.0.0.1", 1000);
+    IPSocketAddress second("10.0.0.2", 1000);
+    EXPECT_TRUE(limiter.try_acquire(first));
+    EXPECT_TRUE(limiter.try_acquire(first));
+    EXPECT_FALSE(limiter.try_acquire(first));
+
+    // other ports of the same client share its bucket, other clients do not
+    EXPECT_FALSE(limiter.try_acquire(IPSocketAddress("10.0.0.1", 2000)));
+    EXPECT_TRUE(limiter.try_acquire(second));
+    EXPECT_EQ(limiter.size(), 2);
+    EXPECT_EQ(limiter.bucket(first), limiter.bucket(first));
+}
+
+TEST(RateLimiterTest, IdleClientsExpire) {
+    RateLimiter limiter(RateLimit{1000, 1}, 20ms);
+    IPSocketAddress idle("10.0.0.1", 1000);
+    IPSocketAddress held("10.0.0.2", 1000);
+    EXPECT_TRUE(limiter.try_acquire(idle));
+    auto bucket = limiter.bucket(held);
+    EXPECT_EQ(limiter.size(), 2);
+
+    std::this_thread::sleep_for(30ms);
+    // buckets in use by a connection are kept
+    EXPECT_EQ(limiter.expire(), 1);
+    EXPECT_EQ(limiter.size(), 1);
+}
+
+TEST(RateLimiterTest, ThrottlesReceives) {
+    auto address = IPSocketAddress("127.0.0.1", PORT);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    ASSERT_EQ(bind(listener, address.data(), address.length()), 0);
+    ASSERT_EQ(listen(listener, 1), 0);
+
+    TCPConnection client(address);
+    client.open();
+    TCPConnection server(accept(listener, nullptr, nullptr), address);
+    close(listener);
+
+    // 100KB at 200KB/s with a 20KB burst takes at least 400ms
+    server.set_receive_limits(
+        std::make_shared<TokenBucket>(RateLimit{200e3, 20e3}), nullptr);
+    std::thread sender([&client]() {
+        client.send_message(MessageBuffer(std::string(100000, 'x').data(),
+                                          100000));
+        client.disable_send();
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(server.receive_message().length(), 100000);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 350ms);
+    sender.join();
+
+    // a deadline shorter than the wait fails instead of sleeping past it
+    auto messages = std::make_shared<TokenBucket>(RateLimit{1, 1});
+    messages->consume(2);
+    server.set_receive_limits(nullptr, messages);
+    EXPECT_THROW(
+        {
+            server.receive_message(std::chrono::steady_clock::now() + 10ms);
+        },
+        TimeoutError);
+}
@@ -0,0 +1,208 @@
+#include "rpc.hpp"
+
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace singularity::network;
+
+constexpr uint16_t PORT = 10303;
+
+std::string to_string(std::span<const std::byte> data) {
+    return {reinterpret_cast<const char*>(data.data()), data.size()};
+}
+
+std::string to_string(const MessageBuffer& buffer) {
+    return to_string(std::span(buffer.raw(), buffer.length()));
+}
+
+MessageBuffer to_buffer(const std::string& text) {
+    return {text.data(), text.size()};
+}
+
+class RPCTest : public testing::Test {
+   protected:
+    RPCServer server{PORT, 4};
+
+    void SetUp() override {
+        server.register_handler(
+            "echo", [](std::span<const std::byte> request) {
+                return MessageBuffer(request.data(), request.size());
+            });
+        // sleeps for the number of milliseconds in the request
+        server.register_handler(
+            "sleep", [](std::span<const std::byte> request) {
+                std::this_thread::sleep_for(
+                    std::chrono::milliseconds(std::stoi(to_string(request))));
+                return to_buffer("slept " + to_string(request));
+            });
+        server.register_handler("fail", [](std::span<const std::byte>) {
+            throw std::runtime_error("handler failed");
+            return MessageBuffer("", 0);
+        });
+        server.register_handler("throw", [](std::span<const std::byte>) {
+            throw 42;
+            return MessageBuffer("", 0);
+        });
+        server.start();
+    }
+};
+
+TEST_F(RPCTest, OutOfOrderResponses) {
+    RPCClient client(IPSocketAddress("127.0.0.1", PORT));
+
+    auto slow = client.call("sleep", to_buffer("300"));
+    auto fast = client.call("echo", to_buffer("quick"));
+
+    // the second call is answered while the first is still running
+    EXPECT_EQ(to_string(fast.get()), "quick");
+    EXPECT_EQ(slow.wait_for(std::chrono::milliseconds(0)),
+              std::future_status::timeout);
+    EXPECT_EQ(client.in_flight(), 1);
+    EXPECT_EQ(to_string(slow.get()), "slept 300");
+    EXPECT_EQ(client.in_flight(), 0);
+}
+
+TEST_F(RPCTest, ConcurrentCallers) {
+    RPCClient client(IPSocketAddress("127.0.0.1", PORT));
+
+    std::vector<std::thread> callers;
+    std::vector<size_t> mismatches(4, 0);
+    for (size_t caller = 0; caller < mismatches.size(); ++caller) {
+        callers.emplace_back([&, caller]() {
+            std::vector<std::pair<std::string, std::future<MessageBuffer>>>
+                calls;
+            for (size_t index = 0; index < 100; ++index) {
+                std::string request = std::to_string(caller) + "-" +
+                                      std::to_string(index) +
+                                      std::string(index * 10, 'p');
+                calls.emplace_back(request,
+                                   client.call("echo", to_buffer(request)));
+            }
+            for (auto& [request, response] : calls) {
+                if (to_string(response.get()) != request) {
+                    ++mismatches[caller];
+                }
+            }
+        });
+    }
+    for (auto& caller : callers) caller.join();
+
+    for (size_t count : mismatches) EXPECT_EQ(count, 0);
+}
+
+TEST_F(RPCTest, Errors) {
+    EXPECT_THROW({ RPCServer invalid(PORT + 1, 0); }, std::invalid_argument);
+    EXPECT_THROW(
+        {
+            server.register_handler(
+                "late", [](std::span<const std::byte>) {
+                    return MessageBuffer("", 0);
+                });
+        },
+        std::logic_error);
+
+    RPCClient client(IPSocketAddress("127.0.0.1", PORT));
+    EXPECT_THROW(
+        { client.call(std::string(70000, 'm'), to_buffer("")); },
+        std::invalid_argument);
+
+    auto unknown = client.call("missing", to_buffer(""));
+    auto failed = client.call("fail", to_buffer(""));
+    auto thrown = client.call("throw", to_buffer(""));
+    auto succeeded = client.call("echo", to_buffer(""));
+    try {
+        unknown.get();
+        ADD_FAILURE() << "unknown method succeeded";
+    } catch (const RPCError& error) {
+        EXPECT_STREQ(error.what(), "Unknown method 'missing'");
+    }
+    try {
+        failed.get();
+        ADD_FAILURE() << "failing handler succeeded";
+    } catch (const RPCError& error) {
+        EXPECT_STREQ(error.what(), "handler failed");
+    }
+    try {
+        thrown.get();
+        ADD_FAILURE() << "throwing handler succeeded";
+    } catch (const RPCError& error) {
+        EXPECT_STREQ(error.what(), "RPC handler failed");
+    }
+    EXPECT_EQ(succeeded.get().length(), 0);
+
+    // errors do not break the connection
+    EXPECT_EQ(to_string(client.call("echo", to_buffer("still")).get()),
+              "still");
+}
+
+TEST_F(RPCTest, ClosedConnectionFailsCalls) {
+    RPCClient closing(IPSocketAddress("127.0.0.1", PORT));
+    auto abandoned = closing.call("sleep", to_buffer("100"));
+    closing.close();
+    EXPECT_THROW({ abandoned.get(); }, RPCError);
+    EXPECT_THROW({ closing.call("echo", to_buffer("")); }, RPCError);
+
+    RPCClient client(IPSocketAddress("127.0.0.1", PORT));
+    auto pending = client.call("sleep", to_buffer("200"));
+
+    // the server drops the connection before the call completes
+    auto report = server.shutdown();
+    EXPECT_GE(report.dropped, 1);
+    EXPECT_THROW({ pending.get(); }, RPCError);
+    EXPECT_THROW({ client.call("echo", to_buffer("")); }, RPCError);
+}
+
+TEST_F(RPCTest, PartialSendClosesClient) {
+    // a peer that accepts connections but never reads from them
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(listener, -1);
+    IPSocketAddress address("127.0.0.1", PORT + 2);
+    ASSERT_EQ(bind(listener, address.data(), address.length()), 0);
+    ASSERT_EQ(listen(listener, 1), 0);
+
+    RPCClient client(address);
+    auto pending = client.call("echo", to_buffer("before"));
+
+    // the socket buffers fill up long before the frame is written
+    std::string large(64 * 1024 * 1024, 'l');
+    EXPECT_THROW(
+        {
+            client.call("echo", to_buffer(large),
+                        std::chrono::steady_clock::now() +
+                            std::chrono::milliseconds(50));
+        },
+        TimeoutError);
+
+    // nothing can follow half a frame, so the client is done
+    EXPECT_THROW({ pending.get(); }, RPCError);
+    EXPECT_THROW({ client.call("echo", to_buffer("after")); }, RPCError);
+    EXPECT_EQ(client.in_flight(), 0);
+    client.close();
+    close(listener);
+}
+
+TEST_F(RPCTest, RetryAfterFailedStart) {
+    RPCServer other(PORT, 1);
+    other.register_handler("echo", [](std::span<const std::byte> request) {
+        return MessageBuffer(request.data(), request.size());
+    });
+
+    // the fixture's server holds the port until it shuts down
+    EXPECT_THROW({ other.start(); }, std::system_error);
+    server.shutdown();
+    other.start();
+
+    RPCClient client(IPSocketAddress("127.0.0.1", PORT));
+    EXPECT_EQ(to_string(client.call("echo", to_buffer("retried")).get()),
+              "retried");
+}
@@ -0,0 +1,57 @@
+#include "scan.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace singularity;
+
+TEST(ScanTest, FindByte) {
+    std::string text = "no delimiter here\nsecond line\n";
+    const auto* data = reinterpret_cast<const std::byte*>(text.data());
+
+    EXPECT_EQ(scan::find_byte(data, text.size(), std::byte{'\n'}),
+              data + text.find('\n'));
+    EXPECT_EQ(scan::find_byte(data, text.size(), std::byte{'#'}), nullptr);
+    EXPECT_EQ(scan::find_byte(data, 0, std::byte{'n'}), nullptr);
+    EXPECT_EQ(scan::find_byte(nullptr, 0, std::byte{0}), nullptr);
+
+    std::string implementation = scan::find_byte_implementation();
+    EXPECT_TRUE(implementation == "avx2" || implementation == "sse2" ||
+                implementation == "portable");
+}
+
+TEST(ScanTest, MatchesPortable) {
+    std::vector<std::byte> data(300, std::byte{'a'});
+
+    // every position in every vector width and the scalar tail, with
+    // misaligned starts, and bytes with the high bit set
+    for (std::byte value : {std::byte{0}, std::byte{'\n'}, std::byte{0xFF}}) {
+        for (size_t offset = 0; offset < 3; ++offset) {
+            for (size_t position = offset; position < data.size();
+                 ++position) {
+                data[position] = value;
+                size_t length = data.size() - offset;
+                const std::byte* expected = data.data() + position;
+                EXPECT_EQ(scan::find_byte(data.data() + offset, length, value),
+                          expected);
+                EXPECT_EQ(scan::find_byte_portable(data.data() + offset,
+                                                   length, value),
+                          expected);
+                // a later occurrence does not hide an earlier one
+                data[data.size() - 1] = value;
+                EXPECT_EQ(scan::find_byte(data.data() + offset, length, value),
+                          expected);
+                data[data.size() - 1] = std::byte{'a'};
+                data[position] = std::byte{'a'};
+            }
+        }
+    }
+
+    // the byte just before a match must not be mistaken for it
+    std::vector<std::byte> borrow = {std::byte{0x01}, std::byte{0x00}};
+    EXPECT_EQ(scan::find_byte_portable(borrow.data(), 2, std::byte{0x01}),
+              borrow.data());
+}
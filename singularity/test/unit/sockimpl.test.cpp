@@ -5,10 +5,21 @@
 #include <gtest/gtest.h>
 #include <netinet/in.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
+
+#include "logging.hpp"
 
 using namespace singularity::network;
 
@@ -21,6 +32,7 @@ class TCPConnectionTest : public testing::Test {
     int _socket;
     std::mutex m;
     std::condition_variable connection_signal;
+    bool accepting = false;
     std::optional<std::thread> runner = std::nullopt;
 
     static constexpr size_t BUFFER_SIZE = 50000;
@@ -47,6 +59,10 @@ class TCPConnectionTest : public testing::Test {
                 sockaddr_in addr;
                 socklen_t addrlen = sizeof(addr);
 
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    accepting = true;
+                }
                 connection_signal.notify_one();
                 int client_socket = accept(
                     _socket, reinterpret_cast<sockaddr*>(&addr), &addrlen);
@@ -81,7 +97,7 @@ class TCPConnectionTest : public testing::Test {
 
         // wait until _right_ before accept syscall
         std::unique_lock<std::mutex> lock(m);
-        connection_signal.wait(lock);
+        connection_signal.wait(lock, [this]() { return accepting; });
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
 
@@ -129,7 +145,8 @@ TEST_F(TCPConnectionTest, ClientBasicLoopbackTest) {
     try {
         connection.open();
     } catch (std::system_error& error) {
-        std::cerr << error.what() << std::endl;
+        singularity::logging::error<"Unable to connect: {}">(error.what());
+        singularity::logging::flush();
         exit(1);
     }
 
@@ -162,7 +179,8 @@ TEST_F(TCPConnectionTest, ClientStateConfirmation) {
     try {
         connection.open();
     } catch (std::system_error& error) {
-        std::cerr << error.what() << std::endl;
+        singularity::logging::error<"Unable to connect: {}">(error.what());
+        singularity::logging::flush();
         exit(1);
     }
 
@@ -189,7 +207,8 @@ TEST_F(TCPConnectionTest, ClientSideBufferTest) {
     try {
         connection.open();
     } catch (std::system_error& error) {
-        std::cerr << error.what() << std::endl;
+        singularity::logging::error<"Unable to connect: {}">(error.what());
+        singularity::logging::flush();
         exit(1);
     }
 
@@ -200,4 +219,613 @@ TEST_F(TCPConnectionTest, ClientSideBufferTest) {
     connection.terminate();
 
     EXPECT_TRUE(out == buffer);
-}
\ No newline at end of file
+}
+// Receives datagrams until `count` have arrived or the receive timeout expires.
+std::vector<Datagram> receive_datagrams(UDPSocket& socket, size_t count) {
+    std::vector<Datagram> received;
+    while (received.size() < count) {
+        auto batch = socket.receive_batch();
+        if (batch.empty()) break;
+        for (auto& datagram : batch) received.push_back(std::move(datagram));
+    }
+    return received;
+}
+
+TEST(UDPSocketTest, BatchLoopbackTest) {
+    UDPSocket receiver;
+    receiver.bind(IPSocketAddress("127.0.0.1", 0));
+    receiver.set_receive_timeout(std::chrono::seconds(1));
+    IPSocketAddress destination = receiver.local_address();
+
+    UDPSocket sender(8);
+    std::vector<Datagram> datagrams;
+    for (size_t index = 0; index < 20; ++index) {
+        datagrams.push_back(
+            {destination, MessageBuffer::from_string(
+                              "datagram " + std::to_string(index))});
+    }
+    sender.send_batch(datagrams);
+
+    auto received = receive_datagrams(receiver, datagrams.size());
+    ASSERT_EQ(received.size(), datagrams.size());
+    for (size_t index = 0; index < datagrams.size(); ++index) {
+        EXPECT_TRUE(received[index].message == datagrams[index].message);
+        EXPECT_EQ(received[index].address.port(),
+                  sender.local_address().port());
+    }
+}
+
+TEST(UDPSocketTest, SegmentedLoopbackTest) {
+    constexpr size_t num_data = 10000;
+    constexpr uint16_t segment_size = 1200;
+
+    char data[num_data];
+    for (size_t index = 0; index < num_data; ++index) {
+        data[index] = static_cast<char>(index % 251);
+    }
+    MessageBuffer buffer(data, num_data);
+
+    for (bool offload : {false, true}) {
+        UDPSocket receiver;
+        receiver.bind(IPSocketAddress("127.0.0.1", 0));
+        receiver.set_receive_timeout(std::chrono::seconds(1));
+        if (offload) receiver.enable_receive_offload();
+
+        UDPSocket sender;
+        sender.send_segmented(receiver.local_address(), buffer, segment_size);
+
+        size_t expected = (num_data + segment_size - 1) / segment_size;
+        auto received = receive_datagrams(receiver, expected);
+        ASSERT_EQ(received.size(), expected);
+
+        size_t offset = 0;
+        for (auto& datagram : received) {
+            EXPECT_LE(datagram.message.length(), segment_size);
+            EXPECT_EQ(memcmp(datagram.message.raw(), data + offset,
+                             datagram.message.length()),
+                      0);
+            offset += datagram.message.length();
+        }
+        EXPECT_EQ(offset, num_data);
+    }
+}
+
+TEST(UDPSocketTest, SegmentSizeLimits) {
+    UDPSocket receiver;
+    receiver.bind(IPSocketAddress("127.0.0.1", 0));
+    MessageBuffer buffer = MessageBuffer::from_string("oversized segments");
+
+    UDPSocket sender;
+    EXPECT_THROW(
+        { sender.send_segmented(receiver.local_address(), buffer, 0); },
+        std::invalid_argument);
+    for (uint16_t segment_size : {uint16_t{65508}, uint16_t{65535}}) {
+        EXPECT_THROW(
+            {
+                sender.send_segmented(receiver.local_address(), buffer,
+                                      segment_size);
+            },
+            std::invalid_argument);
+    }
+}
+
+TEST(UDPSocketTest, DropsTruncatedDatagrams) {
+    UDPSocket receiver(8, 1024);
+    receiver.bind(IPSocketAddress("127.0.0.1", 0));
+    receiver.set_receive_timeout(std::chrono::milliseconds(100));
+    IPSocketAddress destination = receiver.local_address();
+
+    std::string large(4000, 'l');
+    std::vector<Datagram> datagrams;
+    datagrams.push_back({destination, MessageBuffer::from_string("first")});
+    datagrams.push_back(
+        {destination, MessageBuffer(large.data(), large.size())});
+    datagrams.push_back({destination, MessageBuffer::from_string("last")});
+    UDPSocket sender;
+    sender.send_batch(datagrams);
+
+    std::vector<Datagram> received;
+    for (size_t attempt = 0; attempt < 10 && received.size() < 2; ++attempt) {
+        for (auto& datagram : receiver.receive_batch()) {
+            received.push_back(std::move(datagram));
+        }
+    }
+    ASSERT_EQ(received.size(), 2);
+    EXPECT_TRUE(received[0].message == MessageBuffer::from_string("first"));
+    EXPECT_TRUE(received[1].message == MessageBuffer::from_string("last"));
+    EXPECT_EQ(receiver.truncated_datagrams(), 1);
+}
+
+TEST(UDPSocketTest, MoveAssignment) {
+    auto open_descriptors = []() {
+        return std::distance(
+            std::filesystem::directory_iterator("/proc/self/fd"),
+            std::filesystem::directory_iterator{});
+    };
+
+    UDPSocket socket;
+    UDPSocket other;
+    auto before = open_descriptors();
+    socket = std::move(other);
+    // the socket assigned over is closed rather than leaked
+    EXPECT_EQ(open_descriptors(), before - 1);
+    EXPECT_TRUE(socket.active());
+    EXPECT_FALSE(other.active());
+
+    auto& alias = socket;
+    socket = std::move(alias);
+    EXPECT_TRUE(socket.active());
+    socket.bind(IPSocketAddress("127.0.0.1", 0));
+}
+
+TEST(UDPSocketTest, ReceiveTimeout) {
+    UDPSocket receiver;
+    receiver.bind(IPSocketAddress("127.0.0.1", 0));
+    receiver.set_receive_timeout(std::chrono::milliseconds(10));
+    EXPECT_TRUE(receiver.receive_batch().empty());
+}
+
+TEST(UDPSocketTest, SocketInvalidState) {
+    UDPSocket socket;
+    EXPECT_TRUE(socket.active());
+    socket.terminate();
+    EXPECT_FALSE(socket.active());
+
+    std::vector<Datagram> datagrams;
+    EXPECT_THROW({ socket.send_batch(datagrams); }, InactiveConnectionError);
+    EXPECT_THROW({ socket.receive_batch(); }, InactiveConnectionError);
+}
+
+TEST_F(TCPConnectionTest, ReceiveDeadline) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(1);
+    connection.open();
+
+    // the server waits for us to finish sending, so nothing ever arrives
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_THROW(
+        {
+            connection.receive_message(start + std::chrono::milliseconds(20));
+        },
+        TimeoutError);
+    EXPECT_GE(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(20));
+
+    // the connection is still usable after a missed deadline
+    auto buffer = MessageBuffer::from_string("late but intact");
+    connection.send_message(buffer);
+    connection.disable_send();
+    EXPECT_TRUE(connection.receive_message() == buffer);
+}
+
+TEST_F(TCPConnectionTest, IdleTimeout) {
+    auto timers = std::make_shared<singularity::concurrency::TimerService>();
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(1);
+    connection.open();
+    connection.set_idle_timeout(timers, std::chrono::milliseconds(20));
+
+    // a blocked receive is woken up once the connection goes idle
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_THROW({ connection.receive_message(); }, TimeoutError);
+    EXPECT_GE(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(20));
+
+    auto buffer = MessageBuffer::from_string("too late");
+    EXPECT_THROW({ connection.send_message(buffer); }, TimeoutError);
+    connection.terminate();
+    EXPECT_EQ(timers->pending(), 0);
+}
+
+TEST_F(TCPConnectionTest, Keepalive) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    EXPECT_THROW(
+        {
+            connection.set_keepalive(std::chrono::seconds(1),
+                                     std::chrono::seconds(1), 3);
+        },
+        InactiveConnectionError);
+
+    start_server(1);
+    connection.open();
+    EXPECT_NO_THROW({
+        connection.set_keepalive(std::chrono::seconds(30),
+                                 std::chrono::seconds(5), 3);
+    });
+}
+
+TEST_F(TCPConnectionTest, ConnectionStatistics) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(1);
+    connection.open();
+
+    auto buffer = MessageBuffer::from_string("count me");
+    connection.send_message(buffer);
+    connection.disable_send();
+    EXPECT_TRUE(connection.receive_message() == buffer);
+
+    auto stats = connection.stats();
+    EXPECT_EQ(stats.bytes_sent, buffer.length());
+    EXPECT_EQ(stats.bytes_received, buffer.length());
+    EXPECT_EQ(stats.messages_sent, 1);
+    EXPECT_EQ(stats.messages_received, 1);
+    EXPECT_GT(stats.receive_time, std::chrono::nanoseconds::zero());
+#ifdef __linux__
+    EXPECT_GT(stats.mss, 0);
+    EXPECT_GT(stats.congestion_window, 0);
+#endif
+
+    // library counters outlive the connection
+    connection.terminate();
+    stats = connection.stats();
+    EXPECT_EQ(stats.bytes_sent, buffer.length());
+    EXPECT_EQ(stats.mss, 0);
+}
+
+TEST_F(TCPConnectionTest, StreamReceive) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    EXPECT_THROW(
+        { connection.receive_stream([](const std::byte*, size_t) {}); },
+        InactiveConnectionError);
+    EXPECT_THROW({ ChunkReader reader(connection, 0); }, std::invalid_argument);
+
+    start_server(1);
+    connection.open();
+
+    std::vector<std::byte> payload(40000);
+    for (size_t index = 0; index < payload.size(); ++index) {
+        payload[index] = static_cast<std::byte>(index % 251);
+    }
+    connection.send_message(MessageBuffer(payload.data(), payload.size()));
+    connection.disable_send();
+
+    constexpr size_t chunk_size = 1024;
+    std::vector<std::byte> received;
+    size_t largest_chunk = 0;
+    size_t total = connection.receive_stream(
+        [&](const std::byte* data, size_t length) {
+            largest_chunk = std::max(largest_chunk, length);
+            received.insert(received.end(), data, data + length);
+        },
+        chunk_size);
+
+    EXPECT_EQ(total, payload.size());
+    EXPECT_LE(largest_chunk, chunk_size);
+    EXPECT_TRUE(received == payload);
+    EXPECT_EQ(connection.stats().messages_received, 1);
+}
+
+TEST_F(TCPConnectionTest, ChunkReaderRange) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(1);
+    connection.open();
+
+    std::string payload(10000, 'x');
+    connection.send_message(MessageBuffer(payload.data(), payload.size()));
+    connection.disable_send();
+
+    ChunkReader reader(connection, 512);
+    std::string received;
+    for (std::span<const std::byte> chunk : reader) {
+        EXPECT_LE(chunk.size(), 512);
+        received.append(reinterpret_cast<const char*>(chunk.data()),
+                        chunk.size());
+    }
+    EXPECT_EQ(received, payload);
+
+    // the stream stays ended
+    EXPECT_FALSE(reader.next().has_value());
+    EXPECT_TRUE(reader.begin() == reader.end());
+}
+
+TEST_F(TCPConnectionTest, StreamSend) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(1);
+    connection.open();
+
+    constexpr size_t total = 40000;
+    size_t produced = 0;
+    std::string expected;
+    auto producer = [&](std::byte* chunk, size_t capacity) -> size_t {
+        size_t length = std::min({capacity, total - produced, size_t{700}});
+        for (size_t index = 0; index < length; ++index) {
+            char value = static_cast<char>('a' + (produced + index) % 26);
+            chunk[index] = static_cast<std::byte>(value);
+            expected.push_back(value);
+        }
+        produced += length;
+        return length;
+    };
+
+    EXPECT_EQ(connection.send_stream(producer, 1024), total);
+    connection.disable_send();
+
+    auto echoed = connection.receive_message();
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(echoed.raw()),
+                          echoed.length()),
+              expected);
+}
+
+TEST_F(TCPConnectionTest, StreamSendProducerError) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(1);
+    connection.open();
+
+    size_t calls = 0;
+    auto producer = [&calls](std::byte* chunk, size_t) -> size_t {
+        if (++calls == 3) throw std::runtime_error("producer failed");
+        chunk[0] = std::byte{'x'};
+        return 1;
+    };
+    EXPECT_THROW({ connection.send_stream(producer); }, std::runtime_error);
+    EXPECT_THROW({ connection.send_stream(producer, 0); },
+                 std::invalid_argument);
+    connection.disable_send();
+
+    auto echoed = connection.receive_message();
+    EXPECT_EQ(echoed.length(), 2);
+}
+
+TEST_F(TCPConnectionTest, SendFile) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(2);
+
+    std::string contents(30000, '\0');
+    for (size_t index = 0; index < contents.size(); ++index) {
+        contents[index] = static_cast<char>('A' + index % 23);
+    }
+
+    // a regular file, sent from an offset
+    FILE* file = tmpfile();
+    ASSERT_NE(file, nullptr);
+    fwrite(contents.data(), 1, contents.size(), file);
+    fflush(file);
+
+    connection.open();
+    EXPECT_EQ(connection.send_file(fileno(file), 100), contents.size() - 100);
+    connection.disable_send();
+    auto echoed = connection.receive_message();
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(echoed.raw()),
+                          echoed.length()),
+              contents.substr(100));
+    fclose(file);
+    connection.terminate();
+
+    // a pipe, which cannot be sent with sendfile and is streamed instead
+    int pipe_fds[2];
+    ASSERT_EQ(pipe(pipe_fds), 0);
+    std::thread writer([&]() {
+        write(pipe_fds[1], contents.data(), 1000);
+        close(pipe_fds[1]);
+    });
+
+    connection.open();
+    EXPECT_EQ(connection.send_file(pipe_fds[0]), 1000);
+    connection.disable_send();
+    writer.join();
+    close(pipe_fds[0]);
+
+    echoed = connection.receive_message();
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(echoed.raw()),
+                          echoed.length()),
+              contents.substr(0, 1000));
+}
+
+TEST(MessageBufferTest, MapFile) {
+    std::string contents(10000, '\0');
+    for (size_t index = 0; index < contents.size(); ++index) {
+        contents[index] = static_cast<char>('a' + index % 26);
+    }
+
+    FILE* file = tmpfile();
+    ASSERT_NE(file, nullptr);
+    fwrite(contents.data(), 1, contents.size(), file);
+    fflush(file);
+
+    // offsets do not need to be page aligned
+    auto buffer = MessageBuffer::map_file(fileno(file), 5000, 4099);
+    fclose(file);
+
+    EXPECT_TRUE(buffer.mapped());
+    EXPECT_EQ(buffer.length(), 5000);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(buffer.raw()),
+                          buffer.length()),
+              contents.substr(4099, 5000));
+    EXPECT_FALSE(MessageBuffer::from_string("heap").mapped());
+
+    EXPECT_THROW({ MessageBuffer::map_file(-1, 10); }, std::system_error);
+}
+
+TEST_F(TCPConnectionTest, SpillReceive) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(3);
+
+    std::vector<std::byte> payload(40000);
+    for (size_t index = 0; index < payload.size(); ++index) {
+        payload[index] = static_cast<std::byte>(index % 253);
+    }
+
+    // send from a mapping, too
+    FILE* file = tmpfile();
+    ASSERT_NE(file, nullptr);
+    fwrite(payload.data(), 1, payload.size(), file);
+    fflush(file);
+    auto message = MessageBuffer::map_file(fileno(file), payload.size());
+    fclose(file);
+
+    // spill into memfd, into a directory, and stay below the threshold
+    std::vector<std::pair<size_t, const char*>> settings = {
+        {4096, ""}, {4096, "/tmp"}, {1 << 20, ""}};
+    for (const auto& [threshold, directory] : settings) {
+        connection.set_spill_threshold(threshold, directory);
+        connection.open();
+        connection.send_message(message);
+        connection.disable_send();
+
+        auto echoed = connection.receive_message();
+        EXPECT_EQ(echoed.mapped(), threshold < payload.size());
+        EXPECT_TRUE(echoed == message);
+        connection.terminate();
+    }
+}
+
+TEST_F(TCPConnectionTest, FrameRoundTrip) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(1);
+    connection.open();
+    connection.set_compression(true, 64);
+
+    std::vector<std::byte> noise(5000);
+    std::mt19937 generator(7);
+    for (auto& byte : noise) {
+        byte = static_cast<std::byte>(generator() & 0xFF);
+    }
+
+    std::vector<MessageBuffer> frames;
+    frames.push_back(MessageBuffer::from_string(std::string(20000, 'c')));
+    frames.push_back(MessageBuffer::from_string("small"));
+    frames.push_back(MessageBuffer(noise.data(), noise.size()));
+    frames.push_back(MessageBuffer("", 0));
+
+    for (const auto& frame : frames) connection.send_frame(frame);
+    connection.disable_send();
+
+    // compression kept the stream well below the raw size
+    EXPECT_LT(connection.stats().bytes_sent, 20000);
+
+    for (const auto& frame : frames) {
+        auto received = connection.receive_frame();
+        ASSERT_TRUE(received.has_value());
+        EXPECT_TRUE(*received == frame);
+    }
+    EXPECT_FALSE(connection.receive_frame().has_value());
+    EXPECT_EQ(connection.stats().messages_received, frames.size());
+}
+
+TEST_F(TCPConnectionTest, FrameProtocolErrors) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    EXPECT_THROW({ connection.receive_frame(); }, InactiveConnectionError);
+
+    start_server(2);
+
+    // a header with an unknown flag, and one claiming a huge frame
+    std::vector<std::vector<uint8_t>> headers = {
+        {0, 0, 0, 4, 0, 0, 0, 4, 0x80, 0, 0, 0},
+        {0, 0, 0, 4, 0x7F, 0, 0, 0, 0, 0, 0, 0}};
+    for (const auto& header : headers) {
+        connection.open();
+        connection.send_message(MessageBuffer(header.data(), header.size()));
+        connection.disable_send();
+        EXPECT_THROW({ connection.receive_frame(); }, ProtocolError);
+        connection.terminate();
+    }
+}
+
+TEST_F(TCPConnectionTest, FrameChecksums) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(2);
+
+    auto message = MessageBuffer::from_string(std::string(3000, 'k'));
+    connection.open();
+    connection.set_compression(true);
+    connection.set_checksums(true);
+    connection.send_frame(message);
+    connection.disable_send();
+    auto received = connection.receive_frame();
+    ASSERT_TRUE(received.has_value());
+    EXPECT_TRUE(*received == message);
+    connection.terminate();
+
+    // a frame whose trailer does not match its contents
+    std::vector<uint8_t> corrupt = {0, 0, 0, 4, 0,   0,   0,   4, 0x02,
+                                    0, 0, 0, 1, 2,   3,   4,   0, 0,
+                                    0, 0};
+    connection.open();
+    connection.send_message(MessageBuffer(corrupt.data(), corrupt.size()));
+    connection.disable_send();
+    EXPECT_THROW({ connection.receive_frame(); }, ProtocolError);
+}
+
+TEST_F(TCPConnectionTest, FramesIntoCallerStorage) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    start_server(1);
+    connection.open();
+    connection.set_compression(true, 64);
+    connection.set_checksums(true);
+
+    std::string text(10000, 'f');
+    connection.send_frame(reinterpret_cast<const std::byte*>(text.data()),
+                          text.size());
+    connection.send_frame(nullptr, 0);
+    connection.disable_send();
+
+    // the compressed frame is decoded straight into the storage given
+    std::vector<std::byte> storage;
+    std::vector<size_t> requested;
+    auto allocate = [&storage, &requested](size_t length) {
+        requested.push_back(length);
+        storage.resize(length + 1);
+        return storage.data() + 1;
+    };
+    EXPECT_EQ(connection.receive_frame_into(allocate), text.size());
+    EXPECT_EQ(memcmp(storage.data() + 1, text.data(), text.size()), 0);
+    EXPECT_EQ(connection.receive_frame_into(allocate), 0);
+    EXPECT_FALSE(connection.receive_frame_into(allocate).has_value());
+    EXPECT_EQ(requested, (std::vector<size_t>{text.size(), 0}));
+}
+
+TEST_F(TCPConnectionTest, DelimitedRecords) {
+    TCPConnection connection(IPSocketAddress("127.0.0.1", PORT));
+    EXPECT_THROW({ DelimitedReader reader(connection, std::byte{0}, 0); },
+                 std::invalid_argument);
+
+    start_server(4);
+    connection.open();
+
+    // NUL terminated strings, one of which outgrows the buffer
+    std::vector<std::string> records = {"first", "", std::string(100, 'l'),
+                                        "last"};
+    for (const auto& record : records) {
+        connection.send_message(MessageBuffer::from_string(record));
+    }
+    connection.send_message(MessageBuffer("tail", 4));
+    records.emplace_back("tail");
+    connection.disable_send();
+
+    DelimitedReader reader(connection, std::byte{0}, 16);
+    std::vector<std::string> received;
+    for (std::span<const std::byte> record : reader) {
+        received.emplace_back(reinterpret_cast<const char*>(record.data()),
+                              record.size());
+    }
+    EXPECT_EQ(received, records);
+    EXPECT_FALSE(reader.next().has_value());
+    EXPECT_TRUE(reader.begin() == reader.end());
+    EXPECT_EQ(connection.stats().messages_received, records.size());
+    connection.terminate();
+
+    // a peer that never sends a delimiter
+    connection.open();
+    std::string line(1000, 'n');
+    connection.send_message(MessageBuffer(line.data(), line.size()));
+    connection.disable_send();
+    DelimitedReader limited(connection, std::byte{'\n'}, 64, 256);
+    EXPECT_THROW({ limited.next(); }, ProtocolError);
+    connection.terminate();
+
+    // records that fit in the buffer are still held to the limit, whether
+    // they end with a delimiter or with the stream
+    for (bool delimited : {true, false}) {
+        connection.open();
+        std::string records = std::string(256, 'a') + "\n" +
+                              std::string(257, 'b') + (delimited ? "\n" : "");
+        connection.send_message(MessageBuffer(records.data(), records.size()));
+        connection.disable_send();
+        DelimitedReader large(connection, std::byte{'\n'}, 4096, 256);
+        auto record = large.next();
+        ASSERT_TRUE(record.has_value());
+        EXPECT_EQ(record->size(), 256);
+        EXPECT_THROW({ large.next(); }, ProtocolError);
+        connection.terminate();
+    }
+}
@@ -1,13 +1,19 @@
 #include "tcp_server.hpp"
 
 #include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <array>
-#include <iostream>
+#include <functional>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
 
 #include "concurrency.hpp"
+#include "logging.hpp"
+#include "metrics.hpp"
 #include "sockimpl.hpp"
 
 using namespace singularity;
@@ -18,7 +24,6 @@ class TCPServerTest : public testing::Test {
    protected:
     concurrency::DynamicBuffer<bool> client_states;
     std::atomic<size_t> num_clients = 0;
-    std::mutex cerr_mutex;
     std::atomic<bool> handler_shutdown = false;
 
     void launch_loopback_client() {
@@ -32,7 +37,8 @@ class TCPServerTest : public testing::Test {
         try {
             client.open();
         } catch (std::exception& e) {
-            std::cerr << e.what() << std::endl;
+            logging::error<"Unable to connect: {}">(e.what());
+            logging::flush();
             exit(1);
         }
 
@@ -42,9 +48,8 @@ class TCPServerTest : public testing::Test {
             auto out = client.receive_message();
             client_states.push(out == message);
         } catch (std::exception& e) {
-            std::unique_lock<std::mutex> lock(cerr_mutex);
-            std::cerr << "Error in client " << current_client << ": "
-                      << e.what() << std::endl;
+            logging::error<"Error in client {}: {}">(current_client, e.what());
+            logging::flush();
             exit(1);
         }
     }
@@ -55,12 +60,8 @@ class TCPServerTest : public testing::Test {
             auto ctx = connection_buffer.pop(std::chrono::milliseconds(50));
             if (ctx.has_value()) {
                 auto out = ctx->receive_message();
-                {
-                    std::unique_lock<std::mutex> lock(cerr_mutex);
-                    std::cerr << "Server received message: "
-                              << reinterpret_cast<const char*>(out.raw())
-                              << "\n";
-                }
+                logging::info<"Server received message: {}">(std::string_view(
+                    reinterpret_cast<const char*>(out.raw()), out.length()));
                 ctx->send_message(out);
             }
         }
@@ -123,3 +124,519 @@ TEST_F(TCPServerTest, MultiConnectionLoopbackTest) {
         EXPECT_TRUE(client_states.pop());
     }
 }
+
+// Waits up to a second for the server to finish admitting `count` connections.
+bool wait_for_admission(const network::TCPServer& server, uint64_t count) {
+    for (size_t attempt = 0; attempt < 1000; ++attempt) {
+        auto stats = server.admission_stats();
+        if (stats.accepted + stats.shed >= count) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+TEST_F(TCPServerTest, RejectOverloadTest) {
+    network::ServerConfig config;
+    config.overload_policy = network::OverloadPolicy::reject;
+    network::TCPServer server(PORT, config);
+    concurrency::FixedBuffer<network::TCPConnection, 1> connection_buffer;
+
+    server.start(connection_buffer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::vector<network::TCPConnection> clients;
+    for (size_t index = 0; index < 3; ++index) {
+        clients.emplace_back(network::IPSocketAddress("127.0.0.1", PORT));
+        clients.back().open();
+    }
+    ASSERT_TRUE(wait_for_admission(server, 3));
+    server.shutdown();
+
+    auto stats = server.admission_stats();
+    EXPECT_EQ(stats.accepted, 1);
+    EXPECT_EQ(stats.shed, 2);
+    EXPECT_EQ(stats.queued, 0);
+
+    // shed clients are reset instead of left waiting
+    for (size_t index = 1; index < clients.size(); ++index) {
+        EXPECT_THROW({ clients[index].receive_message(); }, std::system_error);
+    }
+}
+
+TEST_F(TCPServerTest, DeadlineOverloadTest) {
+    network::ServerConfig config;
+    config.overload_policy = network::OverloadPolicy::deadline;
+    config.admission_deadline = std::chrono::milliseconds(20);
+    network::TCPServer server(PORT, config);
+    concurrency::FixedBuffer<network::TCPConnection, 1> connection_buffer;
+
+    server.start(connection_buffer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    network::TCPConnection first(network::IPSocketAddress("127.0.0.1", PORT));
+    network::TCPConnection second(network::IPSocketAddress("127.0.0.1", PORT));
+    first.open();
+    second.open();
+    ASSERT_TRUE(wait_for_admission(server, 2));
+    server.shutdown();
+
+    auto stats = server.admission_stats();
+    EXPECT_EQ(stats.accepted, 1);
+    EXPECT_EQ(stats.shed, 1);
+}
+
+TEST_F(TCPServerTest, QueuedAdmissionTest) {
+    network::ServerConfig config;
+    config.overload_policy = network::OverloadPolicy::deadline;
+    config.admission_deadline = std::chrono::seconds(2);
+    network::TCPServer server(PORT, config);
+    concurrency::FixedBuffer<network::TCPConnection, 1> connection_buffer;
+
+    server.start(connection_buffer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    network::TCPConnection first(network::IPSocketAddress("127.0.0.1", PORT));
+    network::TCPConnection second(network::IPSocketAddress("127.0.0.1", PORT));
+    first.open();
+    second.open();
+
+    // free up space for the waiting connection well within the deadline
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    connection_buffer.pop();
+    ASSERT_TRUE(wait_for_admission(server, 2));
+    server.shutdown();
+
+    auto stats = server.admission_stats();
+    EXPECT_EQ(stats.accepted, 2);
+    EXPECT_EQ(stats.shed, 0);
+    EXPECT_EQ(stats.queued, 1);
+    EXPECT_GE(stats.queued_time, std::chrono::milliseconds(5));
+}
+
+TEST_F(TCPServerTest, IdleTimeoutTest) {
+    network::ServerConfig config;
+    config.idle_timeout = std::chrono::milliseconds(20);
+    network::TCPServer server(PORT, config);
+    concurrency::FixedBuffer<network::TCPConnection, 30> connection_buffer;
+
+    server.start(connection_buffer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // a client that connects and then never sends anything
+    network::TCPConnection client(network::IPSocketAddress("127.0.0.1", PORT));
+    client.open();
+
+    auto connection = connection_buffer.pop(std::chrono::seconds(1));
+    ASSERT_TRUE(connection.has_value());
+    EXPECT_THROW({ connection->receive_message(); }, network::TimeoutError);
+    server.shutdown();
+}
+
+TEST_F(TCPServerTest, ShutdownRefusesClients) {
+    network::TCPServer server(PORT);
+    concurrency::FixedBuffer<network::TCPConnection, 30> connection_buffer;
+
+    server.start(connection_buffer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    server.shutdown();
+    server.shutdown();  // repeated shutdowns are harmless
+
+    network::TCPConnection client(network::IPSocketAddress("127.0.0.1", PORT));
+    EXPECT_THROW({ client.open(); }, std::system_error);
+}
+
+TEST_F(TCPServerTest, SampleStatsTest) {
+    network::TCPServer server(PORT);
+    concurrency::FixedBuffer<network::TCPConnection, 30> connection_buffer;
+    server.start(connection_buffer);
+
+    constexpr size_t num_connections = 4;
+    auto message = network::MessageBuffer::from_string("sample me");
+    std::vector<network::TCPConnection> clients;
+    std::vector<network::TCPConnection> handled;
+    for (size_t index = 0; index < num_connections; ++index) {
+        clients.emplace_back(network::IPSocketAddress("127.0.0.1", PORT));
+        clients.back().open();
+        clients.back().send_message(message);
+        clients.back().disable_send();
+
+        handled.push_back(connection_buffer.pop());
+        EXPECT_TRUE(handled.back().receive_message() == message);
+    }
+
+    auto summary = server.sample_stats();
+    EXPECT_EQ(summary.connections, num_connections);
+    EXPECT_EQ(summary.sampled, num_connections);
+    EXPECT_EQ(summary.messages_received, num_connections);
+    EXPECT_EQ(summary.bytes_received, num_connections * message.length());
+    EXPECT_LE(summary.rtt_p50, summary.rtt_p99);
+    EXPECT_LE(summary.rtt_p99, summary.rtt_max);
+
+    // sampling is bounded
+    summary = server.sample_stats(2);
+    EXPECT_EQ(summary.connections, num_connections);
+    EXPECT_EQ(summary.sampled, 2);
+
+    handled.clear();
+    EXPECT_EQ(server.sample_stats().connections, 0);
+    server.shutdown();
+}
+
+TEST_F(TCPServerTest, GracefulShutdownDrains) {
+    network::TCPServer server(PORT);
+    concurrency::FixedBuffer<network::TCPConnection, 30> connection_buffer;
+
+    // a slow handler that is still busy when shutdown begins
+    std::thread handle_thread([&connection_buffer]() {
+        auto ctx = connection_buffer.pop();
+        auto out = ctx.receive_message();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ctx.send_message(out);
+    });
+
+    server.start(connection_buffer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    network::TCPConnection client(network::IPSocketAddress("127.0.0.1", PORT));
+    auto message = network::MessageBuffer::from_string("drain me");
+    client.open();
+    client.send_message(message);
+    client.disable_send();
+
+    // wait for the server to hand the connection out before shutting down
+    for (size_t attempt = 0; attempt < 1000; ++attempt) {
+        if (server.active_connections() > 0) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    auto report = server.shutdown(std::chrono::seconds(2));
+    EXPECT_EQ(report.drained, 1);
+    EXPECT_EQ(report.dropped, 0);
+    EXPECT_EQ(server.active_connections(), 0);
+
+    EXPECT_TRUE(client.receive_message() == message);
+    handle_thread.join();
+}
+
+TEST_F(TCPServerTest, GracefulShutdownDrops) {
+    network::TCPServer server(PORT);
+    concurrency::FixedBuffer<network::TCPConnection, 30> connection_buffer;
+
+    // a handler stuck waiting on a client that never finishes sending
+    std::thread handle_thread([&connection_buffer]() {
+        auto ctx = connection_buffer.pop();
+        auto out = ctx.receive_message();
+        EXPECT_EQ(out.length(), 0);
+    });
+
+    server.start(connection_buffer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    network::TCPConnection client(network::IPSocketAddress("127.0.0.1", PORT));
+    client.open();
+    for (size_t attempt = 0; attempt < 1000; ++attempt) {
+        if (server.active_connections() > 0) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    auto report = server.shutdown(std::chrono::milliseconds(20));
+    EXPECT_EQ(report.drained, 0);
+    EXPECT_EQ(report.dropped, 1);
+    EXPECT_GE(report.elapsed, std::chrono::milliseconds(20));
+
+    // the forced shutdown unblocks the handler
+    handle_thread.join();
+}
+
+// Waits until `condition` holds for the server's worker counters.
+bool wait_for_workers(
+    const network::TCPServer& server,
+    const std::function<bool(const network::WorkerStats&)>& condition) {
+    for (size_t attempt = 0; attempt < 1000; ++attempt) {
+        if (condition(server.worker_stats())) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+TEST_F(TCPServerTest, ServeLoopbackTest) {
+    network::TCPServer server(PORT);
+    network::WorkerConfig config;
+    config.workers = 3;
+    server.serve(
+        [](network::TCPConnection& connection) {
+            connection.send_message(connection.receive_message());
+        },
+        config);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    constexpr size_t num_clients = 10;
+    std::vector<std::thread> clients;
+    for (size_t index = 0; index < num_clients; ++index) {
+        clients.emplace_back([this]() { launch_loopback_client(); });
+    }
+    for (auto& client : clients) client.join();
+    for (size_t index = 0; index < num_clients; ++index) {
+        EXPECT_TRUE(client_states.pop());
+    }
+
+    auto report = server.shutdown(std::chrono::seconds(1));
+    EXPECT_EQ(report.dropped, 0);
+    auto stats = server.worker_stats();
+    EXPECT_EQ(stats.handled, num_clients);
+    EXPECT_EQ(stats.failed, 0);
+    EXPECT_EQ(stats.in_flight, 0);
+    EXPECT_EQ(stats.queued, 0);
+}
+
+TEST_F(TCPServerTest, ServeHandlerFailureTest) {
+    network::TCPServer server(PORT);
+    server.serve([](network::TCPConnection&) {
+        throw std::runtime_error("handler failed");
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // the failed connection is reset and the worker moves on
+    for (size_t index = 0; index < 2; ++index) {
+        network::TCPConnection client(
+            network::IPSocketAddress("127.0.0.1", PORT));
+        client.open();
+        EXPECT_THROW({ client.receive_message(); }, std::system_error);
+    }
+    EXPECT_TRUE(wait_for_workers(server, [](const network::WorkerStats& stats) {
+        return stats.failed == 2;
+    }));
+    EXPECT_EQ(server.worker_stats().handled, 0);
+}
+
+TEST_F(TCPServerTest, ServeNonStandardFailureTest) {
+    network::TCPServer server(PORT);
+    server.serve([](network::TCPConnection&) { throw 42; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    network::TCPConnection client(network::IPSocketAddress("127.0.0.1", PORT));
+    client.open();
+    EXPECT_THROW({ client.receive_message(); }, std::system_error);
+    EXPECT_TRUE(wait_for_workers(server, [](const network::WorkerStats& stats) {
+        return stats.failed == 1;
+    }));
+}
+
+TEST_F(TCPServerTest, ServeQueueDepthTest) {
+    network::TCPServer server(PORT);
+    network::WorkerConfig config;
+    config.workers = 1;
+    config.queue_capacity = 4;
+    std::atomic<bool> release = false;
+    server.serve(
+        [&release](network::TCPConnection&) {
+            while (!release) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        },
+        config);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::vector<network::TCPConnection> clients;
+    for (size_t index = 0; index < 3; ++index) {
+        clients.emplace_back(network::IPSocketAddress("127.0.0.1", PORT));
+        clients.back().open();
+    }
+    // the single worker is busy with the first connection
+    EXPECT_TRUE(wait_for_workers(server, [](const network::WorkerStats& stats) {
+        return stats.in_flight == 1 && stats.queued == 2;
+    }));
+
+    release = true;
+    EXPECT_TRUE(wait_for_workers(server, [](const network::WorkerStats& stats) {
+        return stats.handled == 3 && stats.in_flight == 0;
+    }));
+}
+
+TEST_F(TCPServerTest, ServeErrorsTest) {
+    network::TCPServer server(PORT);
+    network::WorkerConfig config;
+    config.workers = 0;
+    auto handler = [](network::TCPConnection&) {};
+    EXPECT_THROW({ server.serve(handler, config); }, std::invalid_argument);
+    EXPECT_THROW({ server.serve(nullptr); }, std::invalid_argument);
+
+    server.serve(handler);
+    EXPECT_THROW({ server.serve(handler); }, std::logic_error);
+
+    concurrency::FixedBuffer<network::TCPConnection, 30> connection_buffer;
+    EXPECT_THROW({ server.start(connection_buffer); }, std::logic_error);
+}
+
+TEST_F(TCPServerTest, StartTwiceTest) {
+    network::TCPServer server(PORT);
+    concurrency::FixedBuffer<network::TCPConnection, 30> connection_buffer;
+
+    server.start(connection_buffer);
+    EXPECT_THROW({ server.start(connection_buffer); }, std::logic_error);
+    EXPECT_THROW({ server.serve([](network::TCPConnection&) {}); },
+                 std::logic_error);
+    server.shutdown();
+}
+
+TEST_F(TCPServerTest, RetryAfterBindFailureTest) {
+    auto occupant = std::make_unique<network::TCPServer>(PORT);
+    concurrency::FixedBuffer<network::TCPConnection, 30> connection_buffer;
+    occupant->start(connection_buffer);
+
+    // the port is taken, so neither way of starting gets anywhere
+    network::TCPServer server(PORT);
+    auto handler = [](network::TCPConnection& connection) {
+        connection.send_message(network::MessageBuffer::from_string("served"));
+    };
+    EXPECT_THROW({ server.start(connection_buffer); }, std::system_error);
+    EXPECT_THROW({ server.serve(handler); }, std::system_error);
+    occupant.reset();
+
+    server.serve(handler);
+    network::TCPConnection client(network::IPSocketAddress("127.0.0.1", PORT));
+    client.open();
+    EXPECT_TRUE(client.receive_message() ==
+                network::MessageBuffer::from_string("served"));
+    server.shutdown();
+}
+
+TEST_F(TCPServerTest, ServeSteeringTest) {
+    auto cpus = concurrency::available_cpus();
+    network::WorkerConfig config;
+    config.workers = 2;
+    config.steer_by_incoming_cpu = true;
+    {
+        // steering needs to know which CPU each worker runs on
+        network::TCPServer unpinned(PORT);
+        EXPECT_THROW({ unpinned.serve([](auto&) {}, config); },
+                     std::invalid_argument);
+    }
+
+    network::ServerConfig server_config;
+    server_config.acceptor_placement.cpus = {cpus.front()};
+    network::TCPServer server(PORT, server_config);
+    config.placement.cpus = {cpus.front(), cpus.back()};
+    server.serve(
+        [](network::TCPConnection& connection) {
+            connection.send_message(connection.receive_message());
+        },
+        config);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    for (size_t index = 0; index < 4; ++index) launch_loopback_client();
+    for (size_t index = 0; index < 4; ++index) {
+        EXPECT_TRUE(client_states.pop());
+    }
+
+    // loopback packets are processed on one of the machine's CPUs, which is
+    // at least on the same node as a worker unless the node is unknown
+    EXPECT_TRUE(wait_for_workers(server, [](const network::WorkerStats& stats) {
+        return stats.handled == 4;
+    }));
+    auto stats = server.worker_stats();
+    if (concurrency::numa_node_of(cpus.front()) ==
+        concurrency::numa_node_of(cpus.back())) {
+        EXPECT_EQ(stats.steered, 4);
+    }
+}
+
+TEST_F(TCPServerTest, ConnectionRateLimitTest) {
+    network::ServerConfig config;
+    // two connections at once, then hardly any
+    config.connection_rate = {1e-3, 2};
+    network::TCPServer server(PORT, config);
+    concurrency::FixedBuffer<network::TCPConnection, 30> connection_buffer;
+    server.start(connection_buffer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::vector<network::TCPConnection> clients;
+    for (size_t index = 0; index < 4; ++index) {
+        clients.emplace_back(network::IPSocketAddress("127.0.0.1", PORT));
+        clients.back().open();
+    }
+    for (size_t attempt = 0; attempt < 1000; ++attempt) {
+        auto stats = server.admission_stats();
+        if (stats.accepted + stats.rate_limited >= 4) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    server.shutdown();
+
+    auto stats = server.admission_stats();
+    EXPECT_EQ(stats.accepted, 2);
+    EXPECT_EQ(stats.rate_limited, 2);
+    EXPECT_EQ(connection_buffer.size(), 2);
+    EXPECT_THROW({ clients.back().receive_message(); }, std::system_error);
+}
+
+// Fetches the server's metrics endpoint, returning the whole response.
+std::string scrape(uint16_t port, const std::string& request) {
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    network::IPSocketAddress address("127.0.0.1", port);
+    EXPECT_EQ(connect(client, address.data(), address.length()), 0);
+    ssize_t sent = send(client, request.data(), request.size(), 0);
+    EXPECT_EQ(sent, static_cast<ssize_t>(request.size()));
+
+    std::string response;
+    char chunk[4096];
+    ssize_t received;
+    while ((received = recv(client, chunk, sizeof(chunk), 0)) > 0) {
+        response.append(chunk, static_cast<size_t>(received));
+    }
+    close(client);
+    return response;
+}
+
+TEST_F(TCPServerTest, MetricsEndpointTest) {
+    constexpr uint16_t metrics_port = PORT + 1;
+    network::ServerConfig config;
+    config.metrics = std::make_shared<metrics::Registry>();
+    config.metrics_port = metrics_port;
+    network::TCPServer server(PORT, config);
+    server.serve([](network::TCPConnection& connection) {
+        connection.send_message(connection.receive_message());
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    network::TCPConnection client(network::IPSocketAddress("127.0.0.1", PORT));
+    client.open();
+    auto message = network::MessageBuffer::from_string("metered");
+    client.send_message(message);
+    client.disable_send();
+    EXPECT_EQ(client.receive_message(), message);
+    client.terminate();
+    for (size_t attempt = 0; attempt < 1000; ++attempt) {
+        if (server.worker_stats().handled == 1 &&
+            server.admission_stats().accepted == 1) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::string response =
+        scrape(metrics_port, "GET /metrics HTTP/1.1\r\nHost: local\r\n\r\n");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK\r\n"));
+    std::string port_label = "{port=\"" + std::to_string(PORT) + "\"}";
+    for (const auto& sample :
+         {"singularity_server_accepted_total" + port_label + " 1\n",
+          "singularity_server_handler_seconds_count" + port_label + " 1\n",
+          "singularity_server_queued_connections" + port_label + " 0\n",
+          "singularity_connections_open" + port_label + " 0\n",
+          std::string(
+              "# TYPE singularity_connection_send_seconds summary\n")}) {
+        EXPECT_NE(response.find(sample), std::string::npos) << sample;
+    }
+    EXPECT_EQ(config.metrics
+                  ->counter("singularity_connection_received_bytes_total", "",
+                            {{"port", std::to_string(PORT)}})
+                  .value(),
+              client.stats().bytes_sent);
+
+    EXPECT_TRUE(scrape(metrics_port, "POST / HTTP/1.1\r\n\r\n")
+                    .starts_with("HTTP/1.1 405 Method Not Allowed\r\n"));
+
+    server.shutdown();
+    network::TCPConnection refused(
+        network::IPSocketAddress("127.0.0.1", metrics_port));
+    EXPECT_THROW(refused.open(), std::system_error);
+}
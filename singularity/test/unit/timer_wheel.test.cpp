@@ -0,0 +1,179 @@
+#include "timer_wheel.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace singularity;
+
+using tick_t = concurrency::TimerWheel::tick_t;
+
+TEST(TimerWheelTest, FiresAtExpiry) {
+    concurrency::TimerWheel wheel;
+
+    // one timer per level, plus a few on level boundaries
+    std::vector<tick_t> expiries = {0,    5,     255,    256,
+                                    300,  65535, 65536,  70000,
+                                    1000000, (tick_t{1} << 24) + 7};
+    std::vector<tick_t> fired_at(expiries.size(), 0);
+
+    tick_t now = 0;
+    for (size_t index = 0; index < expiries.size(); ++index) {
+        wheel.schedule(expiries[index],
+                       [&fired_at, &now, index]() { fired_at[index] = now; });
+    }
+    EXPECT_EQ(wheel.size(), expiries.size());
+
+    for (now = 0; now <= expiries.back(); ++now) {
+        wheel.advance(now);
+    }
+
+    EXPECT_EQ(wheel.size(), 0);
+    for (size_t index = 0; index < expiries.size(); ++index) {
+        EXPECT_EQ(fired_at[index], expiries[index]);
+    }
+}
+
+TEST(TimerWheelTest, Cancel) {
+    concurrency::TimerWheel wheel;
+    bool fired = false;
+
+    auto handle = wheel.schedule(10, [&fired]() { fired = true; });
+    EXPECT_TRUE(wheel.cancel(handle));
+    EXPECT_FALSE(wheel.cancel(handle));
+    EXPECT_EQ(wheel.size(), 0);
+
+    wheel.advance(20);
+    EXPECT_FALSE(fired);
+}
+
+TEST(TimerWheelTest, StaleHandle) {
+    concurrency::TimerWheel wheel;
+    size_t fired = 0;
+
+    auto stale = wheel.schedule(1, [&fired]() { ++fired; });
+    wheel.advance(1);
+    EXPECT_EQ(fired, 1);
+
+    // the freed slot is reused, the old handle must not cancel the new timer
+    auto fresh = wheel.schedule(5, [&fired]() { ++fired; });
+    EXPECT_EQ(fresh.index, stale.index);
+    EXPECT_FALSE(wheel.cancel(stale));
+
+    wheel.advance(5);
+    EXPECT_EQ(fired, 2);
+}
+
+TEST(TimerWheelTest, PastExpiry) {
+    concurrency::TimerWheel wheel(100);
+    bool fired = false;
+
+    wheel.schedule(3, [&fired]() { fired = true; });
+    wheel.advance(100);
+    EXPECT_TRUE(fired);
+}
+
+TEST(TimerWheelTest, RescheduleFromCallback) {
+    concurrency::TimerWheel wheel;
+    std::vector<tick_t> fired_at;
+    tick_t now = 0;
+
+    std::function<void()> periodic = [&]() {
+        fired_at.push_back(now);
+        if (fired_at.size() < 5) wheel.schedule(now + 100, periodic);
+    };
+    wheel.schedule(100, periodic);
+
+    for (now = 0; now <= 1000; ++now) wheel.advance(now);
+
+    ASSERT_EQ(fired_at.size(), 5);
+    for (size_t index = 0; index < fired_at.size(); ++index) {
+        EXPECT_EQ(fired_at[index], 100 * (index + 1));
+    }
+}
+
+TEST(TimerWheelTest, RandomizedStress) {
+    constexpr size_t num_timers = 100000;
+    constexpr tick_t horizon = tick_t{1} << 20;
+
+    concurrency::TimerWheel wheel;
+    std::mt19937_64 generator(42);
+    std::uniform_int_distribution<tick_t> expiry_distribution(0, horizon);
+    std::uniform_int_distribution<tick_t> step_distribution(1, 5000);
+
+    std::vector<tick_t> expiries(num_timers);
+    std::vector<concurrency::TimerHandle> handles(num_timers);
+    std::vector<bool> fired(num_timers, false);
+
+    tick_t lower = 0;
+    tick_t now = 0;
+    size_t late = 0;
+    for (size_t index = 0; index < num_timers; ++index) {
+        expiries[index] = expiry_distribution(generator);
+        handles[index] = wheel.schedule(expiries[index], [&, index]() {
+            fired[index] = true;
+            // must fire during the advance that first reaches the expiry
+            if (expiries[index] > now || expiries[index] < lower) {
+                ++late;
+            }
+        });
+    }
+
+    // cancel every tenth timer
+    for (size_t index = 0; index < num_timers; index += 10) {
+        EXPECT_TRUE(wheel.cancel(handles[index]));
+    }
+
+    while (now < horizon) {
+        lower = wheel.current();
+        now = std::min(horizon, now + step_distribution(generator));
+        wheel.advance(now);
+    }
+
+    EXPECT_EQ(late, 0);
+    EXPECT_EQ(wheel.size(), 0);
+    for (size_t index = 0; index < num_timers; ++index) {
+        EXPECT_EQ(fired[index], index % 10 != 0);
+    }
+}
+
+TEST(TimerServiceTest, ScheduleAfter) {
+    concurrency::TimerService timers;
+    std::mutex m;
+    std::condition_variable signal;
+    bool fired = false;
+
+    auto start = std::chrono::steady_clock::now();
+    timers.schedule_after(std::chrono::milliseconds(20), [&]() {
+        std::unique_lock<std::mutex> lock(m);
+        fired = true;
+        signal.notify_one();
+    });
+
+    std::unique_lock<std::mutex> lock(m);
+    EXPECT_TRUE(signal.wait_for(lock, std::chrono::seconds(5),
+                                [&fired]() { return fired; }));
+    EXPECT_GE(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(20));
+    EXPECT_EQ(timers.pending(), 0);
+}
+
+TEST(TimerServiceTest, Cancel) {
+    concurrency::TimerService timers;
+    std::atomic<bool> fired = false;
+
+    auto handle = timers.schedule_after(std::chrono::milliseconds(20),
+                                        [&fired]() { fired = true; });
+    EXPECT_EQ(timers.pending(), 1);
+    EXPECT_TRUE(timers.cancel(handle));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(fired);
+    EXPECT_FALSE(timers.cancel(handle));
+}
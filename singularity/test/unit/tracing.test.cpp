@@ -0,0 +1,111 @@
+#include "tracing.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace singularity;
+
+// Counts the occurrences of `needle` in `text`.
+size_t count(const std::string& text, const std::string& needle) {
+    size_t found = 0;
+    for (size_t position = text.find(needle); position != std::string::npos;
+         position = text.find(needle, position + needle.size())) {
+        ++found;
+    }
+    return found;
+}
+
+std::string trace() {
+    std::ostringstream out;
+    tracing::write_chrome_trace(out);
+    return out.str();
+}
+
+TEST(TracingTest, RecordsCompleteSpans) {
+    tracing::clear();
+    {
+        tracing::Span outer("outer");
+        tracing::Span inner("inner");
+    }
+
+    std::string json = trace();
+    EXPECT_TRUE(
+        json.starts_with("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    EXPECT_TRUE(json.ends_with("]}\n"));
+    EXPECT_EQ(count(json, "{\"name\":\"outer\""), 1);
+    EXPECT_EQ(count(json, "{\"name\":\"inner\""), 1);
+    EXPECT_EQ(count(json, "\"ph\":\"X\""), 2);
+    EXPECT_EQ(count(json, "\"ph\":\"M\""), count(json, "thread_name"));
+}
+
+TEST(TracingTest, SpansWithAnIdAreAsync) {
+    tracing::clear();
+    { tracing::Span span("request", 42); }
+
+    std::string json = trace();
+    EXPECT_EQ(count(json, "{\"name\":\"request\""), 2);
+    EXPECT_EQ(count(json, "\"ph\":\"b\",\"cat\":\"connection\",\"id\":42"), 1);
+    EXPECT_EQ(count(json, "\"ph\":\"e\",\"cat\":\"connection\",\"id\":42"), 1);
+    EXPECT_EQ(count(json, "\"ph\":\"X\""), 0);
+}
+
+TEST(TracingTest, ClearDiscardsSpans) {
+    { tracing::Span span("discarded"); }
+    tracing::clear();
+    { tracing::Span span("kept"); }
+
+    std::string json = trace();
+    EXPECT_EQ(count(json, "discarded"), 0);
+    EXPECT_EQ(count(json, "\"kept\""), 1);
+}
+
+TEST(TracingTest, KeepsTheSpansOfEveryThread) {
+    tracing::clear();
+    std::vector<std::thread> threads;
+    for (size_t thread = 0; thread < 4; ++thread) {
+        threads.emplace_back([]() {
+            for (size_t index = 0; index < 100; ++index) {
+                tracing::Span span("work");
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    // rings outlive their threads
+    EXPECT_EQ(count(trace(), "{\"name\":\"work\""), 400);
+}
+
+TEST(TracingTest, KeepsOnlyTheNewestSpans) {
+    tracing::clear();
+    std::thread([]() {
+        for (size_t index = 0; index < tracing::RING_CAPACITY + 10; ++index) {
+            tracing::Span span("wrapped");
+        }
+    }).join();
+
+    // the oldest span left may be the next overwritten, so it is left out
+    size_t kept = count(trace(), "{\"name\":\"wrapped\"");
+    EXPECT_LE(kept, tracing::RING_CAPACITY);
+    EXPECT_GE(kept, tracing::RING_CAPACITY - 1);
+}
+
+TEST(TracingTest, SpansAreOrderedInTime) {
+    tracing::clear();
+    { tracing::Span first("first"); }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    { tracing::Span second("second"); }
+
+    std::string json = trace();
+    auto timestamp = [&json](const std::string& name) {
+        size_t span = json.find("{\"name\":\"" + name + "\"");
+        size_t value = json.find("\"ts\":", span) + 5;
+        return std::stod(json.substr(value));
+    };
+    // timestamps are in microseconds
+    EXPECT_GE(timestamp("second") - timestamp("first"), 900);
+}